@@ -80,12 +80,6 @@ struct ip_address {
     char *address;
 };
 
-struct neigbor_entry {
-    struct   hmap_node neigh_node;
-    char     *mac_address;
-    char     *ip_address;
-};
-
 typedef enum sai_mirror_porttype {
     SAI_MIRROR_PORT_PHYSICAL,
     SAI_MIRROR_PORT_LAG,
@@ -10,9 +10,13 @@
 #include "openvswitch/vlog.h"
 #include <mac-learning-plugin.h>
 #include <plugin-extensions.h>
+#include <sai-handle.h>
 
 extern int sai_mac_learning_init(void);
 
+extern void sai_mac_learning_port_add(handle_t port_id, const char *name);
+extern void sai_mac_learning_port_del(handle_t port_id, const char *name);
+
 extern int sai_mac_learning_get_hmap(struct mlearn_hmap **mhmap);
 
 extern int sai_mac_learning_l2_addr_flush_handler(mac_flush_params_t *settings);
@@ -11,6 +11,43 @@
 #ifdef SAI_VENDOR
 #include <sai-vendor-common.h>
 #endif /* SAI_VENDOR */
+#include <sai-route.h>
+#include <list.h>
+#include <bitmap.h>
+
+/* all_neighbor key. Always zero-initialize before filling. */
+struct ops_sai_neighbor_key {
+    sai_object_id_t rif;                        /* router interface */
+    uint64_t        vrid;                       /* virtual router of rif */
+    uint8_t         family;                     /* AF_INET or AF_INET6 */
+    uint8_t         pad[7];
+    uint8_t         addr[OPS_SAI_IP_ADDR_MAX_LEN];  /* network byte order */
+};
+
+/* Neighbor known to the plugin. Neighbors without MAC address are tracked,
+ * but not programmed. */
+struct ops_sai_neighbor {
+    struct hmap_node            node;       /* in all_neighbor */
+    struct ovs_list             rif_node;   /* in owner's list */
+    struct ops_sai_neighbor_key key;
+    struct ether_addr           mac;        /* all zero if not resolved */
+    uint32_t                    index;      /* bit in activity bitmaps */
+    uint64_t                    epoch;      /* first scan covering it */
+    uint64_t                    op_seq;     /* last operation queued */
+};
+
+/* One neighbor of a bulk neighbor operation */
+struct ops_sai_neighbor_bulk_entry {
+    struct ops_sai_neighbor_key key;
+    struct ether_addr           mac;        /* create and set only */
+    int                         status;     /* [out] result of this entry */
+};
+
+enum ops_sai_neighbor_op {
+    OPS_SAI_NEIGHBOR_OP_CREATE,
+    OPS_SAI_NEIGHBOR_OP_REMOVE,
+    OPS_SAI_NEIGHBOR_OP_SET,                    /* MAC address changed */
+};
 
 struct neighbor_class {
     /**
@@ -20,43 +57,86 @@ struct neighbor_class {
     /**
      *  This function adds a neighbour information.
      *
-     * @param[in] is_ipv6_addr - is address IPv6 or not
-     * @param[in] ip_addr      - neighbor IP address
-     * @param[in] mac_addr     - neighbor MAC address
-     * @param[in] rif          - router Interface ID
+     * @param[in] key      - router interface ID and neighbor IP address
+     * @param[in] mac_addr - neighbor MAC address
      *
      * @return 0     if operation completed successfully.
      * @return errno if operation failed.*/
-    int  (*create)(bool           is_ipv6_addr,
-                   const char     *ip_addr,
-                   const char     *mac_addr,
-                   const handle_t *rif);
+    int  (*create)(const struct ops_sai_neighbor_key *key,
+                   const struct ether_addr           *mac_addr);
     /**
      *  This function deletes a neighbour information.
      *
-     * @param[in] is_ipv6_addr - is address IPv6 or not
-     * @param[in] ip_addr      - neighbor IP address
-     * @param[in] rif          - router Interface ID
+     * @param[in] key - router interface ID and neighbor IP address
+     *
+     * @return 0     if operation completed successfully.
+     * @return errno if operation failed.*/
+    int  (*remove)(const struct ops_sai_neighbor_key *key);
+    /**
+     *  This function changes MAC address of a neighbor in place, so next
+     *  hop resolved by it stays up.
+     *
+     * @param[in] key      - router interface ID and neighbor IP address
+     * @param[in] mac_addr - new neighbor MAC address
+     *
+     * @notes optional. If not set, neighbor is removed and created again.
      *
      * @return 0     if operation completed successfully.
      * @return errno if operation failed.*/
-    int  (*remove)(bool           is_ipv6_addr,
-                   const char     *ip_addr,
-                   const handle_t *rif);
+    int  (*mac_set)(const struct ops_sai_neighbor_key *key,
+                    const struct ether_addr           *mac_addr);
+    /**
+     *  This function adds a batch of neighbors at once.
+     *
+     * @param[in,out] entries - neighbors to add, status of every entry is set
+     * @param[in]     count   - count of entries
+     *
+     * @notes optional. If not set, create is called for every entry.
+     *
+     * @return 0     if all entries were added successfully.
+     * @return errno of the first failed entry otherwise.*/
+    int  (*create_bulk)(struct ops_sai_neighbor_bulk_entry *entries,
+                        uint32_t                           count);
+    /**
+     *  This function deletes a batch of neighbors at once.
+     *
+     * @param[in,out] entries - neighbors to delete, status of every entry is
+     *                          set
+     * @param[in]     count   - count of entries
+     *
+     * @notes optional. If not set, remove is called for every entry.
+     *
+     * @return 0     if all entries were deleted successfully.
+     * @return errno of the first failed entry otherwise.*/
+    int  (*remove_bulk)(struct ops_sai_neighbor_bulk_entry *entries,
+                        uint32_t                           count);
     /**
      *  This function reads the neighbor's activity information.
      *
-     * @param[in]  is_ipv6_addr - is address IPv6 or not
-     * @param[in]  ip_addr      - neighbor IP address
-     * @param[in]  rif          - router Interface ID
-     * @param[out] activity_p   - activity
+     * @param[in]  key        - router interface ID and neighbor IP address
+     * @param[out] activity_p - activity
+     *
+     * @return 0     if operation completed successfully.
+     * @return errno if operation failed.*/
+    int  (*activity_get)(const struct ops_sai_neighbor_key *key,
+                         bool                              *activity_p);
+    /**
+     *  This function reads activity of many neighbors at once. Called from
+     *  the neighbor activity scanner thread.
+     *
+     * @param[in]  keys     - neighbors, keys with family 0 are skipped
+     * @param[in]  count    - count of keys
+     * @param[out] activity - bitmap of count bits, bit is set if neighbor
+     *                        is active
+     *
+     * @notes optional. If not set, activity_get is called for every
+     *        neighbor.
      *
      * @return 0     if operation completed successfully.
      * @return errno if operation failed.*/
-    int  (*activity_get)(bool           is_ipv6_addr,
-                         const char     *ip_addr,
-                         const handle_t *rif,
-                         bool           *activity_p);
+    int  (*activity_scan)(const struct ops_sai_neighbor_key *keys,
+                          size_t                            count,
+                          unsigned long                     *activity);
     /**
      * De-initializes neighbor.
      */
@@ -79,37 +159,119 @@ ops_sai_neighbor_init(void)
 }
 
 static inline int
-ops_sai_neighbor_create(bool           is_ipv6_addr,
-                        const char     *ip_addr,
-                        const char     *mac_addr,
-                        const handle_t *rifid)
+ops_sai_neighbor_create(const struct ops_sai_neighbor_key *key,
+                        const struct ether_addr           *mac_addr)
 {
     ovs_assert(ops_sai_neighbor_class()->create);
-    return ops_sai_neighbor_class()->create(is_ipv6_addr,
-                                            ip_addr,
-                                            mac_addr,
-                                            rifid);
+    return ops_sai_neighbor_class()->create(key, mac_addr);
 }
 
 static inline int
-ops_sai_neighbor_remove(bool is_ipv6_addr, const char *ip_addr,
-                        const handle_t *rifid)
+ops_sai_neighbor_remove(const struct ops_sai_neighbor_key *key)
 {
     ovs_assert(ops_sai_neighbor_class()->remove);
-    return ops_sai_neighbor_class()->remove(is_ipv6_addr, ip_addr, rifid);
+    return ops_sai_neighbor_class()->remove(key);
 }
 
 static inline int
-ops_sai_neighbor_activity_get(bool           is_ipv6_addr,
-                              const char     *ip_addr,
-                              const handle_t *rifid,
-                              bool           *activity)
+ops_sai_neighbor_mac_update(const struct ops_sai_neighbor_key *key,
+                            const struct ether_addr           *mac_addr)
+{
+    int status = 0;
+
+    if (ops_sai_neighbor_class()->mac_set) {
+        return ops_sai_neighbor_class()->mac_set(key, mac_addr);
+    }
+
+    status = ops_sai_neighbor_remove(key);
+    if (status) {
+        return status;
+    }
+
+    return ops_sai_neighbor_create(key, mac_addr);
+}
+
+static inline int
+ops_sai_neighbor_create_bulk(struct ops_sai_neighbor_bulk_entry *entries,
+                             uint32_t                           count)
+{
+    int status = 0;
+
+    if (ops_sai_neighbor_class()->create_bulk) {
+        return ops_sai_neighbor_class()->create_bulk(entries, count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status = ops_sai_neighbor_create(&entries[i].key,
+                                                    &entries[i].mac);
+        if (!status) {
+            status = entries[i].status;
+        }
+    }
+
+    return status;
+}
+
+static inline int
+ops_sai_neighbor_remove_bulk(struct ops_sai_neighbor_bulk_entry *entries,
+                             uint32_t                           count)
+{
+    int status = 0;
+
+    if (ops_sai_neighbor_class()->remove_bulk) {
+        return ops_sai_neighbor_class()->remove_bulk(entries, count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status = ops_sai_neighbor_remove(&entries[i].key);
+        if (!status) {
+            status = entries[i].status;
+        }
+    }
+
+    return status;
+}
+
+static inline int
+ops_sai_neighbor_activity_get(const struct ops_sai_neighbor_key *key,
+                              bool                              *activity)
 {
     ovs_assert(ops_sai_neighbor_class()->activity_get);
-    return ops_sai_neighbor_class()->activity_get(is_ipv6_addr,
-                                                  ip_addr,
-                                                  rifid,
-                                                  activity);
+    return ops_sai_neighbor_class()->activity_get(key, activity);
+}
+
+/* Neighbors failed to be read are reported active, so they are not aged out
+ * because of a read error. */
+static inline int
+ops_sai_neighbor_activity_scan(const struct ops_sai_neighbor_key *keys,
+                               size_t                            count,
+                               unsigned long                     *activity)
+{
+    bool active = false;
+    int status = 0;
+    int rc = 0;
+
+    if (ops_sai_neighbor_class()->activity_scan) {
+        return ops_sai_neighbor_class()->activity_scan(keys, count, activity);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!keys[i].family) {
+            continue;
+        }
+
+        active = false;
+        rc = ops_sai_neighbor_activity_get(&keys[i], &active);
+        if (rc) {
+            active = true;
+            if (!status) {
+                status = rc;
+            }
+        }
+        bitmap_set(activity, i, active);
+    }
+
+    return status;
 }
 
 static inline void
@@ -119,4 +281,52 @@ ops_sai_neighbor_deinit(void)
     ops_sai_neighbor_class()->deinit();
 }
 
+int
+ops_sai_neighbor_key_init(struct ops_sai_neighbor_key *key,
+                          const handle_t *vrid, const handle_t *rif,
+                          const char *ip_addr);
+
+void
+ops_sai_neighbor_nexthop_key_init(struct ops_sai_nexthop_key *nh_key,
+                                  const struct ops_sai_neighbor_key *key);
+
+struct ops_sai_neighbor *
+ops_sai_neighbor_lookup(const struct ops_sai_neighbor_key *key);
+
+struct ops_sai_neighbor *
+ops_sai_neighbor_insert(const struct ops_sai_neighbor_key *key);
+
+void
+ops_sai_neighbor_delete(struct ops_sai_neighbor *neigh);
+
+bool
+ops_sai_neighbor_is_resolved(const struct ops_sai_neighbor *neigh);
+
+void
+ops_sai_neighbor_mac_set(struct ops_sai_neighbor *neigh,
+                         const struct ether_addr *mac);
+
+bool
+ops_sai_neighbor_activity_test(const struct ops_sai_neighbor *neigh);
+
+void
+ops_sai_neighbor_activity_run(void);
+
+void
+ops_sai_neighbor_activity_wait(void);
+
+void
+ops_sai_neighbor_enqueue(enum ops_sai_neighbor_op op,
+                         const struct ops_sai_neighbor_key *key,
+                         const struct ether_addr *mac);
+
+void
+ops_sai_neighbor_queue_flush(void);
+
+void
+ops_sai_neighbor_queue_run(void);
+
+void
+ops_sai_neighbor_queue_wait(void);
+
 #endif /* sai-neighbor.h */
@@ -20,6 +20,7 @@
 #include <openswitch-idl.h>
 #include <ofproto/ofproto-provider.h>
 #include <sai-ofproto-sflow.h>
+#include <sai-route.h>
 
 const struct ofproto_class ofproto_sai_class;
 
@@ -34,6 +35,7 @@ struct ofproto_sai {
     struct sset ghost_ports;    /* Ports with no datapath port. */
     handle_t vrid;
     struct hmap mirrors;        /* type of struct ofmirror_sai */
+    struct ops_sai_route_batch route_batch; /* Pending remote routes */
 
     struct sai_sflow *sflow;
 };
@@ -79,8 +81,8 @@ struct ofbundle_sai {
 
     /* Local routes entries */
     struct hmap local_routes;
-    /* Neighbor entries */
-    struct hmap neighbors;
+    /* Neighbor entries, struct ops_sai_neighbor */
+    struct ovs_list neighbors;
 
     struct {
         bool cache_config; /* Specifies if config should be cached */
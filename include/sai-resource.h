@@ -0,0 +1,41 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#ifndef SAI_RESOURCE_H
+#define SAI_RESOURCE_H 1
+
+#include <sai-common.h>
+
+/*
+ * Accounting of hardware forwarding table entries. Capacity is read from the
+ * switch at init and objects are admitted before they are created, so a full
+ * table fails a request up front instead of half way through it.
+ */
+
+enum ops_sai_resource {
+    OPS_SAI_RESOURCE_ROUTE = 0,
+    OPS_SAI_RESOURCE_NEXTHOP,
+    OPS_SAI_RESOURCE_NHG,
+    OPS_SAI_RESOURCE_MAX
+};
+
+void
+ops_sai_resource_init(void);
+
+bool
+ops_sai_resource_admit(enum ops_sai_resource res, uint32_t count);
+
+void
+ops_sai_resource_force_admit(enum ops_sai_resource res, uint32_t count);
+
+void
+ops_sai_resource_release(enum ops_sai_resource res, uint32_t count);
+
+void
+ops_sai_resource_usage_get(enum ops_sai_resource res, uint32_t *used,
+                           uint32_t *capacity);
+
+#endif /* sai-resource.h */
@@ -0,0 +1,33 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#ifndef SAI_ROUTE_TRIE_H
+#define SAI_ROUTE_TRIE_H 1
+
+#include <sai-route.h>
+
+/*
+ * Longest prefix match shadow of the routes known to the plugin. One
+ * path-compressed binary trie per VRF and address family, nodes are taken
+ * from a slab so a node costs 48 bytes and no malloc overhead.
+ */
+
+int
+ops_sai_route_trie_insert(const struct ops_sai_route_key *key, void *data);
+
+void *
+ops_sai_route_trie_remove(const struct ops_sai_route_key *key);
+
+void *
+ops_sai_route_trie_lookup(int vrf, uint8_t family, const uint8_t *addr);
+
+void *
+ops_sai_route_trie_covering(const struct ops_sai_route_key *key);
+
+void
+ops_sai_route_trie_stats(size_t *n_routes, size_t *n_nodes, size_t *n_bytes);
+
+#endif /* sai-route-trie.h */
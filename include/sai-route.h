@@ -12,10 +12,112 @@
 #include <sai-vendor-common.h>
 #endif /* SAI_VENDOR */
 
+#include <errno.h>
 #include <hmap.h>
 #include <hash.h>
+#include <list.h>
 #include <netdev.h>
 
+#define OPS_SAI_IP_ADDR_MAX_LEN     16      /* IPv6 address length in bytes */
+#define OPS_SAI_PREFIX_STR_LEN      64      /* enough for "<IPv6>/128" */
+
+/* Parsed IP prefix. Address is kept in network byte order with the host
+ * bits cleared, so the struct can be hashed and compared as raw bytes. */
+struct ops_sai_prefix {
+    uint8_t     family;                         /* AF_INET or AF_INET6 */
+    uint8_t     len;                            /* mask length in bits */
+    uint8_t     pad[2];
+    uint8_t     addr[OPS_SAI_IP_ADDR_MAX_LEN];
+};
+
+/* One route of a bulk route operation. Both forms of the prefix are
+ * filled by the caller, so the route worker does not parse it again. */
+struct ops_sai_route_bulk_entry {
+    char            *prefix;            /* IP prefix */
+    struct ops_sai_prefix ip_prefix;    /* parsed prefix */
+    uint32_t        next_hop_count;     /* count of next hops */
+    char            **next_hops;        /* list of next hops */
+    int             status;            /* [out] result of this entry */
+};
+
+/* Work item of the route programming worker: bulk removes, next hop
+ * replacements, bulk adds and next hop removes of one virtual router, in
+ * this order, or a task touching
+ * route state, such as neighbor updates resolving next hops. A task is
+ * executed by the worker after the entries and completed on the main
+ * thread. */
+struct ops_sai_route_job {
+    handle_t                        vrid;
+    struct ops_sai_route_bulk_entry *removes;
+    size_t                          n_removes;
+    struct ops_sai_route_bulk_entry *sets;
+    size_t                          n_sets;
+    struct ops_sai_route_bulk_entry *adds;
+    size_t                          n_adds;
+    struct ops_sai_route_bulk_entry *nh_removes;
+    size_t                          n_nh_removes;
+    int                             (*execute)(void *aux);     /* optional */
+    void                            (*complete)(void *aux);    /* optional */
+    void                            *aux;
+    int                             status;    /* [out] first failure */
+};
+
+struct ds;
+struct unixctl_conn;
+
+/* Appctl command run by the worker. Writes reply or, returning nonzero, error
+ * message to ds. */
+typedef int (*ops_sai_route_unixctl_clb_t)(struct ds *ds, int argc,
+                                           const char *argv[]);
+
+void
+ops_sai_route_pipeline_submit(struct ops_sai_route_job *job);
+
+void
+ops_sai_route_pipeline_task(int (*execute)(void *aux),
+                            void (*complete)(void *aux), void *aux);
+
+void
+ops_sai_route_pipeline_unixctl(struct unixctl_conn *conn, int argc,
+                               const char *argv[],
+                               ops_sai_route_unixctl_clb_t fn);
+
+int
+ops_sai_route_pipeline_sync(void);
+
+void
+ops_sai_route_pipeline_run(void);
+
+void
+ops_sai_route_pipeline_wait(void);
+
+uint64_t
+ops_sai_route_pipeline_failures(void);
+
+void
+ops_sai_route_aggregate_run(void);
+
+void
+ops_sai_route_aggregate_wait(void);
+
+void
+ops_sai_route_snapshot_run(void);
+
+void
+ops_sai_route_snapshot_wait(void);
+
+void
+ops_sai_route_park_run(void);
+
+void
+ops_sai_route_park_wait(void);
+
+void
+ops_sai_route_walk_run(void);
+
+void
+ops_sai_route_walk_wait(void);
+
 struct route_class {
     /**
     * Initializes route.
@@ -63,6 +165,25 @@ struct route_class {
                        const char        *prefix,
                        uint32_t           next_hop_count,
                        char *const *const next_hops);
+    /**
+     *  Function for setting next hops of a remote route to exactly the given
+     *  ones, without the route going missing in between. A route which is
+     *  not programmed yet is added.
+     *
+     * @param[in] vrid           - virtual router ID
+     * @param[in] prefix         - IP prefix
+     * @param[in] next_hop_count - count of next hops
+     * @param[in] next_hops      - list of next hops
+     *
+     * @notes optional. If not set, the route is removed with remove and
+     *        added again with remote_add.
+     *
+     * @return 0     if operation completed successfully.
+     * @return errno if operation failed.*/
+    int  (*remote_set)(handle_t           vrid,
+                       const char        *prefix,
+                       uint32_t           next_hop_count,
+                       char *const *const next_hops);
     /**
      *  Function for deleting next hops(list of remote routes) which now are not
      *  accessible over specified IP prefix
@@ -90,11 +211,103 @@ struct route_class {
      * @return 0     if operation completed successfully.
      * @return errno if operation failed.*/
     int  (*remove)(const handle_t *vrid, const char *prefix);
+    /**
+     *  Function for adding a batch of remote routes at once.
+     *
+     * @param[in]     vrid    - virtual router ID
+     * @param[in,out] entries - routes to add. status of every entry is set
+     *                          to what remote_add would return for it.
+     * @param[in]     count   - count of entries
+     *
+     * @notes optional. If not set, entries are added one by one with
+     *        remote_add.
+     *
+     * @return 0     if all entries were added successfully.
+     * @return status of the first failed entry otherwise.*/
+    int  (*remote_add_bulk)(handle_t                         vrid,
+                            struct ops_sai_route_bulk_entry *entries,
+                            uint32_t                         count);
+    /**
+     *  Function for deleting a batch of remote routes at once.
+     *
+     * @param[in]     vrid    - virtual router ID
+     * @param[in,out] entries - routes to delete, next hops are ignored.
+     *                          status of every entry is set to what remove
+     *                          would return for it.
+     * @param[in]     count   - count of entries
+     *
+     * @notes optional. If not set, entries are deleted one by one with
+     *        remove.
+     *
+     * @return 0     if all entries were deleted successfully.
+     * @return status of the first failed entry otherwise.*/
+    int  (*remove_bulk)(const handle_t                  *vrid,
+                        struct ops_sai_route_bulk_entry *entries,
+                        uint32_t                         count);
+    /**
+     *  Function for setting next hops of a batch of remote routes at once.
+     *
+     * @param[in]     vrid    - virtual router ID
+     * @param[in,out] entries - routes to set next hops of. status of every
+     *                          entry is set to what remote_set would return
+     *                          for it.
+     * @param[in]     count   - count of entries
+     *
+     * @notes optional. If not set, entries are set one by one with
+     *        remote_set.
+     *
+     * @return 0     if all entries were set successfully.
+     * @return status of the first failed entry otherwise.*/
+    int  (*remote_set_bulk)(handle_t                         vrid,
+                            struct ops_sai_route_bulk_entry *entries,
+                            uint32_t                         count);
+    /**
+     *  Function for deleting next hops of a batch of remote routes at once.
+     *
+     * @param[in]     vrid    - virtual router ID
+     * @param[in,out] entries - routes and next hops to delete. status of
+     *                          every entry is set to what remote_nh_remove
+     *                          would return for it.
+     * @param[in]     count   - count of entries
+     *
+     * @notes optional. If not set, entries are handled one by one with
+     *        remote_nh_remove.
+     *
+     * @return 0     if all entries were handled successfully.
+     * @return status of the first failed entry otherwise.*/
+    int  (*remote_nh_remove_bulk)(handle_t                         vrid,
+                                  struct ops_sai_route_bulk_entry *entries,
+                                  uint32_t                         count);
 
     int  (*if_addr_add)(const handle_t *vrid, const char *prefix, const char *ifname);
 
     int  (*if_addr_delete)(const handle_t *vrid, const char *prefix, const char *ifname);
 
+    /**
+     *  Function for switching ECMP groups to resilient hashing, where a
+     *  membership change only remaps the flows of the changed members.
+     *
+     * @param[in] enable - use resilient hashing
+     *
+     * @notes optional. If not set, resilient hashing is not supported.
+     *
+     * @return 0     if operation completed successfully.
+     * @return errno if operation failed.*/
+    int  (*ecmp_resilient_set)(bool enable);
+
+    /**
+     *  Function for deleting all routes of a virtual router at once, before
+     *  the virtual router is removed.
+     *
+     * @param[in] vrid - virtual router ID
+     *
+     * @notes optional. If not set, routes are expected to be deleted one by
+     *        one before.
+     *
+     * @return 0     if operation completed successfully.
+     * @return errno if operation failed.*/
+    int  (*vrf_flush)(const handle_t *vrid);
+
     /**
      * De-initializes route.
      */
@@ -114,33 +327,62 @@ enum ops_route_state {
     OPS_ROUTE_STATE_ECMP
 };
 
+/* all_route key. Always zero-initialize before filling. */
+struct ops_sai_route_key {
+    int                     vrf;
+    struct ops_sai_prefix   prefix;
+};
+
+#define OPS_SAI_NH_INDEX_INVALID    UINT32_MAX
+
+/* all_nexthop key. Always zero-initialize before filling. Next hop is an
+ * address on one router interface, so routes and neighbors of the same
+ * address on other interfaces or virtual routers do not share it. */
+struct ops_sai_nexthop_key {
+    uint64_t        vrid;                       /* virtual router */
+    sai_object_id_t rif;                        /* egress router interface */
+    uint8_t         family;                     /* AF_INET or AF_INET6 */
+    uint8_t         pad[7];
+    uint8_t         addr[OPS_SAI_IP_ADDR_MAX_LEN];  /* network byte order */
+};
+
+struct ops_sai_nhg;
+struct ops_sai_route_aggr;
+
+/* Next hop shared by routes and neighbors, referred to by index */
 struct nh_entry {
     struct hmap_node nh_hmap_node;
-    uint32_t ref;
+    struct ops_sai_nexthop_key key;
+    uint32_t ref;                       /* 0 if entry is free */
+    uint32_t index;                     /* slab index */
     bool is_ipv6_addr;
-    char *id;
+    bool is_down;                       /* no neighbor (yet) */
+    uint32_t weight;                    /* share in weighted ECMP groups */
     handle_t handle;
+    struct ops_sai_nhg **nhgs;          /* ECMP groups with this next hop */
+    size_t n_nhgs;
+    size_t allocated_nhgs;
 };
 
 typedef struct sai_ops_route_s
 {
     struct      hmap_node node;
-    int         vrf;
+    struct      ops_sai_route_key key;      /* vrf and prefix */
     bool        is_ipv6;                   /* IP V4/V6 */
-    char        *prefix;
-    struct      hmap nexthops;              /* list of selected next hops */
+    uint32_t    *nexthops;                  /* indices of selected next hops */
     uint8_t     n_nexthops;                 /* number of nexthops */
     uint8_t     refer_cnt;                 /* refer counts for route with nexthop of interface */
     enum        ops_route_state rstate;     /* state of route */
     handle_t    nh_ecmp;                   /* next hop index ecmp*/
+    struct      ops_sai_nhg *nhg;           /* shared ECMP group of nh_ecmp */
+    uint64_t    vrid;                       /* virtual router of remote route */
+    sai_object_id_t rif;                    /* interface of local route */
+    struct      ops_sai_route_aggr *aggr;   /* programmed as part of it */
+    bool        stale;                      /* restored, not added again */
+    bool        parked;                     /* next hops all unresolved */
+    struct      ovs_list park_node;         /* route_parked, if parked */
 }sai_ops_route_t;
 
-typedef struct sai_ops_nexthop_s
-{
-    struct      hmap_node node;             /* route->nexthops */
-    char        *id;                        /* IP address or Port name */
-}sai_ops_nexthop_t;
-
 struct if_addr {
     struct hmap_node if_addr_hmap_node;
     bool is_ipv6_addr;
@@ -160,6 +402,7 @@ static inline int
 ops_sai_route_ip_to_me_add(const handle_t *vrid, const char *prefix)
 {
     ovs_assert(ops_sai_route_class()->ip_to_me_add);
+    ops_sai_route_pipeline_sync();
     return ops_sai_route_class()->ip_to_me_add(vrid, prefix);
 }
 
@@ -167,6 +410,7 @@ static inline int
 ops_sai_route_ip_to_me_delete(const handle_t *vrid, const char *prefix)
 {
     ovs_assert(ops_sai_route_class()->ip_to_me_delete);
+    ops_sai_route_pipeline_sync();
     return ops_sai_route_class()->ip_to_me_delete(vrid, prefix);
 }
 
@@ -176,9 +420,13 @@ ops_sai_route_local_add(const handle_t *vrid,
                         const handle_t *rifid)
 {
     ovs_assert(ops_sai_route_class()->local_add);
+    ops_sai_route_pipeline_sync();
     return ops_sai_route_class()->local_add(vrid, prefix, rifid);
 }
 
+/* Remote route changes below are made by the route worker for the batches.
+ * The main thread calls them only with no job in flight, after
+ * ops_sai_route_batch_flush() or ops_sai_route_pipeline_sync(). */
 static inline int
 ops_sai_route_remote_add(handle_t           vrid,
                          const char        *prefix,
@@ -209,24 +457,261 @@ ops_sai_route_remove(const handle_t *vrid, const char     *prefix)
     return ops_sai_route_class()->remove(vrid, prefix);
 }
 
+static inline int
+ops_sai_route_remote_set(handle_t           vrid,
+                         const char        *prefix,
+                         uint32_t           next_hop_count,
+                         char *const *const next_hops)
+{
+    int status = 0;
+
+    if (ops_sai_route_class()->remote_set) {
+        return ops_sai_route_class()->remote_set(vrid, prefix, next_hop_count,
+                                                 next_hops);
+    }
+
+    status = ops_sai_route_remove(&vrid, prefix);
+    if (status) {
+        return status;
+    }
+
+    return ops_sai_route_remote_add(vrid, prefix, next_hop_count, next_hops);
+}
+
+static inline int
+ops_sai_route_remote_add_bulk(handle_t                         vrid,
+                              struct ops_sai_route_bulk_entry *entries,
+                              uint32_t                         count)
+{
+    int status = 0;
+
+    if (ops_sai_route_class()->remote_add_bulk) {
+        return ops_sai_route_class()->remote_add_bulk(vrid, entries, count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status = ops_sai_route_remote_add(vrid,
+                                                     entries[i].prefix,
+                                                     entries[i].next_hop_count,
+                                                     entries[i].next_hops);
+        if (!status) {
+            status = entries[i].status;
+        }
+    }
+
+    return status;
+}
+
+static inline int
+ops_sai_route_remove_bulk(const handle_t                  *vrid,
+                          struct ops_sai_route_bulk_entry *entries,
+                          uint32_t                         count)
+{
+    int status = 0;
+
+    if (ops_sai_route_class()->remove_bulk) {
+        return ops_sai_route_class()->remove_bulk(vrid, entries, count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status = ops_sai_route_remove(vrid, entries[i].prefix);
+        if (!status) {
+            status = entries[i].status;
+        }
+    }
+
+    return status;
+}
+
+static inline int
+ops_sai_route_remote_set_bulk(handle_t                         vrid,
+                              struct ops_sai_route_bulk_entry *entries,
+                              uint32_t                         count)
+{
+    int status = 0;
+
+    if (ops_sai_route_class()->remote_set_bulk) {
+        return ops_sai_route_class()->remote_set_bulk(vrid, entries, count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status = ops_sai_route_remote_set(vrid,
+                                                     entries[i].prefix,
+                                                     entries[i].next_hop_count,
+                                                     entries[i].next_hops);
+        if (!status) {
+            status = entries[i].status;
+        }
+    }
+
+    return status;
+}
+
+static inline int
+ops_sai_route_remote_nh_remove_bulk(handle_t                         vrid,
+                                    struct ops_sai_route_bulk_entry *entries,
+                                    uint32_t                         count)
+{
+    int status = 0;
+
+    if (ops_sai_route_class()->remote_nh_remove_bulk) {
+        return ops_sai_route_class()->remote_nh_remove_bulk(vrid, entries,
+                                                            count);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status =
+            ops_sai_route_remote_nh_remove(vrid, entries[i].prefix,
+                                           entries[i].next_hop_count,
+                                           entries[i].next_hops);
+        if (!status) {
+            status = entries[i].status;
+        }
+    }
+
+    return status;
+}
+
+static inline int
+ops_sai_route_ecmp_resilient_set(bool enable)
+{
+    if (!ops_sai_route_class()->ecmp_resilient_set) {
+        return EOPNOTSUPP;
+    }
+
+    ops_sai_route_pipeline_sync();
+    return ops_sai_route_class()->ecmp_resilient_set(enable);
+}
+
+static inline int
+ops_sai_route_vrf_flush(const handle_t *vrid)
+{
+    if (!ops_sai_route_class()->vrf_flush) {
+        return EOPNOTSUPP;
+    }
+
+    ops_sai_route_pipeline_sync();
+    return ops_sai_route_class()->vrf_flush(vrid);
+}
+
 static inline void
 ops_sai_route_deinit(void)
 {
     ovs_assert(ops_sai_route_class()->deinit);
+    ops_sai_route_pipeline_sync();
     ops_sai_route_class()->deinit();
 }
 
-struct nh_entry*
-ops_sai_neighbor_get_nexthop(const char* id);
+#define OPS_SAI_ROUTE_BATCH_MAX     1024
+
+enum ops_sai_route_batch_op {
+    OPS_SAI_ROUTE_BATCH_ADD = 0,
+    OPS_SAI_ROUTE_BATCH_REMOVE,
+    OPS_SAI_ROUTE_BATCH_DELETE_NH
+};
+
+/* Remote route operations of one prefix waiting to be submitted. Later
+ * operations on the prefix are merged into it. */
+struct ops_sai_route_pending {
+    struct hmap_node                node;       /* ops_sai_route_batch */
+    struct ops_sai_route_key        key;
+    char                            *prefix;
+    bool                            remove;     /* drop next hops added
+                                                   before the batch */
+    uint32_t                        next_hop_count;
+    char                            **next_hops; /* next hops to add */
+    uint32_t                        n_nh_removes;
+    char                            **nh_removes; /* next hops to remove */
+};
+
+/* Remote route operations of one virtual router, accumulated for a short
+ * coalescing window and handed to the route programming worker at once.
+ * Queuing an operation cannot fail: entries the worker fails are logged and
+ * counted in sai/route/coalesce, and are not retried. The route stays as the
+ * failed operation left it until the prefix is updated again.
+ * Operations on different prefixes are independent, so only the final
+ * operation of every prefix is kept. Prefixes the batch has submitted adds
+ * for are tracked on the main thread, so that a remove of a prefix never
+ * programmed is dropped and a remove followed by an add becomes one next hop
+ * replacement. */
+struct ops_sai_route_batch {
+    const handle_t                  *vrid;      /* of the owner, read on
+                                                   submit */
+    struct hmap                     pending;    /* ops_sai_route_pending */
+    struct hmap                     programmed; /* ops_sai_route_programmed */
+    long long int                   deadline;   /* window end, msec */
+};
+
+void
+ops_sai_route_batch_init(struct ops_sai_route_batch *batch,
+                         const handle_t *vrid);
+
+void
+ops_sai_route_batch_add(struct ops_sai_route_batch *batch,
+                        enum ops_sai_route_batch_op op,
+                        const char *prefix,
+                        uint32_t next_hop_count,
+                        char *const *const next_hops);
+
+void
+ops_sai_route_batch_submit(struct ops_sai_route_batch *batch);
+
+void
+ops_sai_route_batch_run(struct ops_sai_route_batch *batch);
+
+void
+ops_sai_route_batch_wait(const struct ops_sai_route_batch *batch);
+
+int
+ops_sai_route_batch_flush(struct ops_sai_route_batch *batch);
+
+void
+ops_sai_route_batch_destroy(struct ops_sai_route_batch *batch);
+
+static inline bool
+ops_sai_route_batch_is_empty(const struct ops_sai_route_batch *batch)
+{
+    return hmap_is_empty(&batch->pending);
+}
+
+int
+ops_sai_prefix_parse(const char *str, struct ops_sai_prefix *prefix);
+
+const char *
+ops_sai_prefix_format(const struct ops_sai_prefix *prefix,
+                      char *buf, size_t len);
+
+int
+ops_sai_route_prefix_get(const char *str, struct ops_sai_prefix *prefix);
+
+int
+ops_sai_nexthop_key_init(struct ops_sai_nexthop_key *key, uint64_t vrid,
+                         sai_object_id_t rif, const char *addr);
+
+uint32_t
+ops_sai_nexthop_find(const struct ops_sai_nexthop_key *key);
+
+uint32_t
+ops_sai_nexthop_ref(const struct ops_sai_nexthop_key *key);
+
+void
+ops_sai_nexthop_unref(uint32_t index);
+
+struct nh_entry *
+ops_sai_nexthop_get(uint32_t index);
+
+const char *
+ops_sai_nexthop_format(uint32_t index, char *buf, size_t len);
 
-struct nh_entry*
-ops_sai_neighbor_add_nexthop(const char* id, handle_t *l3_egress_id);
+void
+ops_sai_nexthop_state_set(uint32_t index, bool is_up);
 
 int
-ops_sai_neighbor_delete_nexthop(const char* id);
+ops_sai_ip_addr_fill(sai_ip_address_t *ipaddr, const char *str);
 
 int32_t
-ops_sai_routing_nexthop_create(const handle_t *rif, const char* prefix, handle_t *l3_egress_id);
+ops_sai_routing_nexthop_create(const struct ops_sai_nexthop_key *key,
+                               handle_t *l3_egress_id);
 
 int32_t
 ops_sai_routing_nexthop_remove(handle_t *l3_egress_id);
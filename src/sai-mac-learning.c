@@ -7,11 +7,19 @@
 #define __BOOL_DEFINED
 /* end */
 #include "hmap.h"
+#include "list.h"
 #include "ofproto/ofproto.h"
 #include "packets.h"
 #include "errno.h"
 #include "sai-mac-learning.h"
 #include "ovs-thread.h"
+#include "ovs-atomic.h"
+#include "seq.h"
+#include "poll-loop.h"
+#include "timeval.h"
+#include "unixctl.h"
+#include "dynamic-string.h"
+#include <sai-common.h>
 #include <sai-api-class.h>
 #include <sai-netdev.h>
 #include <sai-fdb.h>
@@ -24,64 +32,204 @@ VLOG_DEFINE_THIS_MODULE(sai_mac_learning);
 static struct vlog_rate_limit mac_learning_rl = VLOG_RATE_LIMIT_INIT(5, 20);
 
 /*
- * The buffers are defined as 20 because:
- *    1:
- *      To allow simultaneous read access to bridge.c and ops-mac-learning.c code
- *      threads will be: __init thread, switchd main thread and thread created for
- *      bcm callback without worrying about wait for acquiring the lock.
- *    2:
- *      BUFFER_SIZE(16384) * 20; centec fdb entry max 128km learn & flush msg = 128k * 2 = 236k;
+ * Learn and age events are handed over from the SAI notification thread to
+ * the switchd main thread through a bounded multi producer, single consumer
+ * ring. Producers never block: they claim a slot with a compare and swap and
+ * publish it through the slot sequence number. When the ring is full the
+ * event is dropped and counted. The main thread drains the ring when the mac
+ * learning plugin asks for learnt MACs and coalesces events into a hmap.
+ *
+ * The notifier thread triggers the plugin. It sleeps on mlearn_seq, which the
+ * first event after each trigger changes, then collects events for a short
+ * batching window, so that a burst ends up in one OVSDB transaction.
+ *
+ * 2^18 slots of 32 bytes, 8 MB, hold a flush and relearn of the full 128k
+ * entry table.
+ */
+#define MLEARN_RING_SIZE        (1u << 18)      /* power of 2 */
+#define MLEARN_RING_MASK        (MLEARN_RING_SIZE - 1)
+
+struct mlearn_event {
+    atomic_uint32_t     seq;                    /* slot sequence number */
+    uint32_t            time;                   /* queued, usec, wraps */
+    sai_object_id_t     port;
+    uint16_t            vlan;
+    uint8_t             mac[ETH_ADDR_LEN];
+    uint8_t             oper;                   /* mac_event */
+};
+
+static struct mlearn_event mlearn_ring[MLEARN_RING_SIZE];
+static atomic_uint32_t mlearn_ring_head;        /* claimed by producers */
+static atomic_uint32_t mlearn_ring_tail;        /* written by consumer only */
+static atomic_uint64_t mlearn_ring_drops;
+
+static struct seq *mlearn_seq;                  /* notifier wakeup */
+static atomic_bool mlearn_notify_armed = ATOMIC_VAR_INIT(true);
+
+/*
+ * Batching window. It widens while batches are large, to amortize OVSDB
+ * writes under load, and narrows while they are small, for low latency.
+ */
+#define MLEARN_BATCH_MIN_MSEC   1
+#define MLEARN_BATCH_MAX_MSEC   8
+#define MLEARN_BATCH_LARGE      64              /* events */
+
+static atomic_uint mlearn_batch_msec = ATOMIC_VAR_INIT(MLEARN_BATCH_MIN_MSEC);
+
+/*
+ * Queued to drained latency, power of 2 buckets of msec: bucket 0 is below
+ * 1 ms, bucket i is [2^(i-1), 2^i) ms, the last one everything above.
+ * It does not include the OVSDB transaction the plugin commits after the
+ * drain. Main thread only.
+ */
+#define MLEARN_LATENCY_BUCKETS  12
+
+static struct {
+    uint64_t    buckets[MLEARN_LATENCY_BUCKETS];
+    uint64_t    events;
+    uint64_t    batches;
+    uint32_t    max_usec;
+} mlearn_latency;
+
+/*
+ * Two buffers, so that the one handed out to the mac learning plugin stays
+ * valid while the next one is filled. While events are coalesced, entries
+ * refer to ports by index; names are filled in once the buffer is complete.
+ * Main thread only.
  */
-#define MAX_BUFFERS   20
+struct mlearn_buffer {
+    struct mlearn_hmap  hmap;
+    uint32_t            ports[BUFFER_SIZE];     /* port index of each node */
+};
+
+static struct mlearn_buffer all_macs_learnt[2];
+static int cur_hmap_in_use = 0;
 
 /*
- * mlearn_mutex is the mutex going to be used to access the all_macs_learnt and
- * what hmap is currently in use.
+ * Ports MACs are learnt on, physical ports and LAGs, by OID. Registered when
+ * they are created in hardware. Main thread only.
  */
-struct ovs_mutex mlearn_mutex = OVS_MUTEX_INITIALIZER;
+#define MLEARN_PORT_NONE        UINT32_MAX
+
+struct mlearn_port {
+    struct hmap_node    node;                   /* in mlearn_ports */
+    handle_t            port_id;
+    uint32_t            index;                  /* in mlearn_port_table */
+    char                name[PORT_NAME_SIZE];
+    struct ovs_list     fdb;                    /* mlearn_fdb_entry */
+    uint32_t            n_fdb;
+};
+
+static struct hmap mlearn_ports = HMAP_INITIALIZER(&mlearn_ports);
+static struct mlearn_port **mlearn_port_table;  /* by index, NULL if free */
+static size_t mlearn_n_ports;                   /* indices handed out */
+static size_t mlearn_port_allocated;
 
 /*
- * all_macs_learnt:
- *      It is for storing the MACs learnt.
+ * Shadow of the dynamic entries in the hardware FDB, applied from drained
+ * learn and age events in order. Entries are also linked per port and per
+ * VLAN, so that flushes and dumps only touch the entries they cover.
+ * Main thread only.
  *
- * Threads that can access this data structure: thread, timer thead,
- * thread created by ASIC for the traversal.
+ * The shadow lags hardware by the events still queued, so it never decides
+ * whether hardware is flushed. Entries are missed while events are lost,
+ * dropped on a full ring or learnt on a port not registered, until the next
+ * full flush.
+ *
+ * Learn events queued before a flush refer to entries the flush removed.
+ * Flushes are remembered with the ring position they happened at until the
+ * events before it are drained, and the learn events they cover dropped.
  */
-struct mlearn_hmap all_macs_learnt[MAX_BUFFERS] OVS_GUARDED_BY(mlearn_mutex);
+#define MLEARN_FDB_VLANS        (VLAN_ID_MAX + 2)
+
+struct mlearn_fdb_entry {
+    struct hmap_node    node;                   /* in mlearn_fdb */
+    struct ovs_list     port_node;              /* in mlearn_port's fdb */
+    struct ovs_list     vlan_node;              /* in mlearn_fdb_vlans */
+    struct ovs_list     flap_node;              /* in mlearn_fdb_flapping */
+    struct eth_addr     mac;
+    uint16_t            vlan;
+    uint32_t            port;                   /* index */
+    uint32_t            reported;               /* port index the plugin has */
+    uint32_t            moves;
+    uint32_t            flap_moves;             /* in the current window */
+    long long int       flap_start;             /* msec */
+    long long int       suppressed_until;       /* msec, 0 if not flapping */
+};
+
+static struct hmap mlearn_fdb = HMAP_INITIALIZER(&mlearn_fdb);
+
+static struct {
+    struct ovs_list     entries;                /* mlearn_fdb_entry */
+    uint32_t            n;
+} mlearn_fdb_vlans[MLEARN_FDB_VLANS];
+
+struct mlearn_flush {
+    uint32_t            pos;                    /* ring head at the flush */
+    int                 options;                /* L2MAC_FLUSH_* */
+    uint32_t            port;                   /* index */
+    int                 vlan;
+};
+
+static struct mlearn_flush *mlearn_flushes;     /* oldest first */
+static size_t mlearn_n_flushes;
+static size_t mlearn_flushes_allocated;
+
+static uint64_t mlearn_fdb_moves;
+static uint64_t mlearn_fdb_stale;               /* learn events flushed */
+static uint64_t mlearn_fdb_lost;                /* since the last full flush */
+static uint64_t mlearn_fdb_drops_seen;          /* ring drops at that flush */
 
-#define TIMER_THREAD_TIMEOUT 20
-static pthread_t sai_timer_thread;
+/*
+ * A MAC moving between ports that often is flapping, a layer 2 loop or a
+ * misbehaving host. Its moves are not reported to the plugin, to keep the
+ * learn storm out of OVSDB, until it stays on one port for the hold time.
+ * The plugin is then told where it ended up.
+ */
+#define MLEARN_FLAP_MOVES       5
+#define MLEARN_FLAP_WINDOW_MSEC 10000
+#define MLEARN_FLAP_HOLD_MSEC   10000
+#define MLEARN_FLAP_TOP         16              /* listed by the appctl */
 
-static int current_hmap_in_use = 0 OVS_GUARDED_BY(mlearn_mutex);
-static int cur_read_hmap_in_use = 0 OVS_GUARDED_BY(mlearn_mutex);
+static struct vlog_rate_limit mac_flap_rl = VLOG_RATE_LIMIT_INIT(1, 5);
 
-#define MACS_TABLES_IS_FULL					((current_hmap_in_use+1) % MAX_BUFFERS == cur_read_hmap_in_use)
-#define MACS_TABLES_IS_EMPTY					(cur_read_hmap_in_use == current_hmap_in_use)
-#define MACS_TABLES_GET_NEXT_INDEX(index)         ((index + 1) % MAX_BUFFERS)
+static struct ovs_list mlearn_fdb_flapping
+    = OVS_LIST_INITIALIZER(&mlearn_fdb_flapping);
+static uint64_t mlearn_fdb_flaps;
+static uint64_t mlearn_fdb_moves_suppressed;
 
-static int next_sleep_timer_in_sec = TIMER_THREAD_TIMEOUT;
+/* Earliest end of a suppression, 0 if none. Set by the main thread, the
+ * notifier triggers the plugin when it passes. */
+static atomic_llong mlearn_flap_deadline = ATOMIC_VAR_INIT(0);
 
-static struct mac_learning_plugin_interface *p_mlearn_plugin_interface = NULL;
+static pthread_t sai_notify_thread;
+
+/*
+ * The plugin interface is looked up from the SAI notification thread, the
+ * timer thread and the main thread.
+ */
+static struct ovs_mutex mlearn_plugin_mutex = OVS_MUTEX_INITIALIZER;
+static struct mac_learning_plugin_interface *p_mlearn_plugin_interface
+    OVS_GUARDED_BY(mlearn_plugin_mutex) = NULL;
 
 static struct mac_learning_plugin_interface *
 get_plugin_mac_learning_interface (void)
 {
     struct plugin_extension_interface *p_extension = NULL;
+    struct mac_learning_plugin_interface *p_interface = NULL;
 
-    if (p_mlearn_plugin_interface) {
-        return (p_mlearn_plugin_interface);
-    }
-
-    if (!find_plugin_extension(MAC_LEARNING_PLUGIN_INTERFACE_NAME,
+    ovs_mutex_lock(&mlearn_plugin_mutex);
+    if (!p_mlearn_plugin_interface &&
+        !find_plugin_extension(MAC_LEARNING_PLUGIN_INTERFACE_NAME,
                                MAC_LEARNING_PLUGIN_INTERFACE_MAJOR,
                                MAC_LEARNING_PLUGIN_INTERFACE_MINOR,
-                               &p_extension)) {
-        if (p_extension) {
-            p_mlearn_plugin_interface = p_extension->plugin_interface;
-            return (p_extension->plugin_interface);
-        }
+                               &p_extension) && p_extension) {
+        p_mlearn_plugin_interface = p_extension->plugin_interface;
     }
-    return NULL;
+    p_interface = p_mlearn_plugin_interface;
+    ovs_mutex_unlock(&mlearn_plugin_mutex);
+
+    return (p_interface);
 }
 
 /*
@@ -111,17 +259,399 @@ sai_mac_learning_table_is_full(const struct mlearn_hmap *mlearn_hmap)
     return ((mlearn_hmap->buffer).actual_size == (mlearn_hmap->buffer).size);
 }
 
+static struct mlearn_port *
+sai_mac_learning_port_find(handle_t port_id)
+{
+    struct mlearn_port *port = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH (port, node, hash_uint64(port_id.data),
+                             &mlearn_ports) {
+        if (HANDLE_EQ(&port->port_id, &port_id)) {
+            return port;
+        }
+    }
+
+    return NULL;
+}
+
+static struct mlearn_fdb_entry *
+sai_mac_learning_fdb_find(const struct eth_addr mac, uint16_t vlan)
+{
+    struct mlearn_fdb_entry *entry = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH (entry, node,
+                             sai_mac_learning_table_hash_calc(mac, vlan, 0),
+                             &mlearn_fdb) {
+        if (entry->vlan == vlan && eth_addr_equals(entry->mac, mac)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
 static void
-sai_mac_learning_get_port_name_from_id(handle_t port_id, char* port_name)
+sai_mac_learning_fdb_remove(struct mlearn_fdb_entry *entry)
 {
-    if(SAI_OBJECT_TYPE_LAG == sai_object_type_query(port_id.data))
-    {
-        ofbundle_get_port_name_by_handle_id(port_id, port_name);
-    } else if (SAI_OBJECT_TYPE_PORT == sai_object_type_query(port_id.data)){
-        netdev_sai_get_port_name_by_handle_id(port_id, port_name);
+    hmap_remove(&mlearn_fdb, &entry->node);
+    list_remove(&entry->port_node);
+    mlearn_port_table[entry->port]->n_fdb--;
+    list_remove(&entry->vlan_node);
+    mlearn_fdb_vlans[entry->vlan].n--;
+    if (entry->suppressed_until) {
+        list_remove(&entry->flap_node);
+    }
+    free(entry);
+}
+
+/*
+ * Function: sai_mac_learning_fdb_flap_check
+ *
+ * This function accounts a move of an entry to another port.
+ *
+ * Returns true if the entry is flapping and the move is not to be reported.
+ */
+static bool
+sai_mac_learning_fdb_flap_check(struct mlearn_fdb_entry *entry,
+                                const struct mlearn_port *from,
+                                const struct mlearn_port *to,
+                                long long int now)
+{
+    entry->moves++;
+    mlearn_fdb_moves++;
+
+    if (entry->suppressed_until) {
+        entry->suppressed_until = now + MLEARN_FLAP_HOLD_MSEC;
+        mlearn_fdb_moves_suppressed++;
+        return true;
+    }
+
+    if (now - entry->flap_start >= MLEARN_FLAP_WINDOW_MSEC) {
+        entry->flap_start = now;
+        entry->flap_moves = 0;
+    }
+    if (++entry->flap_moves < MLEARN_FLAP_MOVES) {
+        return false;
+    }
+
+    entry->suppressed_until = now + MLEARN_FLAP_HOLD_MSEC;
+    list_push_back(&mlearn_fdb_flapping, &entry->flap_node);
+    mlearn_fdb_flaps++;
+    mlearn_fdb_moves_suppressed++;
+    VLOG_WARN_RL(&mac_flap_rl, "MAC "ETH_ADDR_FMT" vlan %u is flapping between "
+                 "%s and %s, %u moves in %lld ms, suppressing moves",
+                 ETH_ADDR_ARGS(entry->mac), entry->vlan, from->name, to->name,
+                 entry->flap_moves, now - entry->flap_start);
+
+    return true;
+}
+
+/*
+ * Function: sai_mac_learning_fdb_update
+ *
+ * This function applies one learn or age event to the shadow FDB. A MAC
+ * learnt again on another port moves to it.
+ *
+ * Returns the port index to report the event on, MLEARN_PORT_NONE if the
+ * MAC is flapping and the event is suppressed.
+ */
+static uint32_t
+sai_mac_learning_fdb_update(const struct mlearn_event *event,
+                            struct mlearn_port *port, long long int now)
+{
+    struct mlearn_fdb_entry *entry = NULL;
+    struct mlearn_port *from = NULL;
+    struct eth_addr mac;
+    uint32_t reported = 0;
+
+    if (event->vlan >= MLEARN_FDB_VLANS) {
+        mlearn_fdb_lost++;
+        return port->index;
+    }
+
+    memcpy(mac.ea, event->mac, sizeof(mac.ea));
+    entry = sai_mac_learning_fdb_find(mac, event->vlan);
+
+    if (event->oper == MLEARN_DEL) {
+        /* Hardware holds a MAC once per VLAN, whichever port it ages on.
+         * A flapping one is reported where the plugin has it. */
+        if (!entry) {
+            return port->index;
+        }
+        reported = entry->suppressed_until ? entry->reported : port->index;
+        sai_mac_learning_fdb_remove(entry);
+        return reported;
+    }
+
+    if (!entry) {
+        entry = xzalloc(sizeof *entry);
+        entry->mac = mac;
+        entry->vlan = event->vlan;
+        entry->port = port->index;
+        entry->reported = port->index;
+        hmap_insert(&mlearn_fdb, &entry->node,
+                    sai_mac_learning_table_hash_calc(mac, event->vlan, 0));
+        list_push_back(&mlearn_fdb_vlans[event->vlan].entries,
+                       &entry->vlan_node);
+        mlearn_fdb_vlans[event->vlan].n++;
+        list_push_back(&port->fdb, &entry->port_node);
+        port->n_fdb++;
+        return port->index;
+    }
+
+    if (entry->port != port->index) {
+        from = mlearn_port_table[entry->port];
+        VLOG_DBG("%s: MAC "ETH_ADDR_FMT" vlan %u moved from %s to %s",
+                 __FUNCTION__, ETH_ADDR_ARGS(mac), event->vlan, from->name,
+                 port->name);
+        list_remove(&entry->port_node);
+        from->n_fdb--;
+        entry->port = port->index;
+        list_push_back(&port->fdb, &entry->port_node);
+        port->n_fdb++;
+
+        if (sai_mac_learning_fdb_flap_check(entry, from, port, now)) {
+            return MLEARN_PORT_NONE;
+        }
+    } else if (entry->suppressed_until) {
+        return MLEARN_PORT_NONE;
+    }
+
+    entry->reported = port->index;
+    return port->index;
+}
+
+/*
+ * Function: sai_mac_learning_flush_covers
+ *
+ * This function tells if an event queued at ring position pos refers to an
+ * entry removed by a flush done after it was queued.
+ */
+static bool
+sai_mac_learning_flush_covers(uint32_t pos, uint32_t port, uint16_t vlan)
+{
+    const struct mlearn_flush *flush = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < mlearn_n_flushes; i++) {
+        flush = &mlearn_flushes[i];
+        if ((int32_t) (pos - flush->pos) >= 0) {
+            continue;
+        }
+
+        switch (flush->options) {
+        case L2MAC_FLUSH_ALL:
+            return true;
+        case L2MAC_FLUSH_BY_VLAN:
+            if (flush->vlan == vlan) {
+                return true;
+            }
+            break;
+        case L2MAC_FLUSH_BY_PORT:
+        case L2MAC_FLUSH_BY_TRUNK:
+            if (flush->port == port) {
+                return true;
+            }
+            break;
+        case L2MAC_FLUSH_BY_PORT_VLAN:
+        case L2MAC_FLUSH_BY_TRUNK_VLAN:
+            if (flush->port == port && flush->vlan == vlan) {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Function: sai_mac_learning_flushes_expire
+ *
+ * This function forgets flushes all events queued before have been drained.
+ */
+static void
+sai_mac_learning_flushes_expire(void)
+{
+    uint32_t tail = 0;
+    size_t i = 0;
+
+    atomic_read_explicit(&mlearn_ring_tail, &tail, memory_order_relaxed);
+    while (i < mlearn_n_flushes &&
+           (int32_t) (tail - mlearn_flushes[i].pos) >= 0) {
+        i++;
+    }
+    if (i) {
+        mlearn_n_flushes -= i;
+        memmove(mlearn_flushes, &mlearn_flushes[i],
+                mlearn_n_flushes * sizeof *mlearn_flushes);
+    }
+}
+
+/*
+ * Function: sai_mac_learning_fdb_flush
+ *
+ * This function removes the entries a hardware flush covers from the shadow
+ * FDB, and remembers the flush for the learn events still queued.
+ *
+ * Returns the count of entries removed.
+ */
+static uint32_t
+sai_mac_learning_fdb_flush(int options, handle_t id, int vlan)
+{
+    struct mlearn_fdb_entry *entry = NULL;
+    struct mlearn_fdb_entry *next  = NULL;
+    struct mlearn_port      *port  = NULL;
+    struct mlearn_flush     *flush = NULL;
+    uint32_t                n      = 0;
+    uint64_t                drops  = 0;
+
+    if (mlearn_n_flushes == mlearn_flushes_allocated) {
+        mlearn_flushes = x2nrealloc(mlearn_flushes, &mlearn_flushes_allocated,
+                                    sizeof *mlearn_flushes);
+    }
+    flush = &mlearn_flushes[mlearn_n_flushes++];
+    atomic_read(&mlearn_ring_head, &flush->pos);
+    flush->options = options;
+    flush->port = MLEARN_PORT_NONE;
+    flush->vlan = vlan;
+
+    switch (options) {
+    case L2MAC_FLUSH_BY_PORT:
+    case L2MAC_FLUSH_BY_TRUNK:
+    case L2MAC_FLUSH_BY_PORT_VLAN:
+    case L2MAC_FLUSH_BY_TRUNK_VLAN:
+        port = sai_mac_learning_port_find(id);
+        if (!port) {
+            break;
+        }
+        flush->port = port->index;
+        LIST_FOR_EACH_SAFE (entry, next, port_node, &port->fdb) {
+            if ((options == L2MAC_FLUSH_BY_PORT_VLAN ||
+                 options == L2MAC_FLUSH_BY_TRUNK_VLAN) &&
+                entry->vlan != vlan) {
+                continue;
+            }
+            sai_mac_learning_fdb_remove(entry);
+            n++;
+        }
+        break;
+
+    case L2MAC_FLUSH_BY_VLAN:
+        if (vlan < 0 || vlan >= MLEARN_FDB_VLANS) {
+            break;
+        }
+        LIST_FOR_EACH_SAFE (entry, next, vlan_node,
+                            &mlearn_fdb_vlans[vlan].entries) {
+            sai_mac_learning_fdb_remove(entry);
+            n++;
+        }
+        break;
+
+    case L2MAC_FLUSH_ALL:
+        HMAP_FOR_EACH_SAFE (entry, next, node, &mlearn_fdb) {
+            sai_mac_learning_fdb_remove(entry);
+            n++;
+        }
+        atomic_read_relaxed(&mlearn_ring_drops, &drops);
+        mlearn_fdb_drops_seen = drops;
+        mlearn_fdb_lost = 0;
+        break;
+
+    default:
+        break;
+    }
+
+    return n;
+}
+
+/*
+ * Function: sai_mac_learning_fdb_is_exact
+ *
+ * This function tells if the shadow FDB holds every entry learnt in hardware.
+ */
+static bool
+sai_mac_learning_fdb_is_exact(void)
+{
+    uint64_t drops = 0;
+
+    atomic_read_relaxed(&mlearn_ring_drops, &drops);
+
+    return drops == mlearn_fdb_drops_seen && !mlearn_fdb_lost;
+}
+
+/*
+ * Function: sai_mac_learning_port_add
+ *
+ * This function registers a port or LAG, so that MACs learnt on it can be
+ * reported. Registering a known port again renames it.
+ */
+void
+sai_mac_learning_port_add(handle_t port_id, const char *name)
+{
+    struct mlearn_port *port = sai_mac_learning_port_find(port_id);
+    size_t index = 0;
+
+    if (!port) {
+        for (index = 0; index < mlearn_n_ports; index++) {
+            if (!mlearn_port_table[index]) {
+                break;
+            }
+        }
+        if (index == mlearn_n_ports) {
+            if (mlearn_n_ports == mlearn_port_allocated) {
+                mlearn_port_table = x2nrealloc(mlearn_port_table,
+                                               &mlearn_port_allocated,
+                                               sizeof *mlearn_port_table);
+            }
+            mlearn_n_ports++;
+        }
+
+        port = xzalloc(sizeof *port);
+        port->port_id = port_id;
+        port->index = index;
+        list_init(&port->fdb);
+        mlearn_port_table[index] = port;
+        hmap_insert(&mlearn_ports, &port->node, hash_uint64(port_id.data));
+    }
+
+    strncpy(port->name, name, PORT_NAME_SIZE - 1);
+    VLOG_DBG("%s: port %s, port_id: %"PRIx64", index: %u", __FUNCTION__,
+             port->name, port_id.data, port->index);
+}
+
+/*
+ * Function: sai_mac_learning_port_del
+ *
+ * This function unregisters a port or LAG, if it is registered by the name.
+ * Hardware drops the entries learnt on it along with it.
+ */
+void
+sai_mac_learning_port_del(handle_t port_id, const char *name)
+{
+    struct mlearn_port *port = sai_mac_learning_port_find(port_id);
+    struct mlearn_fdb_entry *entry = NULL;
+    struct mlearn_fdb_entry *next = NULL;
+
+    if (!port || strcmp(port->name, name)) {
+        return;
+    }
+
+    LIST_FOR_EACH_SAFE (entry, next, port_node, &port->fdb) {
+        sai_mac_learning_fdb_remove(entry);
+    }
+    /* The plugin is told where flapping MACs are when they settle */
+    LIST_FOR_EACH (entry, flap_node, &mlearn_fdb_flapping) {
+        if (entry->reported == port->index) {
+            entry->reported = entry->port;
+        }
     }
 
-    return ;
+    hmap_remove(&mlearn_ports, &port->node);
+    mlearn_port_table[port->index] = NULL;
+    free(port);
 }
 
 /*
@@ -132,46 +662,30 @@ sai_mac_learning_get_port_name_from_id(handle_t port_id, char* port_name)
  * If the entry is already present, it is modified or else it's created.
  */
 static void
-sai_mac_learning_entry_add(	struct mlearn_hmap 	*hmap_entry,
+sai_mac_learning_entry_add(	struct mlearn_buffer 	*buf,
 							const uint8_t 		mac[ETH_ADDR_LEN],
 							const int16_t 		vlan,
-							sai_attribute_t 	*attr,
-							uint32_t 			attr_count,
+							uint32_t 			port,
 							const mac_event 	event)
 {
+    struct mlearn_hmap      *hmap_entry    = &buf->hmap;
     struct mlearn_hmap_node *entry         = NULL;
+    uint32_t                *entry_port    = NULL;
     struct eth_addr 		mac_eth;
     uint32_t 				hash 		= 0;
     int 					actual_size = 0;
-    char 					port_name[PORT_NAME_SIZE] = "";
     bool 					found 		= false;
-    handle_t 		        port_id     = {0};
-    int32_t 				attr_idx 	= 0;
 
     memcpy(mac_eth.ea, mac, sizeof(mac_eth.ea));
     hash = sai_mac_learning_table_hash_calc(mac_eth, vlan, 0);
     actual_size = (hmap_entry->buffer).actual_size;
-    memset((void*)port_name, 0, sizeof(port_name));
-
-    for(attr_idx = 0; attr_idx < attr_count; attr_idx++) {
-        if(attr[attr_idx].id == SAI_FDB_ENTRY_ATTR_PORT_ID) {
-            port_id.data = attr[attr_idx].value.oid;
-        }
-    }
-
-	/* get port_name from sai_object_id_t, eg "lag1", "1" */
-	sai_mac_learning_get_port_name_from_id(port_id, port_name);
-
-    if (!strlen(port_name)) {
-        VLOG_ERR("%s: not able to find port name for port_id: %lx ", __FUNCTION__, port_id.data);
-        return;
-    }
 
     HMAP_FOR_EACH_WITH_HASH (entry, hmap_node, hash,
                                  &(hmap_entry->table)) {
+        entry_port = &buf->ports[entry - hmap_entry->buffer.nodes];
         if ((entry->vlan == vlan) && eth_addr_equals(entry->mac, mac_eth)) {
             if ((event == MLEARN_ADD) && (entry->oper == MLEARN_DEL)) {
-                if (0 == strcmp(port_name,entry->port_name) /* port_id == entry->port */) {
+                if (port == *entry_port) {
                     /*
                      * remove this entry from hmap
                      */
@@ -185,7 +699,7 @@ sai_mac_learning_entry_add(	struct mlearn_hmap 	*hmap_entry,
                 /*
                  * remove this entry from hmap
                  */
-                if (0 == strcmp(port_name,entry->port_name) /* port_id == entry->port */) {
+                if (port == *entry_port) {
                     /*
                      * remove this entry from hmap
                      */
@@ -201,7 +715,7 @@ sai_mac_learning_entry_add(	struct mlearn_hmap 	*hmap_entry,
                 /*
                  * update this entry from hmap
                  */
-                if (0 == strcmp(port_name,entry->port_name) /* port_id == entry->port */) {
+                if (port == *entry_port) {
                     /*
                      * update this entry from hmap
                      */
@@ -214,9 +728,9 @@ sai_mac_learning_entry_add(	struct mlearn_hmap 	*hmap_entry,
                 /*
                  * update this entry from hmap
                  */
-                VLOG_DBG("%s: update event, entry found update port %s -> %s", __FUNCTION__, entry->port_name, port_name);
+                VLOG_DBG("%s: update event, entry found update port %u -> %u", __FUNCTION__, *entry_port, port);
 
-                strncpy(entry->port_name, port_name, PORT_NAME_SIZE);
+                *entry_port = port;
 
                 found = true;
             }
@@ -227,15 +741,15 @@ sai_mac_learning_entry_add(	struct mlearn_hmap 	*hmap_entry,
         if (actual_size < (hmap_entry->buffer).size) {
             struct mlearn_hmap_node *mlearn_node =
                                     &((hmap_entry->buffer).nodes[actual_size]);
-            VLOG_DBG("%s: add new mac event, port: %lx, oper: %d, vlan: %d, MAC: %s",
-                     __FUNCTION__, port_id.data, event, vlan,
+            VLOG_DBG("%s: add new mac event, port: %u, oper: %d, vlan: %d, MAC: %s",
+                     __FUNCTION__, port, event, vlan,
                      ether_ntoa((struct ether_addr *)mac));
 
             memcpy(&mlearn_node->mac, &mac_eth, sizeof(mac_eth));
             mlearn_node->vlan 		= vlan;
             mlearn_node->hw_unit 	= 0;
             mlearn_node->oper 		= event;
-            strncpy(mlearn_node->port_name, port_name, PORT_NAME_SIZE);
+            buf->ports[actual_size] = port;
             hmap_insert(&hmap_entry->table,
                         &(mlearn_node->hmap_node),
                         hash);
@@ -263,151 +777,378 @@ sai_mac_learning_clear_hmap (struct mlearn_hmap *mhmap)
 }
 
 /*
- * Function: sai_mac_learning_run
+ * Function: sai_mac_learning_ring_push
  *
- * This function will be invoked when either of the two conditions
- * are satisfied:
- * 1. current in use hmap for storing all macs learnt is full
- * 2. timer thread times out
+ * This function queues one learn or age event. It is invoked from the SAI
+ * notification thread and never blocks.
  *
- * This function will check if there is any new MACs learnt, if yes,
- * then it triggers callback from bridge.
- * Also it changes the current hmap in use.
+ * Returns false if the ring is full and the event was dropped.
+ */
+static bool
+sai_mac_learning_ring_push(const sai_fdb_event_notification_data_t *data,
+                           mac_event event, uint32_t now)
+{
+    struct mlearn_event *slot = NULL;
+    uint32_t pos  = 0;
+    uint32_t seq  = 0;
+    uint32_t idx  = 0;
+    int32_t diff  = 0;
+
+    atomic_read_explicit(&mlearn_ring_head, &pos, memory_order_relaxed);
+    for (;;) {
+        slot = &mlearn_ring[pos & MLEARN_RING_MASK];
+        atomic_read_explicit(&slot->seq, &seq, memory_order_acquire);
+        diff = (int32_t) (seq - pos);
+        if (!diff) {
+            /* Slot is free, claim it. On failure pos is reloaded. */
+            if (atomic_compare_exchange_weak_explicit(&mlearn_ring_head, &pos,
+                                                      pos + 1,
+                                                      memory_order_seq_cst,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            atomic_read_explicit(&mlearn_ring_head, &pos,
+                                 memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->mac, data->fdb_entry.mac_address, sizeof(slot->mac));
+    slot->time = now;
+    slot->vlan = data->fdb_entry.vlan_id;
+    slot->oper = event;
+    slot->port = SAI_NULL_OBJECT_ID;
+    for (idx = 0; idx < data->attr_count; idx++) {
+        if (data->attr[idx].id == SAI_FDB_ENTRY_ATTR_PORT_ID) {
+            slot->port = data->attr[idx].value.oid;
+        }
+    }
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+/*
+ * Function: sai_mac_learning_notify
  *
- * current_hmap_in_use = current_hmap_in_use ^ 1 is used to toggle
- * the current hmap in use as the buffers are 2.
+ * This function wakes up the notifier thread if it waits for the first
+ * event of a batch. Later events of the batch don't touch mlearn_seq.
  */
-static int
-sai_mac_learning_run (void)
+static void
+sai_mac_learning_notify(void)
+{
+    bool armed = false;
+
+    /* Pairs with the notifier arming itself before it reads the ring head */
+    atomic_read(&mlearn_notify_armed, &armed);
+    if (armed && atomic_compare_exchange_strong(&mlearn_notify_armed, &armed,
+                                                false)) {
+        seq_change(mlearn_seq);
+    }
+}
+
+/*
+ * Function: sai_mac_learning_ring_pop
+ *
+ * This function dequeues the oldest published event and its ring position.
+ * It is invoked from the switchd main thread only.
+ *
+ * Returns false if the ring is empty.
+ */
+static bool
+sai_mac_learning_ring_pop(struct mlearn_event *event, uint32_t *posp)
+{
+    struct mlearn_event *slot = NULL;
+    uint32_t pos = 0;
+    uint32_t seq = 0;
+
+    atomic_read_explicit(&mlearn_ring_tail, &pos, memory_order_relaxed);
+    *posp = pos;
+    slot = &mlearn_ring[pos & MLEARN_RING_MASK];
+    atomic_read_explicit(&slot->seq, &seq, memory_order_acquire);
+    if ((int32_t) (seq - (pos + 1)) < 0) {
+        return false;
+    }
+
+    event->time = slot->time;
+    event->vlan = slot->vlan;
+    memcpy(event->mac, slot->mac, sizeof(event->mac));
+    event->oper = slot->oper;
+    event->port = slot->port;
+
+    /* Hand the slot back to producers for the next lap */
+    atomic_store_explicit(&slot->seq, pos + MLEARN_RING_SIZE,
+                          memory_order_release);
+    atomic_store_explicit(&mlearn_ring_tail, pos + 1, memory_order_release);
+
+    return true;
+}
+
+/*
+ * Function: sai_mac_learning_ring_pending
+ *
+ * This function returns the count of events queued and not drained yet.
+ */
+static uint32_t
+sai_mac_learning_ring_pending(void)
+{
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    atomic_read_explicit(&mlearn_ring_tail, &tail, memory_order_acquire);
+    atomic_read_explicit(&mlearn_ring_head, &head, memory_order_acquire);
+
+    return head - tail;
+}
+
+/*
+ * Function: sai_mac_learning_trigger
+ *
+ * This function triggers callback from bridge, which then collects learnt
+ * MACs with sai_mac_learning_get_hmap().
+ */
+static void
+sai_mac_learning_trigger(void)
 {
     struct mac_learning_plugin_interface *p_mlearn_interface = NULL;
+
     p_mlearn_interface = get_plugin_mac_learning_interface();
     if (p_mlearn_interface) {
-        ovs_mutex_lock(&mlearn_mutex);
-        if (hmap_count(&(all_macs_learnt[current_hmap_in_use].table))) {
-            p_mlearn_interface->mac_learning_trigger_callback();
-
-	     /* check macs tables is full */
-	     if(!MACS_TABLES_IS_FULL) {
-                current_hmap_in_use = MACS_TABLES_GET_NEXT_INDEX(current_hmap_in_use) ;
-                sai_mac_learning_clear_hmap(&all_macs_learnt[current_hmap_in_use]);
-	         VLOG_DBG("%s: current hmap_in_use: %d", __FUNCTION__, current_hmap_in_use);
-	     }else{
-		  VLOG_DBG("%s: current hmap_in_use is full: %d", __FUNCTION__, current_hmap_in_use);
-	     }
-        }
-        ovs_mutex_unlock(&mlearn_mutex);
+        p_mlearn_interface->mac_learning_trigger_callback();
     } else {
         VLOG_ERR("%s: Unable to find mac learning plugin interface",
                  __FUNCTION__);
     }
+}
+
+/*
+ * Function: sai_mac_learning_run
+ *
+ * This function will be invoked when either of the two conditions
+ * are satisfied:
+ * 1. batching window of the notifier thread is over
+ * 2. events are left after the plugin collected a buffer worth of them
+ *
+ * If there are events queued, it triggers the plugin.
+ */
+static int
+sai_mac_learning_run (void)
+{
+    if (sai_mac_learning_ring_pending()) {
+        sai_mac_learning_trigger();
+    }
 
     return (0);
 }
 
 /*
  * This function is for getting callback from ASIC
- * for MAC learning.
+ * for MAC learning. It only queues the events.
  */
 static void
 sai_mac_learning_fdb_event_cb(  uint32_t count,
 								         sai_fdb_event_notification_data_t *data)
 {
     uint32_t    fdb_index = 0;
+    uint32_t    now       = 0;
+    uint64_t    drops     = 0;
+    mac_event   event     = MLEARN_UNDEFINED;
 
     if(count <= 0 || NULL == data){
         return;
     }
 
+    now = time_usec();
+
     for(fdb_index = 0; fdb_index < count; fdb_index++)
     {
         switch(data[fdb_index].event_type)
         {
             case SAI_FDB_EVENT_LEARNED:
-                ovs_mutex_lock(&mlearn_mutex);
-	         VLOG_DBG("%s: current hmap_in_use: %d", __FUNCTION__, current_hmap_in_use);
-                sai_mac_learning_entry_add(&all_macs_learnt[current_hmap_in_use],
-                              data[fdb_index].fdb_entry.mac_address,
-                              data[fdb_index].fdb_entry.vlan_id,
-                              data[fdb_index].attr,
-                              data[fdb_index].attr_count,
-                              MLEARN_ADD);
-                ovs_mutex_unlock(&mlearn_mutex);
+                event = MLEARN_ADD;
                 break;
 
             case SAI_FDB_EVENT_AGED:
-                ovs_mutex_lock(&mlearn_mutex);
-		  VLOG_DBG("%s: current hmap_in_use: %d", __FUNCTION__, current_hmap_in_use);
-                sai_mac_learning_entry_add(&all_macs_learnt[current_hmap_in_use],
-                              data[fdb_index].fdb_entry.mac_address,
-                              data[fdb_index].fdb_entry.vlan_id,
-                              data[fdb_index].attr,
-                              data[fdb_index].attr_count,
-                              MLEARN_DEL);
-                ovs_mutex_unlock(&mlearn_mutex);
+                event = MLEARN_DEL;
                 break;
 
             case SAI_FDB_EVENT_FLUSHED:
             default:
-                break;
+                continue;
         }
 
-        /*
-         * notify vswitchd
-         */
-        if (sai_mac_learning_table_is_full(&all_macs_learnt[current_hmap_in_use])) {
-            sai_mac_learning_run();
+        if (!sai_mac_learning_ring_push(&data[fdb_index], event, now)) {
+            atomic_add_relaxed(&mlearn_ring_drops, 1, &drops);
+            VLOG_WARN_RL(&mac_learning_rl, "%s: learn ring full, %"PRIu64
+                         " events dropped", __FUNCTION__, drops + 1);
+            continue;
         }
+
+        sai_mac_learning_notify();
     }
 }
 
-
+/*
+ * Function: sai_mac_learning_notify_main
+ *
+ * Notifier thread. Sleeps until an event is queued, waits for the batching
+ * window to pass and triggers the plugin. Events left after the plugin
+ * collected a buffer worth of them are handled by the plugin call itself.
+ */
 static void *
-sai_mac_learning_timer_main (void * args OVS_UNUSED)
+sai_mac_learning_notify_main (void * args OVS_UNUSED)
 {
-    struct mac_learning_plugin_interface *p_mlearn_interface = NULL;
-    int delay_time = 0;
+    long long int   deadline    = 0;    /* end of batching window, if open */
+    uint32_t        notified    = 0;    /* ring head at the last trigger */
+    uint32_t        head        = 0;
+    long long int   flap        = 0;    /* end of a MAC suppression */
+    uint32_t        batch       = 0;
+    unsigned int    msec        = 0;
+    uint64_t        seqno       = 0;
 
     while (true) {
-        xsleep(next_sleep_timer_in_sec); 		/* in seconds */
-//        sai_mac_learning_run();
+        seqno = seq_read(mlearn_seq);
+
+        atomic_read(&mlearn_flap_deadline, &flap);
+        if (flap && time_msec() >= flap) {
+            /* Unless the main thread moved it meanwhile */
+            if (atomic_compare_exchange_strong(&mlearn_flap_deadline, &flap,
+                                               0)) {
+                sai_mac_learning_trigger();
+            }
+            continue;
+        }
 
-        p_mlearn_interface = get_plugin_mac_learning_interface();
-        if(!p_mlearn_interface)
-			continue;
+        atomic_read(&mlearn_ring_head, &head);
+        if (head == notified) {
+            /* Batch triggered, from now on the next event queued changes
+             * mlearn_seq. Events queued meanwhile found it disarmed. */
+            atomic_store(&mlearn_notify_armed, true);
+            atomic_read(&mlearn_ring_head, &head);
+        }
+
+        batch = head - notified;
+        if (batch && !deadline) {
+            atomic_read_relaxed(&mlearn_batch_msec, &msec);
+            deadline = time_msec() + msec;
+        }
+
+        if (batch && time_msec() >= deadline) {
+            sai_mac_learning_run();
+            notified = head;
+            deadline = 0;
+
+            msec = batch >= MLEARN_BATCH_LARGE
+                   ? MIN(msec * 2, MLEARN_BATCH_MAX_MSEC)
+                   : MAX(msec / 2, MLEARN_BATCH_MIN_MSEC);
+            atomic_store_relaxed(&mlearn_batch_msec, msec);
+            VLOG_DBG("%s: %u events, next window %u ms", __FUNCTION__, batch,
+                     msec);
+            continue;
+        }
+
+        if (deadline) {
+            poll_timer_wait_until(deadline);
+        }
+        if (flap) {
+            poll_timer_wait_until(flap);
+        }
+        seq_wait(mlearn_seq, seqno);
+        poll_block();
+    }
+
+    return (NULL);
+}
 
-        if(MACS_TABLES_IS_EMPTY){
-		VLOG_DBG("%s: empty macs tables", __FUNCTION__);
+/*
+ * Function: sai_mac_learning_latency_record
+ *
+ * This function accounts the time an event spent queued.
+ */
+static void
+sai_mac_learning_latency_record(uint32_t usec)
+{
+    uint32_t msec = usec / 1000;
+    int bucket = 0;
 
-		/* if fdb is empty, then check current macs table is empty? */
-		sai_mac_learning_run();
+    if (msec) {
+        bucket = MIN(log_2_floor(msec) + 1, MLEARN_LATENCY_BUCKETS - 1);
+    }
 
-		delay_time = 0;
-        }else{
-		p_mlearn_interface->mac_learning_trigger_callback();
+    mlearn_latency.buckets[bucket]++;
+    mlearn_latency.events++;
+    mlearn_latency.max_usec = MAX(mlearn_latency.max_usec, usec);
+}
 
-		/* calc next sleep timer count */
-		 if(current_hmap_in_use > cur_read_hmap_in_use){
-			delay_time = current_hmap_in_use - cur_read_hmap_in_use;
-		 }else{
-			delay_time = current_hmap_in_use + MAX_BUFFERS - cur_read_hmap_in_use;
-		 }
+/*
+ * Function: sai_mac_learning_names_fill
+ *
+ * This function fills in port names of a complete buffer.
+ */
+static void
+sai_mac_learning_names_fill(struct mlearn_buffer *buf)
+{
+    struct mlearn_hmap_node *node = NULL;
+    int i = 0;
+
+    for (i = 0; i < buf->hmap.buffer.actual_size; i++) {
+        node = &buf->hmap.buffer.nodes[i];
+        if (node->oper == MLEARN_UNDEFINED) {
+            continue;
         }
+        strncpy(node->port_name, mlearn_port_table[buf->ports[i]]->name,
+                PORT_NAME_SIZE);
+    }
+}
 
-	 if(delay_time >= 10){
-		next_sleep_timer_in_sec = 5;
-	 }else if(delay_time < 10 && delay_time >= 7){
-		next_sleep_timer_in_sec = 10;
-	 }else if(delay_time < 7  &&  delay_time >= 3){
-		next_sleep_timer_in_sec = 15;
-	 }else{
-		next_sleep_timer_in_sec = 20;
-	 }
+/*
+ * Function: sai_mac_learning_fdb_flap_expire
+ *
+ * This function ends suppression of MACs which stopped flapping, reporting
+ * them on the port they stayed on, as far as the buffer has room.
+ */
+static void
+sai_mac_learning_fdb_flap_expire(struct mlearn_buffer *buf, long long int now)
+{
+    struct mlearn_fdb_entry *entry = NULL;
+    struct mlearn_fdb_entry *next = NULL;
+    long long int deadline = 0;
+    long long int old = 0;
+
+    LIST_FOR_EACH_SAFE (entry, next, flap_node, &mlearn_fdb_flapping) {
+        if (now < entry->suppressed_until) {
+            deadline = deadline ? MIN(deadline, entry->suppressed_until)
+                                : entry->suppressed_until;
+            continue;
+        }
+        if (sai_mac_learning_table_is_full(&buf->hmap)) {
+            deadline = now;
+            break;
+        }
 
-	 VLOG_DBG("%s: next sleep timer : %d", __FUNCTION__, next_sleep_timer_in_sec);
+        list_remove(&entry->flap_node);
+        entry->suppressed_until = 0;
+        entry->flap_start = now;
+        entry->flap_moves = 0;
+        if (entry->reported != entry->port) {
+            sai_mac_learning_entry_add(buf, entry->mac.ea, entry->vlan,
+                                       entry->port, MLEARN_ADD);
+            entry->reported = entry->port;
+        }
+        VLOG_INFO_RL(&mac_flap_rl, "MAC "ETH_ADDR_FMT" vlan %u stopped "
+                     "flapping, on %s", ETH_ADDR_ARGS(entry->mac), entry->vlan,
+                     mlearn_port_table[entry->port]->name);
     }
 
-    return (NULL);
+    atomic_read(&mlearn_flap_deadline, &old);
+    if (deadline != old) {
+        atomic_store(&mlearn_flap_deadline, deadline);
+        if (deadline && (!old || deadline < old)) {
+            seq_change(mlearn_seq);
+        }
+    }
 }
 
 /*
@@ -416,35 +1157,256 @@ sai_mac_learning_timer_main (void * args OVS_UNUSED)
  * This function will be invoked by the mac learning plugin code,
  * so that the switchd main thread can get the new MACs learnt/deleted
  * and can update the MAC table in the OVSDB accordingly.
+ *
+ * It drains queued events into the buffer not handed out last time,
+ * coalescing events of the same MAC, until the buffer is full. If events
+ * are left, the plugin is triggered again.
  */
 int sai_mac_learning_get_hmap(struct mlearn_hmap **mhmap)
 {
+    struct mlearn_buffer *buf       = NULL;
+    struct mlearn_hmap  *hmap_entry = NULL;
+    struct mlearn_port  *port       = NULL;
+    struct mlearn_event event;
+    handle_t            port_id     = HANDLE_INITIALIZAER;
+    uint32_t            port_index  = MLEARN_PORT_NONE;
+    uint32_t            reported    = MLEARN_PORT_NONE;
+    uint32_t            pos         = 0;
+    uint32_t            now         = 0;
+    long long int       now_msec    = 0;
+
     if (!mhmap) {
         VLOG_ERR("%s: Invalid argument", __FUNCTION__);
         return (EINVAL);
     }
 
-    ovs_mutex_lock(&mlearn_mutex);
+    cur_hmap_in_use ^= 1;
+    buf = &all_macs_learnt[cur_hmap_in_use];
+    hmap_entry = &buf->hmap;
+    sai_mac_learning_clear_hmap(hmap_entry);
+
+    now = time_usec();
+    now_msec = time_msec();
+    mlearn_latency.batches++;
+    while (!sai_mac_learning_table_is_full(hmap_entry) &&
+           sai_mac_learning_ring_pop(&event, &pos)) {
+        sai_mac_learning_latency_record(now - event.time);
+
+        /* Bursts mostly come from one port */
+        if (event.port != port_id.data || !port) {
+            port_id.data = event.port;
+            port = sai_mac_learning_port_find(port_id);
+            port_index = port ? port->index : MLEARN_PORT_NONE;
+        }
+        if (MLEARN_PORT_NONE == port_index) {
+            VLOG_ERR_RL(&mac_learning_rl, "%s: not able to find port name for "
+                        "port_id: %"PRIx64, __FUNCTION__, port_id.data);
+            mlearn_fdb_lost++;
+            continue;
+        }
+
+        /* Learnt before a flush, gone from hardware */
+        if (event.oper == MLEARN_ADD && mlearn_n_flushes &&
+            sai_mac_learning_flush_covers(pos, port_index, event.vlan)) {
+            mlearn_fdb_stale++;
+            continue;
+        }
+
+        reported = sai_mac_learning_fdb_update(&event, port, now_msec);
+        if (MLEARN_PORT_NONE == reported) {
+            continue;
+        }
+
+        sai_mac_learning_entry_add(buf, event.mac, event.vlan, reported,
+                                   event.oper);
+    }
+
+    sai_mac_learning_flushes_expire();
+    sai_mac_learning_fdb_flap_expire(buf, now_msec);
+
+    sai_mac_learning_names_fill(buf);
+
+    VLOG_DBG("%s: %"PRIuSIZE" entries, %u events left", __FUNCTION__,
+             hmap_count(&hmap_entry->table), sai_mac_learning_ring_pending());
+
+    *mhmap = hmap_count(&hmap_entry->table) ? hmap_entry : NULL;
+
+    sai_mac_learning_run();
+
+    return (0);
+}
 
-    /* if macs table is empty, then return */
-    if(MACS_TABLES_IS_EMPTY){
-	 VLOG_DBG("%s: empt, current read hmap_in_use == current hmap_in_use: %d", __FUNCTION__, cur_read_hmap_in_use);
-	 ovs_mutex_unlock(&mlearn_mutex);
-        return (0);
+static void
+sai_mac_learning_dump(struct ds *ds)
+{
+    unsigned int msec = 0;
+    uint64_t drops = 0;
+    char range[32];
+    int i = 0;
+
+    atomic_read_relaxed(&mlearn_batch_msec, &msec);
+    atomic_read_relaxed(&mlearn_ring_drops, &drops);
+
+    ds_put_format(ds, "batching window: %u ms\n", msec);
+    ds_put_format(ds, "events queued: %u, dropped: %"PRIu64"\n",
+                  sai_mac_learning_ring_pending(), drops);
+    ds_put_format(ds, "events drained: %"PRIu64" in %"PRIu64" batches\n",
+                  mlearn_latency.events, mlearn_latency.batches);
+    ds_put_format(ds, "max queued to drained latency: %u us\n",
+                  mlearn_latency.max_usec);
+
+    ds_put_format(ds, "%-16s %12s\n", "drain latency", "events");
+    for (i = 0; i < MLEARN_LATENCY_BUCKETS; i++) {
+        if (!i) {
+            snprintf(range, sizeof(range), "< 1 ms");
+        } else if (i < MLEARN_LATENCY_BUCKETS - 1) {
+            snprintf(range, sizeof(range), "%u - %u ms", 1u << (i - 1),
+                     1u << i);
+        } else {
+            snprintf(range, sizeof(range), ">= %u ms", 1u << (i - 1));
+        }
+        ds_put_format(ds, "%-16s %12"PRIu64"\n", range,
+                      mlearn_latency.buckets[i]);
     }
-    VLOG_DBG("%s: current read hmap_in_use: %d", __FUNCTION__, cur_read_hmap_in_use);
-    if (hmap_count(&(all_macs_learnt[cur_read_hmap_in_use].table))) {
-        *mhmap = &all_macs_learnt[cur_read_hmap_in_use];
+}
+
+static void
+sai_mac_learning_unixctl_show(struct unixctl_conn *conn, int argc,
+                              const char *argv[], void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "clear")) {
+            unixctl_command_reply_error(conn, "expected clear");
+            return;
+        }
+        memset(&mlearn_latency, 0, sizeof(mlearn_latency));
+    }
+
+    sai_mac_learning_dump(&ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+sai_mac_learning_fdb_entry_dump(struct ds *ds,
+                                const struct mlearn_fdb_entry *entry)
+{
+    ds_put_format(ds, "%-6u "ETH_ADDR_FMT"  %s\n", entry->vlan,
+                  ETH_ADDR_ARGS(entry->mac),
+                  mlearn_port_table[entry->port]->name);
+}
+
+static void
+sai_mac_learning_fdb_unixctl_show(struct unixctl_conn *conn, int argc,
+                                  const char *argv[], void *aux OVS_UNUSED)
+{
+    const struct mlearn_fdb_entry *entry = NULL;
+    const struct mlearn_port *port = NULL;
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    int vlan = 0;
+    size_t i = 0;
+
+    if (argc == 2 || (argc == 3 && strcmp(argv[1], "port") &&
+                      strcmp(argv[1], "vlan"))) {
+        unixctl_command_reply_error(conn, "expected port NAME or vlan VID");
+        return;
+    }
+
+    ds_put_format(&ds, "%-6s %-17s  %s\n", "VLAN", "MAC", "PORT");
+
+    if (argc == 3 && !strcmp(argv[1], "port")) {
+        for (i = 0; i < mlearn_n_ports; i++) {
+            if (mlearn_port_table[i] &&
+                !strcmp(mlearn_port_table[i]->name, argv[2])) {
+                port = mlearn_port_table[i];
+                break;
+            }
+        }
+        if (!port) {
+            unixctl_command_reply_error(conn, "no such port");
+            ds_destroy(&ds);
+            return;
+        }
+        LIST_FOR_EACH (entry, port_node, &port->fdb) {
+            sai_mac_learning_fdb_entry_dump(&ds, entry);
+        }
+        ds_put_format(&ds, "%u entries\n", port->n_fdb);
+    } else if (argc == 3) {
+        vlan = atoi(argv[2]);
+        if (vlan < VLAN_ID_MIN || vlan > VLAN_ID_MAX) {
+            unixctl_command_reply_error(conn, "invalid VLAN");
+            ds_destroy(&ds);
+            return;
+        }
+        LIST_FOR_EACH (entry, vlan_node, &mlearn_fdb_vlans[vlan].entries) {
+            sai_mac_learning_fdb_entry_dump(&ds, entry);
+        }
+        ds_put_format(&ds, "%u entries\n", mlearn_fdb_vlans[vlan].n);
     } else {
-        *mhmap = NULL;
+        /* By VLAN, so that the output is grouped */
+        for (vlan = 0; vlan < MLEARN_FDB_VLANS; vlan++) {
+            LIST_FOR_EACH (entry, vlan_node, &mlearn_fdb_vlans[vlan].entries) {
+                sai_mac_learning_fdb_entry_dump(&ds, entry);
+            }
+        }
+        ds_put_format(&ds, "%"PRIuSIZE" entries, %"PRIu64" moves, %"PRIu64
+                      " learns flushed while queued\n",
+                      hmap_count(&mlearn_fdb), mlearn_fdb_moves,
+                      mlearn_fdb_stale);
     }
 
-    cur_read_hmap_in_use = MACS_TABLES_GET_NEXT_INDEX(cur_read_hmap_in_use);
+    if (!sai_mac_learning_fdb_is_exact()) {
+        ds_put_cstr(&ds, "events were lost, entries may be missing\n");
+    }
 
-    VLOG_DBG("%s: change current read hmap_in_use: %d", __FUNCTION__, cur_read_hmap_in_use);
-    ovs_mutex_unlock(&mlearn_mutex);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
 
-    return (0);
+static void
+sai_mac_learning_fdb_unixctl_flapping(struct unixctl_conn *conn,
+                                      int argc OVS_UNUSED,
+                                      const char *argv[] OVS_UNUSED,
+                                      void *aux OVS_UNUSED)
+{
+    const struct mlearn_fdb_entry *top[MLEARN_FLAP_TOP];
+    const struct mlearn_fdb_entry *entry = NULL;
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    size_t n = 0;
+    size_t i = 0;
+
+    /* Entries with the most moves, most first */
+    HMAP_FOR_EACH (entry, node, &mlearn_fdb) {
+        if (!entry->moves ||
+            (n == MLEARN_FLAP_TOP && entry->moves <= top[n - 1]->moves)) {
+            continue;
+        }
+        if (n < MLEARN_FLAP_TOP) {
+            n++;
+        }
+        for (i = n - 1; i && top[i - 1]->moves < entry->moves; i--) {
+            top[i] = top[i - 1];
+        }
+        top[i] = entry;
+    }
+
+    ds_put_format(&ds, "moves: %"PRIu64", suppressed: %"PRIu64", "
+                  "flaps: %"PRIu64", flapping now: %"PRIuSIZE"\n",
+                  mlearn_fdb_moves, mlearn_fdb_moves_suppressed,
+                  mlearn_fdb_flaps, list_size(&mlearn_fdb_flapping));
+    ds_put_format(&ds, "%-6s %-17s  %-16s %10s  %s\n", "VLAN", "MAC", "PORT",
+                  "MOVES", "STATE");
+    for (i = 0; i < n; i++) {
+        ds_put_format(&ds, "%-6u "ETH_ADDR_FMT"  %-16s %10u  %s\n",
+                      top[i]->vlan, ETH_ADDR_ARGS(top[i]->mac),
+                      mlearn_port_table[top[i]->port]->name, top[i]->moves,
+                      top[i]->suppressed_until ? "flapping" : "-");
+    }
+
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
 }
 
 /*
@@ -453,7 +1415,7 @@ int sai_mac_learning_get_hmap(struct mlearn_hmap **mhmap)
  * This function is invoked in the ofproto __init.
  *
  * It initializes the hmaps, reserves the buffer capacity of the hmap
- * to avoid the time spent in the malloc and free.
+ * to avoid the time spent in the malloc and free, and the learn ring.
  *
  * It also registers for the initial traversal of the MACs already
  * learnt in the ASIC for all hw_units.
@@ -461,27 +1423,45 @@ int sai_mac_learning_get_hmap(struct mlearn_hmap **mhmap)
 int
 sai_mac_learning_init(void)
 {
-    int         idx     = 0;
+    uint32_t    idx     = 0;
     handle_t    id      = {0};
 
 	/* init hmap */
-    for (; idx < MAX_BUFFERS; idx++) {
-        hmap_init(&(all_macs_learnt[idx].table));
-        all_macs_learnt[idx].buffer.actual_size = 0;
-        all_macs_learnt[idx].buffer.size = BUFFER_SIZE;
-        hmap_reserve(&(all_macs_learnt[idx].table), BUFFER_SIZE);
+    for (idx = 0; idx < ARRAY_SIZE(all_macs_learnt); idx++) {
+        hmap_init(&(all_macs_learnt[idx].hmap.table));
+        all_macs_learnt[idx].hmap.buffer.actual_size = 0;
+        all_macs_learnt[idx].hmap.buffer.size = BUFFER_SIZE;
+        hmap_reserve(&(all_macs_learnt[idx].hmap.table), BUFFER_SIZE);
+    }
+
+    for (idx = 0; idx < MLEARN_FDB_VLANS; idx++) {
+        list_init(&mlearn_fdb_vlans[idx].entries);
+    }
+
+    /* slot i is free for the producer claiming position i */
+    for (idx = 0; idx < MLEARN_RING_SIZE; idx++) {
+        atomic_init(&mlearn_ring[idx].seq, idx);
     }
+    mlearn_seq = seq_create();
 
 	/* register fdb event callback function */
     ops_sai_fdb_register_fdb_event_callback(sai_mac_learning_fdb_event_cb);
 
 	/* use to run function sai_mac_learning_run() */
-    sai_timer_thread = ovs_thread_create("ovs-sai-mac-learning-timer",
-										 sai_mac_learning_timer_main,
-										 NULL);
+    sai_notify_thread = ovs_thread_create("ovs-sai-mac-learning",
+										  sai_mac_learning_notify_main,
+										  NULL);
+
+    unixctl_command_register("sai/mac-learning/show", "[clear]", 0, 1,
+                             sai_mac_learning_unixctl_show, NULL);
+    unixctl_command_register("sai/fdb/show", "[port NAME | vlan VID]", 0, 2,
+                             sai_mac_learning_fdb_unixctl_show, NULL);
+    unixctl_command_register("sai/fdb/flapping", "", 0, 0,
+                             sai_mac_learning_fdb_unixctl_flapping, NULL);
 
 	/* flush all fdb entry */
 	ops_sai_fdb_flush_entrys(L2MAC_FLUSH_ALL,id,0);
+    sai_mac_learning_fdb_flush(L2MAC_FLUSH_ALL, id, 0);
 
     return 0;
 }
@@ -527,6 +1507,7 @@ sai_mac_learning_l2_addr_flush_handler(mac_flush_params_t *settings)
 {
     int                rc  = 0;
     uint32_t        hw_id = 0;
+    uint32_t        n   = 0;
     handle_t       id  = HANDLE_INITIALIZAER;
 
     /* Get Harware Port by port name */
@@ -560,6 +1541,11 @@ sai_mac_learning_l2_addr_flush_handler(mac_flush_params_t *settings)
     }
 
     rc = ops_sai_fdb_flush_entrys(settings->options, id, settings->vlan);
+    if (!rc) {
+        n = sai_mac_learning_fdb_flush(settings->options, id, settings->vlan);
+        VLOG_DBG("%s: mode %d, %u shadow entries flushed", __FUNCTION__,
+                 settings->options, n);
+    }
 
     /* flush fdb need use mac_learning_tigger_callback now */
     sai_mac_learning_run();
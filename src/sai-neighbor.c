@@ -12,8 +12,630 @@
 #include <arpa/inet.h>
 #include <netinet/ether.h>
 
+#include <ovs-thread.h>
+#include <seq.h>
+#include <poll-loop.h>
+#include <timeval.h>
+
 VLOG_DEFINE_THIS_MODULE(sai_neighbor);
 
+#define NEIGHBOR_SCAN_INTERVAL_MS   5000
+#define NEIGHBOR_QUEUE_MAX          1024
+#define NEIGHBOR_REMOVE_RETRIES     3
+
+/* Neighbors of all router interfaces, keyed by ops_sai_neighbor_key */
+static struct hmap all_neighbor = HMAP_INITIALIZER(&all_neighbor);
+
+/* Every neighbor has a dense index, its bit in activity bitmaps. Indices of
+ * deleted neighbors are reused. */
+static uint32_t *free_indices;
+static size_t n_free_indices;
+static size_t allocated_free_indices;
+static uint32_t n_indices;
+
+/*
+ * Neighbor activity scanner. Main thread hands keys of resolved neighbors,
+ * indexed by neighbor index, over to the scanner thread once per interval.
+ * Scanner reads activity of all of them in one pass and publishes a bitmap,
+ * which main thread then consults in O(1) per neighbor. Keys are rebuilt
+ * only if neighbors changed since the previous scan.
+ */
+struct neighbor_scan {
+    uint64_t                    epoch;
+    struct ops_sai_neighbor_key *keys;
+    size_t                      n_keys;
+};
+
+struct neighbor_activity {
+    uint64_t        epoch;          /* epoch of the scan keys */
+    unsigned long   *bitmap;
+};
+
+static struct ovs_mutex scan_mutex = OVS_MUTEX_INITIALIZER;
+static struct neighbor_scan *scan_pending OVS_GUARDED_BY(scan_mutex);
+static bool scan_requested OVS_GUARDED_BY(scan_mutex);
+static struct neighbor_activity *scan_result OVS_GUARDED_BY(scan_mutex);
+
+static struct seq *scan_request_seq;        /* scanner wakeup */
+static struct seq *scan_done_seq;           /* main loop wakeup */
+
+/* Main thread only */
+static uint64_t scan_done_seqno;
+static uint64_t scan_epoch;                 /* epoch of the last keys */
+static bool scan_keys_changed;
+static long long int scan_next;
+static struct neighbor_activity *activity;  /* latest scan result */
+
+/*
+ * Neighbor operations queued by ARP/ND updates. Queue is handed over to the
+ * route programming worker from ofproto type_run(), as neighbors resolve next
+ * hops, which are route state. The worker programs consecutive operations
+ * of one kind with one bulk call, so order of operations is kept, also with
+ * respect to route jobs. Main thread only.
+ *
+ * Every operation is numbered and remembers the neighbor's previous one, so
+ * that failed operations can be undone in reverse order once the worker
+ * reports them.
+ */
+struct neighbor_queue_op {
+    enum ops_sai_neighbor_op    op;
+    uint64_t                    seq;
+    uint64_t                    prev_seq;   /* of the neighbor before */
+    struct ether_addr           prev_mac;   /* of the neighbor before */
+    uint32_t                    retries;    /* remove only */
+};
+
+static struct ops_sai_neighbor_bulk_entry *queue_entries;
+static struct neighbor_queue_op *queue_ops;
+static size_t n_queued;
+static size_t allocated_queue_entries;
+static size_t allocated_queue_ops;
+static uint64_t queue_seq;
+
+/* Queued operations handed over to the worker */
+struct neighbor_queue_job {
+    struct ops_sai_neighbor_bulk_entry  *entries;
+    struct neighbor_queue_op            *ops;
+    size_t                              n_entries;
+};
+
+static const char *const neighbor_op_names[] = {
+    [OPS_SAI_NEIGHBOR_OP_CREATE]    = "create",
+    [OPS_SAI_NEIGHBOR_OP_REMOVE]    = "remove",
+    [OPS_SAI_NEIGHBOR_OP_SET]       = "update",
+};
+
+static inline uint32_t
+__neighbor_key_hash(const struct ops_sai_neighbor_key *key)
+{
+    return hash_bytes(key, sizeof(*key), 0);
+}
+
+/*
+ * Fills neighbor key from router interface and IP address string. Does not
+ * allocate, so it may be used for lookups on every ARP/ND update.
+ *
+ * @param[out] key     - neighbor key
+ * @param[in]  vrid    - virtual router of the router interface
+ * @param[in]  rif     - router interface ID
+ * @param[in]  ip_addr - IPv4 or IPv6 address
+ *
+ * @return 0 if operation completed successfully, EINVAL if address is
+ *         invalid. */
+int
+ops_sai_neighbor_key_init(struct ops_sai_neighbor_key *key,
+                          const handle_t *vrid, const handle_t *rif,
+                          const char *ip_addr)
+{
+    memset(key, 0, sizeof(*key));
+    key->rif = rif->data;
+    key->vrid = vrid->data;
+
+    if (1 == inet_pton(AF_INET, ip_addr, key->addr)) {
+        key->family = AF_INET;
+    } else if (1 == inet_pton(AF_INET6, ip_addr, key->addr)) {
+        key->family = AF_INET6;
+    } else {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/* Fills key of the next hop resolved by neighbor: its address on its router
+ * interface. */
+void
+ops_sai_neighbor_nexthop_key_init(struct ops_sai_nexthop_key *nh_key,
+                                  const struct ops_sai_neighbor_key *key)
+{
+    memset(nh_key, 0, sizeof(*nh_key));
+    nh_key->vrid = key->vrid;
+    nh_key->rif = key->rif;
+    nh_key->family = key->family;
+    memcpy(nh_key->addr, key->addr, sizeof(nh_key->addr));
+}
+
+/* Returns neighbor with key or NULL. */
+struct ops_sai_neighbor *
+ops_sai_neighbor_lookup(const struct ops_sai_neighbor_key *key)
+{
+    struct ops_sai_neighbor *neigh = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(neigh, node, __neighbor_key_hash(key),
+                            &all_neighbor) {
+        if (0 == memcmp(&neigh->key, key, sizeof(*key))) {
+            return neigh;
+        }
+    }
+
+    return NULL;
+}
+
+/* Adds unresolved neighbor with key, which must not be in the table yet.
+ * rif_node is left for the caller to link. */
+struct ops_sai_neighbor *
+ops_sai_neighbor_insert(const struct ops_sai_neighbor_key *key)
+{
+    struct ops_sai_neighbor *neigh = xzalloc(sizeof(*neigh));
+
+    neigh->key = *key;
+    neigh->index = n_free_indices ? free_indices[--n_free_indices]
+                                  : n_indices++;
+    neigh->epoch = scan_epoch + 1;
+    neigh->op_seq = queue_seq;      /* create queued right before, if any */
+    hmap_insert(&all_neighbor, &neigh->node, __neighbor_key_hash(key));
+
+    return neigh;
+}
+
+/* Removes neighbor from the table and frees it. Neighbor must be unlinked
+ * from its owner's list already. */
+void
+ops_sai_neighbor_delete(struct ops_sai_neighbor *neigh)
+{
+    if (n_free_indices == allocated_free_indices) {
+        free_indices = x2nrealloc(free_indices, &allocated_free_indices,
+                                  sizeof(*free_indices));
+    }
+    free_indices[n_free_indices++] = neigh->index;
+
+    if (ops_sai_neighbor_is_resolved(neigh)) {
+        scan_keys_changed = true;
+    }
+
+    hmap_remove(&all_neighbor, &neigh->node);
+    free(neigh);
+}
+
+/* Returns true if neighbor has MAC address, i.e. is programmed. */
+bool
+ops_sai_neighbor_is_resolved(const struct ops_sai_neighbor *neigh)
+{
+    static const struct ether_addr zero_mac;
+
+    return memcmp(&neigh->mac, &zero_mac, sizeof(zero_mac)) != 0;
+}
+
+/*
+ * Sets MAC address of neighbor programmed with it.
+ *
+ * @param[in] neigh - neighbor
+ * @param[in] mac   - MAC address, NULL if neighbor is no longer programmed
+ */
+void
+ops_sai_neighbor_mac_set(struct ops_sai_neighbor *neigh,
+                         const struct ether_addr *mac)
+{
+    if (mac) {
+        neigh->mac = *mac;
+    } else {
+        memset(&neigh->mac, 0, sizeof(neigh->mac));
+    }
+
+    neigh->epoch = scan_epoch + 1;
+    scan_keys_changed = true;
+}
+
+static void
+__neighbor_scan_free(struct neighbor_scan *scan)
+{
+    if (scan) {
+        free(scan->keys);
+        free(scan);
+    }
+}
+
+static void
+__neighbor_activity_free(struct neighbor_activity *result)
+{
+    if (result) {
+        bitmap_free(result->bitmap);
+        free(result);
+    }
+}
+
+static void *
+__neighbor_scan_main(void *aux OVS_UNUSED)
+{
+    struct neighbor_scan *scan = NULL;
+    struct neighbor_activity *result = NULL;
+    bool requested = false;
+    uint64_t seqno = 0;
+    int status = 0;
+
+    for (;;) {
+        seqno = seq_read(scan_request_seq);
+
+        ovs_mutex_lock(&scan_mutex);
+        if (scan_pending) {
+            __neighbor_scan_free(scan);
+            scan = scan_pending;
+            scan_pending = NULL;
+        }
+        requested = scan_requested;
+        scan_requested = false;
+        ovs_mutex_unlock(&scan_mutex);
+
+        if (requested && scan) {
+            result = xmalloc(sizeof(*result));
+            result->epoch = scan->epoch;
+            result->bitmap = bitmap_allocate(MAX(scan->n_keys, 1));
+
+            status = ops_sai_neighbor_activity_scan(scan->keys, scan->n_keys,
+                                                    result->bitmap);
+            if (status) {
+                VLOG_WARN("Failed to read activity of some neighbors "
+                          "(status: %d)", status);
+            }
+
+            ovs_mutex_lock(&scan_mutex);
+            __neighbor_activity_free(scan_result);
+            scan_result = result;
+            ovs_mutex_unlock(&scan_mutex);
+            seq_change(scan_done_seq);
+        }
+
+        seq_wait(scan_request_seq, seqno);
+        poll_block();
+    }
+
+    return NULL;
+}
+
+static void
+__neighbor_scan_start(void)
+{
+    static struct ovsthread_once once = OVSTHREAD_ONCE_INITIALIZER;
+
+    if (ovsthread_once_start(&once)) {
+        scan_request_seq = seq_create();
+        scan_done_seq = seq_create();
+        scan_done_seqno = seq_read(scan_done_seq);
+        ovs_thread_create("sai_neighbor", __neighbor_scan_main, NULL);
+        ovsthread_once_done(&once);
+    }
+}
+
+/* Hands keys over to the scanner, if neighbors changed, and requests a
+ * scan. */
+static void
+__neighbor_scan_request(void)
+{
+    struct neighbor_scan *scan = NULL;
+    struct ops_sai_neighbor *neigh = NULL;
+
+    if (scan_keys_changed) {
+        scan = xmalloc(sizeof(*scan));
+        scan->epoch = ++scan_epoch;
+        scan->n_keys = n_indices;
+        scan->keys = xcalloc(MAX(n_indices, 1), sizeof(*scan->keys));
+
+        HMAP_FOR_EACH(neigh, node, &all_neighbor) {
+            if (ops_sai_neighbor_is_resolved(neigh)) {
+                scan->keys[neigh->index] = neigh->key;
+            }
+        }
+        scan_keys_changed = false;
+    }
+
+    __neighbor_scan_start();
+
+    ovs_mutex_lock(&scan_mutex);
+    if (scan) {
+        __neighbor_scan_free(scan_pending);
+        scan_pending = scan;
+    }
+    scan_requested = true;
+    ovs_mutex_unlock(&scan_mutex);
+    seq_change(scan_request_seq);
+}
+
+/*
+ * Returns activity of neighbor read by the last scan. Neighbors not scanned
+ * yet are reported active.
+ *
+ * @param[in] neigh - resolved neighbor
+ */
+bool
+ops_sai_neighbor_activity_test(const struct ops_sai_neighbor *neigh)
+{
+    if (!activity || activity->epoch < neigh->epoch) {
+        return true;
+    }
+
+    return bitmap_is_set(activity->bitmap, neigh->index);
+}
+
+/* Takes scan results and requests next scan once per interval. Called from
+ * ofproto type_run(). */
+void
+ops_sai_neighbor_activity_run(void)
+{
+    struct neighbor_activity *result = NULL;
+
+    if (scan_done_seq) {
+        scan_done_seqno = seq_read(scan_done_seq);
+
+        ovs_mutex_lock(&scan_mutex);
+        result = scan_result;
+        scan_result = NULL;
+        ovs_mutex_unlock(&scan_mutex);
+
+        if (result) {
+            __neighbor_activity_free(activity);
+            activity = result;
+        }
+    }
+
+    if (time_msec() < scan_next) {
+        return;
+    }
+
+    scan_next = time_msec() + NEIGHBOR_SCAN_INTERVAL_MS;
+    if (!hmap_is_empty(&all_neighbor) || scan_keys_changed) {
+        __neighbor_scan_request();
+    }
+}
+
+/* Wakes up the main loop for the next scan or when a scan completes. */
+void
+ops_sai_neighbor_activity_wait(void)
+{
+    poll_timer_wait_until(scan_next);
+
+    if (scan_done_seq) {
+        seq_wait(scan_done_seq, scan_done_seqno);
+    }
+}
+
+static void
+__neighbor_entry_fill(sai_neighbor_entry_t *neighbor,
+                      const struct ops_sai_neighbor_key *key)
+{
+    uint32_t ip4 = 0;
+
+    memset(neighbor, 0, sizeof(*neighbor));
+    neighbor->rif_id = key->rif;
+
+    if (AF_INET6 == key->family) {
+        neighbor->ip_address.addr_family = SAI_IP_ADDR_FAMILY_IPV6;
+        memcpy(neighbor->ip_address.addr.ip6, key->addr,
+               sizeof(neighbor->ip_address.addr.ip6));
+    } else {
+        memcpy(&ip4, key->addr, sizeof(ip4));
+        neighbor->ip_address.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
+        neighbor->ip_address.addr.ip4 = htonl(ip4);
+    }
+}
+
+/* Appends operation to the queue without handing it over. */
+static struct ops_sai_neighbor_bulk_entry *
+__neighbor_queue_push(enum ops_sai_neighbor_op op,
+                      const struct ops_sai_neighbor_key *key,
+                      struct neighbor_queue_op **queue_op)
+{
+    struct ops_sai_neighbor_bulk_entry *entry = NULL;
+
+    if (n_queued == allocated_queue_entries) {
+        queue_entries = x2nrealloc(queue_entries, &allocated_queue_entries,
+                                   sizeof(*queue_entries));
+    }
+    if (n_queued == allocated_queue_ops) {
+        queue_ops = x2nrealloc(queue_ops, &allocated_queue_ops,
+                               sizeof(*queue_ops));
+    }
+
+    entry = &queue_entries[n_queued];
+    memset(entry, 0, sizeof(*entry));
+    entry->key = *key;
+
+    *queue_op = &queue_ops[n_queued++];
+    memset(*queue_op, 0, sizeof(**queue_op));
+    (*queue_op)->op = op;
+    (*queue_op)->seq = ++queue_seq;
+
+    return entry;
+}
+
+/*
+ * Queues neighbor operation. Queue is handed over to the route programming
+ * worker when it is full or on the next ofproto type_run(). Operation must be
+ * queued before the neighbor is inserted, gets MAC address or is deleted.
+ *
+ * @param[in] op  - operation
+ * @param[in] key - router interface ID and neighbor IP address
+ * @param[in] mac - neighbor MAC address, create and set only
+ */
+void
+ops_sai_neighbor_enqueue(enum ops_sai_neighbor_op op,
+                         const struct ops_sai_neighbor_key *key,
+                         const struct ether_addr *mac)
+{
+    struct ops_sai_neighbor *neigh = ops_sai_neighbor_lookup(key);
+    struct ops_sai_neighbor_bulk_entry *entry = NULL;
+    struct neighbor_queue_op *queue_op = NULL;
+
+    entry = __neighbor_queue_push(op, key, &queue_op);
+    if (mac) {
+        entry->mac = *mac;
+    }
+    if (neigh) {
+        queue_op->prev_seq = neigh->op_seq;
+        queue_op->prev_mac = neigh->mac;
+        neigh->op_seq = queue_op->seq;
+    }
+
+    if (n_queued >= NEIGHBOR_QUEUE_MAX) {
+        ops_sai_neighbor_queue_flush();
+    }
+}
+
+/* Programs queued neighbor operations. Run by the route programming
+ * worker. Returns status of the first failure. */
+static int
+__neighbor_queue_execute(void *aux)
+{
+    struct neighbor_queue_job *job = aux;
+    struct ops_sai_neighbor_bulk_entry *entries = NULL;
+    enum ops_sai_neighbor_op op;
+    size_t count = 0;
+    int status = 0;
+
+    for (size_t i = 0; i < job->n_entries; i += count) {
+        op = job->ops[i].op;
+        entries = &job->entries[i];
+        for (count = 1;
+             i + count < job->n_entries && job->ops[i + count].op == op;
+             count++) {
+        }
+
+        if (OPS_SAI_NEIGHBOR_OP_CREATE == op) {
+            ops_sai_neighbor_create_bulk(entries, count);
+        } else if (OPS_SAI_NEIGHBOR_OP_REMOVE == op) {
+            ops_sai_neighbor_remove_bulk(entries, count);
+        } else {
+            /* MAC changes are rare, there is no bulk call for them */
+            for (size_t j = 0; j < count; j++) {
+                entries[j].status = ops_sai_neighbor_mac_update(
+                                            &entries[j].key, &entries[j].mac);
+            }
+        }
+
+        for (size_t j = 0; j < count && !status; j++) {
+            status = entries[j].status;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * Undoes failed operation, so that neighbor is as it was programmed before:
+ * - create: neighbor is unresolved, so the next update creates it again;
+ * - set: neighbor gets back the MAC address it had;
+ * - remove: neighbor is still in hardware, so remove is retried a few
+ *   times, unless neighbor was added again meanwhile.
+ * Neighbor with operations queued after the failed one is left alone.
+ */
+static void
+__neighbor_rollback(const struct neighbor_queue_op *queue_op,
+                    const struct ops_sai_neighbor_bulk_entry *entry)
+{
+    struct ops_sai_neighbor *neigh = ops_sai_neighbor_lookup(&entry->key);
+    struct neighbor_queue_op *retry = NULL;
+
+    if (OPS_SAI_NEIGHBOR_OP_REMOVE == queue_op->op) {
+        if (!neigh && queue_op->retries < NEIGHBOR_REMOVE_RETRIES) {
+            __neighbor_queue_push(queue_op->op, &entry->key, &retry);
+            retry->retries = queue_op->retries + 1;
+        }
+        return;
+    }
+
+    if (!neigh || neigh->op_seq != queue_op->seq) {
+        return;
+    }
+
+    ops_sai_neighbor_mac_set(neigh, OPS_SAI_NEIGHBOR_OP_CREATE == queue_op->op
+                                    ? NULL : &queue_op->prev_mac);
+    neigh->op_seq = queue_op->prev_seq;
+}
+
+/* Logs failed entries once the worker is done with them and undoes them,
+ * last one first. */
+static void
+__neighbor_queue_complete(void *aux)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
+    struct neighbor_queue_job *job = aux;
+    struct ops_sai_neighbor_bulk_entry *entry = NULL;
+    char ip_str[INET6_ADDRSTRLEN];
+
+    for (size_t i = job->n_entries; i-- > 0;) {
+        entry = &job->entries[i];
+        if (!entry->status) {
+            continue;
+        }
+        VLOG_ERR_RL(&rl, "Failed to %s neighbor (ip: %s, rif: 0x%"PRIx64
+                    ", status: %d)",
+                    neighbor_op_names[job->ops[i].op],
+                    inet_ntop(entry->key.family, entry->key.addr,
+                              ip_str, sizeof(ip_str)) ? ip_str : "?",
+                    entry->key.rif, entry->status);
+        __neighbor_rollback(&job->ops[i], entry);
+    }
+
+    free(job->entries);
+    free(job->ops);
+    free(job);
+}
+
+/*
+ * Hands all queued neighbor operations over to the route programming worker.
+ * Does not wait for them: failed entries are logged and undone when the
+ * worker is done, and ops_sai_route_pipeline_sync() waits for them and
+ * reports the first failure.
+ */
+void
+ops_sai_neighbor_queue_flush(void)
+{
+    struct neighbor_queue_job *job = NULL;
+
+    if (!n_queued) {
+        return;
+    }
+
+    job = xmalloc(sizeof(*job));
+    job->entries = queue_entries;
+    job->ops = queue_ops;
+    job->n_entries = n_queued;
+
+    queue_entries = NULL;
+    queue_ops = NULL;
+    n_queued = 0;
+    allocated_queue_entries = 0;
+    allocated_queue_ops = 0;
+
+    ops_sai_route_pipeline_task(__neighbor_queue_execute,
+                                __neighbor_queue_complete, job);
+}
+
+/* Hands queued neighbor operations over. Called from ofproto type_run(). */
+void
+ops_sai_neighbor_queue_run(void)
+{
+    ops_sai_neighbor_queue_flush();
+}
+
+/* Wakes up the main loop right away while operations are queued. */
+void
+ops_sai_neighbor_queue_wait(void)
+{
+    if (n_queued) {
+        poll_immediate_wake();
+    }
+}
+
 /*
  * Initializes neighbor.
  */
@@ -26,151 +648,293 @@ __neighbor_init(void)
 /*
  *  This function adds a neighbour information.
  *
- * @param[in] is_ipv6_addr - is address IPv6 or not
- * @param[in] ip_addr      - neighbor IP address
- * @param[in] mac_addr     - neighbor MAC address
- * @param[in] rif          - router Interface ID
+ * @param[in] key      - router interface ID and neighbor IP address
+ * @param[in] mac_addr - neighbor MAC address
  *
  * @return 0  if operation completed successfully.
  * @return -1 if operation failed.*/
 static int
-__neighbor_create(bool           is_ipv6_addr,
-                  const char     *ip_addr,
-                  const char     *mac_addr,
-                  const handle_t *rif)
+__neighbor_create(const struct ops_sai_neighbor_key *key,
+                  const struct ether_addr           *mac_addr)
 {
     const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
     sai_status_t            status      = SAI_STATUS_SUCCESS;
-    struct nh_entry         *p_nh_entry = NULL;
     sai_neighbor_entry_t    sai_neighbor;
     sai_attribute_t         attr[1];
-    char                    buf[64];
-    int                     retv;
-    int                     rc;
-    uint32_t                ip_prefix;
-    handle_t                l3_egress_id;
+    struct ops_sai_nexthop_key nh_key;
+    uint32_t                nh_index;
 
-    if (NULL == mac_addr || NULL == ip_addr) {
+    if (NULL == mac_addr || NULL == key) {
         return SAI_STATUS_FAILURE;
     }
 
-    memset(&sai_neighbor, 0 , sizeof(sai_neighbor));
-    memset(&ip_prefix, 0, sizeof(ip_prefix));
-    memset(buf, 0, sizeof(buf));
-    retv = inet_pton(AF_INET, ip_addr, buf);
-    if (!retv) {
-        return SAI_STATUS_INVALID_PARAMETER;
-    }
-
-    memcpy(&ip_prefix, buf, sizeof(ip_prefix));
+    __neighbor_entry_fill(&sai_neighbor, key);
 
     memset(attr, 0, sizeof(attr));
     attr[0].id = SAI_NEIGHBOR_ATTR_DST_MAC_ADDRESS;
+    memcpy(attr[0].value.mac, mac_addr, sizeof(attr[0].value.mac));
 
-    struct ether_addr *ether_mac = ether_aton(mac_addr);
-    memcpy(attr[0].value.mac, ether_mac, sizeof(attr[0].value.mac));
-    sai_neighbor.rif_id = rif->data;
-    if (!is_ipv6_addr)
-    {
-        sai_neighbor.ip_address.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-        sai_neighbor.ip_address.addr.ip4 = htonl(ip_prefix);
+    ops_sai_neighbor_nexthop_key_init(&nh_key, key);
+    nh_index = ops_sai_nexthop_ref(&nh_key);
+    if (OPS_SAI_NH_INDEX_INVALID == nh_index) {
+        return ENOSPC;
     }
-    else
-    {
-        /* TO SUPPORT */
-    }
-
-    p_nh_entry = ops_sai_neighbor_get_nexthop(ip_addr);
-    if (NULL == p_nh_entry) {
-        rc = ops_sai_routing_nexthop_create(rif, ip_addr, &l3_egress_id);
-        if (rc) {
-            goto exit;
-        }
-    }
-    else {
-        l3_egress_id.data = p_nh_entry->handle.data;
-    }
-
-    ops_sai_neighbor_add_nexthop(ip_addr, &l3_egress_id);
 
     status = sai_api->neighbor_api->create_neighbor_entry(&sai_neighbor, 1, attr);
     SAI_ERROR_LOG_EXIT(status, "Failed to create host entry");
 
+    ops_sai_nexthop_state_set(nh_index, true);
+
 exit:
-    return SAI_STATUS_SUCCESS;
+    if (SAI_ERROR_2_ERRNO(status)) {
+        ops_sai_nexthop_unref(nh_index);
+    }
+    return SAI_ERROR_2_ERRNO(status);
 }
 
 /*
  *  This function deletes a neighbour information.
  *
- * @param[in] is_ipv6_addr - is address IPv6 or not
- * @param[in] ip_addr      - neighbor IP address
- * @param[in] rif          - router Interface ID
+ * @param[in] key - router interface ID and neighbor IP address
  *
  * @return 0  if operation completed successfully.
  * @return -1 if operation failed.*/
 static int
-__neighbor_remove(bool is_ipv6_addr, const char *ip_addr, const handle_t *rif)
+__neighbor_remove(const struct ops_sai_neighbor_key *key)
 {
     const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
     sai_status_t        status      = SAI_STATUS_SUCCESS;
-    struct nh_entry     *p_nh_entry = NULL;
     sai_neighbor_entry_t neighbor;
-    char                buf[64];
-    int                 retv    = 0;
-    int                 rc      = 0;
-    uint32_t            ip_prefix;
-    handle_t            l3_egress_id;
+    struct ops_sai_nexthop_key nh_key;
+    uint32_t            nh_index;
 
-    if (NULL == ip_addr) {
+    if (NULL == key) {
         return SAI_STATUS_FAILURE;
     }
 
-    memset(&neighbor, 0, sizeof(neighbor));
-    memset(&ip_prefix, 0, sizeof(ip_prefix));
-    memset(buf, 0, sizeof(buf));
-    retv = inet_pton(AF_INET, ip_addr, buf);
-    if (!retv) {
-        return SAI_STATUS_INVALID_PARAMETER;
-    }
+    __neighbor_entry_fill(&neighbor, key);
 
-    memcpy(&ip_prefix, buf, sizeof(ip_prefix));
-
-    neighbor.rif_id = rif->data;
-    neighbor.ip_address.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    neighbor.ip_address.addr.ip4 = htonl(ip_prefix);
+    /* Move ECMP traffic off the next hop before it stops resolving */
+    ops_sai_neighbor_nexthop_key_init(&nh_key, key);
+    nh_index = ops_sai_nexthop_find(&nh_key);
+    ops_sai_nexthop_state_set(nh_index, false);
 
     status = sai_api->neighbor_api->remove_neighbor_entry(&neighbor);
     SAI_ERROR_LOG_EXIT(status, "Failed to remove host entry");
 
-    p_nh_entry = ops_sai_neighbor_get_nexthop(ip_addr);
-    if (NULL != p_nh_entry) {
-        l3_egress_id.data = p_nh_entry->handle.data;
-        rc = ops_sai_neighbor_delete_nexthop(ip_addr);
-        if (!rc) {
-            rc = ops_sai_routing_nexthop_remove(&l3_egress_id);
-        }
+    ops_sai_nexthop_unref(nh_index);
+
+exit:
+    if (SAI_ERROR_2_ERRNO(status)) {
+        /* Neighbor is still in hardware, so is its next hop */
+        ops_sai_nexthop_state_set(nh_index, true);
     }
+    return status;
+}
+
+/*
+ *  This function changes MAC address of a neighbor in place.
+ *
+ * @param[in] key      - router interface ID and neighbor IP address
+ * @param[in] mac_addr - new neighbor MAC address
+ *
+ * @return 0     if operation completed successfully.
+ * @return errno if operation failed.*/
+static int
+__neighbor_mac_set(const struct ops_sai_neighbor_key *key,
+                   const struct ether_addr           *mac_addr)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_status_t            status      = SAI_STATUS_SUCCESS;
+    sai_neighbor_entry_t    sai_neighbor;
+    sai_attribute_t         attr;
+
+    __neighbor_entry_fill(&sai_neighbor, key);
+
+    memset(&attr, 0, sizeof(attr));
+    attr.id = SAI_NEIGHBOR_ATTR_DST_MAC_ADDRESS;
+    memcpy(attr.value.mac, mac_addr, sizeof(attr.value.mac));
+
+    status = sai_api->neighbor_api->set_neighbor_attribute(&sai_neighbor,
+                                                           &attr);
+    SAI_ERROR_LOG_EXIT(status, "Failed to update host entry MAC address");
 
 exit:
+    return SAI_ERROR_2_ERRNO(status);
+}
+
+/*
+ * Programs a batch of neighbor entries. The SAI neighbor API in use has no
+ * bulk create, so entries are pushed one by one here; this is the single
+ * place to switch to a vectorized call.
+ */
+static void
+__neighbor_entries_create(const sai_neighbor_entry_t *neighbors,
+                          const sai_attribute_t *attrs,
+                          sai_status_t *statuses,
+                          uint32_t count)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+
+    for (uint32_t i = 0; i < count; i++) {
+        statuses[i] = sai_api->neighbor_api->create_neighbor_entry(
+                                                    &neighbors[i], 1,
+                                                    &attrs[i]);
+    }
+}
+
+/* Bulk counterpart of __neighbor_entries_create() for neighbor removal. */
+static void
+__neighbor_entries_remove(const sai_neighbor_entry_t *neighbors,
+                          sai_status_t *statuses,
+                          uint32_t count)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+
+    for (uint32_t i = 0; i < count; i++) {
+        statuses[i] = sai_api->neighbor_api->remove_neighbor_entry(
+                                                    &neighbors[i]);
+    }
+}
+
+/*
+ *  This function adds a batch of neighbors at once. Next hops resolved by
+ *  the neighbors go up once all entries are programmed.
+ *
+ * @param[in,out] entries - neighbors to add, status of every entry is set
+ * @param[in]     count   - count of entries
+ *
+ * @return 0     if all entries were added successfully.
+ * @return errno of the first failed entry otherwise.*/
+static int
+__neighbor_create_bulk(struct ops_sai_neighbor_bulk_entry *entries,
+                       uint32_t                           count)
+{
+    sai_neighbor_entry_t        *neighbors  = xcalloc(count,
+                                                      sizeof(*neighbors));
+    sai_attribute_t             *attrs      = xcalloc(count, sizeof(*attrs));
+    sai_status_t                *statuses   = xcalloc(count,
+                                                      sizeof(*statuses));
+    uint32_t                    *nh_indices = xcalloc(count,
+                                                      sizeof(*nh_indices));
+    uint32_t                    *positions  = xcalloc(count,
+                                                      sizeof(*positions));
+    struct ops_sai_nexthop_key  nh_key;
+    uint32_t                    n_pending   = 0;
+    uint32_t                    i           = 0;
+    int                         status      = 0;
+
+    for (i = 0; i < count; i++) {
+        ops_sai_neighbor_nexthop_key_init(&nh_key, &entries[i].key);
+        nh_indices[n_pending] = ops_sai_nexthop_ref(&nh_key);
+        if (OPS_SAI_NH_INDEX_INVALID == nh_indices[n_pending]) {
+            entries[i].status = ENOSPC;
+            if (!status) {
+                status = ENOSPC;
+            }
+            continue;
+        }
+
+        __neighbor_entry_fill(&neighbors[n_pending], &entries[i].key);
+        attrs[n_pending].id = SAI_NEIGHBOR_ATTR_DST_MAC_ADDRESS;
+        memcpy(attrs[n_pending].value.mac, &entries[i].mac,
+               sizeof(attrs[n_pending].value.mac));
+        positions[n_pending++] = i;
+    }
+
+    __neighbor_entries_create(neighbors, attrs, statuses, n_pending);
+
+    for (uint32_t j = 0; j < n_pending; j++) {
+        i = positions[j];
+        entries[i].status = SAI_ERROR_2_ERRNO(statuses[j]);
+        if (entries[i].status) {
+            VLOG_ERR("SAI error %d Failed to create host entry", statuses[j]);
+            if (!status) {
+                status = entries[i].status;
+            }
+            ops_sai_nexthop_unref(nh_indices[j]);
+            continue;
+        }
+
+        ops_sai_nexthop_state_set(nh_indices[j], true);
+    }
+
+    free(positions);
+    free(nh_indices);
+    free(statuses);
+    free(attrs);
+    free(neighbors);
+
+    return status;
+}
+
+/*
+ *  This function deletes a batch of neighbors at once. Next hops resolved by
+ *  the neighbors go down before any entry is removed, and back up for
+ *  entries which failed to be removed.
+ *
+ * @param[in,out] entries - neighbors to delete, status of every entry is set
+ * @param[in]     count   - count of entries
+ *
+ * @return 0     if all entries were deleted successfully.
+ * @return errno of the first failed entry otherwise.*/
+static int
+__neighbor_remove_bulk(struct ops_sai_neighbor_bulk_entry *entries,
+                       uint32_t                           count)
+{
+    sai_neighbor_entry_t        *neighbors  = xcalloc(count,
+                                                      sizeof(*neighbors));
+    sai_status_t                *statuses   = xcalloc(count,
+                                                      sizeof(*statuses));
+    uint32_t                    *nh_indices = xcalloc(count,
+                                                      sizeof(*nh_indices));
+    struct ops_sai_nexthop_key  nh_key;
+    int                         status      = 0;
+
+    /* Move ECMP traffic off the next hops before they stop resolving */
+    for (uint32_t i = 0; i < count; i++) {
+        __neighbor_entry_fill(&neighbors[i], &entries[i].key);
+
+        ops_sai_neighbor_nexthop_key_init(&nh_key, &entries[i].key);
+        nh_indices[i] = ops_sai_nexthop_find(&nh_key);
+        ops_sai_nexthop_state_set(nh_indices[i], false);
+    }
+
+    __neighbor_entries_remove(neighbors, statuses, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].status = SAI_ERROR_2_ERRNO(statuses[i]);
+        if (entries[i].status) {
+            VLOG_ERR("SAI error %d Failed to remove host entry", statuses[i]);
+            if (!status) {
+                status = entries[i].status;
+            }
+            /* Neighbor is still in hardware, so is its next hop */
+            ops_sai_nexthop_state_set(nh_indices[i], true);
+            continue;
+        }
+
+        ops_sai_nexthop_unref(nh_indices[i]);
+    }
+
+    free(nh_indices);
+    free(statuses);
+    free(neighbors);
+
     return status;
 }
 
 /*
  *  This function reads the neighbor's activity information.
  *
- * @param[in] is_ipv6_addr - is address IPv6 or not
- * @param[in] ip_addr      - neighbor IP address
- * @param[in] rif          - router Interface ID
+ * @param[in] key          - router interface ID and neighbor IP address
  * @param[out] activity_p  - activity
  *
  * @return 0  if operation completed successfully.
  * @return -1 if operation failed.*/
 static int
-__neighbor_activity_get(bool           is_ipv6_addr,
-                        const char     *ip_addr,
-                        const handle_t *rif,
-                        bool           *activity)
+__neighbor_activity_get(const struct ops_sai_neighbor_key *key,
+                        bool                              *activity)
 {
     SAI_API_TRACE_NOT_IMPLEMENTED_FN();
     return 0;
@@ -189,6 +953,9 @@ DEFINE_GENERIC_CLASS(struct neighbor_class, neighbor) = {
     .init = __neighbor_init,
     .create = __neighbor_create,
     .remove = __neighbor_remove,
+    .mac_set = __neighbor_mac_set,
+    .create_bulk = __neighbor_create_bulk,
+    .remove_bulk = __neighbor_remove_bulk,
     .activity_get = __neighbor_activity_get,
     .deinit = __neighbor_deinit
 };
@@ -21,6 +21,7 @@
 #include <sai-host-intf.h>
 #include <sai-router-intf.h>
 #include <sai-ofproto-provider.h>
+#include <sai-mac-learning.h>
 #include <sai-netdev.h>
 
 VLOG_DEFINE_THIS_MODULE(netdev_sai);
@@ -392,6 +393,7 @@ __construct(struct netdev *netdev_)
 static void
 __destruct(struct netdev *netdev_)
 {
+    handle_t hw_id_handle;
     struct netdev_sai *netdev = __netdev_sai_cast(netdev_);
 
     SAI_API_TRACE_FN();
@@ -400,6 +402,8 @@ __destruct(struct netdev *netdev_)
 
     if (netdev->is_initialized) {
         ops_sai_host_intf_netdev_remove(netdev_get_name(netdev_));
+        hw_id_handle.data = ops_sai_api_port_map_get_oid(netdev->hw_id);
+        sai_mac_learning_port_del(hw_id_handle, netdev_get_name(netdev_));
     }
 
     if (netdev->split_info.is_child) {
@@ -484,6 +488,10 @@ __set_hw_intf_info(struct netdev *netdev_, const struct smap *args)
     netdev->default_config.max_speed = max_speed;
     netdev->is_initialized = true;
 
+    /* MACs learnt on the port are reported by its OID */
+    hw_id_handle.data = ops_sai_api_port_map_get_oid(hw_id);
+    sai_mac_learning_port_add(hw_id_handle, netdev_get_name(netdev_));
+
 exit:
     ovs_mutex_unlock(&netdev->mutex);
     return status;
@@ -32,6 +32,7 @@
 #include <sai-router-intf.h>
 #include <sai-route.h>
 #include <sai-neighbor.h>
+#include <sai-resource.h>
 #include <sai-hash.h>
 #include <sai-classifier.h>
 #include <sai-ofproto-provider.h>
@@ -45,6 +46,7 @@
 #include "sai-ofproto-notification.h"
 #include <sai-sflow.h>
 #include <sai-ofproto-sflow.h>
+#include <poll-loop.h>
 
 #define SAI_INTERFACE_TYPE_SYSTEM "system"
 #define SAI_INTERFACE_TYPE_VRF "vrf"
@@ -158,12 +160,6 @@ static enum ofperr __group_modify(struct ofgroup *);
 static enum ofperr __group_get_stats(const struct ofgroup *,
                                      struct ofputil_group_stats *);
 static const char *__get_datapath_version(const struct ofproto *);
-static struct neigbor_entry* __neigh_entry_hash_find(const char *,
-                                                     const struct
-                                                     ofbundle_sai *);
-static void __neigh_entry_hash_add(const char *, const char *,
-                                   struct ofbundle_sai *);
-static void __neigh_entry_hash_remove(const char *, struct ofbundle_sai *);
 
 static int __add_l3_host_entry(const struct ofproto *, void *, bool, char *,
                                char *, int *);
@@ -177,6 +173,8 @@ static void __l3_local_route_attach_to_bundle(struct ofbundle_sai *, char *);
 static void __l3_local_route_dettach_from_bundle(struct ofbundle_sai *, char *);
 static int __l3_ecmp_set(const struct ofproto *, bool);
 static int __l3_ecmp_hash_set(const struct ofproto *, unsigned int, bool);
+static int __type_run(const char *);
+static void __type_wait(const char *);
 static int __run(struct ofproto *);
 static void __wait(struct ofproto *);
 static void __set_tables_version(struct ofproto *, cls_version_t);
@@ -208,8 +206,8 @@ const struct ofproto_class ofproto_sai_class = {
     PROVIDER_INIT_GENERIC(enumerate_names,       __enumerate_names)
     PROVIDER_INIT_GENERIC(del,                   __del)
     PROVIDER_INIT_GENERIC(port_open_type,        __port_open_type)
-    PROVIDER_INIT_GENERIC(type_run,              NULL)
-    PROVIDER_INIT_GENERIC(type_wait,             NULL)
+    PROVIDER_INIT_GENERIC(type_run,              __type_run)
+    PROVIDER_INIT_GENERIC(type_wait,             __type_wait)
     PROVIDER_INIT_GENERIC(alloc,                 __alloc)
     PROVIDER_INIT_GENERIC(construct,             __construct)
     PROVIDER_INIT_GENERIC(destruct,              __destruct)
@@ -416,6 +414,7 @@ __init(const struct shash *iface_hints)
     SAI_API_TRACE_FN();
 
     ops_sai_api_init();
+    ops_sai_resource_init();
     ops_sai_port_init();
     ops_sai_vlan_init();
     ops_sai_policer_init();
@@ -473,6 +472,7 @@ __del(const char *type, const char *name)
 
     ops_sai_ecmp_hash_deinit();
     ops_sai_host_intf_traps_unregister();
+    ops_sai_neighbor_queue_flush();
     ops_sai_route_deinit();
     ops_sai_neighbor_deinit();
     ops_sai_router_intf_deinit();
@@ -533,6 +533,9 @@ __construct(struct ofproto *ofproto_)
 
     hmap_init(&ofproto->bundles);
     hmap_init(&ofproto->mirrors);
+    /* Before any exit: destruct destroys the batch unconditionally. Virtual
+     * router ID is read when the batch is submitted. */
+    ops_sai_route_batch_init(&ofproto->route_batch, &ofproto->vrid);
 
     if (STR_EQ(ofproto_->type, SAI_TYPE_IACL)) {
         VLOG_DBG("iACL container construct placeholder");
@@ -559,7 +562,10 @@ __destruct(struct ofproto *ofproto_ OVS_UNUSED)
 
     SAI_API_TRACE_FN();
 
+    ops_sai_route_batch_destroy(&ofproto->route_batch);
+
     if (STR_EQ(ofproto_->type, SAI_INTERFACE_TYPE_VRF)) {
+        ops_sai_route_vrf_flush(&ofproto->vrid);
         ops_sai_router_remove(&ofproto->vrid);
     }
 
@@ -1573,14 +1579,16 @@ static int __ofbundle_router_intf_remove(struct ofbundle_sai *bundle)
     struct ofproto_sai *ofproto = NULL;
     struct ofport_sai *port = NULL;
     struct ofport_sai *next_port = NULL;
-    struct neigbor_entry *neigh = NULL;
-    struct neigbor_entry *next_neigh = NULL;
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor *next_neigh = NULL;
 
     ovs_assert(bundle != NULL);
     ovs_assert(bundle->ofproto != NULL);
 
     ofproto = bundle->ofproto;
 
+    ops_sai_route_batch_flush(&ofproto->route_batch);
+
     /* Remove all existing local routes before interface deletion */
     HMAP_FOR_EACH_SAFE (addr, next, addr_node, &bundle->local_routes) {
         status = ops_sai_route_remove(&ofproto->vrid, addr->address);
@@ -1591,21 +1599,21 @@ static int __ofbundle_router_intf_remove(struct ofbundle_sai *bundle)
         free(addr);
     }
 
-    HMAP_FOR_EACH_SAFE(neigh, next_neigh, neigh_node, &bundle->neighbors) {
-        if (0 != strnlen(neigh->mac_address, MAC_STR_LEN)) {
-            status = ops_sai_neighbor_remove(addr_is_ipv6(neigh->ip_address),
-                                             neigh->ip_address,
-                                             &bundle->router_intf.rifid);
-            ERRNO_EXIT(status);
-
-            hmap_remove(&bundle->neighbors, &neigh->neigh_node);
-
-            free(neigh->ip_address);
-            free(neigh->mac_address);
-            free(neigh);
+    LIST_FOR_EACH_SAFE(neigh, next_neigh, rif_node, &bundle->neighbors) {
+        if (ops_sai_neighbor_is_resolved(neigh)) {
+            ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_REMOVE, &neigh->key,
+                                     NULL);
         }
+
+        list_remove(&neigh->rif_node);
+        ops_sai_neighbor_delete(neigh);
     }
 
+    /* Nothing may refer to router interface once it is removed */
+    ops_sai_neighbor_queue_flush();
+    status = ops_sai_route_pipeline_sync();
+    ERRNO_EXIT(status);
+
     if (bundle->router_intf.created) {
         LIST_FOR_EACH_SAFE(port, next_port, bundle_node, &bundle->ports) {
             __ofbundle_intf_mac_reconfigure(port, false);
@@ -2002,7 +2010,7 @@ __ofbundle_create(struct ofproto_sai *ofproto, void *aux,
     hmap_init(&bundle->ipv4_secondary);
     hmap_init(&bundle->ipv6_secondary);
     hmap_init(&bundle->local_routes);
-    hmap_init(&bundle->neighbors);
+    list_init(&bundle->neighbors);
 
     __bundle_cache_init(bundle);
 
@@ -2107,7 +2115,6 @@ __ofbundle_destroy(struct ofbundle_sai *bundle, bool delete_config_only)
         hmap_destroy(&bundle->ipv4_secondary);
         hmap_destroy(&bundle->ipv6_secondary);
         hmap_destroy(&bundle->local_routes);
-        hmap_destroy(&bundle->neighbors);
         hmap_remove(&bundle->ofproto->bundles, &bundle->hmap_node);
 
         //__bundle_cache_free(bundle);
@@ -2200,6 +2207,7 @@ static void __ofproto_lag_create(struct ofbundle_sai *bundle)
 
     bundle->lag_info.is_lag = true;
     ops_sai_lag_get_handle_id(bundle->lag_info.lag_id, &bundle->lag_info.lag_hw_handle);
+    sai_mac_learning_port_add(bundle->lag_info.lag_hw_handle, bundle->name);
 
     port_ = (struct port *)bundle->aux;
     port_->bond_hw_handle = bundle->lag_info.lag_id;
@@ -2218,6 +2226,7 @@ static void __ofproto_lag_destroy(struct ofbundle_sai *bundle)
         __ofproto_lag_port_update(bundle->lag_info.lag_id, port, false /*del*/);
     }
 
+    sai_mac_learning_port_del(bundle->lag_info.lag_hw_handle, bundle->name);
     ops_sai_lag_remove(bundle->lag_info.lag_id);
 
     bundle->lag_info.is_lag = false;
@@ -2702,64 +2711,6 @@ __get_datapath_version(const struct ofproto *ofproto_ OVS_UNUSED)
     return strdup(SAI_DATAPATH_VERSION);
 }
 
-static struct neigbor_entry*
-__neigh_entry_hash_find(const char *ip_addr,
-                        const struct ofbundle_sai *bundle)
-{
-    struct neigbor_entry* neigh_entry = NULL;
-
-    ovs_assert(ip_addr);
-    ovs_assert(bundle);
-
-    HMAP_FOR_EACH_WITH_HASH(neigh_entry, neigh_node, hash_string(ip_addr, 0),
-                            &bundle->neighbors) {
-        if (STR_EQ(neigh_entry->ip_address, ip_addr)) {
-            return neigh_entry;
-        }
-    }
-
-    return NULL;
-}
-
-static void
-__neigh_entry_hash_add(const char *mac_address,
-                       const char *ip_addr,
-                       struct ofbundle_sai *bundle)
-{
-    struct neigbor_entry* neigh_entry = NULL;
-
-    ovs_assert(mac_address);
-    ovs_assert(ip_addr);
-    ovs_assert(bundle);
-
-    if (NULL == __neigh_entry_hash_find(ip_addr, bundle)) {
-        neigh_entry = xzalloc(sizeof *neigh_entry);
-        neigh_entry->mac_address = xstrdup(mac_address);
-        neigh_entry->ip_address  = xstrdup(ip_addr);
-
-        hmap_insert(&bundle->neighbors, &neigh_entry->neigh_node,
-                    hash_string(neigh_entry->ip_address, 0));
-    }
-}
-
-static void
-__neigh_entry_hash_remove(const char *ip_addr,
-                          struct ofbundle_sai *bundle)
-{
-    struct neigbor_entry* neigh_entry = NULL;
-
-    ovs_assert(ip_addr);
-    ovs_assert(bundle);
-
-    neigh_entry = __neigh_entry_hash_find(ip_addr, bundle);
-    if (NULL != neigh_entry) {
-        hmap_remove(&bundle->neighbors, &neigh_entry->neigh_node);
-        free(neigh_entry->ip_address);
-        free(neigh_entry->mac_address);
-        free(neigh_entry);
-    }
-}
-
 static int
 __add_l3_host_entry(const struct ofproto *ofproto_, void *aux,
                     bool is_ipv6_addr, char *ip_addr,
@@ -2768,7 +2719,9 @@ __add_l3_host_entry(const struct ofproto *ofproto_, void *aux,
     int status = 0;
     struct ofproto_sai *ofproto = ofproto_sai_cast(ofproto_);
     struct ofbundle_sai *bundle = __ofbundle_lookup(ofproto, aux);
-    struct neigbor_entry *neigh = NULL;
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
+    struct ether_addr mac;
 
     SAI_API_TRACE_FN();
 
@@ -2783,9 +2736,20 @@ __add_l3_host_entry(const struct ofproto *ofproto_, void *aux,
 
     ovs_assert(bundle->router_intf.created);
 
-    neigh = __neigh_entry_hash_find(ip_addr, bundle);
+    memset(&mac, 0, sizeof(mac));
+    if (ops_sai_neighbor_key_init(&key, &ofproto->vrid,
+                                  &bundle->router_intf.rifid, ip_addr) ||
+        (0 != strnlen(next_hop_mac_addr, MAC_STR_LEN) &&
+         NULL == ether_aton_r(next_hop_mac_addr, &mac))) {
+        VLOG_ERR("Invalid neighbor entry (ip address: %s, MAC: %s)",
+                 ip_addr, next_hop_mac_addr);
+        status = EINVAL;
+        goto exit;
+    }
+
+    neigh = ops_sai_neighbor_lookup(&key);
 
-    if (NULL != neigh && STR_EQ(neigh->mac_address, next_hop_mac_addr)) {
+    if (NULL != neigh && 0 == memcmp(&neigh->mac, &mac, sizeof(mac))) {
         VLOG_WARN("Not adding neighbor entry as it was already added"
                   "(ip address: %s, MAC: %s rifid: %lu)",
                   ip_addr, next_hop_mac_addr,
@@ -2796,18 +2760,25 @@ __add_l3_host_entry(const struct ofproto *ofproto_, void *aux,
                       "(ip address: %s, rifid: %lu). Don't passing it to asic",
                       ip_addr, bundle->router_intf.rifid.data);
         } else {
-            if (NULL != neigh &&
-                0 == strnlen(neigh->mac_address,
-                             MAC_STR_LEN)) {
-                __neigh_entry_hash_remove(ip_addr, bundle);
+            /* Programmed in bulk from __type_run() */
+            if (NULL != neigh && ops_sai_neighbor_is_resolved(neigh)) {
+                /* MAC address changed, next hop stays up */
+                ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_SET, &key, &mac);
+                ops_sai_neighbor_mac_set(neigh, &mac);
+            } else {
+                ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_CREATE, &key,
+                                         &mac);
             }
-            status = ops_sai_neighbor_create(is_ipv6_addr,
-                                             ip_addr,
-                                             next_hop_mac_addr,
-                                             &bundle->router_intf.rifid);
-            ERRNO_EXIT(status);
         }
-        __neigh_entry_hash_add(next_hop_mac_addr, ip_addr, bundle);
+
+        if (NULL == neigh) {
+            neigh = ops_sai_neighbor_insert(&key);
+            list_push_back(&bundle->neighbors, &neigh->rif_node);
+        }
+        if (!ops_sai_neighbor_is_resolved(neigh) &&
+            0 != strnlen(next_hop_mac_addr, MAC_STR_LEN)) {
+            ops_sai_neighbor_mac_set(neigh, &mac);
+        }
         *l3_egress_id = 1;
     }
 
@@ -2824,7 +2795,8 @@ __delete_l3_host_entry(const struct ofproto *ofproto_, void *aux,
     int status = 0;
     struct ofproto_sai *ofproto = ofproto_sai_cast(ofproto_);
     struct ofbundle_sai *bundle = __ofbundle_lookup(ofproto, aux);
-    struct neigbor_entry *neigh = NULL;
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
 
     SAI_API_TRACE_FN();
 
@@ -2838,16 +2810,22 @@ __delete_l3_host_entry(const struct ofproto *ofproto_, void *aux,
 
     ovs_assert(bundle->router_intf.created);
 
-    neigh = __neigh_entry_hash_find(ip_addr, bundle);
+    if (ops_sai_neighbor_key_init(&key, &ofproto->vrid,
+                                  &bundle->router_intf.rifid,
+                                  ip_addr)) {
+        VLOG_ERR("Invalid neighbor IP address %s", ip_addr);
+        status = EINVAL;
+        goto exit;
+    }
+
+    neigh = ops_sai_neighbor_lookup(&key);
 
     if (NULL != neigh){
-        if (0 != strnlen(neigh->mac_address, MAC_STR_LEN)) {
-            status = ops_sai_neighbor_remove(is_ipv6_addr,
-                                             ip_addr,
-                                             &bundle->router_intf.rifid);
-            ERRNO_EXIT(status);
+        if (ops_sai_neighbor_is_resolved(neigh)) {
+            ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_REMOVE, &key, NULL);
         }
-        __neigh_entry_hash_remove(ip_addr, bundle);
+        list_remove(&neigh->rif_node);
+        ops_sai_neighbor_delete(neigh);
         *l3_egress_id = -1;
     }
 
@@ -2864,27 +2842,33 @@ __get_l3_host_hit_bit(const struct ofproto *ofproto_, void *aux,
     int status = 0;
     struct ofproto_sai *ofproto = ofproto_sai_cast(ofproto_);
     struct ofbundle_sai *bundle = __ofbundle_lookup(ofproto, aux);
-    struct neigbor_entry *neigh = NULL;
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
 
     SAI_API_TRACE_FN();
 
     ovs_assert(ip_addr);
     ovs_assert(hit_bit);
 
-     neigh = __neigh_entry_hash_find(ip_addr, bundle);
+    if (ops_sai_neighbor_key_init(&key, &ofproto->vrid,
+                                  &bundle->router_intf.rifid,
+                                  ip_addr)) {
+        VLOG_ERR("Invalid neighbor IP address %s", ip_addr);
+        status = EINVAL;
+        goto exit;
+    }
+
+     neigh = ops_sai_neighbor_lookup(&key);
 
     if (NULL != neigh) {
-        if (0 == strnlen(neigh->mac_address, MAC_STR_LEN)) {
+        if (!ops_sai_neighbor_is_resolved(neigh)) {
             VLOG_INFO("Not getting neighbor activity for entry with "
                       "empty MAC address(ip address: %s, rif: %lu)",
                       ip_addr, bundle->router_intf.rifid.data);
             *hit_bit = false;
         } else {
-            status = ops_sai_neighbor_activity_get(is_ipv6_addr,
-                                                   ip_addr,
-                                                   &bundle->router_intf.rifid,
-                                                   hit_bit);
-            ERRNO_EXIT(status);
+            /* Read by the activity scanner in bulk */
+            *hit_bit = ops_sai_neighbor_activity_test(neigh);
             }
         } else {
             *hit_bit = false;
@@ -2911,9 +2895,14 @@ __l3_route_action(const struct ofproto *ofprotop,
     char *egress_intf[routep->n_nexthops];
     struct ofbundle_sai *bundle = NULL;
     struct ip_address *addr = NULL;
+    struct ops_sai_prefix prefix;
 
     SAI_API_TRACE_FN();
 
+    /* Parse the prefix once; route class functions below hit the cache */
+    status = ops_sai_route_prefix_get(routep->prefix, &prefix);
+    ERRNO_LOG_EXIT(status, "Invalid route prefix %s", routep->prefix);
+
     for (uint32_t index=0; index < routep->n_nexthops; index ++) {
         struct ofproto_route_nexthop *nh = &(routep->nexthops[index]);
 
@@ -2934,22 +2923,31 @@ __l3_route_action(const struct ofproto *ofprotop,
     if (rnh_count) {
         ovs_assert(lnh_count == 0);
 
+        /* Route adds, deletes and next hop deletes are batched and
+         * submitted to the route worker in __run(), so they return 0 before
+         * anything is programmed. Entries the worker fails are logged and
+         * counted in sai/route/coalesce. */
         switch (action) {
         case OFPROTO_ROUTE_ADD:
-            status = ops_sai_route_remote_add(sai_ofproto->vrid,
-                                              routep->prefix,
-                                              rnh_count,
-                                              next_hops);
+            ops_sai_route_batch_add(&sai_ofproto->route_batch,
+                                    OPS_SAI_ROUTE_BATCH_ADD,
+                                    routep->prefix,
+                                    rnh_count,
+                                    next_hops);
             break;
         case OFPROTO_ROUTE_DELETE_NH:
-            status = ops_sai_route_remote_nh_remove(sai_ofproto->vrid,
-                                                    routep->prefix,
-                                                    rnh_count,
-                                                    next_hops);
+            ops_sai_route_batch_add(&sai_ofproto->route_batch,
+                                    OPS_SAI_ROUTE_BATCH_DELETE_NH,
+                                    routep->prefix,
+                                    rnh_count,
+                                    next_hops);
             break;
         case OFPROTO_ROUTE_DELETE:
-            status = ops_sai_route_remove(&sai_ofproto->vrid,
-                                          routep->prefix);
+            ops_sai_route_batch_add(&sai_ofproto->route_batch,
+                                    OPS_SAI_ROUTE_BATCH_REMOVE,
+                                    routep->prefix,
+                                    0,
+                                    NULL);
             break;
         default:
             status = -1;
@@ -2959,6 +2957,9 @@ __l3_route_action(const struct ofproto *ofprotop,
         ovs_assert(rnh_count == 0);
         ovs_assert(lnh_count == 1);
 
+        /* Keep order with remote routes queued for the same prefix */
+        ops_sai_route_batch_flush(&sai_ofproto->route_batch);
+
         bundle = __ofbundle_lookup_by_netdev_name(sai_ofproto,
                                                   egress_intf[0]);
         if (bundle && bundle->router_intf.is_loopback) {
@@ -3080,9 +3081,59 @@ static int
 __l3_ecmp_hash_set(const struct ofproto *ofprotop, unsigned int hash,
                              bool enable)
 {
+    int error = 0;
+
+    if (hash & OFPROTO_ECMP_HASH_RESILIENT) {
+        error = ops_sai_route_ecmp_resilient_set(enable);
+        if (error && (EOPNOTSUPP != error || enable)) {
+            VLOG_WARN("Failed to %s resilient ECMP groups (error %d)",
+                      enable ? "enable" : "disable", error);
+        }
+    }
+
     return ops_sai_ecmp_hash_set(hash, enable);
 }
 
+/*
+ * Route and neighbor programming is shared by all bridges and VRFs, so it is
+ * run once per main loop iteration, on behalf of the system type, rather than
+ * from run() of every ofproto.
+ */
+static int
+__type_run(const char *type)
+{
+    if (!STR_EQ(type, SAI_INTERFACE_TYPE_SYSTEM)) {
+        return 0;
+    }
+
+    /* Route programming completes asynchronously on the route worker */
+    ops_sai_route_pipeline_run();
+    ops_sai_route_aggregate_run();
+    ops_sai_route_snapshot_run();
+    ops_sai_route_walk_run();
+    ops_sai_neighbor_queue_run();
+    ops_sai_route_park_run();
+    ops_sai_neighbor_activity_run();
+
+    return 0;
+}
+
+static void
+__type_wait(const char *type)
+{
+    if (!STR_EQ(type, SAI_INTERFACE_TYPE_SYSTEM)) {
+        return;
+    }
+
+    ops_sai_route_pipeline_wait();
+    ops_sai_route_aggregate_wait();
+    ops_sai_route_snapshot_wait();
+    ops_sai_route_walk_wait();
+    ops_sai_neighbor_queue_wait();
+    ops_sai_route_park_wait();
+    ops_sai_neighbor_activity_wait();
+}
+
 static int
 __run(struct ofproto *ofproto_)
 {
@@ -3090,6 +3141,8 @@ __run(struct ofproto *ofproto_)
 
     SAI_API_TRACE_FN();
 
+    ops_sai_route_batch_run(&ofproto->route_batch);
+
     if (ofproto->sflow) {
         sai_sflow_run(ofproto->sflow);
     }
@@ -3104,6 +3157,8 @@ __wait(struct ofproto *ofproto_)
 
     SAI_API_TRACE_FN();
 
+    ops_sai_route_batch_wait(&ofproto->route_batch);
+
     if (ofproto->sflow) {
         sai_sflow_wait(ofproto->sflow);
     }
@@ -0,0 +1,182 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#include <sai-log.h>
+#include <sai-resource.h>
+#include <sai-route.h>
+#include <sai-api-class.h>
+#include <dynamic-string.h>
+#include "unixctl.h"
+
+VLOG_DEFINE_THIS_MODULE(sai_resource);
+
+/* Usage of one table. Capacity 0 means the switch did not report it and
+ * nothing is rejected. */
+struct resource_usage {
+    const char  *name;
+    uint32_t    capacity;
+    uint32_t    used;
+    uint32_t    peak;
+    uint64_t    rejected;
+};
+
+/* Routes, next hops and groups are touched by the route programming worker
+ * only, or by the main thread after ops_sai_route_pipeline_sync(), so usage
+ * needs no locking. */
+static struct resource_usage resources[OPS_SAI_RESOURCE_MAX] = {
+    [OPS_SAI_RESOURCE_ROUTE]    = { .name = "route" },
+    [OPS_SAI_RESOURCE_NEXTHOP]  = { .name = "nexthop" },
+    [OPS_SAI_RESOURCE_NHG]      = { .name = "ecmp group" },
+};
+
+/* Switch attribute holding table capacity. There is no next hop table size
+ * attribute; every resolved next hop needs a neighbor entry, so neighbor
+ * table size bounds it. */
+static const sai_attr_id_t resource_attrs[OPS_SAI_RESOURCE_MAX] = {
+    [OPS_SAI_RESOURCE_ROUTE]    = SAI_SWITCH_ATTR_L3_ROUTE_TABLE_SIZE,
+    [OPS_SAI_RESOURCE_NEXTHOP]  = SAI_SWITCH_ATTR_L3_NEIGHBOR_TABLE_SIZE,
+    [OPS_SAI_RESOURCE_NHG]      = SAI_SWITCH_ATTR_NUMBER_OF_ECMP_GROUPS,
+};
+
+static void
+__resource_capacity_get(enum ops_sai_resource res)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_attribute_t attr;
+    sai_status_t status = SAI_STATUS_SUCCESS;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.id = resource_attrs[res];
+
+    status = sai_api->switch_api->get_switch_attribute(1, &attr);
+    if (SAI_ERROR_2_ERRNO(status)) {
+        VLOG_WARN("Failed to get %s table size, not limited (status: %d)",
+                  resources[res].name, status);
+        return;
+    }
+
+    resources[res].capacity = attr.value.u32;
+    VLOG_INFO("Hardware %s table size %u", resources[res].name,
+              resources[res].capacity);
+}
+
+static int
+__resources_dump(struct ds *ds, int argc OVS_UNUSED,
+                 const char *argv[] OVS_UNUSED)
+{
+    const struct resource_usage *usage = NULL;
+
+    ds_put_format(ds, "%-12s %10s %10s %10s %10s\n", "table", "capacity",
+                  "used", "peak", "rejected");
+    for (int i = 0; i < OPS_SAI_RESOURCE_MAX; i++) {
+        usage = &resources[i];
+        ds_put_format(ds, "%-12s ", usage->name);
+        if (usage->capacity) {
+            ds_put_format(ds, "%10u ", usage->capacity);
+        } else {
+            ds_put_format(ds, "%10s ", "-");
+        }
+        ds_put_format(ds, "%10u %10u %10"PRIu64"\n", usage->used, usage->peak,
+                      usage->rejected);
+    }
+
+    return 0;
+}
+
+static void
+__resources_unixctl_show(struct unixctl_conn *conn, int argc,
+                         const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __resources_dump);
+}
+
+/*
+ * Reads table capacities from the switch. Must be called after SAI API is
+ * initialized and before any route is programmed.
+ */
+void
+ops_sai_resource_init(void)
+{
+    for (int i = 0; i < OPS_SAI_RESOURCE_MAX; i++) {
+        __resource_capacity_get(i);
+    }
+
+    unixctl_command_register("sai/resources/show", "", 0, 0,
+                             __resources_unixctl_show, NULL);
+}
+
+/*
+ * Reserves table entries for objects about to be created. Entries of objects
+ * which then fail to be created must be released.
+ *
+ * @param[in] res   - table
+ * @param[in] count - count of entries
+ *
+ * @return true if entries were reserved, false if the table is full. */
+bool
+ops_sai_resource_admit(enum ops_sai_resource res, uint32_t count)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+    struct resource_usage *usage = &resources[res];
+
+    if (usage->capacity && (usage->used > usage->capacity ||
+                            usage->capacity - usage->used < count)) {
+        usage->rejected++;
+        VLOG_WARN_RL(&rl, "Hardware %s table is full (used: %u, capacity: %u)",
+                     usage->name, usage->used, usage->capacity);
+        return false;
+    }
+
+    usage->used += count;
+    usage->peak = MAX(usage->peak, usage->used);
+
+    return true;
+}
+
+/*
+ * Accounts entries of objects which already exist in hardware, such as ones
+ * taken over on warm restart. They are counted even if the table is then over
+ * its capacity, so that releasing them later stays balanced.
+ *
+ * @param[in] res   - table
+ * @param[in] count - count of entries */
+void
+ops_sai_resource_force_admit(enum ops_sai_resource res, uint32_t count)
+{
+    struct resource_usage *usage = &resources[res];
+
+    usage->used += count;
+    usage->peak = MAX(usage->peak, usage->used);
+
+    if (usage->capacity && usage->used > usage->capacity) {
+        VLOG_WARN("Hardware %s table is over capacity (used: %u, "
+                  "capacity: %u)", usage->name, usage->used, usage->capacity);
+    }
+}
+
+/* Returns table entries of removed objects. */
+void
+ops_sai_resource_release(enum ops_sai_resource res, uint32_t count)
+{
+    struct resource_usage *usage = &resources[res];
+
+    ovs_assert(usage->used >= count);
+    usage->used -= count;
+}
+
+/*
+ * Reports table usage.
+ *
+ * @param[in]  res      - table
+ * @param[out] used     - entries in use
+ * @param[out] capacity - table size, 0 if not known */
+void
+ops_sai_resource_usage_get(enum ops_sai_resource res, uint32_t *used,
+                           uint32_t *capacity)
+{
+    *used = resources[res].used;
+    *capacity = resources[res].capacity;
+}
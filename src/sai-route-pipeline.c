@@ -0,0 +1,434 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#include <sai-log.h>
+#include <sai-route.h>
+#include <stdlib.h>
+
+#include <dynamic-string.h>
+#include <ovs-atomic.h>
+#include <ovs-thread.h>
+#include <seq.h>
+#include <poll-loop.h>
+#include "unixctl.h"
+
+VLOG_DEFINE_THIS_MODULE(sai_route_pipeline);
+
+/*
+ * Route programming worker. Jobs are handed over from the main thread to the
+ * worker and back through two single producer, single consumer rings. The
+ * worker is the only thread touching route state while jobs are in flight.
+ * Next hops and neighbors, periodic passes and appctl commands go through
+ * it as tasks, so the main thread only calls ops_sai_route_pipeline_sync()
+ * for route changes whose result it needs right away.
+ */
+
+#define ROUTE_RING_SIZE     64      /* power of 2 */
+#define ROUTE_RING_MASK     (ROUTE_RING_SIZE - 1)
+
+struct route_ring {
+    struct ops_sai_route_job    *jobs[ROUTE_RING_SIZE];
+    atomic_uint32_t             head;   /* written by producer only */
+    atomic_uint32_t             tail;   /* written by consumer only */
+};
+
+static struct route_ring route_submit_ring;     /* main -> worker */
+static struct route_ring route_done_ring;       /* worker -> main */
+
+static struct seq *route_submit_seq;            /* worker wakeup */
+static struct seq *route_done_seq;              /* main loop wakeup */
+static uint64_t route_done_seqno;
+
+/* Main thread blocking in ops_sai_route_pipeline_sync() */
+static struct ovs_mutex route_done_mutex = OVS_MUTEX_INITIALIZER;
+static pthread_cond_t route_done_cond;
+
+/* Jobs submitted and not completed yet. Main thread only. */
+static size_t route_n_inflight;
+
+/* Entries of completed jobs which failed. Main thread only. */
+static uint64_t route_n_failed;
+
+DEFINE_STATIC_PER_THREAD_DATA(bool, route_is_worker, false);
+
+static bool
+__ring_push(struct route_ring *ring, struct ops_sai_route_job *job)
+{
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    atomic_read_explicit(&ring->head, &head, memory_order_relaxed);
+    atomic_read_explicit(&ring->tail, &tail, memory_order_acquire);
+    if (head - tail == ROUTE_RING_SIZE) {
+        return false;
+    }
+
+    ring->jobs[head & ROUTE_RING_MASK] = job;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+static struct ops_sai_route_job *
+__ring_pop(struct route_ring *ring)
+{
+    struct ops_sai_route_job *job = NULL;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    atomic_read_explicit(&ring->tail, &tail, memory_order_relaxed);
+    atomic_read_explicit(&ring->head, &head, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+
+    job = ring->jobs[tail & ROUTE_RING_MASK];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return job;
+}
+
+static void
+__job_execute(struct ops_sai_route_job *job)
+{
+    int status = 0;
+    int rc = 0;
+
+    if (job->n_removes) {
+        status = ops_sai_route_remove_bulk(&job->vrid, job->removes,
+                                           job->n_removes);
+    }
+
+    if (job->n_sets) {
+        rc = ops_sai_route_remote_set_bulk(job->vrid, job->sets, job->n_sets);
+        if (!status) {
+            status = rc;
+        }
+    }
+
+    if (job->n_adds) {
+        rc = ops_sai_route_remote_add_bulk(job->vrid, job->adds, job->n_adds);
+        if (!status) {
+            status = rc;
+        }
+    }
+
+    /* After the adds, so a route losing some next hops to others added in
+     * the same window is not removed in between */
+    if (job->n_nh_removes) {
+        rc = ops_sai_route_remote_nh_remove_bulk(job->vrid, job->nh_removes,
+                                                 job->n_nh_removes);
+        if (!status) {
+            status = rc;
+        }
+    }
+
+    job->status = status;
+
+    if (job->execute) {
+        status = job->execute(job->aux);
+        if (!job->status) {
+            job->status = status;
+        }
+    }
+}
+
+static void *
+__route_worker_main(void *aux OVS_UNUSED)
+{
+    struct ops_sai_route_job *job = NULL;
+    uint64_t seqno = 0;
+
+    *route_is_worker_get() = true;
+
+    for (;;) {
+        seqno = seq_read(route_submit_seq);
+
+        while ((job = __ring_pop(&route_submit_ring))) {
+            __job_execute(job);
+
+            /* Never full, there are no more jobs than ring entries */
+            ovs_assert(__ring_push(&route_done_ring, job));
+
+            ovs_mutex_lock(&route_done_mutex);
+            xpthread_cond_broadcast(&route_done_cond);
+            ovs_mutex_unlock(&route_done_mutex);
+            seq_change(route_done_seq);
+        }
+
+        seq_wait(route_submit_seq, seqno);
+        poll_block();
+    }
+
+    return NULL;
+}
+
+static void
+__pipeline_start(void)
+{
+    static struct ovsthread_once once = OVSTHREAD_ONCE_INITIALIZER;
+
+    if (ovsthread_once_start(&once)) {
+        route_submit_seq = seq_create();
+        route_done_seq = seq_create();
+        route_done_seqno = seq_read(route_done_seq);
+        xpthread_cond_init(&route_done_cond, NULL);
+        ovs_thread_create("sai_route", __route_worker_main, NULL);
+        ovsthread_once_done(&once);
+    }
+}
+
+static void
+__job_entries_free(struct ops_sai_route_bulk_entry *entries, size_t n_entries)
+{
+    for (size_t i = 0; i < n_entries; i++) {
+        for (uint32_t j = 0; j < entries[i].next_hop_count; j++) {
+            free(entries[i].next_hops[j]);
+        }
+        free(entries[i].next_hops);
+        free(entries[i].prefix);
+    }
+    free(entries);
+}
+
+static void
+__job_entries_log(const struct ops_sai_route_bulk_entry *entries,
+                  size_t n_entries, const char *op)
+{
+    for (size_t i = 0; i < n_entries; i++) {
+        if (entries[i].status) {
+            route_n_failed++;
+            VLOG_ERR("Failed to %s remote route (prefix: %s, status: %d)",
+                     op, entries[i].prefix, entries[i].status);
+        }
+    }
+}
+
+/* Applies completed jobs. Returns status of the first failed one. */
+static int
+__pipeline_complete(void)
+{
+    struct ops_sai_route_job *job = NULL;
+    int status = 0;
+
+    while ((job = __ring_pop(&route_done_ring))) {
+        route_n_inflight--;
+
+        __job_entries_log(job->removes, job->n_removes, "remove");
+        __job_entries_log(job->sets, job->n_sets, "replace");
+        __job_entries_log(job->adds, job->n_adds, "add");
+        __job_entries_log(job->nh_removes, job->n_nh_removes,
+                          "remove next hops of");
+        if (!status) {
+            status = job->status;
+        }
+        if (job->complete) {
+            job->complete(job->aux);
+        }
+
+        __job_entries_free(job->removes, job->n_removes);
+        __job_entries_free(job->sets, job->n_sets);
+        __job_entries_free(job->adds, job->n_adds);
+        __job_entries_free(job->nh_removes, job->n_nh_removes);
+        free(job);
+    }
+
+    return status;
+}
+
+/* Blocks until at least one job in flight completes and applies it. */
+static int
+__pipeline_wait_completion(void)
+{
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    ovs_mutex_lock(&route_done_mutex);
+    for (;;) {
+        atomic_read_explicit(&route_done_ring.tail, &tail,
+                             memory_order_relaxed);
+        atomic_read_explicit(&route_done_ring.head, &head,
+                             memory_order_acquire);
+        if (head != tail) {
+            break;
+        }
+        ovs_mutex_cond_wait(&route_done_cond, &route_done_mutex);
+    }
+    ovs_mutex_unlock(&route_done_mutex);
+
+    return __pipeline_complete();
+}
+
+/*
+ * Hands job over to the route programming worker. Blocks while the worker
+ * has as many jobs as it can hold. Job and its entries are freed when the
+ * job is completed.
+ *
+ * @param[in] job - job allocated with malloc
+ */
+void
+ops_sai_route_pipeline_submit(struct ops_sai_route_job *job)
+{
+    __pipeline_start();
+
+    while (route_n_inflight == ROUTE_RING_SIZE) {
+        __pipeline_wait_completion();
+    }
+
+    VLOG_DBG("Submitting %"PRIuSIZE" route removes, %"PRIuSIZE" replaces, "
+             "%"PRIuSIZE" adds and %"PRIuSIZE" next hop removes%s",
+             job->n_removes, job->n_sets, job->n_adds, job->n_nh_removes,
+             job->execute ? " and a task" : "");
+
+    route_n_inflight++;
+    ovs_assert(__ring_push(&route_submit_ring, job));
+    seq_change(route_submit_seq);
+}
+
+/*
+ * Hands task over to the route programming worker. Tasks are executed in
+ * order with route jobs.
+ *
+ * @param[in] execute  - run by the worker, returns 0 or errno
+ * @param[in] complete - run on the main thread once the task is done, may be
+ *                       NULL
+ * @param[in] aux      - argument of both
+ */
+void
+ops_sai_route_pipeline_task(int (*execute)(void *aux),
+                            void (*complete)(void *aux), void *aux)
+{
+    struct ops_sai_route_job *job = xzalloc(sizeof(*job));
+
+    job->execute = execute;
+    job->complete = complete;
+    job->aux = aux;
+    ops_sai_route_pipeline_submit(job);
+}
+
+/* Appctl command waiting for the worker */
+struct route_unixctl {
+    struct unixctl_conn         *conn;
+    ops_sai_route_unixctl_clb_t fn;
+    int                         argc;
+    char                        **argv;
+    struct ds                   ds;
+    int                         status;
+};
+
+static int
+__unixctl_execute(void *aux)
+{
+    struct route_unixctl *cmd = aux;
+
+    cmd->status = cmd->fn(&cmd->ds, cmd->argc, (const char **) cmd->argv);
+
+    return 0;
+}
+
+static void
+__unixctl_complete(void *aux)
+{
+    struct route_unixctl *cmd = aux;
+    const char *reply = cmd->ds.length ? ds_cstr(&cmd->ds) : NULL;
+
+    if (cmd->status) {
+        unixctl_command_reply_error(cmd->conn, reply);
+    } else {
+        unixctl_command_reply(cmd->conn, reply);
+    }
+
+    for (int i = 0; i < cmd->argc; i++) {
+        free(cmd->argv[i]);
+    }
+    free(cmd->argv);
+    ds_destroy(&cmd->ds);
+    free(cmd);
+}
+
+/*
+ * Runs appctl command on the route programming worker, in order with route
+ * jobs, and replies once it is done. The main loop does not wait for it.
+ *
+ * @param[in] conn - connection to reply to
+ * @param[in] argc - count of arguments
+ * @param[in] argv - arguments, copied
+ * @param[in] fn   - command
+ */
+void
+ops_sai_route_pipeline_unixctl(struct unixctl_conn *conn, int argc,
+                               const char *argv[],
+                               ops_sai_route_unixctl_clb_t fn)
+{
+    struct route_unixctl *cmd = xzalloc(sizeof(*cmd));
+
+    cmd->conn = conn;
+    cmd->fn = fn;
+    cmd->argc = argc;
+    cmd->argv = xmalloc(argc * sizeof(*cmd->argv));
+    for (int i = 0; i < argc; i++) {
+        cmd->argv[i] = xstrdup(argv[i]);
+    }
+    ds_init(&cmd->ds);
+
+    ops_sai_route_pipeline_task(__unixctl_execute, __unixctl_complete, cmd);
+}
+
+/*
+ * Waits until the worker is done with all jobs and applies their completions.
+ * Must be called before touching route state from the main thread. No-op on
+ * the worker itself.
+ *
+ * @return 0 if all jobs completed succeeded, status of the first failure
+ *         otherwise.
+ */
+int
+ops_sai_route_pipeline_sync(void)
+{
+    int status = 0;
+    int rc = 0;
+
+    if (*route_is_worker_get()) {
+        return 0;
+    }
+
+    while (route_n_inflight) {
+        rc = __pipeline_wait_completion();
+        if (!status) {
+            status = rc;
+        }
+    }
+
+    return status;
+}
+
+/* Applies completions posted by the worker. Called from ofproto type_run(). */
+void
+ops_sai_route_pipeline_run(void)
+{
+    if (!route_n_inflight) {
+        return;
+    }
+
+    route_done_seqno = seq_read(route_done_seq);
+    __pipeline_complete();
+}
+
+/* Wakes up the main loop when the worker completes a job. */
+void
+ops_sai_route_pipeline_wait(void)
+{
+    if (route_n_inflight) {
+        seq_wait(route_done_seq, route_done_seqno);
+    }
+}
+
+/* Count of route entries failed by the worker since start. */
+uint64_t
+ops_sai_route_pipeline_failures(void)
+{
+    return route_n_failed;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#include <sai-log.h>
+#include <sai-route-trie.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+VLOG_DEFINE_THIS_MODULE(sai_route_trie);
+
+#define ROUTE_TRIE_SLAB_NODES   1024
+
+/*
+ * Trie node. A node either holds a route (data != NULL) or is a glue node
+ * joining two subtrees which diverge at bit 'len'. Glue nodes always have
+ * two children, so there are never more glue nodes than routes.
+ */
+struct route_trie_node {
+    struct route_trie_node  *child[2];
+    void                    *data;
+    uint8_t                 len;
+    uint8_t                 addr[OPS_SAI_IP_ADDR_MAX_LEN];
+};
+
+/* Tries of one VRF, first for IPv4 and second for IPv6 */
+struct route_trie_vrf {
+    struct hmap_node        node;
+    int                     vrf;
+    struct route_trie_node  *root[2];
+    size_t                  n_routes;
+};
+
+struct route_trie_slab {
+    struct route_trie_slab  *next;
+    struct route_trie_node  nodes[ROUTE_TRIE_SLAB_NODES];
+};
+
+static struct hmap all_trie_vrf = HMAP_INITIALIZER(&all_trie_vrf);
+
+static struct route_trie_slab *trie_slabs;
+static struct route_trie_node *trie_free_nodes;
+static size_t trie_n_slabs;
+static size_t trie_n_nodes;
+
+static struct route_trie_node *
+__trie_node_alloc(const uint8_t *addr, uint8_t len, void *data)
+{
+    struct route_trie_node *node = NULL;
+
+    if (!trie_free_nodes) {
+        struct route_trie_slab *slab = xmalloc(sizeof *slab);
+        size_t i = 0;
+
+        for (i = 0; i < ROUTE_TRIE_SLAB_NODES; i++) {
+            slab->nodes[i].child[0] = trie_free_nodes;
+            trie_free_nodes = &slab->nodes[i];
+        }
+        slab->next = trie_slabs;
+        trie_slabs = slab;
+        trie_n_slabs++;
+    }
+
+    node = trie_free_nodes;
+    trie_free_nodes = node->child[0];
+    trie_n_nodes++;
+
+    memset(node, 0, sizeof *node);
+    memcpy(node->addr, addr, (len + 7) / 8);
+    node->len = len;
+    node->data = data;
+
+    return node;
+}
+
+static void
+__trie_node_free(struct route_trie_node *node)
+{
+    node->child[0] = trie_free_nodes;
+    trie_free_nodes = node;
+    trie_n_nodes--;
+}
+
+static inline int
+__trie_bit(const uint8_t *addr, uint8_t pos)
+{
+    return (addr[pos / 8] >> (7 - pos % 8)) & 1;
+}
+
+/* Count leading bits (up to max_len) equal in both addresses */
+static uint8_t
+__trie_common_len(const uint8_t *a, const uint8_t *b, uint8_t max_len)
+{
+    uint8_t len = 0;
+    uint8_t diff = 0;
+
+    while (len + 8 <= max_len && a[len / 8] == b[len / 8]) {
+        len += 8;
+    }
+    if (len >= max_len) {
+        return max_len;
+    }
+
+    diff = a[len / 8] ^ b[len / 8];
+    while (len < max_len && !(diff & (0x80 >> (len % 8)))) {
+        len++;
+    }
+
+    return len;
+}
+
+static inline bool
+__trie_node_covers(const struct route_trie_node *node, const uint8_t *addr)
+{
+    return __trie_common_len(node->addr, addr, node->len) == node->len;
+}
+
+static inline int
+__trie_family_index(uint8_t family)
+{
+    return AF_INET6 == family;
+}
+
+static inline uint8_t
+__trie_family_max_len(uint8_t family)
+{
+    return AF_INET6 == family ? 128 : 32;
+}
+
+static struct route_trie_vrf *
+__trie_vrf_get(int vrf, bool create)
+{
+    struct route_trie_vrf *trie_vrf = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(trie_vrf, node, hash_int(vrf, 0), &all_trie_vrf) {
+        if (trie_vrf->vrf == vrf) {
+            return trie_vrf;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    trie_vrf = xzalloc(sizeof *trie_vrf);
+    trie_vrf->vrf = vrf;
+    hmap_insert(&all_trie_vrf, &trie_vrf->node, hash_int(vrf, 0));
+
+    return trie_vrf;
+}
+
+/*
+ * Inserts route data for the prefix. Existing data of the same prefix is
+ * replaced.
+ *
+ * @param[in] key  - vrf and prefix
+ * @param[in] data - route, must not be NULL
+ *
+ * @return 0 on success, errno otherwise. */
+int
+ops_sai_route_trie_insert(const struct ops_sai_route_key *key, void *data)
+{
+    const struct ops_sai_prefix *prefix = &key->prefix;
+    struct route_trie_vrf *trie_vrf = NULL;
+    struct route_trie_node **link = NULL;
+    struct route_trie_node *node = NULL;
+    struct route_trie_node *leaf = NULL;
+    struct route_trie_node *glue = NULL;
+    uint8_t common = 0;
+
+    if (!data || prefix->len > __trie_family_max_len(prefix->family)) {
+        return EINVAL;
+    }
+
+    trie_vrf = __trie_vrf_get(key->vrf, true);
+    link = &trie_vrf->root[__trie_family_index(prefix->family)];
+
+    while ((node = *link)) {
+        common = __trie_common_len(node->addr, prefix->addr,
+                                   MIN(node->len, prefix->len));
+        if (common < node->len) {
+            break;
+        }
+        if (node->len == prefix->len) {
+            if (!node->data) {
+                trie_vrf->n_routes++;
+            }
+            node->data = data;
+            return 0;
+        }
+        link = &node->child[__trie_bit(prefix->addr, node->len)];
+    }
+
+    leaf = __trie_node_alloc(prefix->addr, prefix->len, data);
+    trie_vrf->n_routes++;
+
+    if (!node) {
+        *link = leaf;
+    } else if (common == prefix->len) {
+        /* New prefix covers the node */
+        leaf->child[__trie_bit(node->addr, common)] = node;
+        *link = leaf;
+    } else {
+        glue = __trie_node_alloc(prefix->addr, common, NULL);
+        glue->child[__trie_bit(node->addr, common)] = node;
+        glue->child[__trie_bit(prefix->addr, common)] = leaf;
+        *link = glue;
+    }
+
+    return 0;
+}
+
+/*
+ * Removes the prefix from the trie.
+ *
+ * @param[in] key - vrf and prefix
+ *
+ * @return data stored for the prefix or NULL if it was not found. */
+void *
+ops_sai_route_trie_remove(const struct ops_sai_route_key *key)
+{
+    const struct ops_sai_prefix *prefix = &key->prefix;
+    struct route_trie_vrf *trie_vrf = NULL;
+    struct route_trie_node **link = NULL;
+    struct route_trie_node **parent_link = NULL;
+    struct route_trie_node *node = NULL;
+    struct route_trie_node *parent = NULL;
+    void *data = NULL;
+
+    trie_vrf = __trie_vrf_get(key->vrf, false);
+    if (!trie_vrf) {
+        return NULL;
+    }
+
+    link = &trie_vrf->root[__trie_family_index(prefix->family)];
+    while ((node = *link) && node->len < prefix->len
+           && __trie_node_covers(node, prefix->addr)) {
+        parent_link = link;
+        link = &node->child[__trie_bit(prefix->addr, node->len)];
+    }
+
+    if (!node || node->len != prefix->len || !node->data
+        || !__trie_node_covers(node, prefix->addr)) {
+        return NULL;
+    }
+
+    data = node->data;
+    node->data = NULL;
+    trie_vrf->n_routes--;
+
+    if (node->child[0] && node->child[1]) {
+        /* Stays as glue */
+    } else {
+        *link = node->child[0] ? node->child[0] : node->child[1];
+        __trie_node_free(node);
+
+        /* Parent glue left with a single child is not needed anymore */
+        parent = parent_link ? *parent_link : NULL;
+        if (parent && !parent->data && !*link) {
+            *parent_link = parent->child[0] ? parent->child[0]
+                                            : parent->child[1];
+            __trie_node_free(parent);
+        }
+    }
+
+    if (!trie_vrf->n_routes) {
+        hmap_remove(&all_trie_vrf, &trie_vrf->node);
+        free(trie_vrf);
+    }
+
+    return data;
+}
+
+/* Walks down to the longest route covering addr with length below max_len */
+static void *
+__trie_match(int vrf, uint8_t family, const uint8_t *addr, uint8_t max_len)
+{
+    struct route_trie_vrf *trie_vrf = NULL;
+    struct route_trie_node *node = NULL;
+    void *best = NULL;
+
+    trie_vrf = __trie_vrf_get(vrf, false);
+    if (!trie_vrf) {
+        return NULL;
+    }
+
+    node = trie_vrf->root[__trie_family_index(family)];
+    while (node && node->len <= max_len && __trie_node_covers(node, addr)) {
+        if (node->data) {
+            best = node->data;
+        }
+        if (node->len == __trie_family_max_len(family)) {
+            break;
+        }
+        node = node->child[__trie_bit(addr, node->len)];
+    }
+
+    return best;
+}
+
+/*
+ * Longest prefix match of an address.
+ *
+ * @param[in] vrf    - VRF id
+ * @param[in] family - AF_INET or AF_INET6
+ * @param[in] addr   - address in network byte order
+ *
+ * @return data of the best matching route or NULL. */
+void *
+ops_sai_route_trie_lookup(int vrf, uint8_t family, const uint8_t *addr)
+{
+    return __trie_match(vrf, family, addr, __trie_family_max_len(family));
+}
+
+/*
+ * Finds the longest route strictly shorter than the prefix which covers it.
+ *
+ * @param[in] key - vrf and prefix
+ *
+ * @return data of the covering route or NULL. */
+void *
+ops_sai_route_trie_covering(const struct ops_sai_route_key *key)
+{
+    if (!key->prefix.len) {
+        return NULL;
+    }
+
+    return __trie_match(key->vrf, key->prefix.family, key->prefix.addr,
+                        key->prefix.len - 1);
+}
+
+/*
+ * Reports trie size.
+ *
+ * @param[out] n_routes - routes in all tries
+ * @param[out] n_nodes  - nodes in use, routes and glue
+ * @param[out] n_bytes  - memory held by the node slabs */
+void
+ops_sai_route_trie_stats(size_t *n_routes, size_t *n_nodes, size_t *n_bytes)
+{
+    struct route_trie_vrf *trie_vrf = NULL;
+
+    *n_routes = 0;
+    HMAP_FOR_EACH(trie_vrf, node, &all_trie_vrf) {
+        *n_routes += trie_vrf->n_routes;
+    }
+    *n_nodes = trie_n_nodes;
+    *n_bytes = trie_n_slabs * sizeof(struct route_trie_slab);
+}
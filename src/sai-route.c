@@ -6,121 +6,388 @@
 
 #include <sai-log.h>
 #include <sai-route.h>
+#include <sai-route-trie.h>
+#include <sai-resource.h>
 #include <sai-api-class.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dynamic-string.h>
+#include <ovs-thread.h>
+#include <ovs-atomic.h>
+#include <timeval.h>
+#include <poll-loop.h>
+#include <dirs.h>
+#include "unixctl.h"
 
 VLOG_DEFINE_THIS_MODULE(sai_route);
 
 #undef malloc
 
 #define SAI_NEXT_HOP_MAX    32
-
-#define OPS_ROUTE_HASH_MAXSIZE 64
+#define OPS_SAI_NH_SLAB_SIZE    256
+#define OPS_SAI_NHG_BUCKETS_DEFAULT 64
+#define OPS_SAI_NHG_BUCKETS_MAX     512
+#define OPS_SAI_NH_WEIGHT_DEFAULT   1
+#define OPS_SAI_ROUTE_COALESCE_MSEC_DEFAULT 10
+#define OPS_SAI_ROUTE_COALESCE_MSEC_MAX     1000
+#define OPS_SAI_ROUTE_AGGR_INTERVAL_MSEC    1000
+#define OPS_SAI_ROUTE_AGGR_AUTO_PCT         90
+#define OPS_SAI_ROUTE_AGGR_CHANGED_MAX      65536
+#define OPS_SAI_ROUTE_RECONCILE_MSEC        120000
+#define OPS_SAI_ROUTE_WALK_SLICE_USEC       2000
+#define OPS_SAI_ROUTE_WALK_BATCH            64
+#define OPS_SAI_NH_WEIGHT_MAX       65535
 
 #define COPS_IPV4_ADDR_LEN_IN_BIT        32          /**< IPv4 address length in bit */
+#define COPS_IPV6_ADDR_LEN_IN_BIT        128         /**< IPv6 address length in bit */
 
 #define SAI_IPV4_LEN_TO_MASK(mask, len)  \
     {                           \
         (mask) = (len) ? ~((1 << (COPS_IPV4_ADDR_LEN_IN_BIT - (len))) - 1) : 0; \
     }
 
+#define SAI_IPV6_LEN_TO_MASK(mask, len)  \
+    {                           \
+        int __byte;             \
+        for (__byte = 0; __byte < OPS_SAI_IP_ADDR_MAX_LEN; __byte++) { \
+            (mask)[__byte] = ((len) >= (__byte + 1) * 8) ? 0xff :      \
+                ((len) > __byte * 8) ?                                 \
+                (uint8_t)(0xff << ((__byte + 1) * 8 - (len))) : 0;     \
+        }                       \
+    }
+
 #define SAI_OBJECT_TYPE_SET(objtype,index)  					\
     (((sai_object_id_t)objtype << 32) | (sai_object_id_t)index)
 
 struct hmap all_nexthop     = HMAP_INITIALIZER(&all_nexthop);
-struct hmap all_route       = HMAP_INITIALIZER(&all_route);
 struct hmap all_if_addr     = HMAP_INITIALIZER(&all_if_addr);
 
-struct hmap*
-sai_nexthop_hmap_get_global()
+/* all_nexthop entries are kept in slabs of OPS_SAI_NH_SLAB_SIZE entries, so
+ * an index stays valid for the entry lifetime and routes refer to next hops
+ * by index. Next hops are touched by the route programming worker only:
+ * neighbors resolve them through ops_sai_neighbor_queue_flush(). */
+static struct nh_entry  **nh_slabs;
+static size_t           n_nh_slabs;
+static size_t           allocated_nh_slabs;
+static uint32_t         *nh_free;               /* free indices */
+static size_t           n_nh_free;
+static size_t           allocated_nh_free;
+
+/* Last prefix string parsed by ops_sai_route_prefix_get(). Used by the
+ * main thread only: the route programming worker gets prefixes already
+ * parsed in bulk entries. */
+static struct route_prefix_cache {
+    bool                    valid;
+    char                    str[OPS_SAI_PREFIX_STR_LEN];
+    struct ops_sai_prefix   prefix;
+} route_prefix_cache;
+
+/* Remote route operations are held in the batch for this long, so add and
+ * delete bursts for a prefix collapse into its final state. */
+static unsigned int route_coalesce_msec = OPS_SAI_ROUTE_COALESCE_MSEC_DEFAULT;
+
+/* Routes restored from snapshot on warm restart are stale until added again
+ * or until this deadline, when the rest is removed. 0 when not reconciling.
+ * Hardware entries found already programmed are adopted meanwhile. */
+static long long int route_reconcile_deadline;
+static size_t route_n_stale;                    /* stale routes left */
+
+/* The deadline as seen by the main thread, which hands the end of
+ * reconciliation over to the route programming worker */
+static long long int route_reconcile_timer;
+
+/*
+ * Next hop resolution. A next hop is unresolved from its creation until a
+ * neighbor for it is added. Remote routes whose next hops are all unresolved
+ * are parked when they are programmed: their entries trap packets to CPU,
+ * which makes the kernel resolve the next hops, or drop them. Once
+ * neighbors are added, parked routes with a resolved next hop are promoted
+ * to forwarding in one pass from ofproto type_run(). A programmed route whose
+ * next hops lose their neighbors is left to prefix independent convergence.
+ */
+enum route_park_mode {
+    ROUTE_PARK_OFF = 0,
+    ROUTE_PARK_DROP,
+    ROUTE_PARK_TRAP
+};
+
+static const char *route_park_mode_names[] = { "off", "drop", "trap" };
+
+static enum route_park_mode route_park_mode = ROUTE_PARK_TRAP;
+static struct ovs_list route_parked = OVS_LIST_INITIALIZER(&route_parked);
+static size_t route_n_parked;
+
+/* Set by the worker once a next hop got resolved, cleared by the main thread
+ * when it hands a promotion pass over */
+static atomic_bool route_park_dirty = ATOMIC_VAR_INIT(false);
+
+static struct {
+    uint64_t    parked;
+    uint64_t    promoted;
+    uint64_t    failures;
+} route_park_stats;
+
+static struct {
+    uint64_t        restored;   /* routes loaded from snapshot */
+    uint64_t        unchanged;  /* stale routes added again as they were */
+    uint64_t        updated;    /* stale routes added with other next hops */
+    uint64_t        removed;    /* stale routes not added by the deadline */
+    uint64_t        saves;
+    long long int   last_save;  /* wall clock, msec */
+} route_snap_stats;
+
+/* Coalescing counters of all batches */
+static struct {
+    uint64_t    received;       /* operations queued */
+    uint64_t    merged;         /* operations merged into a pending one */
+    uint64_t    submitted;      /* bulk entries handed to the worker */
+    uint64_t    cancelled;      /* prefixes added and removed in a window */
+    uint64_t    replaced;       /* removes and adds turned into one set */
+    uint64_t    pending;        /* prefixes waiting in batches */
+} route_coalesce_stats;
+
+static inline uint32_t
+ops_sai_nexthop_key_hash(const struct ops_sai_nexthop_key *key)
 {
-    return &all_nexthop;
+    return hash_bytes(key, sizeof(*key), 0);
 }
 
-int
-ops_sai_nh_refcnt_inc(struct nh_entry *p_nh_entry)
+/* Configured next hop weights, also for next hops not used yet */
+struct ops_sai_nh_weight {
+    struct hmap_node            node;
+    struct ops_sai_nexthop_key  key;
+    uint32_t                    weight;
+};
+
+static struct hmap all_nh_weight = HMAP_INITIALIZER(&all_nh_weight);
+
+/* Weights are set per address, whatever the router interface. */
+static void
+ops_sai_nh_weight_key_init(struct ops_sai_nexthop_key *weight_key,
+                           const struct ops_sai_nexthop_key *key)
 {
-    if (NULL != p_nh_entry)
-    {
-        p_nh_entry->ref ++;
+    memset(weight_key, 0, sizeof(*weight_key));
+    weight_key->family = key->family;
+    memcpy(weight_key->addr, key->addr, sizeof(weight_key->addr));
+}
+
+static struct ops_sai_nh_weight *
+ops_sai_nh_weight_lookup(const struct ops_sai_nexthop_key *key)
+{
+    struct ops_sai_nh_weight *nh_weight = NULL;
+    struct ops_sai_nexthop_key weight_key;
+
+    ops_sai_nh_weight_key_init(&weight_key, key);
+    HMAP_FOR_EACH_WITH_HASH(nh_weight, node,
+                            ops_sai_nexthop_key_hash(&weight_key),
+                            &all_nh_weight) {
+        if (!memcmp(&nh_weight->key, &weight_key, sizeof(weight_key))) {
+            return nh_weight;
+        }
     }
 
-    return 0;
+    return NULL;
+}
+
+static uint32_t
+ops_sai_nh_weight_get(const struct ops_sai_nexthop_key *key)
+{
+    struct ops_sai_nh_weight *nh_weight = ops_sai_nh_weight_lookup(key);
+
+    return nh_weight ? nh_weight->weight : OPS_SAI_NH_WEIGHT_DEFAULT;
 }
 
+/*
+ * Fills next hop key from address string.
+ *
+ * @param[out] key  - next hop key
+ * @param[in]  vrid - virtual router ID
+ * @param[in]  rif  - egress router interface ID
+ * @param[in]  addr - IPv4 or IPv6 address string
+ *
+ * @return 0 on success, EINVAL if the string is not an IP address. */
 int
-ops_sai_nh_refcnt_dec(struct nh_entry *p_nh_entry)
+ops_sai_nexthop_key_init(struct ops_sai_nexthop_key *key, uint64_t vrid,
+                         sai_object_id_t rif, const char *addr)
 {
-    if (NULL != p_nh_entry)
-    {
-        p_nh_entry->ref --;
+    memset(key, 0, sizeof(*key));
+    key->vrid = vrid;
+    key->rif = rif;
+
+    if (1 == inet_pton(AF_INET, addr, key->addr)) {
+        key->family = AF_INET;
+    } else if (1 == inet_pton(AF_INET6, addr, key->addr)) {
+        key->family = AF_INET6;
+    } else {
+        return EINVAL;
     }
 
     return 0;
 }
 
-struct nh_entry*
-nexthop_hmap_find_by_id(struct hmap *nh_hmap, char* id)
+/* Returns next hop entry in use at index or NULL. */
+struct nh_entry *
+ops_sai_nexthop_get(uint32_t index)
 {
     struct nh_entry *p_nh_entry = NULL;
-    char            *hashstr    = NULL;
 
-    hashstr = id;
-    HMAP_FOR_EACH_WITH_HASH(p_nh_entry, nh_hmap_node, hash_string(hashstr, 0),
-                            nh_hmap) {
-        if ((strcmp(p_nh_entry->id, id) == 0)){
-            return p_nh_entry;
-        }
+    if (index >= n_nh_slabs * OPS_SAI_NH_SLAB_SIZE) {
+        return NULL;
     }
 
-    return NULL;
+    p_nh_entry = &nh_slabs[index / OPS_SAI_NH_SLAB_SIZE]
+                          [index % OPS_SAI_NH_SLAB_SIZE];
+
+    return p_nh_entry->ref ? p_nh_entry : NULL;
 }
 
-int
-nexthop_hmap_add(struct hmap *nh_hmap, struct nh_entry *nh_entry)
+/* Formats next hop address into buf. Returns buf. */
+const char *
+ops_sai_nexthop_format(uint32_t index, char *buf, size_t len)
 {
-    struct nh_entry *p_nh_entry = NULL;
-    char            *hashstr    = NULL;
+    struct nh_entry *p_nh_entry = ops_sai_nexthop_get(index);
 
-    if (!nh_entry) {
-        return 1;
+    if (!p_nh_entry || !inet_ntop(p_nh_entry->key.family, p_nh_entry->key.addr,
+                                  buf, len)) {
+        snprintf(buf, len, "<invalid>");
     }
 
-    p_nh_entry = nexthop_hmap_find_by_id(nh_hmap, nh_entry->id);
-    if (NULL == p_nh_entry) {
-        nh_entry->ref = 1;
+    return buf;
+}
+
+static struct nh_entry *
+ops_sai_nexthop_alloc(void)
+{
+    struct nh_entry *p_nh_entry = NULL;
+    uint32_t        index       = 0;
+    uint32_t        base        = 0;
+
+    if (!n_nh_free) {
+        if (n_nh_slabs == allocated_nh_slabs) {
+            nh_slabs = x2nrealloc(nh_slabs, &allocated_nh_slabs,
+                                  sizeof(*nh_slabs));
+        }
+        while (allocated_nh_free < OPS_SAI_NH_SLAB_SIZE) {
+            nh_free = x2nrealloc(nh_free, &allocated_nh_free,
+                                 sizeof(*nh_free));
+        }
+
+        base = n_nh_slabs * OPS_SAI_NH_SLAB_SIZE;
+        nh_slabs[n_nh_slabs++] = xcalloc(OPS_SAI_NH_SLAB_SIZE,
+                                         sizeof(**nh_slabs));
+        /* Hand out lower indices first */
+        for (index = OPS_SAI_NH_SLAB_SIZE; index > 0; index--) {
+            nh_free[n_nh_free++] = base + index - 1;
+        }
     }
-    else {
-        ops_sai_nh_refcnt_inc(p_nh_entry);
-        return 0;
+
+    index = nh_free[--n_nh_free];
+    p_nh_entry = &nh_slabs[index / OPS_SAI_NH_SLAB_SIZE]
+                          [index % OPS_SAI_NH_SLAB_SIZE];
+    memset(p_nh_entry, 0, sizeof(*p_nh_entry));
+    p_nh_entry->index = index;
+
+    return p_nh_entry;
+}
+
+static void
+ops_sai_nexthop_free(struct nh_entry *p_nh_entry)
+{
+    if (n_nh_free == allocated_nh_free) {
+        nh_free = x2nrealloc(nh_free, &allocated_nh_free, sizeof(*nh_free));
     }
 
-    hashstr = nh_entry->id;
-    hmap_insert(nh_hmap, &nh_entry->nh_hmap_node, hash_string(hashstr, 0));
+    free(p_nh_entry->nhgs);
+    p_nh_entry->nhgs = NULL;
+    p_nh_entry->ref = 0;
+    nh_free[n_nh_free++] = p_nh_entry->index;
+}
 
-    return 0;
+/*
+ * Finds next hop of an address on a router interface.
+ *
+ * @return next hop index or OPS_SAI_NH_INDEX_INVALID. */
+uint32_t
+ops_sai_nexthop_find(const struct ops_sai_nexthop_key *key)
+{
+    struct nh_entry *p_nh_entry = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(p_nh_entry, nh_hmap_node,
+                            ops_sai_nexthop_key_hash(key), &all_nexthop) {
+        if (!memcmp(&p_nh_entry->key, key, sizeof(*key))) {
+            return p_nh_entry->index;
+        }
+    }
+
+    return OPS_SAI_NH_INDEX_INVALID;
 }
 
-int
-nexthop_hmap_delete(struct hmap *nh_hmap, struct nh_entry *nh_entry)
+/*
+ * Takes reference on next hop, creating it in hardware on first use.
+ *
+ * @param[in] key - next hop key
+ *
+ * @return next hop index or OPS_SAI_NH_INDEX_INVALID on failure. */
+uint32_t
+ops_sai_nexthop_ref(const struct ops_sai_nexthop_key *key)
 {
-    if (!nh_entry) {
-        return 1;
+    struct nh_entry *p_nh_entry = NULL;
+    handle_t        l3_egress_id;
+    uint32_t        index       = 0;
+
+    index = ops_sai_nexthop_find(key);
+    if (OPS_SAI_NH_INDEX_INVALID != index) {
+        ops_sai_nexthop_get(index)->ref++;
+        return index;
     }
 
-    if (nh_entry->ref > 1) {
-        ops_sai_nh_refcnt_dec(nh_entry);
-        return 0;
+    if (!ops_sai_resource_admit(OPS_SAI_RESOURCE_NEXTHOP, 1)) {
+        return OPS_SAI_NH_INDEX_INVALID;
     }
 
-    hmap_remove(nh_hmap, &nh_entry->nh_hmap_node);
-    if (nh_entry->id) {
-        free(nh_entry->id);
+    memset(&l3_egress_id, 0, sizeof(l3_egress_id));
+    if (ops_sai_routing_nexthop_create(key, &l3_egress_id)) {
+        ops_sai_resource_release(OPS_SAI_RESOURCE_NEXTHOP, 1);
+        return OPS_SAI_NH_INDEX_INVALID;
     }
 
-    free(nh_entry);
+    p_nh_entry = ops_sai_nexthop_alloc();
+    p_nh_entry->key = *key;
+    p_nh_entry->is_ipv6_addr = (AF_INET6 == key->family);
+    p_nh_entry->handle = l3_egress_id;
+    p_nh_entry->weight = ops_sai_nh_weight_get(key);
+    p_nh_entry->is_down = true;         /* unresolved until neighbor added */
+    p_nh_entry->ref = 1;
+    hmap_insert(&all_nexthop, &p_nh_entry->nh_hmap_node,
+                ops_sai_nexthop_key_hash(key));
+
+    return p_nh_entry->index;
+}
 
-    return 0;
+/* Drops reference on next hop, removing it from hardware on last one. */
+void
+ops_sai_nexthop_unref(uint32_t index)
+{
+    struct nh_entry *p_nh_entry = NULL;
+
+    p_nh_entry = ops_sai_nexthop_get(index);
+    if (!p_nh_entry) {
+        return;
+    }
+
+    if (--p_nh_entry->ref) {
+        return;
+    }
+
+    ops_sai_routing_nexthop_remove(&p_nh_entry->handle);
+    ops_sai_resource_release(OPS_SAI_RESOURCE_NEXTHOP, 1);
+    hmap_remove(&all_nexthop, &p_nh_entry->nh_hmap_node);
+    ops_sai_nexthop_free(p_nh_entry);
 }
 
 struct if_addr*
@@ -198,356 +465,588 @@ if_addr_hmap_delete(struct hmap *if_addr_hmap, struct if_addr *p_if_addr)
     return 0;
 }
 
-struct nh_entry*
-ops_sai_neighbor_get_nexthop(const char* id)
+/* Add nexthop into the route entry */
+static void
+ops_sai_nexthop_add(sai_ops_route_t *route, uint32_t nh_index)
 {
-    struct nh_entry *pst_nh = NULL;
-    struct hmap     *nh_hmap= NULL;
-    char   id_cp[64];
-
-    memset(id_cp, 0x0, sizeof(id_cp));
-    memcpy(id_cp, id, sizeof(id_cp));
-    nh_hmap = sai_nexthop_hmap_get_global();
+    char    prefix_str[OPS_SAI_PREFIX_STR_LEN];
+    char    nh_str[OPS_SAI_PREFIX_STR_LEN];
 
-    if (NULL != nh_hmap) {
-        pst_nh = nexthop_hmap_find_by_id(nh_hmap, id_cp);
-
-        if (NULL != pst_nh) {
-            return pst_nh;
-        }
-    }
+    route->nexthops = xrealloc(route->nexthops, (route->n_nexthops + 1) *
+                               sizeof(*route->nexthops));
+    route->nexthops[route->n_nexthops++] = nh_index;
 
-    return NULL;
+    VLOG_DBG("Add NH %s, for route %s",
+             ops_sai_nexthop_format(nh_index, nh_str, sizeof nh_str),
+             ops_sai_prefix_format(&route->key.prefix, prefix_str,
+                                   sizeof prefix_str));
 }
 
-struct nh_entry*
-ops_sai_neighbor_add_nexthop(const char* id, handle_t *l3_egress_id)
+/* Delete nexthop at position pos from the route entry */
+static void
+ops_sai_nexthop_delete(sai_ops_route_t *route, int pos)
 {
+    char    prefix_str[OPS_SAI_PREFIX_STR_LEN];
+    char    nh_str[OPS_SAI_PREFIX_STR_LEN];
 
-    struct nh_entry *p_nh_entry = NULL;
-    struct hmap     *nh_hmap = NULL;
+    VLOG_DBG("Delete NH %s in route %s",
+             ops_sai_nexthop_format(route->nexthops[pos], nh_str,
+                                    sizeof nh_str),
+             ops_sai_prefix_format(&route->key.prefix, prefix_str,
+                                   sizeof prefix_str));
 
-    nh_hmap = sai_nexthop_hmap_get_global();
-    if (NULL == nh_hmap) {
-        return NULL;
-    }
+    route->nexthops[pos] = route->nexthops[--route->n_nexthops];
+}
 
-    p_nh_entry = xzalloc(sizeof(*p_nh_entry));
-    if (NULL  == p_nh_entry) {
-        return NULL;
-    }
+/* Find position of nexthop in the route's nexthops, -1 if not used */
+static int
+ops_sai_nexthop_lookup(const sai_ops_route_t *route, uint32_t nh_index)
+{
+    int i = 0;
 
-    memset(p_nh_entry, 0, sizeof(*p_nh_entry));
+    for (i = 0; i < route->n_nexthops; i++) {
+        if (route->nexthops[i] == nh_index) {
+            return i;
+        }
+    }
 
-    p_nh_entry->id = xstrdup(id);
-    p_nh_entry->handle.data = l3_egress_id->data;
+    return -1;
+}
 
-    nexthop_hmap_add(nh_hmap, p_nh_entry);
+/* Find position of the route's nexthop of an address, whatever its router
+ * interface, -1 if not used */
+static int
+ops_sai_nexthop_addr_lookup(const sai_ops_route_t *route,
+                            const struct ops_sai_nexthop_key *key)
+{
+    const struct nh_entry *p_nh_entry = NULL;
+    int i = 0;
+
+    for (i = 0; i < route->n_nexthops; i++) {
+        p_nh_entry = ops_sai_nexthop_get(route->nexthops[i]);
+        if (p_nh_entry->key.family == key->family &&
+            !memcmp(p_nh_entry->key.addr, key->addr, sizeof(key->addr))) {
+            return i;
+        }
+    }
 
-    return p_nh_entry;
+    return -1;
 }
 
+/*
+ * Parses "<address>[/<length>]" into binary form. A missing length means a
+ * host route.
+ *
+ * @return 0 on success, EINVAL if the string is not a valid prefix. */
 int
-ops_sai_neighbor_delete_nexthop(const char* id)
+ops_sai_prefix_parse(const char *str, struct ops_sai_prefix *prefix)
 {
+    char            buf[OPS_SAI_PREFIX_STR_LEN];
+    char            *len_str    = NULL;
+    unsigned int    len         = 0;
+    unsigned int    max_len     = 0;
+    unsigned int    bits        = 0;
+    int             i           = 0;
 
-    struct nh_entry *p_nh_entry = NULL;
-    struct hmap* nh_hmap = NULL;
-    char   id_cp[64];
+    memset(prefix, 0, sizeof(*prefix));
 
-    memset(id_cp, 0x0, sizeof(id_cp));
-    memcpy(id_cp, id, sizeof(id_cp));
-    nh_hmap = sai_nexthop_hmap_get_global();
-    if (NULL == nh_hmap) {
-        return -1;
+    if (!str || strlen(str) >= sizeof(buf)) {
+        return EINVAL;
     }
 
-    p_nh_entry = nexthop_hmap_find_by_id(nh_hmap, id_cp);
-    if (NULL != p_nh_entry && p_nh_entry->ref > 1) {
-        ops_sai_nh_refcnt_dec(p_nh_entry);
-        return 1;
+    strcpy(buf, str);
+    len_str = strchr(buf, '/');
+    if (len_str) {
+        *len_str++ = '\0';
     }
 
-    nexthop_hmap_delete(nh_hmap, p_nh_entry);
-
-    return 0;
-}
+    if (1 == inet_pton(AF_INET, buf, prefix->addr)) {
+        prefix->family = AF_INET;
+        max_len = COPS_IPV4_ADDR_LEN_IN_BIT;
+    } else if (1 == inet_pton(AF_INET6, buf, prefix->addr)) {
+        prefix->family = AF_INET6;
+        max_len = COPS_IPV6_ADDR_LEN_IN_BIT;
+    } else {
+        return EINVAL;
+    }
 
-struct nh_entry*
-ops_sai_route_get_nexthop(char* id)
-{
-    struct nh_entry *pst_nh = NULL;
+    if (!len_str) {
+        len = max_len;
+    } else if (!str_to_uint(len_str, 10, &len) || len > max_len) {
+        return EINVAL;
+    }
+    prefix->len = len;
 
-    pst_nh = nexthop_hmap_find_by_id(&all_nexthop, id);
+    /* Clear host bits so equal prefixes are equal byte-wise */
+    for (i = 0; i < OPS_SAI_IP_ADDR_MAX_LEN; i++) {
+        bits = (len > i * 8) ? len - i * 8 : 0;
+        if (bits < 8) {
+            prefix->addr[i] &= bits ? (uint8_t)(0xff << (8 - bits)) : 0;
+        }
+    }
 
-    return pst_nh;
+    return 0;
 }
 
-struct nh_entry*
-ops_sai_route_add_nexthop(char* id, handle_t *l3_egress_id)
+/* Formats prefix into buf as "<address>/<length>". Returns buf. */
+const char *
+ops_sai_prefix_format(const struct ops_sai_prefix *prefix,
+                      char *buf, size_t len)
 {
-    struct nh_entry *p_nh_entry = NULL;
+    char addr_str[INET6_ADDRSTRLEN];
 
-    p_nh_entry = xzalloc(sizeof(*p_nh_entry));
-    if (NULL  == p_nh_entry) {
-        return NULL;
+    if (!inet_ntop(prefix->family, prefix->addr, addr_str, sizeof(addr_str))) {
+        snprintf(buf, len, "<invalid>");
+    } else {
+        snprintf(buf, len, "%s/%u", addr_str, prefix->len);
     }
 
-    memset(p_nh_entry, 0, sizeof(*p_nh_entry));
-
-    p_nh_entry->id = xstrdup(id);
-    p_nh_entry->handle.data = l3_egress_id->data;
-
-    nexthop_hmap_add(&all_nexthop, p_nh_entry);
-
-    return p_nh_entry;
+    return buf;
 }
 
+/*
+ * Cached ops_sai_prefix_parse(). Route actions pass the same prefix string
+ * down through several layers; __l3_route_action() primes this cache once
+ * so the layers below get the parsed prefix back without parsing again.
+ * Main thread only.
+ *
+ * @return 0 on success, EINVAL if the string is not a valid prefix. */
 int
-ops_sai_route_delete_nexthop(char* id)
+ops_sai_route_prefix_get(const char *str, struct ops_sai_prefix *prefix)
 {
-    struct nh_entry *p_nh_entry = NULL;
+    struct route_prefix_cache *cache = &route_prefix_cache;
+    int rc = 0;
 
-    p_nh_entry = nexthop_hmap_find_by_id(&all_nexthop, id);
-    if (NULL != p_nh_entry && p_nh_entry->ref > 1) {
-        ops_sai_nh_refcnt_dec(p_nh_entry);
-        return 1;
+    if (!str) {
+        return EINVAL;
+    }
+
+    if (cache->valid && STR_EQ(cache->str, str)) {
+        *prefix = cache->prefix;
+        return 0;
+    }
+
+    rc = ops_sai_prefix_parse(str, prefix);
+    if (rc) {
+        return rc;
     }
 
-    nexthop_hmap_delete(&all_nexthop, p_nh_entry);
+    /* parse succeeded, so str fits in the cache buffer */
+    strcpy(cache->str, str);
+    cache->prefix = *prefix;
+    cache->valid = true;
 
     return 0;
 }
 
-/* Add nexthop into the route entry */
 static void
-ops_sai_nexthop_add(sai_ops_route_t *route, char *id)
+ops_sai_route_key_init(struct ops_sai_route_key *key, int vrf,
+                       const struct ops_sai_prefix *prefix)
 {
-    sai_ops_nexthop_t   *nh         = NULL;
-    char                *hashstr    = NULL;
+    memset(key, 0, sizeof(*key));
+    key->vrf = vrf;
+    key->prefix = *prefix;
+}
 
-    if (!route || !id) {
-        return;
-    }
+static inline uint32_t
+ops_sai_route_key_hash(const struct ops_sai_route_key *key)
+{
+    return hash_bytes(key, sizeof(*key), 0);
+}
 
-    nh = malloc(sizeof(*nh));
-    if (!nh) {
-        return;
-    }
+/*
+ * Routes of one virtual router. Route keys carry the number of their
+ * partition as vrf, which is an index into route_vrfs, so finding the
+ * partition of a key costs nothing and a VRF is flushed without looking at
+ * routes or aggregates of other VRFs.
+ */
+struct ops_sai_route_vrf {
+    struct hmap_node    node;           /* all_route_vrf */
+    uint64_t            vrid;
+    int                 vrf;
+    struct hmap         routes;
+    struct hmap         aggrs;          /* aggregates of the routes */
+};
 
-    /* NOTE: Either IP or Port, not both */
-    nh->id = xstrdup(id);
+static struct hmap all_route_vrf = HMAP_INITIALIZER(&all_route_vrf);
+static struct ops_sai_route_vrf **route_vrfs;   /* by vrf, NULL if free */
+static size_t n_route_vrfs;
+static size_t allocated_route_vrfs;
 
-    hashstr = id;
-    hmap_insert(&route->nexthops, &nh->node, hash_string(hashstr, 0));
-    route->n_nexthops++;
+static struct ops_sai_route_vrf *
+__route_vrf_lookup(uint64_t vrid)
+{
+    struct ops_sai_route_vrf *route_vrf = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(route_vrf, node, hash_uint64(vrid),
+                            &all_route_vrf) {
+        if (route_vrf->vrid == vrid) {
+            return route_vrf;
+        }
+    }
 
-    VLOG_DBG("Add NH %s, for route %s", nh->id, route->prefix);
+    return NULL;
 }
 
-/* Delete nexthop into route entry */
-static void
-ops_sai_nexthop_delete(sai_ops_route_t *route, sai_ops_nexthop_t *nh)
+/*
+ * Gets vrf number of routes of a virtual router.
+ *
+ * @param[in] vrid   - virtual router ID
+ * @param[in] create - create the partition if the virtual router has none
+ *
+ * @return vrf number, -1 if the virtual router has no routes partition. */
+static int
+__route_vrf_num(uint64_t vrid, bool create)
 {
-    if (!route || !nh) {
-        return;
-    }
+    struct ops_sai_route_vrf *route_vrf = __route_vrf_lookup(vrid);
+    size_t vrf = 0;
 
-    VLOG_DBG("Delete NH %s in route %s", nh->id, route->prefix);
+    if (route_vrf) {
+        return route_vrf->vrf;
+    }
+    if (!create) {
+        return -1;
+    }
 
-    hmap_remove(&route->nexthops, &nh->node);
-    if (nh->id) {
-        free(nh->id);
+    /* Numbers of flushed VRFs are reused, so they stay small */
+    while (vrf < n_route_vrfs && route_vrfs[vrf]) {
+        vrf++;
+    }
+    if (vrf == n_route_vrfs) {
+        if (n_route_vrfs == allocated_route_vrfs) {
+            route_vrfs = x2nrealloc(route_vrfs, &allocated_route_vrfs,
+                                    sizeof(*route_vrfs));
+        }
+        n_route_vrfs++;
     }
-    free(nh);
-    route->n_nexthops--;
+
+    route_vrf = xzalloc(sizeof(*route_vrf));
+    route_vrf->vrid = vrid;
+    route_vrf->vrf = vrf;
+    hmap_init(&route_vrf->routes);
+    hmap_init(&route_vrf->aggrs);
+    hmap_insert(&all_route_vrf, &route_vrf->node, hash_uint64(vrid));
+    route_vrfs[vrf] = route_vrf;
+
+    return vrf;
 }
 
-/* Find nexthop entry in the route's nexthops hash */
-sai_ops_nexthop_t*
-ops_sai_nexthop_lookup(sai_ops_route_t *route, char *id)
+/* Returns routes partition of a virtual router ID given as text, in hex
+ * or decimal, or NULL. */
+static struct ops_sai_route_vrf *
+__route_vrf_parse(const char *str)
 {
-    sai_ops_nexthop_t   *nh         = NULL;
-    char                *hashstr    = NULL;
+    unsigned long long vrid = 0;
+    char *end = NULL;
 
-    if (!route || !id) {
+    errno = 0;
+    vrid = strtoull(str, &end, 0);
+    if (errno || end == str || *end) {
         return NULL;
     }
 
-    hashstr = id;
-    HMAP_FOR_EACH_WITH_HASH(nh, node, hash_string(hashstr, 0),
-                            &route->nexthops) {
-        if ((strcmp(nh->id, id) == 0)){
-            return nh;
-        }
-    }
-    return NULL;
+    return __route_vrf_lookup(vrid);
+}
+
+/* Returns routes partition of vrf number or NULL. */
+static struct ops_sai_route_vrf *
+__route_vrf_get(int vrf)
+{
+    return vrf >= 0 && vrf < n_route_vrfs ? route_vrfs[vrf] : NULL;
 }
 
 static void
-ops_sai_route_hash(int vrf, const char *prefix, char *hashstr, int hashlen)
+__route_vrf_destroy(struct ops_sai_route_vrf *route_vrf)
+{
+    route_vrfs[route_vrf->vrf] = NULL;
+    hmap_remove(&all_route_vrf, &route_vrf->node);
+    hmap_destroy(&route_vrf->routes);
+    hmap_destroy(&route_vrf->aggrs);
+    free(route_vrf);
+}
+
+/* Count of routes of all virtual routers */
+static size_t
+__route_count(void)
 {
-    snprintf(hashstr, hashlen, "%d:%s", vrf, prefix);
+    struct ops_sai_route_vrf *route_vrf = NULL;
+    size_t n_routes = 0;
+
+    HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+        n_routes += hmap_count(&route_vrf->routes);
+    }
+
+    return n_routes;
 }
 
-/* Find a route entry matching the prefix */
+/* Find a route entry matching the key */
 sai_ops_route_t *
-ops_sai_route_lookup(int vrf, const char *prefix)
+ops_sai_route_lookup(const struct ops_sai_route_key *key)
 {
+    struct ops_sai_route_vrf *route_vrf = __route_vrf_get(key->vrf);
     sai_ops_route_t *route = NULL;
-    char            hashstr[OPS_ROUTE_HASH_MAXSIZE];
 
-    ops_sai_route_hash(vrf, prefix, hashstr, sizeof(hashstr));
-    HMAP_FOR_EACH_WITH_HASH(route, node, hash_string(hashstr, 0),
-                            &all_route) {
-        if ((strcmp(route->prefix, prefix) == 0) &&
-            (route->vrf == vrf)) {
+    if (!route_vrf) {
+        return NULL;
+    }
+
+    HMAP_FOR_EACH_WITH_HASH(route, node, ops_sai_route_key_hash(key),
+                            &route_vrf->routes) {
+        if (!memcmp(&route->key, key, sizeof(*key))) {
             return route;
         }
     }
     return NULL;
 } /* ops_route_lookup */
 
-/* Add new route and NHs */
+/* Add new route without next hops. Key vrf must have a partition. */
 sai_ops_route_t*
-ops_sai_route_add(int vrf, const char *prefix, uint32_t nh_count, char *const *const next_hops)
+ops_sai_route_add(const struct ops_sai_route_key *key)
 {
+    struct ops_sai_route_vrf *route_vrf = NULL;
     sai_ops_route_t *routep = NULL;
-    char            hashstr[OPS_ROUTE_HASH_MAXSIZE];
-    int             i = 0;
 
-    if (!prefix) {
+    if (!key) {
         return NULL;
     }
 
-    routep = malloc(sizeof(*routep));
-    if (!routep) {
-        return NULL;
-    }
+    route_vrf = __route_vrf_get(key->vrf);
+    ovs_assert(route_vrf);
+
+    routep = xzalloc(sizeof(*routep));
 
-    routep->vrf = vrf;
-    routep->prefix = xstrdup(prefix);
+    routep->key = *key;
+    routep->is_ipv6 = (AF_INET6 == key->prefix.family);
     routep->n_nexthops = 0;
     routep->refer_cnt = 0;
 
-    hmap_init(&routep->nexthops);
+    hmap_insert(&route_vrf->routes, &routep->node,
+                ops_sai_route_key_hash(key));
+    ops_sai_route_trie_insert(key, routep);
+    return routep;
+}
+
+/*
+ * Fills key of a next hop of a remote route. The next hop egresses the
+ * router interface of the local route it is on, which is found walking up
+ * from the longest match of its address in the virtual router of the route.
+ *
+ * @param[in]  routep - remote route
+ * @param[in]  addr   - next hop address string
+ * @param[out] nh_key - next hop key
+ *
+ * @return 0 on success, EINVAL on invalid address, ENETUNREACH if no local
+ * route covers the address. */
+static int
+__route_nexthop_key_init(const sai_ops_route_t *routep, const char *addr,
+                         struct ops_sai_nexthop_key *nh_key)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
+    const sai_ops_route_t *local = NULL;
+
+    if (ops_sai_nexthop_key_init(nh_key, routep->vrid, 0, addr)) {
+        VLOG_ERR("Invalid next hop %s", addr);
+        return EINVAL;
+    }
+
+    local = ops_sai_route_trie_lookup(routep->key.vrf, nh_key->family,
+                                      nh_key->addr);
+    while (local && !local->rif) {
+        local = ops_sai_route_trie_covering(&local->key);
+    }
+    if (!local) {
+        VLOG_ERR_RL(&rl, "No interface for next hop %s", addr);
+        return ENETUNREACH;
+    }
+
+    nh_key->rif = local->rif;
+
+    return 0;
+}
+
+/*
+ * Adds next hops not yet used by the route. Every added next hop holds a
+ * reference on its all_nexthop entry, created in hardware if needed.
+ *
+ * @param[in]  routep    - route
+ * @param[in]  nh_count  - count of next hops
+ * @param[in]  next_hops - next hop addresses
+ * @param[out] added     - indices of added next hops, may be NULL
+ *
+ * @return count of added next hops. */
+static uint32_t
+ops_sai_route_nexthops_add(sai_ops_route_t *routep,
+                           uint32_t nh_count,
+                           char *const *const next_hops,
+                           uint32_t *added)
+{
+    struct ops_sai_nexthop_key  nh_key;
+    uint32_t                    index   = 0;
+    uint32_t                    n_added = 0;
+    uint32_t                    i       = 0;
 
     for (i = 0; i < nh_count; i++) {
-        ops_sai_nexthop_add(routep, next_hops[i]);
+        if (SAI_NEXT_HOP_MAX <= routep->n_nexthops + 1) {
+            VLOG_ERR("The num of nexthops is overflow");
+            break;
+        }
+
+        if (__route_nexthop_key_init(routep, next_hops[i], &nh_key) ||
+            0 <= ops_sai_nexthop_addr_lookup(routep, &nh_key)) {
+            continue;
+        }
+
+        index = ops_sai_nexthop_ref(&nh_key);
+        if (OPS_SAI_NH_INDEX_INVALID == index) {
+            VLOG_ERR("Failed to create next hop %s", next_hops[i]);
+            continue;
+        }
+
+        ops_sai_nexthop_add(routep, index);
+        if (added) {
+            added[n_added] = index;
+        }
+        n_added++;
     }
 
-    ops_sai_route_hash(vrf, prefix, hashstr, sizeof(hashstr));
-    hmap_insert(&all_route, &routep->node, hash_string(hashstr, 0));
-    return routep;
+    return n_added;
 }
 
-/* Update route nexthop: add, delete, resolve and unresolve nh */
-static int
-ops_sai_route_update(int vrf, sai_ops_route_t *routep,
-                 uint32_t nh_count,
-                 char *const *const next_hops,
-                 bool is_delete_nh)
+/*
+ * Removes next hops from the route. Next hops the route does not use are
+ * skipped. References are kept: the caller drops them with
+ * ops_sai_nexthop_unref() once hardware no longer uses the next hops.
+ *
+ * @param[out] removed - indices of removed next hops
+ *
+ * @return count of removed next hops. */
+static uint32_t
+ops_sai_route_nexthops_remove(sai_ops_route_t *routep,
+                              uint32_t nh_count,
+                              char *const *const next_hops,
+                              uint32_t *removed)
 {
-    sai_ops_nexthop_t* nh = NULL;
-    int ret = 0;
-    int i;
+    struct ops_sai_nexthop_key  nh_key;
+    uint32_t                    index     = 0;
+    uint32_t                    n_removed = 0;
+    uint32_t                    i         = 0;
+    int                         pos       = 0;
 
     for (i = 0; i < nh_count; i++) {
-        nh = ops_sai_nexthop_lookup(routep, next_hops[i]);
-        if (is_delete_nh) {
-            ops_sai_nexthop_delete(routep, nh);
-        } else {
-            /* add or update */
-            if (!nh) {
-                ops_sai_nexthop_add(routep, next_hops[i]);
-            } else {
-                /* update is currently resolved on unreoslved */
-                ret = 1;
-                continue;
-            }
+        if (ops_sai_nexthop_key_init(&nh_key, routep->vrid, 0,
+                                     next_hops[i])) {
+            continue;
         }
+
+        pos = ops_sai_nexthop_addr_lookup(routep, &nh_key);
+        if (0 > pos) {
+            continue;
+        }
+
+        index = routep->nexthops[pos];
+        ops_sai_nexthop_delete(routep, pos);
+        removed[n_removed++] = index;
     }
 
-    return ret;
+    return n_removed;
 }
 
-/* Delete route in system*/
+/* Delete route in system. Next hop references must be released already. */
 static void
 ops_sai_route_del(sai_ops_route_t *routep)
 {
-    sai_ops_nexthop_t *nh = NULL;
-    sai_ops_nexthop_t *next = NULL;
+    char              prefix_str[OPS_SAI_PREFIX_STR_LEN];
 
     if (!routep) {
         return;
     }
 
-    VLOG_DBG("delete route %s", routep->prefix);
+    VLOG_DBG("delete route %s",
+             ops_sai_prefix_format(&routep->key.prefix, prefix_str,
+                                   sizeof prefix_str));
 
-    hmap_remove(&all_route, &routep->node);
-
-    HMAP_FOR_EACH_SAFE(nh, next, node, &routep->nexthops) {
-        ops_sai_nexthop_delete(routep, nh);
+    if (routep->stale) {
+        route_n_stale--;
     }
-
-    if (routep->prefix) {
-        free(routep->prefix);
+    if (routep->parked) {
+        list_remove(&routep->park_node);
+        route_n_parked--;
     }
+
+    hmap_remove(&__route_vrf_get(routep->key.vrf)->routes, &routep->node);
+    ops_sai_route_trie_remove(&routep->key);
+
+    free(routep->nexthops);
     free(routep);
 }
 
-int
-ops_string_to_prefix(char *prefix, uint32_t *addr, uint8_t *mask_len)
+/*
+ * Fills SAI route entry for the given virtual router and prefix.
+ *
+ * @return 0 on success, errno if the prefix can't be programmed. */
+static int
+ops_sai_route_entry_fill(sai_unicast_route_entry_t *route, uint64_t vrid,
+                         const struct ops_sai_prefix *prefix)
 {
-    int     rc = 0;
-    int     ret = 0;
-    char    *ptr = NULL;
-    char    buf[64];
-    int     i = 0;
-    uint8_t mask =0;
+    uint32_t    ip_prefix   = 0;
 
-    memset(buf, 0, sizeof(buf));
+    memset(route, 0, sizeof(*route));
+    route->vr_id = vrid;
 
-    ptr = strtok(prefix, "/");
-    while(NULL != ptr)
-    {
-        if (0 == i)
-        {
-            rc = inet_pton(AF_INET, ptr, buf);
-            if (!rc)
-            {
-                ret = 1;
-                return ret;
-            }
+    if (AF_INET6 == prefix->family) {
+        route->destination.addr_family = SAI_IP_ADDR_FAMILY_IPV6;
+        memcpy(route->destination.addr.ip6, prefix->addr,
+               sizeof(route->destination.addr.ip6));
+        SAI_IPV6_LEN_TO_MASK(route->destination.mask.ip6, prefix->len);
+        return 0;
+    }
 
-            memcpy(addr, buf, sizeof(uint32_t));
-        }
-        else if (1 == i)
-        {
-            mask = atoi(ptr);
-            *mask_len = mask;
-        }
-        else
-        {
-            return ret;
-        }
+    memcpy(&ip_prefix, prefix->addr, sizeof(ip_prefix));
+    route->destination.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
+    route->destination.addr.ip4 = htonl(ip_prefix);
+    SAI_IPV4_LEN_TO_MASK(route->destination.mask.ip4, prefix->len);
 
-        ptr = strtok(NULL, "/");
-        i ++;
+    return 0;
+}
+
+/*
+ * Fills SAI IP address from IPv4 or IPv6 address string.
+ *
+ * @param[out] ipaddr - SAI IP address
+ * @param[in]  str    - address string
+ *
+ * @return 0 on success, EINVAL if the string is not an IP address. */
+int
+ops_sai_ip_addr_fill(sai_ip_address_t *ipaddr, const char *str)
+{
+    uint32_t    ip4 = 0;
+
+    memset(ipaddr, 0, sizeof(*ipaddr));
+
+    if (1 == inet_pton(AF_INET, str, &ip4)) {
+        ipaddr->addr_family = SAI_IP_ADDR_FAMILY_IPV4;
+        ipaddr->addr.ip4 = htonl(ip4);
+    } else if (1 == inet_pton(AF_INET6, str, ipaddr->addr.ip6)) {
+        ipaddr->addr_family = SAI_IP_ADDR_FAMILY_IPV6;
+    } else {
+        return EINVAL;
     }
 
-    return ret;
+    return 0;
 }
 
-/* Add nexthop into the route entry */
+/* Create nexthop object in hardware */
 int32_t
-ops_sai_routing_nexthop_create(const handle_t *rif, const char* prefix, handle_t *l3_egress_id)
+ops_sai_routing_nexthop_create(const struct ops_sai_nexthop_key *key,
+                               handle_t *l3_egress_id)
 {
     sai_status_t status = SAI_STATUS_SUCCESS;
     const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
     sai_attribute_t attr[4];
+    uint32_t            ip4 = 0;
+    sai_object_id_t     nhid = 0;
 
-    if (NULL == prefix)
+    if (NULL == key)
     {
         return SAI_STATUS_FAILURE;
     }
@@ -557,30 +1056,18 @@ ops_sai_routing_nexthop_create(const handle_t *rif, const char* prefix, handle_t
     attr[0].value.s32 = SAI_NEXT_HOP_IP;
     attr[1].id = SAI_NEXT_HOP_ATTR_IP;
 
-    char                buf[64];
-    int                 retv = 0;
-    uint32_t            ip_prefix;
-    sai_object_id_t     nhid = 0;
-
-    memset(&ip_prefix, 0, sizeof(ip_prefix));
-    memset(buf, 0, sizeof(buf));
-    retv = inet_pton(AF_INET, prefix, buf);
-    if (!retv) {
-        VLOG_ERR("Invaild prefix %s", prefix);
-        return status;
+    if (AF_INET6 == key->family) {
+        attr[1].value.ipaddr.addr_family = SAI_IP_ADDR_FAMILY_IPV6;
+        memcpy(attr[1].value.ipaddr.addr.ip6, key->addr,
+               sizeof(attr[1].value.ipaddr.addr.ip6));
+    } else {
+        memcpy(&ip4, key->addr, sizeof(ip4));
+        attr[1].value.ipaddr.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
+        attr[1].value.ipaddr.addr.ip4 = htonl(ip4);
     }
-    memcpy(&ip_prefix, buf, sizeof(ip_prefix));
-
-    attr[1].value.ipaddr.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    attr[1].value.ipaddr.addr.ip4 = htonl(ip_prefix);
 
     attr[2].id = SAI_NEXT_HOP_ATTR_ROUTER_INTERFACE_ID;
-    if (NULL != rif) {
-        attr[2].value.oid = rif->data;
-    }
-    else {
-        attr[2].value.oid = 0;
-    }
+    attr[2].value.oid = key->rif;
 
     status = sai_api->nexthop_api->create_next_hop(&nhid, 3, attr);
     SAI_ERROR_LOG_EXIT(status, "Failed to create nexthop");
@@ -612,54 +1099,49 @@ exit:
     return status;
 }
 
+/* Translates next hop indices into SAI objects. Caller frees the list. */
+static sai_object_id_t *
+ops_sai_routing_nh_obj_list_get(const uint32_t *nexthops, uint32_t n_nexthops)
+{
+    struct nh_entry     *p_nexthop  = NULL;
+    sai_object_id_t     *nh_obj     = xcalloc(MAX(n_nexthops, 1),
+                                              sizeof(*nh_obj));
+    uint32_t            i           = 0;
+
+    for (i = 0; i < n_nexthops; i++) {
+        p_nexthop = ops_sai_nexthop_get(nexthops[i]);
+        if (NULL != p_nexthop) {
+            nh_obj[i] = p_nexthop->handle.data;
+        }
+    }
+
+    return nh_obj;
+}
+
 int32_t
-ops_sai_routing_nh_group_add(sai_ops_route_t *pst_routep, handle_t *l3_egress_id)
+ops_sai_routing_nh_group_add(const uint32_t *nexthops, uint32_t n_nexthops,
+                             handle_t *l3_egress_id)
 {
     sai_status_t status = SAI_STATUS_SUCCESS;
     const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
 
-    sai_ops_nexthop_t *pst_nh = NULL;
-    struct nh_entry*  p_nexthop= NULL;
-
     sai_attribute_t             attr[2];
     sai_object_id_t             nhg_obj;
     sai_object_list_t           obj_list;
-    sai_object_id_t             nh_obj[SAI_NEXT_HOP_MAX];
-    uint32_t                    i = 0;
+    sai_object_id_t             *nh_obj = NULL;
 
     memset(&obj_list, 0, sizeof(obj_list));
     memset(&nhg_obj, 0, sizeof(nhg_obj));
     memset(attr, 0, sizeof(attr));
-    memset(nh_obj, 0, sizeof(nh_obj));
 
     /* Operation one: add the nexthop group */
     attr[0].id          = SAI_NEXT_HOP_GROUP_ATTR_TYPE;
     attr[0].value.u32   = SAI_NEXT_HOP_GROUP_ECMP;
 
-    /* update with single nexthop */
-    HMAP_FOR_EACH(pst_nh, node, &pst_routep->nexthops)
-    {
-        if (!pst_routep->n_nexthops)
-        {
-            break;
-        }
-
-        p_nexthop = nexthop_hmap_find_by_id(&all_nexthop, pst_nh->id);
-        if (NULL == p_nexthop)
-        {
-            i++;
-            continue;
-        }
-        else
-        {
-            nh_obj[i] = p_nexthop->handle.data;
-        }
-
-        i++;
-    }
+    nh_obj = ops_sai_routing_nh_obj_list_get(nexthops, n_nexthops);
 
     obj_list.list           = nh_obj;
-    obj_list.count          = pst_routep->n_nexthops;
+    obj_list.count          = n_nexthops;
     attr[1].id              = SAI_NEXT_HOP_GROUP_ATTR_NEXT_HOP_LIST;
     memcpy(&attr[1].value.objlist, &obj_list, sizeof(obj_list));
 
@@ -668,6 +1150,32 @@ ops_sai_routing_nh_group_add(sai_ops_route_t *pst_routep, handle_t *l3_egress_id
     l3_egress_id->data = nhg_obj;
 
 exit:
+    free(nh_obj);
+    return status;
+}
+
+/* Replaces all members of a nexthop group. Next hops may repeat. */
+int32_t
+ops_sai_routing_nh_group_set(const handle_t *nhg, const uint32_t *nexthops,
+                             uint32_t n_nexthops)
+{
+    sai_status_t status = SAI_STATUS_SUCCESS;
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_attribute_t             attr;
+    sai_object_id_t             *nh_obj = NULL;
+
+    memset(&attr, 0, sizeof(attr));
+
+    nh_obj = ops_sai_routing_nh_obj_list_get(nexthops, n_nexthops);
+    attr.id                     = SAI_NEXT_HOP_GROUP_ATTR_NEXT_HOP_LIST;
+    attr.value.objlist.list     = nh_obj;
+    attr.value.objlist.count    = n_nexthops;
+
+    status = sai_api->nhg_api->set_next_hop_group_attribute(nhg->data, &attr);
+    SAI_ERROR_LOG_EXIT(status, "Failed to set nexthop group members");
+
+exit:
+    free(nh_obj);
     return status;
 }
 
@@ -690,15 +1198,18 @@ exit:
 }
 
 int32_t
-ops_sai_routing_nhg_add_member(sai_ops_route_t *p_route, char *keyid)
+ops_sai_routing_nhg_add_member(const handle_t *nhg, uint32_t nh_index)
 {
     sai_status_t status = SAI_STATUS_SUCCESS;
     struct nh_entry     *p_nh_entry = NULL;
     const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
 
-    p_nh_entry = ops_sai_route_get_nexthop(keyid);
+    p_nh_entry = ops_sai_nexthop_get(nh_index);
+
+    if(!p_nh_entry)
+		goto exit;
 
-    status = sai_api->nhg_api->add_next_hop_to_group(p_route->nh_ecmp.data, 1, &p_nh_entry->handle.data);
+    status = sai_api->nhg_api->add_next_hop_to_group(nhg->data, 1, &p_nh_entry->handle.data);
     SAI_ERROR_LOG_EXIT(status, "Failed to add member to nexthop group");
 
 exit:
@@ -706,18 +1217,18 @@ exit:
 }
 
 int32_t
-ops_sai_routing_nhg_del_member(sai_ops_route_t *p_route, char *keyid)
+ops_sai_routing_nhg_del_member(const handle_t *nhg, uint32_t nh_index)
 {
     sai_status_t status = SAI_STATUS_SUCCESS;
     struct nh_entry     *p_nh_entry = NULL;
     const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
 
-    p_nh_entry = ops_sai_route_get_nexthop(keyid);
+    p_nh_entry = ops_sai_nexthop_get(nh_index);
 
     if(!p_nh_entry)
 		goto exit;
 
-    status = sai_api->nhg_api->remove_next_hop_from_group(p_route->nh_ecmp.data, 1, &p_nh_entry->handle.data);
+    status = sai_api->nhg_api->remove_next_hop_from_group(nhg->data, 1, &p_nh_entry->handle.data);
     SAI_ERROR_LOG_EXIT(status, "Failed to remove member from nexthop group");
 
 exit:
@@ -725,677 +1236,4697 @@ exit:
 }
 
 
-int32_t
-ops_sai_routing_nexthop_id_update(sai_unicast_route_entry_t *p_route, handle_t *l3_egress_id)
-{
-    sai_status_t status = SAI_STATUS_SUCCESS;
-    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
-    sai_attribute_t             attr[1];
+/* ECMP group shared by all routes using the same set of next hops */
+struct ops_sai_nhg {
+    struct hmap_node    node;                           /* all_nhg */
+    uint32_t            n_nexthops;
+    uint32_t            nexthops[SAI_NEXT_HOP_MAX];     /* sorted indices */
+    uint32_t            active;         /* bitmap of members in hardware */
+    uint32_t            ref;                            /* routes using it */
+    handle_t            handle;
+    uint32_t            *buckets;       /* next hop of every bucket, only in
+                                         * resilient or weighted mode */
+    uint32_t            n_buckets;
+};
 
-    memset(attr, 0, sizeof(attr));
+BUILD_ASSERT_DECL(SAI_NEXT_HOP_MAX <= 32);
 
-    attr[0].id = SAI_ROUTE_ATTR_NEXT_HOP_ID;
-    attr[0].value.oid = l3_egress_id->data;
+static struct hmap all_nhg = HMAP_INITIALIZER(&all_nhg);
 
-    status = sai_api->route_api->set_route_attribute(p_route, attr);
-    SAI_ERROR_LOG_EXIT(status, "Failed to update route nexthop id");
+/* Prefix independent convergence: on next hop loss, drop it from the shared
+ * groups instead of waiting for every route to be updated. */
+static bool route_pic_enabled = true;
 
-exit:
-    return status;
-}
+/* Resilient hashing: groups are programmed as a table of
+ * route_ecmp_buckets members and a membership change only moves the buckets
+ * which have to move. Groups of next hops with different weights always use
+ * such a table, with buckets replicated by weight. */
+static bool route_ecmp_resilient;
+static uint32_t route_ecmp_buckets = OPS_SAI_NHG_BUCKETS_DEFAULT;
 
-static int
-__ops_sai_route_local_add(const handle_t *vrid, const char *prefix, const handle_t *rifid)
+static void
+ops_sai_nhg_set_sort(uint32_t *nexthops, uint32_t n_nexthops)
 {
-    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    uint32_t i = 0, j = 0;
+    uint32_t index = 0;
 
-    sai_unicast_route_entry_t route;
-    sai_attribute_t attr[3];
-    uint32_t    ip_prefix = 0;
-    char        buf_preifx[256];
-    int         rc = 0;
-    uint8_t         prefix_len;
-    sai_status_t    status = SAI_STATUS_SUCCESS;
+    for (i = 1; i < n_nexthops; i++) {
+        index = nexthops[i];
+        for (j = i; j > 0 && nexthops[j - 1] > index; j--) {
+            nexthops[j] = nexthops[j - 1];
+        }
+        nexthops[j] = index;
+    }
+}
 
-    memset(&route, 0, sizeof(route));
-    memset(attr, 0, sizeof(attr));
-    memset(buf_preifx, 0, sizeof(buf_preifx));
+static inline uint32_t
+ops_sai_nhg_hash(const uint32_t *nexthops, uint32_t n_nexthops)
+{
+    return hash_words(nexthops, n_nexthops, n_nexthops);
+}
 
-    attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
-    attr[0].value.s32 = SAI_PACKET_ACTION_TRAP;
-    attr[1].id = SAI_ROUTE_ATTR_NEXT_HOP_ID + 1; //For map attr of SAI_ROUTE_ATTR_RIF_ID
-    if (!rifid) {
-        attr[1].value.oid = SAI_OBJECT_TYPE_SET(SAI_OBJECT_TYPE_ROUTER_INTERFACE, 1);
-    } else {
-        attr[1].value.oid = rifid->data;
+/* Find group of a sorted next hop set */
+static struct ops_sai_nhg *
+ops_sai_nhg_lookup(const uint32_t *nexthops, uint32_t n_nexthops)
+{
+    struct ops_sai_nhg *nhg = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(nhg, node,
+                            ops_sai_nhg_hash(nexthops, n_nexthops),
+                            &all_nhg) {
+        if (nhg->n_nexthops == n_nexthops &&
+            !memcmp(nhg->nexthops, nexthops,
+                    n_nexthops * sizeof(*nexthops))) {
+            return nhg;
+        }
     }
 
-    attr[2].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
-    attr[2].value.u8 = 0;              // default to zero
+    return NULL;
+}
 
-    memcpy(buf_preifx, prefix, sizeof(buf_preifx));
-    rc = ops_string_to_prefix(buf_preifx, &ip_prefix, &prefix_len);
-    if (rc)
-    {
-        VLOG_ERR("Invalid IPv4/Prefix");
-        return rc; /* Return error */
+/* Returns position of next hop in the set or -1 */
+static int
+ops_sai_nhg_set_find(const uint32_t *nexthops, uint32_t n_nexthops,
+                     uint32_t index)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < n_nexthops; i++) {
+        if (nexthops[i] == index) {
+            return i;
+        }
     }
 
-    route.vr_id = vrid->data;
-    route.destination.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    route.destination.addr.ip4 = htonl(ip_prefix);
-    SAI_IPV4_LEN_TO_MASK(route.destination.mask.ip4, prefix_len);
+    return -1;
+}
 
-    status = sai_api->route_api->create_route(&route, 3, attr);
-    SAI_ERROR_LOG_EXIT(status, "Failed to add route entry");
+/* Adds group to the next hop to group reverse index */
+static void
+ops_sai_nhg_link(struct ops_sai_nhg *nhg, uint32_t index)
+{
+    struct nh_entry *p_nh_entry = ops_sai_nexthop_get(index);
 
-exit:
-    return rc;
+    if (p_nh_entry->n_nhgs == p_nh_entry->allocated_nhgs) {
+        p_nh_entry->nhgs = x2nrealloc(p_nh_entry->nhgs,
+                                      &p_nh_entry->allocated_nhgs,
+                                      sizeof(*p_nh_entry->nhgs));
+    }
+    p_nh_entry->nhgs[p_nh_entry->n_nhgs++] = nhg;
 }
 
-static int
-__ops_sai_route_local_delete(const handle_t *vrid, const char *prefix)
+static void
+ops_sai_nhg_unlink(struct ops_sai_nhg *nhg, uint32_t index)
 {
-    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    struct nh_entry *p_nh_entry = ops_sai_nexthop_get(index);
+    size_t          i           = 0;
 
-    sai_unicast_route_entry_t route;
-    uint32_t    ip_prefix = 0;
-    char        buf_preifx[256];
-    int         rc = 0;
-    uint8_t         prefix_len;
-    sai_status_t    status = SAI_STATUS_SUCCESS;
+    for (i = 0; i < p_nh_entry->n_nhgs; i++) {
+        if (p_nh_entry->nhgs[i] == nhg) {
+            p_nh_entry->nhgs[i] = p_nh_entry->nhgs[--p_nh_entry->n_nhgs];
+            return;
+        }
+    }
+}
 
-    memset(&route, 0, sizeof(route));
-    memset(buf_preifx, 0, sizeof(buf_preifx));
+/* Members which should be in hardware. A group never runs empty, if all of
+ * its next hops are down it keeps forwarding to the ones it has. */
+static uint32_t
+ops_sai_nhg_active_get(const struct ops_sai_nhg *nhg)
+{
+    uint32_t active = 0;
+    uint32_t i      = 0;
 
-    memcpy(buf_preifx, prefix, sizeof(buf_preifx));
-    rc = ops_string_to_prefix(buf_preifx, &ip_prefix, &prefix_len);
-    if (rc)
-    {
-        VLOG_ERR("Invalid IPv4/Prefix");
-        return rc; /* Return error */
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        if (!route_pic_enabled ||
+            !ops_sai_nexthop_get(nhg->nexthops[i])->is_down) {
+            active |= 1u << i;
+        }
     }
 
-    route.vr_id = vrid->data;
-    route.destination.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    route.destination.addr.ip4 = htonl(ip_prefix);
-    SAI_IPV4_LEN_TO_MASK(route.destination.mask.ip4, prefix_len);
+    if (!active) {
+        active = nhg->active ? nhg->active
+                             : (uint32_t) ((1ull << nhg->n_nexthops) - 1);
+    }
 
-    status = sai_api->route_api->remove_route(&route);
-    SAI_ERROR_LOG_EXIT(status, "Failed to remove route entry");
+    return active;
+}
 
-exit:
-    return rc;
+/* Whether members of the group do not all have the same weight */
+static bool
+ops_sai_nhg_is_weighted(const struct ops_sai_nhg *nhg)
+{
+    uint32_t weight = ops_sai_nexthop_get(nhg->nexthops[0])->weight;
+    uint32_t i      = 0;
+
+    for (i = 1; i < nhg->n_nexthops; i++) {
+        if (ops_sai_nexthop_get(nhg->nexthops[i])->weight != weight) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-/*
- * Initializes route.
- */
-static void
-__route_init(void)
+/* Whether group is programmed as a bucket table rather than a member list */
+static inline bool
+ops_sai_nhg_uses_buckets(const struct ops_sai_nhg *nhg)
 {
-    SAI_API_TRACE_NOT_IMPLEMENTED_FN();
+    return route_ecmp_resilient || ops_sai_nhg_is_weighted(nhg);
 }
 
 /*
- *  Function for adding IP to me route.
- *  Means tell hardware to trap packets with specified prefix to CPU.
- *  Used while assigning IP address(s) to routing interface.
+ * Spreads buckets of a group over the active members in proportion to their
+ * weights, moving as few buckets as possible: buckets of members that went
+ * away and the surplus of members above their share.
  *
- * @param[in] vrid    - virtual router ID
- * @param[in] prefix  - IP prefix
+ * @param[in] nhg    - group
+ * @param[in] active - members to spread the buckets over, not empty
  *
- * @return 0  if operation completed successfully.
- * @return -1 if operation failed.*/
-static int
-__route_ip_to_me_add(const handle_t *vrid, const char *prefix)
+ * @return true if any bucket moved. */
+static bool
+ops_sai_nhg_buckets_balance(struct ops_sai_nhg *nhg, uint32_t active)
 {
-    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    uint32_t    count[SAI_NEXT_HOP_MAX];
+    uint32_t    target[SAI_NEXT_HOP_MAX];
+    uint32_t    rem[SAI_NEXT_HOP_MAX];
+    bool        bonus[SAI_NEXT_HOP_MAX];
+    int         owner[OPS_SAI_NHG_BUCKETS_MAX];
+    uint32_t    n_buckets   = route_ecmp_buckets;
+    uint32_t    weight      = 0;
+    uint32_t    total       = 0;
+    uint32_t    assigned    = 0;
+    uint32_t    i = 0, j = 0, b = 0;
+    int         best        = 0;
+    bool        changed     = false;
+
+    if (nhg->n_buckets != n_buckets) {
+        nhg->buckets = xrealloc(nhg->buckets,
+                                n_buckets * sizeof(*nhg->buckets));
+        for (b = nhg->n_buckets; b < n_buckets; b++) {
+            nhg->buckets[b] = OPS_SAI_NH_INDEX_INVALID;
+        }
+        nhg->n_buckets = n_buckets;
+        changed = true;
+    }
 
-    sai_unicast_route_entry_t route;
-    sai_attribute_t attr[2];
-    uint32_t    ip_prefix = 0;
-    char        buf_preifx[256];
-    int         rc = 0;
-    uint8_t         prefix_len;
-    sai_status_t    status = SAI_STATUS_SUCCESS;
+    memset(count, 0, sizeof(count));
+    memset(target, 0, sizeof(target));
+    memset(bonus, 0, sizeof(bonus));
+    for (b = 0; b < n_buckets; b++) {
+        owner[b] = ops_sai_nhg_set_find(nhg->nexthops, nhg->n_nexthops,
+                                        nhg->buckets[b]);
+        if (owner[b] >= 0 && !(active & (1u << owner[b]))) {
+            owner[b] = -1;
+        }
+        if (owner[b] >= 0) {
+            count[owner[b]]++;
+        }
+    }
 
-    memset(&route, 0, sizeof(route));
-    memset(attr, 0, sizeof(attr));
-    memset(buf_preifx, 0, sizeof(buf_preifx));
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        if (active & (1u << i)) {
+            total += ops_sai_nexthop_get(nhg->nexthops[i])->weight;
+        }
+    }
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        if (active & (1u << i)) {
+            weight = ops_sai_nexthop_get(nhg->nexthops[i])->weight;
+            target[i] = n_buckets * weight / total;
+            rem[i] = n_buckets * weight % total;
+            assigned += target[i];
+        }
+    }
 
-    attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
-    attr[0].value.s32 = SAI_PACKET_ACTION_TRAP;
+    /* Remainder goes to the largest fractions of a share, then to the
+     * members already holding the most buckets */
+    for (; assigned < n_buckets; assigned++) {
+        best = -1;
+        for (i = 0; i < nhg->n_nexthops; i++) {
+            if ((active & (1u << i)) && !bonus[i]
+                && (best < 0 || rem[i] > rem[best]
+                    || (rem[i] == rem[best] && count[i] > count[best]))) {
+                best = i;
+            }
+        }
+        bonus[best] = true;
+        target[best]++;
+    }
 
-    attr[1].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
-    attr[1].value.u8 = 0;              // default to zero
+    for (b = 0; b < n_buckets; b++) {
+        if (owner[b] >= 0 && count[owner[b]] > target[owner[b]]) {
+            count[owner[b]]--;
+            owner[b] = -1;
+        }
+    }
 
-    memcpy(buf_preifx, prefix, sizeof(buf_preifx));
-    rc = ops_string_to_prefix(buf_preifx, &ip_prefix, &prefix_len);
-    if (rc)
-    {
-        VLOG_ERR("Invalid IPv4/Prefix");
-        return rc; /* Return error */
+    for (b = 0, j = 0; b < n_buckets; b++) {
+        if (owner[b] >= 0) {
+            continue;
+        }
+        while (count[j] >= target[j]) {
+            j++;
+        }
+        count[j]++;
+        nhg->buckets[b] = nhg->nexthops[j];
+        changed = true;
     }
 
-    route.vr_id = vrid->data;
-    route.destination.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    route.destination.addr.ip4 = htonl(ip_prefix);
-    SAI_IPV4_LEN_TO_MASK(route.destination.mask.ip4, prefix_len);
+    return changed;
+}
 
-    status = sai_api->route_api->create_route(&route, 2, attr);
-    SAI_ERROR_LOG_EXIT(status, "Failed to add route entry");
+/* Drops bucket table of a group going back to a plain member list */
+static void
+ops_sai_nhg_buckets_free(struct ops_sai_nhg *nhg)
+{
+    free(nhg->buckets);
+    nhg->buckets = NULL;
+    nhg->n_buckets = 0;
+}
 
-exit:
-    return rc;
+/* Members of a group as programmed in hardware */
+static uint32_t
+ops_sai_nhg_members_get(const struct ops_sai_nhg *nhg, uint32_t active,
+                        uint32_t *members)
+{
+    uint32_t n_members = 0;
+    uint32_t i = 0;
+
+    if (nhg->buckets) {
+        memcpy(members, nhg->buckets, nhg->n_buckets * sizeof(*members));
+        return nhg->n_buckets;
+    }
+
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        if (active & (1u << i)) {
+            members[n_members++] = nhg->nexthops[i];
+        }
+    }
+
+    return n_members;
 }
 
+/*
+ * Brings group members in hardware in line with the state and weights of
+ * the next hops and with the hashing mode. New members are added before old
+ * ones are removed.
+ *
+ * @param[in] nhg - group
+ *
+ * @return 0 on success, SAI status otherwise. */
 static int
-__route_ip_to_me_delete(const handle_t *vrid, const char *prefix)
+ops_sai_nhg_sync(struct ops_sai_nhg *nhg)
 {
-    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
-    sai_unicast_route_entry_t route;
-    uint32_t        ip_prefix = 0;
-    char            buf_preifx[256];
-    int             rc = 0;
-    uint8_t         prefix_len;
     sai_status_t    status = SAI_STATUS_SUCCESS;
-
-    memset(&route, 0, sizeof(route));
-    memset(buf_preifx, 0, sizeof(buf_preifx));
-
-    memcpy(buf_preifx, prefix, sizeof(buf_preifx));
-    rc = ops_string_to_prefix(buf_preifx, &ip_prefix, &prefix_len);
-    if (rc)
-    {
-        VLOG_ERR("Invalid IPv4/Prefix");
-        return rc; /* Return error */
+    uint32_t        active = ops_sai_nhg_active_get(nhg);
+    uint32_t        members[SAI_NEXT_HOP_MAX];
+    uint32_t        n_members = 0;
+    uint32_t        i      = 0;
+
+    if (ops_sai_nhg_uses_buckets(nhg)) {
+        if (ops_sai_nhg_buckets_balance(nhg, active)) {
+            status = ops_sai_routing_nh_group_set(&nhg->handle, nhg->buckets,
+                                                  nhg->n_buckets);
+        }
+        if (!status) {
+            nhg->active = active;
+        }
+        return status;
     }
 
-    route.vr_id = vrid->data;
-    route.destination.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    route.destination.addr.ip4 = htonl(ip_prefix);
-    SAI_IPV4_LEN_TO_MASK(route.destination.mask.ip4, prefix_len);
+    if (nhg->buckets) {
+        ops_sai_nhg_buckets_free(nhg);
+        n_members = ops_sai_nhg_members_get(nhg, active, members);
+        status = ops_sai_routing_nh_group_set(&nhg->handle, members,
+                                              n_members);
+        if (!status) {
+            nhg->active = active;
+        }
+        return status;
+    }
 
-    /* del the ipuc prefix */
-    status = sai_api->route_api->remove_route(&route);
-    SAI_ERROR_LOG_EXIT(status, "Failed to delete route entry");
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        if ((active & ~nhg->active) & (1u << i)) {
+            status = ops_sai_routing_nhg_add_member(&nhg->handle,
+                                                    nhg->nexthops[i]);
+            if (status) {
+                return status;
+            }
+            nhg->active |= 1u << i;
+        }
+    }
 
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        if ((nhg->active & ~active) & (1u << i)) {
+            status = ops_sai_routing_nhg_del_member(&nhg->handle,
+                                                    nhg->nexthops[i]);
+            if (status) {
+                return status;
+            }
+            nhg->active &= ~(1u << i);
+        }
+    }
 
-exit:
-    return rc;
+    return status;
 }
 
-static int
-__sai_route_remote_action(uint64_t          vrid,
-                      const char            *prefix,
-                      uint32_t              next_hop_count,
-                      char *const *const    next_hops,
-                      uint32_t              action)
+/*
+ * Takes reference on the ECMP group of a next hop set, creating the group
+ * in hardware on first use.
+ *
+ * @param[in] nexthops   - next hop indices, any order
+ * @param[in] n_nexthops - count of next hops
+ *
+ * @return group or NULL if it could not be created. */
+static struct ops_sai_nhg *
+ops_sai_nhg_ref(const uint32_t *nexthops, uint32_t n_nexthops)
 {
-    sai_status_t                    status      = SAI_STATUS_SUCCESS;
-    const struct ops_sai_api_class  *sai_api    = ops_sai_api_get_instance();
-    struct nh_entry     *p_nh_entry = NULL;
-    sai_ops_route_t     *ops_routep = NULL;
-    sai_ops_nexthop_t   *ops_nh = NULL;
-    sai_unicast_route_entry_t route;
-    sai_attribute_t     attr[3];
-    char                buf_preifx[256];
-    handle_t            l3_egress_id;
-    handle_t            l3_nhg_id;
-    handle_t            l3_id_cp;
-    uint32_t            ip_prefix   = 0;
-    uint32_t            index       = 0;
-    uint8_t             prefix_len  = 0;
-    int                 rc          = 0;
-    int                 vrf_id      = 0;
-    handle_t            vrfid;
+    struct ops_sai_nhg  *nhg = NULL;
+    uint32_t            set[SAI_NEXT_HOP_MAX];
+    uint32_t            members[OPS_SAI_NHG_BUCKETS_MAX];
+    uint32_t            n_members = 0;
+    uint32_t            i = 0;
+
+    memcpy(set, nexthops, n_nexthops * sizeof(*set));
+    ops_sai_nhg_set_sort(set, n_nexthops);
+
+    nhg = ops_sai_nhg_lookup(set, n_nexthops);
+    if (nhg) {
+        nhg->ref++;
+        return nhg;
+    }
 
-    memset(buf_preifx, 0, sizeof(buf_preifx));
-    memset(&l3_egress_id, 0, sizeof(l3_egress_id));
-    memset(&l3_id_cp, 0, sizeof(l3_id_cp));
+    if (!ops_sai_resource_admit(OPS_SAI_RESOURCE_NHG, 1)) {
+        return NULL;
+    }
 
-    memcpy(buf_preifx, prefix, sizeof(buf_preifx));
-    rc = ops_string_to_prefix(buf_preifx, &ip_prefix, &prefix_len);
-    if (rc) {
-        VLOG_ERR("Invalid IPv4/Prefix");
-        return rc; /* Return error */
+    nhg = xzalloc(sizeof(*nhg));
+    nhg->n_nexthops = n_nexthops;
+    memcpy(nhg->nexthops, set, n_nexthops * sizeof(*set));
+    nhg->active = ops_sai_nhg_active_get(nhg);
+    if (ops_sai_nhg_uses_buckets(nhg)) {
+        ops_sai_nhg_buckets_balance(nhg, nhg->active);
     }
+    n_members = ops_sai_nhg_members_get(nhg, nhg->active, members);
 
-    vrfid.data = vrid;
-    memset(&route, 0, sizeof(route));
-    route.vr_id = vrid;
-    route.destination.addr_family = SAI_IP_ADDR_FAMILY_IPV4;
-    route.destination.addr.ip4 = htonl(ip_prefix);
-    SAI_IPV4_LEN_TO_MASK(route.destination.mask.ip4, prefix_len);
+    if (ops_sai_routing_nh_group_add(members, n_members, &nhg->handle)) {
+        ops_sai_resource_release(OPS_SAI_RESOURCE_NHG, 1);
+        free(nhg->buckets);
+        free(nhg);
+        return NULL;
+    }
 
-    if (action) {
-        ops_routep = ops_sai_route_lookup(vrf_id, prefix);
-        if (!ops_routep) {
-            ops_routep = ops_sai_route_add(vrf_id, prefix, next_hop_count, next_hops);
-            if (NULL != ops_routep) {
-                if (1 == ops_routep->n_nexthops) {
-                    p_nh_entry = ops_sai_route_get_nexthop(next_hops[0]);
-                    if (NULL == p_nh_entry) {
-                        rc = ops_sai_routing_nexthop_create(NULL, next_hops[0], &l3_egress_id);
-                        if (rc) {
-                            return status;
-                        }
-                    }else {
-                        l3_egress_id.data = p_nh_entry->handle.data;
-                    }
-
-                    ops_sai_route_add_nexthop(next_hops[0], &l3_egress_id);
-                    l3_id_cp.data = l3_egress_id.data;
-
-                } else if (1 <= ops_routep->n_nexthops) {
-                    HMAP_FOR_EACH(ops_nh, node, &ops_routep->nexthops) {
-                        /* need to add nexthop db or update refer cnt */
-                        p_nh_entry = ops_sai_route_get_nexthop(ops_nh->id);
-                        if (NULL == p_nh_entry) {
-                            rc = ops_sai_routing_nexthop_create(NULL, ops_nh->id, &l3_egress_id);
-                            if (rc) {
-                                continue;
-                                /* continue to add the rest of nexthops */
-                            }
-                        }else {
-                            l3_egress_id.data = p_nh_entry->handle.data;
-                        }
-
-                        ops_sai_route_add_nexthop(ops_nh->id, &l3_egress_id);
-                    }
-
-                    /* create nexthop group */
-                    ops_sai_routing_nh_group_add(ops_routep, &l3_nhg_id);
-                    ops_routep->nh_ecmp.data = l3_nhg_id.data;
-                    l3_id_cp.data = l3_nhg_id.data;
-                }
+    nhg->ref = 1;
+    hmap_insert(&all_nhg, &nhg->node, ops_sai_nhg_hash(set, n_nexthops));
+    for (i = 0; i < n_nexthops; i++) {
+        ops_sai_nhg_link(nhg, set[i]);
+    }
 
-                /* next comes routes adding */
-                attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
-                attr[0].value.s32 = SAI_PACKET_ACTION_FORWARD;
-                attr[1].id = SAI_ROUTE_ATTR_NEXT_HOP_ID;
-                attr[1].value.oid = l3_id_cp.data;
-                attr[2].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
-                attr[2].value.u8 = 0;                       // default to zero
+    return nhg;
+}
 
-                status = sai_api->route_api->create_route(&route, 3, attr);
-                SAI_ERROR_LOG_EXIT(status, "Failed to add route entry");
-            }
-        } else {
-            /* for support the route with intf nexthop */
-
-            if (0 == ops_routep->n_nexthops && ops_routep->refer_cnt)
-            {
-                //ops_routep = ops_sai_route_add(vrf_id, prefix, next_hop_count, next_hops);
-                rc = ops_sai_route_update(vrf_id, ops_routep, next_hop_count, next_hops, false);
-                if (rc) {
-                    goto exit;
-                }
-
-                if (1 == ops_routep->n_nexthops) {
-                    p_nh_entry = ops_sai_route_get_nexthop(next_hops[0]);
-                    if (NULL == p_nh_entry) {
-                        rc = ops_sai_routing_nexthop_create(NULL, next_hops[0], &l3_egress_id);
-                        if (rc) {
-                            return status;
-                        }
-                    }else {
-                        l3_egress_id.data = p_nh_entry->handle.data;
-                    }
-
-                    ops_sai_route_add_nexthop(next_hops[0], &l3_egress_id);
-                    l3_id_cp.data = l3_egress_id.data;
-
-                } else if (1 <= ops_routep->n_nexthops) {
-                    HMAP_FOR_EACH(ops_nh, node, &ops_routep->nexthops) {
-                        /* need to add nexthop db or update refer cnt */
-                        p_nh_entry = ops_sai_route_get_nexthop(ops_nh->id);
-                        if (NULL == p_nh_entry) {
-                            rc = ops_sai_routing_nexthop_create(NULL, ops_nh->id, &l3_egress_id);
-                            if (rc) {
-                                continue;
-                                /* continue to add the rest of nexthops */
-                            }
-                        }else {
-                            l3_egress_id.data = p_nh_entry->handle.data;
-                        }
-
-                        ops_sai_route_add_nexthop(ops_nh->id, &l3_egress_id);
-                    }
-
-                    /* create nexthop group */
-                    ops_sai_routing_nh_group_add(ops_routep, &l3_nhg_id);
-                    ops_routep->nh_ecmp.data = l3_nhg_id.data;
-                    l3_id_cp.data = l3_nhg_id.data;
-                }
-
-                /* next comes routes adding */
-                attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
-                attr[0].value.s32 = SAI_PACKET_ACTION_FORWARD;
-                attr[1].id = SAI_ROUTE_ATTR_NEXT_HOP_ID;
-                attr[1].value.oid = l3_id_cp.data;
-                attr[2].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
-                attr[2].value.u8 = 0;                       // default to zero
-
-                status = sai_api->route_api->create_route(&route, 3, attr);
-                SAI_ERROR_LOG_EXIT(status, "Failed to add route entry");
-            }
-            else if (ops_routep->n_nexthops)
-            {
-                /* update to ecmp  */
-                rc = ops_sai_route_update(vrf_id, ops_routep, next_hop_count, next_hops, false);
-                if (rc) {
-                    goto exit;
-                }
+/* Drops reference on ECMP group, removing it from hardware on last one. */
+static void
+ops_sai_nhg_unref(struct ops_sai_nhg *nhg)
+{
+    uint32_t i = 0;
 
-                HMAP_FOR_EACH(ops_nh, node, &ops_routep->nexthops)
-                {
-                    /* need to add nexthop db or update refer cnt */
-                    p_nh_entry = ops_sai_route_get_nexthop(ops_nh->id);
-                    if (NULL == p_nh_entry) {
-                        rc = ops_sai_routing_nexthop_create(NULL, ops_nh->id, &l3_egress_id);
-                        if (rc) {
-                            continue;
-                        }
-                    } else {
-                        l3_egress_id.data = p_nh_entry->handle.data;
-                    }
-
-                    /* add the nexthop db or refer  */
-                    for(index = 0; index < next_hop_count; index++)
-                    {
-                        if (0 == strcmp(ops_nh->id, next_hops[index])) {
-                            ops_sai_route_add_nexthop(ops_nh->id, &l3_egress_id);
-                        }
-                    }
-                }
+    if (!nhg || --nhg->ref) {
+        return;
+    }
 
-                if (OPS_ROUTE_STATE_ECMP != ops_routep->rstate) {
-                     /* create nexthop group */
-                     ops_sai_routing_nh_group_add(ops_routep, &l3_nhg_id);
-                     ops_sai_routing_nexthop_id_update(&route, &l3_nhg_id);
-                     ops_routep->nh_ecmp.data = l3_nhg_id.data;
-                     goto exit;
-                }
+    ops_sai_routing_nh_group_del(&nhg->handle);
+    ops_sai_resource_release(OPS_SAI_RESOURCE_NHG, 1);
+    for (i = 0; i < nhg->n_nexthops; i++) {
+        ops_sai_nhg_unlink(nhg, nhg->nexthops[i]);
+    }
+    hmap_remove(&all_nhg, &nhg->node);
+    free(nhg->buckets);
+    free(nhg);
+}
 
-                /* add nexthop member */
-                for(index = 0; index < next_hop_count; index++){
-                    ops_sai_routing_nhg_add_member(ops_routep,next_hops[index]);
-                }
-            }
+/*
+ * Changes members of a group in place. New members are added before old
+ * ones are removed, so the group never runs empty.
+ *
+ * @param[in] nhg        - group used by a single route
+ * @param[in] nexthops   - sorted next hop indices
+ * @param[in] n_nexthops - count of next hops
+ *
+ * @return 0 on success, SAI status otherwise. */
+static int
+ops_sai_nhg_modify(struct ops_sai_nhg *nhg, const uint32_t *nexthops,
+                   uint32_t n_nexthops)
+{
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+    uint32_t        old_nexthops[SAI_NEXT_HOP_MAX];
+    uint32_t        old_n_nexthops = nhg->n_nexthops;
+    uint32_t        old_active = nhg->active;
+    uint32_t        i = 0;
+    int             pos = 0;
+
+    memcpy(old_nexthops, nhg->nexthops, old_n_nexthops * sizeof(*nexthops));
+    for (i = 0; i < old_n_nexthops; i++) {
+        if (ops_sai_nhg_set_find(nexthops, n_nexthops, old_nexthops[i]) < 0) {
+            ops_sai_nhg_unlink(nhg, old_nexthops[i]);
         }
-    } else {
-        ops_routep = ops_sai_route_lookup(vrf_id, prefix);
-        if (!ops_routep) {
-            return status;
+    }
+
+    hmap_remove(&all_nhg, &nhg->node);
+    nhg->n_nexthops = n_nexthops;
+    nhg->active = 0;
+    for (i = 0; i < n_nexthops; i++) {
+        nhg->nexthops[i] = nexthops[i];
+        pos = ops_sai_nhg_set_find(old_nexthops, old_n_nexthops, nexthops[i]);
+        if (pos < 0) {
+            ops_sai_nhg_link(nhg, nexthops[i]);
+        } else if (old_active & (1u << pos)) {
+            nhg->active |= 1u << i;
         }
+    }
+    hmap_insert(&all_nhg, &nhg->node, ops_sai_nhg_hash(nexthops, n_nexthops));
 
-        if (next_hops) {
-            ops_sai_route_update(vrf_id, ops_routep, next_hop_count, next_hops, true);
-            if (1 == ops_routep->n_nexthops) {
-                HMAP_FOR_EACH(ops_nh, node, &ops_routep->nexthops)
-                {
-                    p_nh_entry = ops_sai_route_get_nexthop(ops_nh->id);
-                    if (NULL != p_nh_entry) {
-                        l3_egress_id.data = p_nh_entry->handle.data;
-                    }
-                }
+    status = ops_sai_nhg_sync(nhg);
+    if (status || nhg->buckets) {
+        return status;
+    }
 
-                /* update the nhid */
-                ops_sai_routing_nexthop_id_update(&route, &l3_egress_id);
+    for (i = 0; i < old_n_nexthops; i++) {
+        if ((old_active & (1u << i)) &&
+            ops_sai_nhg_set_find(nexthops, n_nexthops, old_nexthops[i]) < 0) {
+            status = ops_sai_routing_nhg_del_member(&nhg->handle,
+                                                    old_nexthops[i]);
+        }
+    }
 
-                /* delete the nhid after */
-                if (OPS_ROUTE_STATE_ECMP == ops_routep->rstate) {
-                    ops_sai_routing_nh_group_del(&ops_routep->nh_ecmp);
-                }
-            }
-            else if (1 < ops_routep->n_nexthops) {
+    return status;
+}
 
-                /* remove nexthop member */
-                for(index = 0; index < next_hop_count; index++){
-                    ops_sai_routing_nhg_del_member(ops_routep,next_hops[index]);
-                }
-            } else {
-            if (ops_routep->refer_cnt) {
-                    /* del the ipuc prefix */
-                    status = sai_api->route_api->remove_route(&route);
-                    __ops_sai_route_local_add(&vrfid, prefix, NULL);
-                } else {
-                    /* del the ipuc prefix */
-                    status = sai_api->route_api->remove_route(&route);
-                    ops_sai_route_del(ops_routep);
-                    return status;
-                }
-            }
-            /* del the nexthop db or refer  */
-            for(index = 0; index < next_hop_count; index++)
-            {
-                p_nh_entry = ops_sai_route_get_nexthop(next_hops[index]);
-                if (NULL != p_nh_entry) {
-                    l3_egress_id.data = p_nh_entry->handle.data;
-                    rc = ops_sai_route_delete_nexthop(p_nh_entry->id);
-                    if (!rc) {
-                        rc = ops_sai_routing_nexthop_remove(&l3_egress_id);
-                    }
-                }
-            }
-        } else {
-            /* del the ipuc prefix */
-            status = sai_api->route_api->remove_route(&route);
-            SAI_ERROR_LOG_EXIT(status, "Failed to delete route entry");
+/*
+ * Updates next hop state after its neighbor was added or removed. With
+ * prefix independent convergence the groups the next hop is in are fixed
+ * up right away, routes keep pointing to the same groups.
+ *
+ * @param[in] index - next hop index
+ * @param[in] is_up - whether next hop has a neighbor */
+void
+ops_sai_nexthop_state_set(uint32_t index, bool is_up)
+{
+    struct nh_entry *p_nh_entry = NULL;
+    size_t          i           = 0;
 
-            if (OPS_ROUTE_STATE_ECMP == ops_routep->rstate) {
-                ops_sai_routing_nh_group_del(&ops_routep->nh_ecmp);
-            }
+    p_nh_entry = ops_sai_nexthop_get(index);
+    if (!p_nh_entry || p_nh_entry->is_down == !is_up) {
+        return;
+    }
 
-            /* del the nexthop db or refer  */
-            HMAP_FOR_EACH(ops_nh, node, &ops_routep->nexthops)
-            {
-                p_nh_entry = ops_sai_route_get_nexthop(ops_nh->id);
-                if (NULL != p_nh_entry) {
-                    l3_egress_id.data = p_nh_entry->handle.data;
-                    rc = ops_sai_route_delete_nexthop(p_nh_entry->id);
-                    if (!rc) {
-                        rc = ops_sai_routing_nexthop_remove(&l3_egress_id);
-                    }
-                }
-            }
+    p_nh_entry->is_down = !is_up;
+    if (is_up && route_n_parked) {
+        atomic_store_relaxed(&route_park_dirty, true);
+    }
+    if (!route_pic_enabled) {
+        return;
+    }
 
-            ops_sai_route_del(ops_routep);
-            return status;
+    for (i = 0; i < p_nh_entry->n_nhgs; i++) {
+        if (ops_sai_nhg_sync(p_nh_entry->nhgs[i])) {
+            VLOG_ERR("Failed to update ECMP group after next hop went %s",
+                     is_up ? "up" : "down");
         }
     }
+}
 
-exit:
-    if (ops_routep->n_nexthops > 1) {
-        ops_routep->rstate = OPS_ROUTE_STATE_ECMP;
-    } else {
-        ops_routep->rstate = OPS_ROUTE_STATE_NON_ECMP;
-        ops_routep->nh_ecmp.data = 0;
+/* Re-programs all groups after a change of the hashing settings */
+static int
+ops_sai_nhg_sync_all(void)
+{
+    struct ops_sai_nhg  *nhg    = NULL;
+    int                 status  = 0;
+    int                 rc      = 0;
+
+    HMAP_FOR_EACH(nhg, node, &all_nhg) {
+        rc = ops_sai_nhg_sync(nhg);
+        if (!status) {
+            status = rc;
+        }
     }
 
     return status;
 }
 
 /*
- *  Function for adding local route.
- *  Means while creating new routing interface and assigning IP address to it
- *  'tells' the hardware that new subnet is accessible through specified
- *  router interface.
+ * Switches ECMP groups between resilient and regular hashing.
  *
- * @param[in] vrid    - virtual router ID
- * @param[in] prefix  - IP prefix
- * @param[in] rifid   - router interface ID
+ * @param[in] enable - use resilient hashing
  *
- * @return 0  if operation completed successfully.
- * @return -1 if operation failed.*/
+ * @return 0 on success, SAI status of the first group failed otherwise. */
 static int
-__route_local_add(const handle_t *vrid,
-                  const char     *prefix,
-                  const handle_t *rifid)
+__route_ecmp_resilient_set(bool enable)
 {
-    sai_status_t    status      = SAI_STATUS_SUCCESS;
-    int                 vrf_id      = 0;
-    sai_ops_route_t     *ops_routep = NULL;
-
-    ops_routep = ops_sai_route_lookup(vrf_id, prefix);
-    if (NULL == ops_routep) {
-        ops_routep = ops_sai_route_add(vrf_id, prefix, 0, NULL);
-        if (NULL != ops_routep) {
-            ops_routep->refer_cnt = 1;
-        } else {
-            return status;
-        }
-
-        __ops_sai_route_local_add(vrid, prefix, rifid);
-        /* need to check when mask is 32 */
-
-    } else {
-        ops_routep->refer_cnt++;
+    if (enable == route_ecmp_resilient) {
+        return 0;
     }
 
-    return status;
+    VLOG_INFO("%s resilient ECMP hashing", enable ? "Enabling" : "Disabling");
+    route_ecmp_resilient = enable;
+
+    return ops_sai_nhg_sync_all();
 }
 
 /*
- *  Function for adding next hops(list of remote routes) which are accessible
- *  over specified IP prefix
+ * Sets weight of a next hop. ECMP groups with the next hop get a share of
+ * buckets proportional to the weights of their members.
  *
- * @param[in] vrid           - virtual router ID
- * @param[in] prefix         - IP prefix
- * @param[in] next_hop_count - count of next hops
- * @param[in] next_hops      - list of next hops
+ * @param[in] key    - next hop key, of address only
+ * @param[in] weight - weight, OPS_SAI_NH_WEIGHT_DEFAULT drops the setting
  *
- * @return 0  if operation completed successfully.
- * @return -1 if operation failed.*/
+ * @return 0 on success, SAI status of the first group failed otherwise. */
 static int
-__route_remote_add(handle_t           vrid,
-                   const char        *prefix,
-                   uint32_t           next_hop_count,
-                   char *const *const next_hops)
+ops_sai_nexthop_weight_set(const struct ops_sai_nexthop_key *key,
+                           uint32_t weight)
 {
-    sai_status_t    status = SAI_STATUS_SUCCESS;
-    uint32_t        cmd_add = true;
+    struct ops_sai_nh_weight    *nh_weight  = ops_sai_nh_weight_lookup(key);
+    struct nh_entry             *p_nh_entry = NULL;
+    size_t                      i           = 0;
+    int                         status      = 0;
+    int                         rc          = 0;
+
+    if (OPS_SAI_NH_WEIGHT_DEFAULT == weight) {
+        if (nh_weight) {
+            hmap_remove(&all_nh_weight, &nh_weight->node);
+            free(nh_weight);
+        }
+    } else {
+        if (!nh_weight) {
+            nh_weight = xzalloc(sizeof(*nh_weight));
+            ops_sai_nh_weight_key_init(&nh_weight->key, key);
+            hmap_insert(&all_nh_weight, &nh_weight->node,
+                        ops_sai_nexthop_key_hash(&nh_weight->key));
+        }
+        nh_weight->weight = weight;
+    }
 
-    VLOG_INFO("Adding next hop(s) for remote route"
-              "(prefix: %s, next hop count %u)", prefix, next_hop_count);
+    /* Same address on every router interface */
+    HMAP_FOR_EACH(p_nh_entry, nh_hmap_node, &all_nexthop) {
+        if (p_nh_entry->key.family != key->family
+            || memcmp(p_nh_entry->key.addr, key->addr, sizeof(key->addr))
+            || p_nh_entry->weight == weight) {
+            continue;
+        }
 
-    ovs_assert(prefix);
-    ovs_assert(next_hops);
-    ovs_assert(next_hop_count);
-    if (SAI_NEXT_HOP_MAX <= next_hop_count) {
-        VLOG_ERR("The num of nexthops is overflow");
-        goto exit;
+        p_nh_entry->weight = weight;
+        for (i = 0; i < p_nh_entry->n_nhgs; i++) {
+            rc = ops_sai_nhg_sync(p_nh_entry->nhgs[i]);
+            if (!status) {
+                status = rc;
+            }
+        }
     }
 
-    status = __sai_route_remote_action(vrid.data, prefix, next_hop_count,
-                                   next_hops, cmd_add);
+    return status;
+}
 
-    SAI_ERROR_LOG_EXIT(status, "Failed to add remote route"
-                      "(prefix: %s, next hop count %u)",
-                      prefix, next_hop_count);
+int32_t
+ops_sai_routing_nexthop_id_update(sai_unicast_route_entry_t *p_route, handle_t *l3_egress_id)
+{
+    sai_status_t status = SAI_STATUS_SUCCESS;
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_attribute_t             attr[1];
+
+    memset(attr, 0, sizeof(attr));
+
+    attr[0].id = SAI_ROUTE_ATTR_NEXT_HOP_ID;
+    attr[0].value.oid = l3_egress_id->data;
+
+    status = sai_api->route_api->set_route_attribute(p_route, attr);
+    SAI_ERROR_LOG_EXIT(status, "Failed to update route nexthop id");
 
 exit:
     return status;
 }
 
-/*
- *  Function for deleting next hops(list of remote routes) which now are not
- *  accessible over specified IP prefix
- *
- * @param[in] vrid           - virtual router ID
- * @param[in] prefix         - IP prefix
- * @param[in] next_hop_count - count of next hops
- * @param[in] next_hops      - list of next hops
- *
- * @return 0  if operation completed successfully.
- * @return -1 if operation failed.*/
-static int
-__route_remote_nh_remove(handle_t           vrid,
-                         const char        *prefix,
-                         uint32_t           next_hop_count,
-                         char *const *const next_hops)
+/* Whether route has next hops and none of them is resolved */
+static bool
+__route_is_unresolved(const sai_ops_route_t *ops_routep)
 {
-    sai_status_t    status = SAI_STATUS_SUCCESS;
-    uint32_t        cmd_add = false;
+    uint8_t i = 0;
 
-    status = __sai_route_remote_action(vrid.data, prefix, next_hop_count,
-                                   next_hops, cmd_add);
+    if (!ops_routep->n_nexthops) {
+        return false;
+    }
 
-    return status;
+    for (i = 0; i < ops_routep->n_nexthops; i++) {
+        if (!ops_sai_nexthop_get(ops_routep->nexthops[i])->is_down) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-/*
- *  Function for deleting remote route
- *
- * @param[in] vrid           - virtual router ID
- * @param[in] prefix         - IP prefix over which next hops can be accessed
- *
- * @notes if next hops were already configured earlier for this route then
- *        delete all next-hops of a route as well as the route itself.
- *
- * @return 0  if operation completed successfully.
- * @return -1 if operation failed.*/
-static int
-__route_remove(const handle_t *vrid, const char     *prefix)
+/* Whether route about to be programmed should be parked */
+static inline bool
+__route_park_needed(const sai_ops_route_t *ops_routep)
 {
-    sai_status_t        status          = SAI_STATUS_SUCCESS;
-    uint32_t            cmd_add         = false;
-    int                 vrf_id          = 0;
-    sai_ops_route_t     *ops_routep     = NULL;
+    return ROUTE_PARK_OFF != route_park_mode && !ops_routep->aggr &&
+           __route_is_unresolved(ops_routep);
+}
 
-    if (NULL == vrid || NULL == prefix)
-    {
-        return SAI_STATUS_FAILURE;
+/* Packet action remote route is programmed with */
+static int32_t
+__route_packet_action(const sai_ops_route_t *ops_routep)
+{
+    if (!ops_routep->parked) {
+        return SAI_PACKET_ACTION_FORWARD;
     }
 
-    ops_routep = ops_sai_route_lookup(vrf_id, prefix);
-    if (NULL != ops_routep) {
-        if (ops_routep->refer_cnt) {
-            if (ops_routep->n_nexthops) {
-                if (1 <= ops_routep->refer_cnt) {
-                    ops_routep->refer_cnt --;
-                }
-            } else {
-                /* For route without nexthop of intf, and local multipath */
-                if (1 < ops_routep->refer_cnt) {
-                    ops_routep->refer_cnt --;
-                } else if (1 == ops_routep->refer_cnt) {
-                    /* for delete the local route */
-                    __ops_sai_route_local_delete(vrid, prefix);
-                    ops_sai_route_del(ops_routep);
-                }
-            }
-        } else {
-            if (ops_routep->n_nexthops) {
-                /* for delete the remote route and nexthop  */
-                status = __sai_route_remote_action(vrid->data, prefix, 0, NULL, cmd_add);
-            }
-        }
+    return ROUTE_PARK_TRAP == route_park_mode ? SAI_PACKET_ACTION_TRAP
+                                              : SAI_PACKET_ACTION_DROP;
+}
+
+/* Parks or promotes route in the route table only. */
+static void
+__route_park_set(sai_ops_route_t *ops_routep, bool parked)
+{
+    if (parked == ops_routep->parked) {
+        return;
     }
 
-    return status;
+    ops_routep->parked = parked;
+    if (parked) {
+        list_push_back(&route_parked, &ops_routep->park_node);
+        route_n_parked++;
+        route_park_stats.parked++;
+    } else {
+        list_remove(&ops_routep->park_node);
+        route_n_parked--;
+    }
 }
 
 /*
- * De-initializes route.
- */
+ * Re-evaluates parking of a programmed remote route after its next hops
+ * changed, updating packet action of its route entry.
+ *
+ * @param[in] ops_routep - route
+ * @param[in] route      - route entry of the route */
 static void
-__route_deinit(void)
+__route_park_update(sai_ops_route_t *ops_routep,
+                    const sai_unicast_route_entry_t *route)
 {
-    SAI_API_TRACE_NOT_IMPLEMENTED_FN();
-}
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_attribute_t attr;
+    sai_status_t status = SAI_STATUS_SUCCESS;
+    bool parked = __route_park_needed(ops_routep);
 
-DEFINE_GENERIC_CLASS(struct route_class, route) = {
-    .init = __route_init,
-    .ip_to_me_add = __route_ip_to_me_add,
-    .ip_to_me_delete = __route_ip_to_me_delete,
-    .local_add = __route_local_add,
-    .remote_add = __route_remote_add,
+    /* Route without next hops is programmed as local route, if at all */
+    if (!ops_routep->n_nexthops) {
+        __route_park_set(ops_routep, false);
+        return;
+    }
+
+    if (parked == ops_routep->parked) {
+        return;
+    }
+
+    __route_park_set(ops_routep, parked);
+
+    memset(&attr, 0, sizeof(attr));
+    attr.id = SAI_ROUTE_ATTR_PACKET_ACTION;
+    attr.value.s32 = __route_packet_action(ops_routep);
+    status = sai_api->route_api->set_route_attribute(route, &attr);
+    if (SAI_ERROR_2_ERRNO(status)) {
+        VLOG_ERR("SAI error %d Failed to %s route", status,
+                 parked ? "park" : "promote");
+        route_park_stats.failures++;
+    } else if (!parked) {
+        route_park_stats.promoted++;
+    }
+}
+
+/* Sets route attributes for forwarding to next hop (or group) l3_id. Parked
+ * routes keep the next hop, but trap or drop packets. */
+static void
+__route_forward_attr_fill(sai_attribute_t *attr, const handle_t *l3_id,
+                          int32_t action)
+{
+    memset(attr, 0, 3 * sizeof(*attr));
+
+    attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
+    attr[0].value.s32 = action;
+    attr[1].id = SAI_ROUTE_ATTR_NEXT_HOP_ID;
+    attr[1].value.oid = l3_id->data;
+    attr[2].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
+    attr[2].value.u8 = 0;                       // default to zero
+}
+
+/*
+ * Takes over a route entry found in hardware after warm restart by setting
+ * the attributes it would have been created with.
+ *
+ * @return 0 on success, SAI status otherwise. */
+static int
+__route_entry_adopt(const sai_unicast_route_entry_t *route,
+                    const sai_attribute_t *attr, uint32_t attr_count)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_status_t status = SAI_STATUS_SUCCESS;
+
+    for (uint32_t i = 0; i < attr_count; i++) {
+        status = sai_api->route_api->set_route_attribute(route, &attr[i]);
+        SAI_ERROR_LOG_EXIT(status, "Failed to adopt route entry");
+    }
+
+exit:
+    return status;
+}
+
+/*
+ * Creates a route entry, taking a route table entry for it. An entry kept
+ * in hardware over warm restart is taken over while reconciling. Nothing is
+ * taken if the table is full or the entry could not be created.
+ *
+ * @return 0 on success, SAI status otherwise. */
+static sai_status_t
+__route_entry_create(const sai_unicast_route_entry_t *route,
+                     const sai_attribute_t *attr, uint32_t attr_count)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_status_t status = SAI_STATUS_SUCCESS;
+
+    if (!ops_sai_resource_admit(OPS_SAI_RESOURCE_ROUTE, 1)) {
+        return SAI_STATUS_TABLE_FULL;
+    }
+
+    status = sai_api->route_api->create_route(route, attr_count, attr);
+    if (SAI_STATUS_ITEM_ALREADY_EXISTS == status && route_reconcile_deadline) {
+        status = __route_entry_adopt(route, attr, attr_count);
+    }
+    if (SAI_ERROR_2_ERRNO(status)) {
+        ops_sai_resource_release(OPS_SAI_RESOURCE_ROUTE, 1);
+    }
+
+    return status;
+}
+
+/* Removes a route entry and returns its route table entry. */
+static sai_status_t
+__route_entry_remove(const sai_unicast_route_entry_t *route)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_status_t status = SAI_STATUS_SUCCESS;
+
+    status = sai_api->route_api->remove_route(route);
+    if (!SAI_ERROR_2_ERRNO(status)) {
+        ops_sai_resource_release(OPS_SAI_RESOURCE_ROUTE, 1);
+    }
+
+    return status;
+}
+
+/*
+ * Route aggregation. When enabled, two sibling prefixes (same length,
+ * differing in the last bit only) forwarding to the same next hop or group
+ * are programmed as one route entry of their parent prefix, as long as no
+ * route of the parent prefix exists. Merging repeats upwards, so an
+ * aggregate stands for a set of routes whose prefixes make up its prefix.
+ * More specific routes with other next hops stay programmed and still win
+ * the lookup, so forwarding is unchanged.
+ *
+ * Aggregates are built by a periodic pass from ofproto type_run(). Before any
+ * route operation on a prefix, aggregates covering it are split along the
+ * path to the prefix only, one route entry per level.
+ */
+struct ops_sai_route_aggr {
+    struct hmap_node            node;           /* ops_sai_route_vrf aggrs */
+    struct ops_sai_route_key    key;
+    uint64_t                    vrid;
+    handle_t                    l3_id;          /* next hop or group */
+    sai_ops_route_t             **members;
+    size_t                      n_members;
+};
+
+enum route_aggr_mode {
+    ROUTE_AGGR_OFF = 0,
+    ROUTE_AGGR_ON,
+    ROUTE_AGGR_AUTO             /* only while route table is filling up */
+};
+
+static const char *route_aggr_mode_names[] = { "off", "on", "auto" };
+
+static size_t route_n_aggrs;                    /* of all VRFs */
+
+/* Set by the main thread, read by the worker */
+static atomic_uint route_aggr_mode = ATOMIC_VAR_INIT(ROUTE_AGGR_OFF);
+
+/* Set by route operations on either thread, cleared by the pass */
+static atomic_bool route_aggr_dirty = ATOMIC_VAR_INIT(false);
+static long long int route_aggr_next;           /* next pass, msec */
+
+/*
+ * Prefixes changed since the last pass. Two units can only become mergeable
+ * where a route changed or where a merge just made their parent, so the pass
+ * walks up from changed prefixes rather than looking at every route. Kept
+ * with the routes, by whichever thread programs them. After too many changes
+ * the next pass walks up from every route instead.
+ */
+static struct ops_sai_route_key *route_aggr_changed;
+static size_t route_aggr_n_changed;
+static size_t route_aggr_allocated_changed;
+static bool route_aggr_full = true;             /* next pass takes all */
+
+static struct {
+    uint64_t    passes;
+    uint64_t    merges;
+    uint64_t    splits;
+    uint64_t    failures;
+} route_aggr_stats;
+
+/* Route or aggregate which may be merged with its sibling */
+struct route_aggr_unit {
+    struct ops_sai_route_key    key;
+    uint64_t                    vrid;
+    handle_t                    l3_id;
+    sai_ops_route_t             *route;         /* NULL for aggregate */
+    struct ops_sai_route_aggr   *aggr;
+};
+
+static inline enum route_aggr_mode
+__route_aggr_mode_get(void)
+{
+    unsigned int mode = ROUTE_AGGR_OFF;
+
+    atomic_read_relaxed(&route_aggr_mode, &mode);
+
+    return mode;
+}
+
+static inline int
+__route_prefix_bit(const struct ops_sai_prefix *prefix, uint8_t pos)
+{
+    return (prefix->addr[pos / 8] >> (7 - pos % 8)) & 1;
+}
+
+/* Shortens the prefix to len bits, clearing host bits. */
+static void
+__route_prefix_truncate(struct ops_sai_prefix *prefix, uint8_t len)
+{
+    int i = 0;
+
+    for (i = len / 8; i < OPS_SAI_IP_ADDR_MAX_LEN; i++) {
+        prefix->addr[i] &= (i == len / 8 && len % 8)
+                           ? (uint8_t)(0xff << (8 - len % 8)) : 0;
+    }
+    prefix->len = len;
+}
+
+/* Next hop or group a remote route forwards to */
+static handle_t
+__route_l3_id(const sai_ops_route_t *ops_routep)
+{
+    handle_t l3_id;
+
+    memset(&l3_id, 0, sizeof(l3_id));
+    if (ops_routep->nhg) {
+        l3_id = ops_routep->nhg->handle;
+    } else if (1 == ops_routep->n_nexthops) {
+        l3_id = ops_sai_nexthop_get(ops_routep->nexthops[0])->handle;
+    }
+
+    return l3_id;
+}
+
+static struct ops_sai_route_aggr *
+__route_aggr_lookup(const struct ops_sai_route_key *key)
+{
+    struct ops_sai_route_vrf *route_vrf = __route_vrf_get(key->vrf);
+    struct ops_sai_route_aggr *aggr = NULL;
+
+    if (!route_vrf) {
+        return NULL;
+    }
+
+    HMAP_FOR_EACH_WITH_HASH(aggr, node, ops_sai_route_key_hash(key),
+                            &route_vrf->aggrs) {
+        if (!memcmp(&aggr->key, key, sizeof(*key))) {
+            return aggr;
+        }
+    }
+
+    return NULL;
+}
+
+/* Finds an aggregate whose prefix covers or equals the key prefix */
+static struct ops_sai_route_aggr *
+__route_aggr_covering(const struct ops_sai_route_key *key)
+{
+    struct ops_sai_route_aggr *aggr = NULL;
+    struct ops_sai_route_key parent;
+    int len = 0;
+
+    for (len = key->prefix.len; len >= 0; len--) {
+        parent = *key;
+        __route_prefix_truncate(&parent.prefix, len);
+        aggr = __route_aggr_lookup(&parent);
+        if (aggr) {
+            return aggr;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Programs a route entry forwarding to l3_id, taking a route table entry.
+ *
+ * @return 0 on success, SAI status otherwise. */
+static int
+__route_aggr_entry_create(uint64_t vrid, const struct ops_sai_prefix *prefix,
+                          const handle_t *l3_id)
+{
+    sai_unicast_route_entry_t route;
+    sai_attribute_t attr[3];
+    sai_status_t status = SAI_STATUS_SUCCESS;
+
+    ops_sai_route_entry_fill(&route, vrid, prefix);
+    __route_forward_attr_fill(attr, l3_id, SAI_PACKET_ACTION_FORWARD);
+
+    status = __route_entry_create(&route, attr, 3);
+    SAI_ERROR_LOG_EXIT(status, "Failed to add aggregated route entry");
+
+exit:
+    return status;
+}
+
+/* Removes route entry programmed in place of aggregated routes. */
+static int
+__route_aggr_entry_remove(uint64_t vrid, const struct ops_sai_prefix *prefix)
+{
+    sai_unicast_route_entry_t route;
+    sai_status_t status = SAI_STATUS_SUCCESS;
+
+    ops_sai_route_entry_fill(&route, vrid, prefix);
+
+    status = __route_entry_remove(&route);
+    SAI_ERROR_LOG_EXIT(status, "Failed to remove aggregated route entry");
+
+exit:
+    return status;
+}
+
+static struct ops_sai_route_aggr *
+__route_aggr_create(const struct ops_sai_route_key *key, uint64_t vrid,
+                    const handle_t *l3_id, sai_ops_route_t **members,
+                    size_t n_members)
+{
+    struct ops_sai_route_aggr *aggr = xzalloc(sizeof(*aggr));
+
+    aggr->key = *key;
+    aggr->vrid = vrid;
+    aggr->l3_id = *l3_id;
+    aggr->members = members;
+    aggr->n_members = n_members;
+    for (size_t i = 0; i < n_members; i++) {
+        members[i]->aggr = aggr;
+    }
+    hmap_insert(&__route_vrf_get(key->vrf)->aggrs, &aggr->node,
+                ops_sai_route_key_hash(key));
+    route_n_aggrs++;
+
+    return aggr;
+}
+
+static void
+__route_aggr_destroy(struct ops_sai_route_aggr *aggr)
+{
+    hmap_remove(&__route_vrf_get(aggr->key.vrf)->aggrs, &aggr->node);
+    route_n_aggrs--;
+    free(aggr->members);
+    free(aggr);
+}
+
+/*
+ * Replaces aggregate with the two halves of its prefix. A half made of a
+ * single route is that route programmed on its own. Halves are programmed
+ * before the aggregate entry is removed, so traffic keeps flowing and a
+ * failure leaves the aggregate as it was.
+ *
+ * @return 0 on success, SAI status otherwise. */
+static int
+__route_aggr_split(struct ops_sai_route_aggr *aggr)
+{
+    struct ops_sai_route_key half[2];
+    sai_ops_route_t **members[2];
+    size_t n_members[2] = { 0, 0 };
+    uint8_t len = aggr->key.prefix.len;
+    int status = 0;
+    int h = 0;
+
+    for (h = 0; h < 2; h++) {
+        half[h] = aggr->key;
+        half[h].prefix.len = len + 1;
+        if (h) {
+            half[h].prefix.addr[len / 8] |= 0x80 >> (len % 8);
+        }
+        members[h] = xcalloc(aggr->n_members, sizeof(*members[h]));
+    }
+
+    for (size_t i = 0; i < aggr->n_members; i++) {
+        h = __route_prefix_bit(&aggr->members[i]->key.prefix, len);
+        members[h][n_members[h]++] = aggr->members[i];
+    }
+
+    for (h = 0; h < 2; h++) {
+        status = __route_aggr_entry_create(aggr->vrid, &half[h].prefix,
+                                           &aggr->l3_id);
+        if (status) {
+            if (h) {
+                __route_aggr_entry_remove(aggr->vrid, &half[0].prefix);
+            }
+            goto exit;
+        }
+    }
+
+    status = __route_aggr_entry_remove(aggr->vrid, &aggr->key.prefix);
+    if (status) {
+        __route_aggr_entry_remove(aggr->vrid, &half[0].prefix);
+        __route_aggr_entry_remove(aggr->vrid, &half[1].prefix);
+        goto exit;
+    }
+
+    for (h = 0; h < 2; h++) {
+        if (1 == n_members[h]) {
+            members[h][0]->aggr = NULL;
+        } else {
+            __route_aggr_create(&half[h], aggr->vrid, &aggr->l3_id,
+                                members[h], n_members[h]);
+            members[h] = NULL;
+        }
+    }
+    __route_aggr_destroy(aggr);
+    route_aggr_stats.splits++;
+
+exit:
+    if (status) {
+        route_aggr_stats.failures++;
+    }
+    free(members[0]);
+    free(members[1]);
+    return status;
+}
+
+/* Remembers prefix changed for the next pass. Changes made while off are
+ * not kept, the next pass takes all routes. */
+static void
+__route_aggr_changed_add(const struct ops_sai_route_key *key)
+{
+    if (route_aggr_full) {
+        return;
+    }
+
+    if (ROUTE_AGGR_OFF == __route_aggr_mode_get() ||
+        route_aggr_n_changed == OPS_SAI_ROUTE_AGGR_CHANGED_MAX) {
+        route_aggr_n_changed = 0;
+        route_aggr_full = true;
+        return;
+    }
+
+    if (route_aggr_n_changed == route_aggr_allocated_changed) {
+        route_aggr_changed = x2nrealloc(route_aggr_changed,
+                                        &route_aggr_allocated_changed,
+                                        sizeof(*route_aggr_changed));
+    }
+    route_aggr_changed[route_aggr_n_changed++] = *key;
+}
+
+/*
+ * Makes the prefix safe to operate on: aggregates covering it are split
+ * until the prefix is programmed on its own or not covered at all. Called
+ * before every route operation.
+ *
+ * @return 0 on success, SAI status if an aggregate could not be split. */
+static int
+__route_aggr_expand(const struct ops_sai_route_key *key)
+{
+    struct ops_sai_route_aggr *aggr = NULL;
+    int status = 0;
+
+    atomic_store_relaxed(&route_aggr_dirty, true);
+    __route_aggr_changed_add(key);
+
+    if (!route_n_aggrs) {
+        return 0;
+    }
+
+    while ((aggr = __route_aggr_covering(key))) {
+        status = __route_aggr_split(aggr);
+        if (status) {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Gets unit of a prefix: an aggregate, or a remote route which may be
+ * aggregated and is not yet.
+ *
+ * @return true if prefix has a unit. */
+static bool
+__route_aggr_unit_get(const struct ops_sai_route_key *key,
+                      struct route_aggr_unit *unit)
+{
+    sai_ops_route_t *ops_routep = NULL;
+
+    memset(unit, 0, sizeof(*unit));
+    unit->key = *key;
+
+    unit->aggr = __route_aggr_lookup(key);
+    if (unit->aggr) {
+        unit->vrid = unit->aggr->vrid;
+        unit->l3_id = unit->aggr->l3_id;
+        return true;
+    }
+
+    ops_routep = ops_sai_route_lookup(key);
+    if (!ops_routep || ops_routep->aggr || ops_routep->refer_cnt ||
+        ops_routep->parked || !ops_routep->n_nexthops ||
+        !ops_routep->key.prefix.len) {
+        return false;
+    }
+
+    unit->route = ops_routep;
+    unit->vrid = ops_routep->vrid;
+    unit->l3_id = __route_l3_id(ops_routep);
+
+    return true;
+}
+
+/* Takes members of a unit, leaving it empty */
+static void
+__route_aggr_unit_members_move(struct route_aggr_unit *unit,
+                               sai_ops_route_t **members, size_t *n_members)
+{
+    if (unit->route) {
+        members[(*n_members)++] = unit->route;
+        return;
+    }
+
+    memcpy(&members[*n_members], unit->aggr->members,
+           unit->aggr->n_members * sizeof(*members));
+    *n_members += unit->aggr->n_members;
+    __route_aggr_destroy(unit->aggr);
+    unit->aggr = NULL;
+}
+
+/*
+ * Merges two sibling units into an aggregate of their parent prefix. The
+ * parent entry is programmed before the sibling entries are removed.
+ *
+ * @return aggregate or NULL if hardware could not be updated. */
+static struct ops_sai_route_aggr *
+__route_aggr_merge(struct route_aggr_unit *unit, struct route_aggr_unit *sib,
+                   const struct ops_sai_route_key *parent)
+{
+    sai_ops_route_t **members = NULL;
+    size_t n_members = 0;
+
+    if (__route_aggr_entry_create(unit->vrid, &parent->prefix,
+                                  &unit->l3_id)) {
+        return NULL;
+    }
+
+    if (__route_aggr_entry_remove(unit->vrid, &unit->key.prefix)) {
+        __route_aggr_entry_remove(unit->vrid, &parent->prefix);
+        return NULL;
+    }
+
+    if (__route_aggr_entry_remove(sib->vrid, &sib->key.prefix)) {
+        __route_aggr_entry_create(unit->vrid, &unit->key.prefix,
+                                  &unit->l3_id);
+        __route_aggr_entry_remove(unit->vrid, &parent->prefix);
+        return NULL;
+    }
+
+    members = xcalloc((unit->aggr ? unit->aggr->n_members : 1)
+                      + (sib->aggr ? sib->aggr->n_members : 1),
+                      sizeof(*members));
+    __route_aggr_unit_members_move(unit, members, &n_members);
+    __route_aggr_unit_members_move(sib, members, &n_members);
+    route_aggr_stats.merges++;
+
+    return __route_aggr_create(parent, unit->vrid, &unit->l3_id, members,
+                               n_members);
+}
+
+/*
+ * Merges unit of a prefix with its sibling, then the aggregate made with
+ * the sibling of its prefix and so on, up to the first level with nothing
+ * to merge.
+ *
+ * @param[in] key - prefix, may have no unit
+ */
+static void
+__route_aggr_walk(const struct ops_sai_route_key *key)
+{
+    struct route_aggr_unit unit;
+    struct route_aggr_unit sib;
+    struct ops_sai_route_aggr *aggr = NULL;
+    struct ops_sai_route_key sib_key;
+    struct ops_sai_route_key parent;
+    int len = 0;
+
+    if (!__route_aggr_unit_get(key, &unit)) {
+        return;
+    }
+
+    for (len = unit.key.prefix.len; len > 0; len--) {
+        sib_key = unit.key;
+        sib_key.prefix.addr[(len - 1) / 8] ^= 0x80 >> ((len - 1) % 8);
+        if (!__route_aggr_unit_get(&sib_key, &sib) ||
+            sib.vrid != unit.vrid || sib.l3_id.data != unit.l3_id.data) {
+            return;
+        }
+
+        parent = unit.key;
+        __route_prefix_truncate(&parent.prefix, len - 1);
+        if (ops_sai_route_lookup(&parent)) {
+            return;
+        }
+
+        aggr = __route_aggr_merge(&unit, &sib, &parent);
+        if (!aggr) {
+            /* Retried by the next pass */
+            route_aggr_stats.failures++;
+            __route_aggr_changed_add(&unit.key);
+            return;
+        }
+
+        memset(&unit, 0, sizeof(unit));
+        unit.key = aggr->key;
+        unit.vrid = aggr->vrid;
+        unit.l3_id = aggr->l3_id;
+        unit.aggr = aggr;
+    }
+}
+
+/*
+ * Aggregation pass. Walks up from every prefix changed since the last pass
+ * and from its first half, which may merge with the other half once a route
+ * of the prefix is gone. The first pass, and a pass after too many changes,
+ * walks up from every remote route instead.
+ */
+static void
+__route_aggr_compress(void)
+{
+    struct ops_sai_route_key *changed = route_aggr_changed;
+    size_t n_changed = route_aggr_n_changed;
+    struct ops_sai_route_vrf *route_vrf = NULL;
+    sai_ops_route_t *ops_routep = NULL;
+    struct ops_sai_route_key half;
+
+    /* Failed merges are added back for the next pass */
+    route_aggr_changed = NULL;
+    route_aggr_n_changed = 0;
+    route_aggr_allocated_changed = 0;
+
+    if (route_aggr_full) {
+        route_aggr_full = false;
+        HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+            HMAP_FOR_EACH(ops_routep, node, &route_vrf->routes) {
+                __route_aggr_walk(ops_routep->aggr ? &ops_routep->aggr->key
+                                                   : &ops_routep->key);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n_changed; i++) {
+            if (changed[i].prefix.len < COPS_IPV6_ADDR_LEN_IN_BIT) {
+                half = changed[i];
+                half.prefix.len++;
+                __route_aggr_walk(&half);
+            }
+            __route_aggr_walk(&changed[i]);
+        }
+    }
+
+    free(changed);
+    route_aggr_stats.passes++;
+}
+
+/*
+ * Splits all aggregates back into their routes.
+ *
+ * @return 0 on success, SAI status of the first failed split otherwise. */
+static int
+__route_aggr_dissolve_all(void)
+{
+    struct ops_sai_route_vrf *route_vrf = NULL;
+    struct ops_sai_route_aggr *aggr = NULL;
+    struct ops_sai_route_aggr **aggrs = NULL;
+    size_t n_aggrs = 0;
+    int status = 0;
+
+    /* Splits make new aggregates, so split a copy of the map level by
+     * level rather than restarting from its first node after every split */
+    HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+        while (!status && !hmap_is_empty(&route_vrf->aggrs)) {
+            aggrs = xrealloc(aggrs, hmap_count(&route_vrf->aggrs) *
+                                    sizeof(*aggrs));
+            n_aggrs = 0;
+            HMAP_FOR_EACH(aggr, node, &route_vrf->aggrs) {
+                aggrs[n_aggrs++] = aggr;
+            }
+            for (size_t i = 0; i < n_aggrs && !status; i++) {
+                status = __route_aggr_split(aggrs[i]);
+            }
+        }
+        if (status) {
+            break;
+        }
+    }
+
+    free(aggrs);
+    return status;
+}
+
+/* Whether auto mode should aggregate: route table is known and filling up */
+static bool
+__route_aggr_table_high(void)
+{
+    uint32_t used = 0;
+    uint32_t capacity = 0;
+
+    ops_sai_resource_usage_get(OPS_SAI_RESOURCE_ROUTE, &used, &capacity);
+
+    return capacity && (uint64_t) used * 100 >=
+                       (uint64_t) capacity * OPS_SAI_ROUTE_AGGR_AUTO_PCT;
+}
+
+/* Aggregation pass, run by the route programming worker. */
+static int
+__route_aggregate_pass(void *aux OVS_UNUSED)
+{
+    if (ROUTE_AGGR_AUTO == __route_aggr_mode_get() &&
+        !__route_aggr_table_high()) {
+        return 0;
+    }
+
+    atomic_store_relaxed(&route_aggr_dirty, false);
+    __route_aggr_compress();
+
+    return 0;
+}
+
+/*
+ * Hands an aggregation pass over to the route programming worker once in a
+ * while if routes changed. Called from ofproto type_run().
+ */
+void
+ops_sai_route_aggregate_run(void)
+{
+    bool dirty = false;
+
+    if (ROUTE_AGGR_OFF == __route_aggr_mode_get() ||
+        time_msec() < route_aggr_next) {
+        return;
+    }
+
+    atomic_read_relaxed(&route_aggr_dirty, &dirty);
+    if (!dirty) {
+        return;
+    }
+
+    route_aggr_next = time_msec() + OPS_SAI_ROUTE_AGGR_INTERVAL_MSEC;
+    ops_sai_route_pipeline_task(__route_aggregate_pass, NULL, NULL);
+}
+
+/* Wakes up the main loop for the next aggregation pass. */
+void
+ops_sai_route_aggregate_wait(void)
+{
+    bool dirty = false;
+
+    atomic_read_relaxed(&route_aggr_dirty, &dirty);
+    if (ROUTE_AGGR_OFF != __route_aggr_mode_get() && dirty) {
+        poll_timer_wait_until(route_aggr_next);
+    }
+}
+
+static void
+__route_aggregate_dump(struct ds *ds)
+{
+    struct ops_sai_route_vrf *route_vrf = NULL;
+    struct ops_sai_route_aggr *aggr = NULL;
+    size_t n_members = 0;
+
+    HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+        HMAP_FOR_EACH(aggr, node, &route_vrf->aggrs) {
+            n_members += aggr->n_members;
+        }
+    }
+
+    ds_put_format(ds, "mode: %s\n",
+                  route_aggr_mode_names[__route_aggr_mode_get()]);
+    ds_put_format(ds, "aggregates: %"PRIuSIZE"\n", route_n_aggrs);
+    ds_put_format(ds, "routes aggregated: %"PRIuSIZE"\n", n_members);
+    ds_put_format(ds, "route entries saved: %"PRIuSIZE"\n",
+                  n_members - route_n_aggrs);
+    ds_put_format(ds, "passes: %"PRIu64", merges: %"PRIu64", splits: %"PRIu64
+                  ", failures: %"PRIu64"\n", route_aggr_stats.passes,
+                  route_aggr_stats.merges, route_aggr_stats.splits,
+                  route_aggr_stats.failures);
+}
+
+static int
+__route_aggregate_cmd(struct ds *ds, int argc, const char *argv[])
+{
+    if (argc > 1 && STR_EQ(argv[1], "off")) {
+        route_aggr_full = true;
+        if (__route_aggr_dissolve_all()) {
+            ds_put_cstr(ds, "failed to split aggregates");
+            return EIO;
+        }
+    }
+
+    __route_aggregate_dump(ds);
+
+    return 0;
+}
+
+/* Mode is set here, by the main thread, which runs aggregation passes */
+static void
+__route_unixctl_aggregate(struct unixctl_conn *conn, int argc,
+                          const char *argv[], void *aux OVS_UNUSED)
+{
+    int mode = 0;
+
+    if (argc > 1) {
+        for (mode = ROUTE_AGGR_OFF; mode <= ROUTE_AGGR_AUTO; mode++) {
+            if (STR_EQ(argv[1], route_aggr_mode_names[mode])) {
+                break;
+            }
+        }
+        if (mode > ROUTE_AGGR_AUTO) {
+            unixctl_command_reply_error(conn, "expected off, on or auto");
+            return;
+        }
+
+        atomic_store_relaxed(&route_aggr_mode, mode);
+        route_aggr_next = 0;
+        atomic_store_relaxed(&route_aggr_dirty, true);
+    }
+
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_aggregate_cmd);
+}
+
+/*
+ * Sets packet action of route entries of parked routes. This is the single
+ * place to switch to a bulk call once SAI has one for route attributes.
+ *
+ * @param[in]  routes   - parked routes
+ * @param[in]  action   - packet action
+ * @param[out] statuses - SAI status per route
+ * @param[in]  count    - count of routes */
+static void
+__route_entries_action_set(sai_ops_route_t **routes, int32_t action,
+                           sai_status_t *statuses, size_t count)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_unicast_route_entry_t route;
+    sai_attribute_t attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.id = SAI_ROUTE_ATTR_PACKET_ACTION;
+    attr.value.s32 = action;
+
+    for (size_t i = 0; i < count; i++) {
+        statuses[i] = SAI_STATUS_FAILURE;
+        if (ops_sai_route_entry_fill(&route, routes[i]->vrid,
+                                     &routes[i]->key.prefix)) {
+            continue;
+        }
+        statuses[i] = sai_api->route_api->set_route_attribute(&route, &attr);
+    }
+}
+
+/*
+ * Promotes parked routes to forwarding.
+ *
+ * @param[in] all - promote all parked routes, not only those with a resolved
+ *                  next hop
+ *
+ * @return 0 on success, errno otherwise. */
+static int
+__route_park_promote(bool all)
+{
+    sai_ops_route_t *routep = NULL;
+    sai_ops_route_t **routes = NULL;
+    sai_status_t *statuses = NULL;
+    size_t n_routes = 0;
+    int status = 0;
+
+    if (!route_n_parked) {
+        return 0;
+    }
+
+    routes = xmalloc(route_n_parked * sizeof *routes);
+    statuses = xmalloc(route_n_parked * sizeof *statuses);
+
+    LIST_FOR_EACH (routep, park_node, &route_parked) {
+        if (all || !__route_is_unresolved(routep)) {
+            routes[n_routes++] = routep;
+        }
+    }
+
+    __route_entries_action_set(routes, SAI_PACKET_ACTION_FORWARD, statuses,
+                               n_routes);
+
+    for (size_t i = 0; i < n_routes; i++) {
+        if (SAI_ERROR_2_ERRNO(statuses[i])) {
+            VLOG_ERR("SAI error %d Failed to promote route", statuses[i]);
+            route_park_stats.failures++;
+            status = SAI_ERROR_2_ERRNO(statuses[i]);
+            continue;
+        }
+        __route_park_set(routes[i], false);
+        __route_aggr_changed_add(&routes[i]->key);
+        route_park_stats.promoted++;
+    }
+
+    if (n_routes) {
+        /* Promoted routes may be aggregated now */
+        atomic_store_relaxed(&route_aggr_dirty, true);
+    }
+
+    free(routes);
+    free(statuses);
+
+    return status;
+}
+
+/* Applies packet action of the current mode to all parked routes. */
+static int
+__route_park_reapply(void)
+{
+    sai_ops_route_t *routep = NULL;
+    sai_ops_route_t **routes = NULL;
+    sai_status_t *statuses = NULL;
+    size_t n_routes = 0;
+    int status = 0;
+
+    if (!route_n_parked) {
+        return 0;
+    }
+
+    routes = xmalloc(route_n_parked * sizeof *routes);
+    statuses = xmalloc(route_n_parked * sizeof *statuses);
+
+    LIST_FOR_EACH (routep, park_node, &route_parked) {
+        routes[n_routes++] = routep;
+    }
+
+    __route_entries_action_set(routes, __route_packet_action(routes[0]),
+                               statuses, n_routes);
+
+    for (size_t i = 0; i < n_routes; i++) {
+        if (SAI_ERROR_2_ERRNO(statuses[i])) {
+            route_park_stats.failures++;
+            status = SAI_ERROR_2_ERRNO(statuses[i]);
+        }
+    }
+
+    free(routes);
+    free(statuses);
+
+    return status;
+}
+
+/* Promotion pass, run by the route programming worker. */
+static int
+__route_park_pass(void *aux OVS_UNUSED)
+{
+    __route_park_promote(false);
+
+    return 0;
+}
+
+/*
+ * Hands a promotion pass of parked routes over to the route programming
+ * worker once neighbors resolved some of their next hops. Next hops
+ * resolved after the dirty flag is cleared are left to the next pass.
+ * Called from ofproto type_run().
+ */
+void
+ops_sai_route_park_run(void)
+{
+    bool dirty = false;
+
+    atomic_read_relaxed(&route_park_dirty, &dirty);
+    if (!dirty) {
+        return;
+    }
+
+    atomic_store_relaxed(&route_park_dirty, false);
+    ops_sai_route_pipeline_task(__route_park_pass, NULL, NULL);
+}
+
+/* Wakes up the main loop if next hops got resolved after run(). */
+void
+ops_sai_route_park_wait(void)
+{
+    bool dirty = false;
+
+    atomic_read_relaxed(&route_park_dirty, &dirty);
+    if (dirty) {
+        poll_immediate_wake();
+    }
+}
+
+static void
+__route_park_dump(struct ds *ds)
+{
+    ds_put_format(ds, "mode: %s\n", route_park_mode_names[route_park_mode]);
+    ds_put_format(ds, "routes parked: %"PRIuSIZE"\n", route_n_parked);
+    ds_put_format(ds, "parked: %"PRIu64", promoted: %"PRIu64", failures: %"
+                  PRIu64"\n", route_park_stats.parked,
+                  route_park_stats.promoted, route_park_stats.failures);
+}
+
+static int
+__route_unresolved_cmd(struct ds *ds, int argc, const char *argv[])
+{
+    int mode = 0;
+    int status = 0;
+
+    if (argc > 1) {
+        for (mode = ROUTE_PARK_OFF; mode <= ROUTE_PARK_TRAP; mode++) {
+            if (STR_EQ(argv[1], route_park_mode_names[mode])) {
+                break;
+            }
+        }
+        if (mode > ROUTE_PARK_TRAP) {
+            ds_put_cstr(ds, "expected off, drop or trap");
+            return EINVAL;
+        }
+
+        if (mode != route_park_mode) {
+            route_park_mode = mode;
+            status = ROUTE_PARK_OFF == mode ? __route_park_promote(true)
+                                            : __route_park_reapply();
+        }
+        if (status) {
+            ds_put_cstr(ds, "failed to update parked routes");
+            return status;
+        }
+    }
+
+    __route_park_dump(ds);
+
+    return 0;
+}
+
+static void
+__route_unixctl_unresolved(struct unixctl_conn *conn, int argc,
+                           const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_unresolved_cmd);
+}
+
+static int
+__ops_sai_route_local_add(const handle_t *vrid,
+                          const struct ops_sai_prefix *prefix,
+                          const handle_t *rifid)
+{
+    sai_unicast_route_entry_t route;
+    sai_attribute_t attr[3];
+    int         rc = 0;
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+
+    memset(attr, 0, sizeof(attr));
+
+    attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
+    attr[0].value.s32 = SAI_PACKET_ACTION_TRAP;
+    attr[1].id = SAI_ROUTE_ATTR_NEXT_HOP_ID + 1; //For map attr of SAI_ROUTE_ATTR_RIF_ID
+    if (!rifid) {
+        attr[1].value.oid = SAI_OBJECT_TYPE_SET(SAI_OBJECT_TYPE_ROUTER_INTERFACE, 1);
+    } else {
+        attr[1].value.oid = rifid->data;
+    }
+
+    attr[2].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
+    attr[2].value.u8 = 0;              // default to zero
+
+    rc = ops_sai_route_entry_fill(&route, vrid->data, prefix);
+    if (rc) {
+        return rc; /* Return error */
+    }
+
+    status = __route_entry_create(&route, attr, 3);
+    if (SAI_STATUS_TABLE_FULL == status) {
+        return ENOSPC;
+    }
+    SAI_ERROR_LOG_EXIT(status, "Failed to add route entry");
+
+exit:
+    return rc;
+}
+
+static int
+__ops_sai_route_local_delete(const handle_t *vrid,
+                             const struct ops_sai_prefix *prefix)
+{
+    sai_unicast_route_entry_t route;
+    int         rc = 0;
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+
+    rc = ops_sai_route_entry_fill(&route, vrid->data, prefix);
+    if (rc) {
+        return rc; /* Return error */
+    }
+
+    status = __route_entry_remove(&route);
+    SAI_ERROR_LOG_EXIT(status, "Failed to remove route entry");
+
+exit:
+    return rc;
+}
+
+static int
+__route_lookup_dump(struct ds *ds, int argc, const char *argv[])
+{
+    struct ops_sai_prefix addr;
+    sai_ops_route_t *routep = NULL;
+    char prefix_str[OPS_SAI_PREFIX_STR_LEN];
+    char nh_str[OPS_SAI_PREFIX_STR_LEN];
+    uint8_t i = 0;
+    size_t n_routes = 0, n_nodes = 0, n_bytes = 0;
+    struct ops_sai_route_vrf *route_vrf = __route_vrf_parse(argv[1]);
+
+    if (!route_vrf) {
+        ds_put_format(ds, "no routes in virtual router %s\n", argv[1]);
+        return 0;
+    }
+
+    if (strchr(argv[2], '/') || ops_sai_prefix_parse(argv[2], &addr)) {
+        ds_put_format(ds, "invalid address %s\n", argv[2]);
+        return 0;
+    }
+
+    routep = ops_sai_route_trie_lookup(route_vrf->vrf, addr.family, addr.addr);
+    if (!routep) {
+        ds_put_format(ds, "no route to %s\n", argv[2]);
+    } else {
+        ds_put_format(ds, "%s\n",
+                      ops_sai_prefix_format(&routep->key.prefix, prefix_str,
+                                            sizeof prefix_str));
+        if (!routep->n_nexthops) {
+            ds_put_cstr(ds, "    directly connected\n");
+        }
+        for (i = 0; i < routep->n_nexthops; i++) {
+            ds_put_format(ds, "    via %s\n",
+                          ops_sai_nexthop_format(routep->nexthops[i], nh_str,
+                                                 sizeof nh_str));
+        }
+        if (routep->aggr) {
+            ds_put_format(ds, "    programmed as %s\n",
+                          ops_sai_prefix_format(&routep->aggr->key.prefix,
+                                                prefix_str,
+                                                sizeof prefix_str));
+        }
+    }
+
+    ops_sai_route_trie_stats(&n_routes, &n_nodes, &n_bytes);
+    ds_put_format(ds, "trie: %"PRIuSIZE" routes, %"PRIuSIZE" nodes, "
+                  "%"PRIuSIZE" bytes\n", n_routes, n_nodes, n_bytes);
+
+    return 0;
+}
+
+static void
+__route_unixctl_lookup(struct unixctl_conn *conn, int argc,
+                       const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_lookup_dump);
+}
+
+static int
+__route_pic_dump(struct ds *ds, int argc, const char *argv[])
+{
+    struct ops_sai_nhg *nhg = NULL;
+    size_t n_degraded = 0;
+    bool enable = route_pic_enabled;
+
+    if (argc > 1) {
+        if (!strcmp(argv[1], "on")) {
+            enable = true;
+        } else if (!strcmp(argv[1], "off")) {
+            enable = false;
+        } else {
+            ds_put_cstr(ds, "expected on or off");
+            return EINVAL;
+        }
+    }
+
+    if (enable != route_pic_enabled) {
+        route_pic_enabled = enable;
+        if (ops_sai_nhg_sync_all()) {
+            ds_put_cstr(ds, "failed to update ECMP groups");
+            return EIO;
+        }
+    }
+
+    HMAP_FOR_EACH(nhg, node, &all_nhg) {
+        if (nhg->active != (uint32_t) ((1ull << nhg->n_nexthops) - 1)) {
+            n_degraded++;
+        }
+    }
+
+    ds_put_format(ds, "pic: %s\n", route_pic_enabled ? "on" : "off");
+    ds_put_format(ds, "ecmp groups: %"PRIuSIZE", %"PRIuSIZE
+                  " with next hops down\n", hmap_count(&all_nhg), n_degraded);
+
+    return 0;
+}
+
+static void
+__route_unixctl_pic(struct unixctl_conn *conn, int argc,
+                    const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_pic_dump);
+}
+
+static int
+__route_ecmp_show_dump(struct ds *ds, int argc OVS_UNUSED,
+                       const char *argv[] OVS_UNUSED)
+{
+    struct ops_sai_nhg *nhg = NULL;
+    struct nh_entry *p_nh_entry = NULL;
+    char nh_str[OPS_SAI_PREFIX_STR_LEN];
+    uint32_t n_active = 0;
+    uint32_t count = 0;
+    uint32_t i = 0, b = 0;
+
+    ds_put_format(ds, "resilient hashing: %s, max group size: %"PRIu32"\n",
+                  route_ecmp_resilient ? "on" : "off", route_ecmp_buckets);
+
+    HMAP_FOR_EACH(nhg, node, &all_nhg) {
+        n_active = 0;
+        for (i = 0; i < nhg->n_nexthops; i++) {
+            if (nhg->active & (1u << i)) {
+                n_active++;
+            }
+        }
+
+        ds_put_format(ds, "group 0x%"PRIx64": %"PRIu32" routes, ",
+                      (uint64_t) nhg->handle.data, nhg->ref);
+        if (nhg->buckets) {
+            ds_put_format(ds, "%"PRIu32" buckets\n", nhg->n_buckets);
+        } else {
+            ds_put_format(ds, "%"PRIu32" members\n", n_active);
+        }
+
+        for (i = 0; i < nhg->n_nexthops; i++) {
+            p_nh_entry = ops_sai_nexthop_get(nhg->nexthops[i]);
+            if (nhg->buckets) {
+                for (b = 0, count = 0; b < nhg->n_buckets; b++) {
+                    count += nhg->buckets[b] == nhg->nexthops[i];
+                }
+            } else {
+                count = (nhg->active & (1u << i)) ? 1 : 0;
+            }
+
+            ds_put_format(ds, "    %-40s weight %-5"PRIu32" %-4s %5.1f%%\n",
+                          ops_sai_nexthop_format(nhg->nexthops[i], nh_str,
+                                                 sizeof nh_str),
+                          p_nh_entry->weight,
+                          p_nh_entry->is_down ? "down" : "up",
+                          100.0 * count / (nhg->buckets ? nhg->n_buckets
+                                                        : n_active));
+        }
+    }
+
+    return 0;
+}
+
+static void
+__route_unixctl_ecmp_show(struct unixctl_conn *conn, int argc,
+                          const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_ecmp_show_dump);
+}
+
+static int
+__route_ecmp_weight_cmd(struct ds *ds, int argc OVS_UNUSED,
+                        const char *argv[])
+{
+    struct ops_sai_nexthop_key key;
+    unsigned int weight = 0;
+
+    if (ops_sai_nexthop_key_init(&key, 0, 0, argv[1])) {
+        ds_put_cstr(ds, "invalid next hop address");
+        return EINVAL;
+    }
+
+    if (!str_to_uint(argv[2], 10, &weight) || !weight
+        || weight > OPS_SAI_NH_WEIGHT_MAX) {
+        ds_put_cstr(ds, "invalid weight");
+        return EINVAL;
+    }
+
+    if (ops_sai_nexthop_weight_set(&key, weight)) {
+        ds_put_cstr(ds, "failed to update ECMP groups");
+        return EIO;
+    }
+
+    return 0;
+}
+
+static void
+__route_unixctl_ecmp_weight(struct unixctl_conn *conn, int argc,
+                            const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_ecmp_weight_cmd);
+}
+
+static int
+__route_ecmp_max_size_cmd(struct ds *ds, int argc, const char *argv[])
+{
+    unsigned int size = 0;
+
+    if (argc > 1) {
+        if (!str_to_uint(argv[1], 10, &size) || size < SAI_NEXT_HOP_MAX
+            || size > OPS_SAI_NHG_BUCKETS_MAX) {
+            ds_put_cstr(ds, "invalid group size");
+            return EINVAL;
+        }
+
+        route_ecmp_buckets = size;
+        if (ops_sai_nhg_sync_all()) {
+            ds_put_cstr(ds, "failed to update ECMP groups");
+            return EIO;
+        }
+    }
+
+    ds_put_format(ds, "%"PRIu32, route_ecmp_buckets);
+
+    return 0;
+}
+
+static void
+__route_unixctl_ecmp_max_size(struct unixctl_conn *conn, int argc,
+                              const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv,
+                                   __route_ecmp_max_size_cmd);
+}
+
+static void
+__route_unixctl_coalesce(struct unixctl_conn *conn, int argc,
+                         const char *argv[], void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    unsigned int msec = 0;
+    uint64_t done = 0;
+
+    if (argc > 1) {
+        if (!str_to_uint(argv[1], 10, &msec)
+            || msec > OPS_SAI_ROUTE_COALESCE_MSEC_MAX) {
+            unixctl_command_reply_error(conn, "invalid window");
+            return;
+        }
+        route_coalesce_msec = msec;
+    }
+
+    done = route_coalesce_stats.received - route_coalesce_stats.pending;
+    ds_put_format(&ds, "window: %u ms\n", route_coalesce_msec);
+    ds_put_format(&ds, "operations received: %"PRIu64"\n",
+                  route_coalesce_stats.received);
+    ds_put_format(&ds, "merged into pending: %"PRIu64"\n",
+                  route_coalesce_stats.merged);
+    ds_put_format(&ds, "submitted: %"PRIu64"\n",
+                  route_coalesce_stats.submitted);
+    ds_put_format(&ds, "cancelled: %"PRIu64", replaced: %"PRIu64"\n",
+                  route_coalesce_stats.cancelled,
+                  route_coalesce_stats.replaced);
+    ds_put_format(&ds, "failed: %"PRIu64"\n",
+                  ops_sai_route_pipeline_failures());
+    ds_put_format(&ds, "pending: %"PRIu64"\n", route_coalesce_stats.pending);
+    ds_put_format(&ds, "SAI calls saved: %"PRIu64"\n",
+                  done > route_coalesce_stats.submitted
+                  ? done - route_coalesce_stats.submitted : 0);
+
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+/*
+ * Route dump and audit. Routes are walked a slice at a time by the route
+ * programming worker, in between route jobs, resuming at the partition and
+ * hmap position where the previous slice stopped. The main thread hands the
+ * next slice over from ofproto type_run() and replies to the command when the
+ * walk is over. Routes changed meanwhile may be missed or visited twice.
+ */
+
+enum route_walk_kind {
+    ROUTE_WALK_DUMP = 0,
+    ROUTE_WALK_AUDIT
+};
+
+struct route_walk {
+    struct unixctl_conn     *conn;
+    enum route_walk_kind    kind;
+    char                    *vrid;          /* NULL to walk all VRFs */
+    bool                    busy;           /* slice handed to the worker */
+    bool                    done;
+    bool                    unknown_vrid;
+    int                     vrf;            /* partition being walked */
+    uint32_t                bucket;         /* position in its routes */
+    uint32_t                offset;
+    struct ds               ds;
+    size_t                  n_routes;
+    size_t                  n_skipped;      /* aggregated, not audited */
+    size_t                  n_drifts;
+    size_t                  n_slices;
+    long long int           start;          /* msec */
+};
+
+static struct route_walk *route_walk;           /* NULL when idle */
+
+static const char *route_walk_names[] = { "dump", "audit" };
+
+static void
+__route_walk_dump(struct route_walk *walk, const sai_ops_route_t *routep)
+{
+    char    prefix_str[OPS_SAI_PREFIX_STR_LEN];
+    char    nh_str[OPS_SAI_PREFIX_STR_LEN];
+    uint8_t i = 0;
+
+    ds_put_format(&walk->ds, "vrf 0x%"PRIx64" %s", routep->vrid,
+                  ops_sai_prefix_format(&routep->key.prefix, prefix_str,
+                                        sizeof prefix_str));
+    if (!routep->n_nexthops) {
+        ds_put_cstr(&walk->ds, " connected");
+    }
+    for (i = 0; i < routep->n_nexthops; i++) {
+        ds_put_format(&walk->ds, "%s%s", i ? ", " : " via ",
+                      ops_sai_nexthop_format(routep->nexthops[i], nh_str,
+                                             sizeof nh_str));
+    }
+    if (routep->aggr) {
+        ds_put_format(&walk->ds, " (as %s)",
+                      ops_sai_prefix_format(&routep->aggr->key.prefix,
+                                            prefix_str, sizeof prefix_str));
+    }
+    if (routep->stale) {
+        ds_put_cstr(&walk->ds, " (stale)");
+    }
+    if (routep->parked) {
+        ds_put_cstr(&walk->ds, " (parked)");
+    }
+    ds_put_char(&walk->ds, '\n');
+}
+
+/* Compares route entry in hardware with what the route should be
+ * programmed as. Members of aggregates have no entry of their own. */
+static void
+__route_walk_audit(struct route_walk *walk, const sai_ops_route_t *routep)
+{
+    const struct ops_sai_api_class *sai_api = ops_sai_api_get_instance();
+    sai_unicast_route_entry_t   route;
+    sai_attribute_t             attr[2];
+    sai_status_t                status = SAI_STATUS_SUCCESS;
+    handle_t                    l3_id;
+    int32_t                     action = SAI_PACKET_ACTION_TRAP;
+    char                        prefix_str[OPS_SAI_PREFIX_STR_LEN];
+
+    if (routep->aggr ||
+        ops_sai_route_entry_fill(&route, routep->vrid, &routep->key.prefix)) {
+        walk->n_skipped++;
+        return;
+    }
+
+    ops_sai_prefix_format(&routep->key.prefix, prefix_str, sizeof prefix_str);
+
+    memset(attr, 0, sizeof(attr));
+    attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
+    attr[1].id = SAI_ROUTE_ATTR_NEXT_HOP_ID;
+    status = sai_api->route_api->get_route_attribute(&route, 2, attr);
+    if (SAI_ERROR_2_ERRNO(status)) {
+        ds_put_format(&walk->ds, "vrf 0x%"PRIx64" %s: not in hardware "
+                      "(status: %d)\n", routep->vrid, prefix_str, status);
+        walk->n_drifts++;
+        return;
+    }
+
+    if (routep->n_nexthops) {
+        action = __route_packet_action(routep);
+    }
+    if (attr[0].value.s32 != action) {
+        ds_put_format(&walk->ds, "vrf 0x%"PRIx64" %s: packet action %d, "
+                      "expected %d\n", routep->vrid, prefix_str, attr[0].value.s32, action);
+        walk->n_drifts++;
+        return;
+    }
+
+    l3_id = __route_l3_id(routep);
+    if (routep->n_nexthops && attr[1].value.oid != l3_id.data) {
+        ds_put_format(&walk->ds, "vrf 0x%"PRIx64" %s: next hop 0x%"PRIx64
+                      ", expected 0x%"PRIx64"\n", routep->vrid, prefix_str,
+                      attr[1].value.oid, l3_id.data);
+        walk->n_drifts++;
+    }
+}
+
+static void
+__route_walk_finish(struct route_walk *walk)
+{
+    if (walk->unknown_vrid) {
+        unixctl_command_reply_error(walk->conn, "no routes in virtual router");
+        goto exit;
+    }
+
+    ds_put_format(&walk->ds, "%s of %"PRIuSIZE" routes",
+                  route_walk_names[walk->kind], walk->n_routes);
+    if (ROUTE_WALK_AUDIT == walk->kind) {
+        ds_put_format(&walk->ds, ", %"PRIuSIZE" drifts, %"PRIuSIZE" skipped",
+                      walk->n_drifts, walk->n_skipped);
+    }
+    ds_put_format(&walk->ds, " in %lld ms, %"PRIuSIZE" slices\n",
+                  time_msec() - walk->start, walk->n_slices);
+
+    unixctl_command_reply(walk->conn, ds_cstr(&walk->ds));
+
+exit:
+    ds_destroy(&walk->ds);
+    free(walk->vrid);
+    free(walk);
+}
+
+/* Walks routes for at most a few milliseconds. Run by the route programming
+ * worker. */
+static int
+__route_walk_slice(void *aux)
+{
+    struct route_walk   *walk   = aux;
+    struct ops_sai_route_vrf *route_vrf = NULL;
+    struct hmap_node    *node   = NULL;
+    sai_ops_route_t     *routep = NULL;
+    long long int       deadline = 0;
+    size_t              n = 0;
+
+    deadline = time_usec() + OPS_SAI_ROUTE_WALK_SLICE_USEC;
+    if (!walk->n_slices++ && walk->vrid) {
+        route_vrf = __route_vrf_parse(walk->vrid);
+        if (!route_vrf) {
+            walk->unknown_vrid = true;
+            walk->done = true;
+            return 0;
+        }
+        walk->vrf = route_vrf->vrf;
+    }
+
+    for (; walk->vrf < n_route_vrfs; walk->vrf++) {
+        route_vrf = __route_vrf_get(walk->vrf);
+        while (route_vrf &&
+               (node = hmap_at_position(&route_vrf->routes, &walk->bucket,
+                                        &walk->offset))) {
+            routep = CONTAINER_OF(node, sai_ops_route_t, node);
+            walk->n_routes++;
+            if (ROUTE_WALK_DUMP == walk->kind) {
+                __route_walk_dump(walk, routep);
+            } else {
+                __route_walk_audit(walk, routep);
+            }
+
+            /* Check the clock once per batch of routes */
+            if (!(++n % OPS_SAI_ROUTE_WALK_BATCH) &&
+                time_usec() >= deadline) {
+                return 0;
+            }
+        }
+
+        walk->bucket = 0;
+        walk->offset = 0;
+        if (walk->vrid) {
+            break;
+        }
+    }
+
+    walk->done = true;
+
+    return 0;
+}
+
+static void
+__route_walk_slice_done(void *aux)
+{
+    struct route_walk *walk = aux;
+
+    walk->busy = false;
+    if (walk->done) {
+        route_walk = NULL;
+        __route_walk_finish(walk);
+    }
+}
+
+/*
+ * Hands the next slice of a pending dump or audit over to the route
+ * programming worker. Called from ofproto type_run().
+ */
+void
+ops_sai_route_walk_run(void)
+{
+    if (!route_walk || route_walk->busy) {
+        return;
+    }
+
+    route_walk->busy = true;
+    ops_sai_route_pipeline_task(__route_walk_slice, __route_walk_slice_done,
+                                route_walk);
+}
+
+/* Wakes up the main loop right away while a walk waits for its next slice.
+ * Completion of a slice wakes it up through the pipeline. */
+void
+ops_sai_route_walk_wait(void)
+{
+    if (route_walk && !route_walk->busy) {
+        poll_immediate_wake();
+    }
+}
+
+static void
+__route_unixctl_walk(struct unixctl_conn *conn, int argc,
+                     const char *argv[], void *aux)
+{
+    struct route_walk *walk = NULL;
+
+    if (route_walk) {
+        unixctl_command_reply_error(conn, "route dump or audit in progress");
+        return;
+    }
+
+    walk = xzalloc(sizeof(*walk));
+    walk->conn = conn;
+    walk->kind = (enum route_walk_kind) (uintptr_t) aux;
+    walk->vrid = argc > 1 ? xstrdup(argv[1]) : NULL;
+    walk->start = time_msec();
+    ds_init(&walk->ds);
+    route_walk = walk;
+}
+
+static void __route_snapshot_init(void);
+
+/*
+ * Initializes route.
+ */
+static void
+__route_init(void)
+{
+    unixctl_command_register("sai/route/lookup", "vrid address", 2, 2,
+                             __route_unixctl_lookup, NULL);
+    unixctl_command_register("sai/route/pic", "[on|off]", 0, 1,
+                             __route_unixctl_pic, NULL);
+    unixctl_command_register("sai/route/ecmp/show", "", 0, 0,
+                             __route_unixctl_ecmp_show, NULL);
+    unixctl_command_register("sai/route/ecmp/weight", "address weight", 2, 2,
+                             __route_unixctl_ecmp_weight, NULL);
+    unixctl_command_register("sai/route/ecmp/max-size", "[size]", 0, 1,
+                             __route_unixctl_ecmp_max_size, NULL);
+    unixctl_command_register("sai/route/coalesce", "[window-msec]", 0, 1,
+                             __route_unixctl_coalesce, NULL);
+    unixctl_command_register("sai/route/aggregate", "[off|on|auto]", 0, 1,
+                             __route_unixctl_aggregate, NULL);
+    unixctl_command_register("sai/route/unresolved", "[off|drop|trap]", 0, 1,
+                             __route_unixctl_unresolved, NULL);
+    unixctl_command_register("sai/route/dump", "[vrid]", 0, 1,
+                             __route_unixctl_walk,
+                             (void *) (uintptr_t) ROUTE_WALK_DUMP);
+    unixctl_command_register("sai/route/audit", "[vrid]", 0, 1,
+                             __route_unixctl_walk,
+                             (void *) (uintptr_t) ROUTE_WALK_AUDIT);
+    __route_snapshot_init();
+}
+
+/*
+ *  Function for adding IP to me route.
+ *  Means tell hardware to trap packets with specified prefix to CPU.
+ *  Used while assigning IP address(s) to routing interface.
+ *
+ * @param[in] vrid    - virtual router ID
+ * @param[in] prefix  - IP prefix
+ *
+ * @return 0  if operation completed successfully.
+ * @return -1 if operation failed.*/
+static int
+__route_ip_to_me_add(const handle_t *vrid, const char *prefix)
+{
+    sai_unicast_route_entry_t route;
+    sai_attribute_t attr[2];
+    struct ops_sai_prefix ip_prefix;
+    int         rc = 0;
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+
+    memset(attr, 0, sizeof(attr));
+
+    attr[0].id = SAI_ROUTE_ATTR_PACKET_ACTION;
+    attr[0].value.s32 = SAI_PACKET_ACTION_TRAP;
+
+    attr[1].id = SAI_ROUTE_ATTR_TRAP_PRIORITY;
+    attr[1].value.u8 = 0;              // default to zero
+
+    rc = ops_sai_route_prefix_get(prefix, &ip_prefix);
+    if (rc)
+    {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return rc; /* Return error */
+    }
+
+    rc = ops_sai_route_entry_fill(&route, vrid->data, &ip_prefix);
+    if (rc) {
+        return rc; /* Return error */
+    }
+
+    status = __route_entry_create(&route, attr, 2);
+    if (SAI_STATUS_TABLE_FULL == status) {
+        return ENOSPC;
+    }
+    SAI_ERROR_LOG_EXIT(status, "Failed to add route entry");
+
+exit:
+    return rc;
+}
+
+static int
+__route_ip_to_me_delete(const handle_t *vrid, const char *prefix)
+{
+    sai_unicast_route_entry_t route;
+    struct ops_sai_prefix ip_prefix;
+    int             rc = 0;
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+
+    rc = ops_sai_route_prefix_get(prefix, &ip_prefix);
+    if (rc)
+    {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return rc; /* Return error */
+    }
+
+    rc = ops_sai_route_entry_fill(&route, vrid->data, &ip_prefix);
+    if (rc) {
+        return rc; /* Return error */
+    }
+
+    /* del the ipuc prefix */
+    status = __route_entry_remove(&route);
+    SAI_ERROR_LOG_EXIT(status, "Failed to delete route entry");
+
+exit:
+    return rc;
+}
+
+static void
+__route_state_update(sai_ops_route_t *ops_routep)
+{
+    if (ops_routep->n_nexthops > 1) {
+        ops_routep->rstate = OPS_ROUTE_STATE_ECMP;
+    } else {
+        ops_routep->rstate = OPS_ROUTE_STATE_NON_ECMP;
+    }
+    ops_routep->nh_ecmp.data = ops_routep->nhg ? ops_routep->nhg->handle.data
+                                               : 0;
+}
+
+/*
+ * Gets next hop or ECMP group to program a route that is not yet programmed
+ * with. Routes with several next hops take a reference on the group shared
+ * by all routes with the same next hop set.
+ *
+ * @param[in]  ops_routep - route with next hops already added
+ * @param[out] l3_id      - next hop or group to program the route with
+ *
+ * @return 0 on success, error of the group creation otherwise. */
+static int
+__route_nexthops_setup(sai_ops_route_t *ops_routep, handle_t *l3_id)
+{
+    struct nh_entry     *p_nh_entry = NULL;
+
+    if (1 == ops_routep->n_nexthops) {
+        p_nh_entry = ops_sai_nexthop_get(ops_routep->nexthops[0]);
+        l3_id->data = p_nh_entry->handle.data;
+    } else if (1 < ops_routep->n_nexthops) {
+        ops_routep->nhg = ops_sai_nhg_ref(ops_routep->nexthops,
+                                          ops_routep->n_nexthops);
+        if (!ops_routep->nhg) {
+            return SAI_STATUS_FAILURE;
+        }
+        l3_id->data = ops_routep->nhg->handle.data;
+    } else {
+        return SAI_STATUS_FAILURE;
+    }
+
+    return 0;
+}
+
+/*
+ * Moves a programmed route to the ECMP group, or the single next hop,
+ * matching its current next hops. A group no other route uses is edited in
+ * place instead.
+ *
+ * @param[in] ops_routep - route with next hops already updated
+ * @param[in] route      - SAI route entry of the route
+ *
+ * @return 0 on success, SAI status otherwise. */
+static int
+__route_nhg_update(sai_ops_route_t *ops_routep,
+                   sai_unicast_route_entry_t *route)
+{
+    struct ops_sai_nhg  *old_nhg    = ops_routep->nhg;
+    struct ops_sai_nhg  *nhg        = NULL;
+    struct nh_entry     *p_nh_entry = NULL;
+    uint32_t            set[SAI_NEXT_HOP_MAX];
+    handle_t            l3_id;
+    int                 status      = 0;
+
+    if (1 < ops_routep->n_nexthops) {
+        memcpy(set, ops_routep->nexthops,
+               ops_routep->n_nexthops * sizeof(*set));
+        ops_sai_nhg_set_sort(set, ops_routep->n_nexthops);
+
+        if (old_nhg && 1 == old_nhg->ref &&
+            !ops_sai_nhg_lookup(set, ops_routep->n_nexthops)) {
+            return ops_sai_nhg_modify(old_nhg, set, ops_routep->n_nexthops);
+        }
+
+        nhg = ops_sai_nhg_ref(set, ops_routep->n_nexthops);
+        if (!nhg) {
+            return SAI_STATUS_FAILURE;
+        }
+        if (nhg == old_nhg) {
+            ops_sai_nhg_unref(nhg);
+            return 0;
+        }
+        l3_id = nhg->handle;
+    } else if (1 == ops_routep->n_nexthops) {
+        p_nh_entry = ops_sai_nexthop_get(ops_routep->nexthops[0]);
+        l3_id = p_nh_entry->handle;
+    } else {
+        return SAI_STATUS_FAILURE;
+    }
+
+    status = ops_sai_routing_nexthop_id_update(route, &l3_id);
+    if (status) {
+        ops_sai_nhg_unref(nhg);
+        return status;
+    }
+
+    ops_routep->nhg = nhg;
+    ops_sai_nhg_unref(old_nhg);
+
+    return 0;
+}
+
+/*
+ * Takes back next hops just added to a programmed route after moving the
+ * route to them failed, so the route keeps forwarding as before.
+ *
+ * @param[in] ops_routep - route
+ * @param[in] route      - SAI route entry of the route
+ * @param[in] added      - indices of the added next hops
+ * @param[in] n_added    - count of added next hops */
+static void
+__route_nexthops_rollback(sai_ops_route_t *ops_routep,
+                          sai_unicast_route_entry_t *route,
+                          const uint32_t *added, uint32_t n_added)
+{
+    uint32_t    i   = 0;
+    int         pos = 0;
+
+    for (i = 0; i < n_added; i++) {
+        pos = ops_sai_nexthop_lookup(ops_routep, added[i]);
+        if (0 <= pos) {
+            ops_sai_nexthop_delete(ops_routep, pos);
+        }
+    }
+
+    /* Group edited in place may hold some of the added next hops already */
+    if (__route_nhg_update(ops_routep, route)) {
+        VLOG_ERR("Failed to restore route next hops");
+    }
+
+    for (i = 0; i < n_added; i++) {
+        ops_sai_nexthop_unref(added[i]);
+    }
+}
+
+/*
+ * Releases ECMP group and next hops of a route no longer forwarding to them
+ * in hardware.
+ */
+static void
+__route_nexthops_release(sai_ops_route_t *ops_routep)
+{
+    uint8_t i = 0;
+
+    ops_sai_nhg_unref(ops_routep->nhg);
+    ops_routep->nhg = NULL;
+
+    for (i = 0; i < ops_routep->n_nexthops; i++) {
+        ops_sai_nexthop_unref(ops_routep->nexthops[i]);
+    }
+    ops_routep->n_nexthops = 0;
+
+    __route_state_update(ops_routep);
+}
+
+/*
+ * Releases ECMP group and next hops of a remote route already removed from
+ * hardware and deletes the route.
+ */
+static void
+__route_remote_release(sai_ops_route_t *ops_routep)
+{
+    __route_nexthops_release(ops_routep);
+    ops_sai_route_del(ops_routep);
+}
+
+static int
+__sai_route_remote_action(uint64_t          vrid,
+                      const struct ops_sai_prefix *prefix,
+                      uint32_t              next_hop_count,
+                      char *const *const    next_hops,
+                      uint32_t              action)
+{
+    sai_status_t                    status      = SAI_STATUS_SUCCESS;
+    const struct ops_sai_api_class  *sai_api    = ops_sai_api_get_instance();
+    sai_ops_route_t     *ops_routep = NULL;
+    sai_unicast_route_entry_t route;
+    sai_attribute_t     attr[3];
+    struct ops_sai_prefix   ip_prefix;
+    struct ops_sai_route_key key;
+    uint32_t            nh_changed[SAI_NEXT_HOP_MAX];
+    uint32_t            n_changed   = 0;
+    handle_t            l3_id_cp;
+    uint32_t            index       = 0;
+    int                 rc          = 0;
+    int                 vrf_id      = 0;
+    handle_t            vrfid;
+
+    memset(&l3_id_cp, 0, sizeof(l3_id_cp));
+
+    /* copied, the prefix may be the key of a route removed below */
+    ip_prefix = *prefix;
+
+    rc = ops_sai_route_entry_fill(&route, vrid, &ip_prefix);
+    if (rc) {
+        return rc; /* Return error */
+    }
+
+    vrfid.data = vrid;
+    vrf_id = __route_vrf_num(vrid, action);
+    ops_sai_route_key_init(&key, vrf_id, &ip_prefix);
+
+    status = __route_aggr_expand(&key);
+    if (status) {
+        return status;
+    }
+
+    if (action) {
+        ops_routep = ops_sai_route_lookup(&key);
+        if (!ops_routep) {
+            ops_routep = ops_sai_route_add(&key);
+            ops_routep->vrid = vrid;
+            ops_sai_route_nexthops_add(ops_routep, next_hop_count, next_hops,
+                                       NULL);
+            rc = __route_nexthops_setup(ops_routep, &l3_id_cp);
+            if (rc) {
+                __route_remote_release(ops_routep);
+                return rc;
+            }
+
+            /* next comes routes adding */
+            __route_park_set(ops_routep, __route_park_needed(ops_routep));
+            __route_forward_attr_fill(attr, &l3_id_cp,
+                                      __route_packet_action(ops_routep));
+
+            status = __route_entry_create(&route, attr, 3);
+            if (SAI_ERROR_2_ERRNO(status)) {
+                VLOG_ERR("SAI error %d Failed to add route entry", status);
+                __route_remote_release(ops_routep);
+                return status;
+            }
+        } else {
+            /* for support the route with intf nexthop */
+
+            if (0 == ops_routep->n_nexthops && ops_routep->refer_cnt)
+            {
+                ops_routep->vrid = vrid;
+                if (!ops_sai_route_nexthops_add(ops_routep, next_hop_count,
+                                                next_hops, NULL)) {
+                    goto exit;
+                }
+
+                rc = __route_nexthops_setup(ops_routep, &l3_id_cp);
+                if (rc) {
+                    __route_nexthops_release(ops_routep);
+                    return rc;
+                }
+
+                /* next comes routes adding, it takes over the route table
+                 * entry of the local route */
+                __route_park_set(ops_routep, __route_park_needed(ops_routep));
+                __route_forward_attr_fill(attr, &l3_id_cp,
+                                          __route_packet_action(ops_routep));
+
+                status = sai_api->route_api->create_route(&route, 3, attr);
+                if (SAI_STATUS_ITEM_ALREADY_EXISTS == status &&
+                    route_reconcile_deadline) {
+                    status = __route_entry_adopt(&route, attr, 3);
+                }
+                if (SAI_ERROR_2_ERRNO(status)) {
+                    VLOG_ERR("SAI error %d Failed to add route entry", status);
+                    __route_park_set(ops_routep, false);
+                    __route_nexthops_release(ops_routep);
+                    return status;
+                }
+            }
+            else if (ops_routep->n_nexthops)
+            {
+                /* update to ecmp  */
+                n_changed = ops_sai_route_nexthops_add(ops_routep,
+                                                       next_hop_count,
+                                                       next_hops, nh_changed);
+                if (!n_changed) {
+                    goto exit;
+                }
+
+                status = __route_nhg_update(ops_routep, &route);
+                if (SAI_ERROR_2_ERRNO(status)) {
+                    VLOG_ERR("SAI error %d Failed to update route next hops",
+                             status);
+                    __route_nexthops_rollback(ops_routep, &route, nh_changed,
+                                              n_changed);
+                }
+            }
+        }
+    } else {
+        ops_routep = ops_sai_route_lookup(&key);
+        if (!ops_routep) {
+            return status;
+        }
+
+        if (next_hops) {
+            n_changed = ops_sai_route_nexthops_remove(ops_routep,
+                                                      next_hop_count,
+                                                      next_hops, nh_changed);
+            if (!n_changed) {
+                goto exit;
+            }
+
+            if (ops_routep->n_nexthops) {
+                status = __route_nhg_update(ops_routep, &route);
+                if (SAI_ERROR_2_ERRNO(status)) {
+                    VLOG_ERR("SAI error %d Failed to update route next hops",
+                             status);
+                }
+            } else {
+                /* del the ipuc prefix */
+                status = __route_entry_remove(&route);
+                ops_sai_nhg_unref(ops_routep->nhg);
+                ops_routep->nhg = NULL;
+
+                if (ops_routep->refer_cnt) {
+                    __ops_sai_route_local_add(&vrfid, &ip_prefix, NULL);
+                } else {
+                    ops_sai_route_del(ops_routep);
+                    ops_routep = NULL;
+                }
+            }
+
+            /* del the nexthop db or refer  */
+            for (index = 0; index < n_changed; index++) {
+                ops_sai_nexthop_unref(nh_changed[index]);
+            }
+
+            if (!ops_routep) {
+                return status;
+            }
+        } else {
+            /* del the ipuc prefix */
+            status = __route_entry_remove(&route);
+            SAI_ERROR_LOG_EXIT(status, "Failed to delete route entry");
+
+            __route_remote_release(ops_routep);
+            return status;
+        }
+    }
+
+exit:
+    __route_state_update(ops_routep);
+    __route_park_update(ops_routep, &route);
+
+    return status;
+}
+
+/*
+ *  Function for adding local route.
+ *  Means while creating new routing interface and assigning IP address to it
+ *  'tells' the hardware that new subnet is accessible through specified
+ *  router interface.
+ *
+ * @param[in] vrid    - virtual router ID
+ * @param[in] prefix  - IP prefix
+ * @param[in] rifid   - router interface ID
+ *
+ * @return 0  if operation completed successfully.
+ * @return -1 if operation failed.*/
+static int
+__route_local_add(const handle_t *vrid,
+                  const char     *prefix,
+                  const handle_t *rifid)
+{
+    sai_status_t    status      = SAI_STATUS_SUCCESS;
+    int                 vrf_id      = 0;
+    sai_ops_route_t     *ops_routep = NULL;
+    sai_ops_route_t     *covering   = NULL;
+    struct ops_sai_prefix   ip_prefix;
+    struct ops_sai_route_key key;
+    char                prefix_str[OPS_SAI_PREFIX_STR_LEN];
+
+    if (ops_sai_route_prefix_get(prefix, &ip_prefix)) {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return status;
+    }
+
+    vrf_id = __route_vrf_num(vrid->data, true);
+    ops_sai_route_key_init(&key, vrf_id, &ip_prefix);
+    if (__route_aggr_expand(&key)) {
+        VLOG_ERR("Failed to split aggregated routes covering %s", prefix);
+        return SAI_STATUS_FAILURE;
+    }
+
+    ops_routep = ops_sai_route_lookup(&key);
+    if (NULL == ops_routep) {
+        ops_routep = ops_sai_route_add(&key);
+        if (NULL != ops_routep) {
+            ops_routep->refer_cnt = 1;
+            ops_routep->vrid = vrid->data;
+            ops_routep->rif = rifid->data;
+        } else {
+            return status;
+        }
+
+        covering = ops_sai_route_trie_covering(&key);
+        if (covering && covering->n_nexthops) {
+            VLOG_DBG("Local route %s shadows remote route %s",
+                     prefix,
+                     ops_sai_prefix_format(&covering->key.prefix, prefix_str,
+                                           sizeof prefix_str));
+        }
+
+        __ops_sai_route_local_add(vrid, &ip_prefix, rifid);
+        /* need to check when mask is 32 */
+
+    } else {
+        ops_routep->refer_cnt++;
+        ops_routep->rif = rifid->data;
+    }
+
+    return status;
+}
+
+/*
+ * Gives a programmed remote route exactly the given next hops. Missing ones
+ * are added before the others are removed, so the route keeps forwarding
+ * throughout, and a route which has them already is not touched in hardware
+ * at all.
+ *
+ * @param[out] changed - whether next hops were added or removed
+ *
+ * @return 0 on success, SAI status otherwise. */
+static sai_status_t
+__route_nexthops_replace(const sai_ops_route_t  *ops_routep,
+                         uint32_t               next_hop_count,
+                         char *const *const     next_hops,
+                         bool                   *changed)
+{
+    struct ops_sai_nexthop_key  nh_key;
+    char                        extra_str[SAI_NEXT_HOP_MAX][INET6_ADDRSTRLEN];
+    char                        *extra[SAI_NEXT_HOP_MAX];
+    uint64_t                    vrid        = ops_routep->vrid;
+    uint32_t                    n_extra     = 0;
+    uint32_t                    n_missing   = 0;
+    uint32_t                    index       = 0;
+    uint32_t                    i = 0, j = 0;
+    sai_status_t                status      = SAI_STATUS_SUCCESS;
+
+    for (i = 0; i < next_hop_count; i++) {
+        if (ops_sai_nexthop_key_init(&nh_key, vrid, 0, next_hops[i])) {
+            continue;
+        }
+        if (0 > ops_sai_nexthop_addr_lookup(ops_routep, &nh_key)) {
+            n_missing++;
+        }
+    }
+
+    for (i = 0; i < ops_routep->n_nexthops; i++) {
+        index = ops_routep->nexthops[i];
+        for (j = 0; j < next_hop_count; j++) {
+            if (!ops_sai_nexthop_key_init(&nh_key, vrid, 0, next_hops[j]) &&
+                ops_sai_nexthop_addr_lookup(ops_routep, &nh_key) == i) {
+                break;
+            }
+        }
+        if (j == next_hop_count) {
+            extra[n_extra] = extra_str[n_extra];
+            ops_sai_nexthop_format(index, extra_str[n_extra],
+                                   sizeof extra_str[n_extra]);
+            n_extra++;
+        }
+    }
+
+    /* The route may be gone once its last next hop is removed */
+    if (n_missing) {
+        status = __sai_route_remote_action(vrid, &ops_routep->key.prefix,
+                                           next_hop_count, next_hops, true);
+    }
+    if (!status && n_extra) {
+        status = __sai_route_remote_action(vrid, &ops_routep->key.prefix,
+                                           n_extra, extra, false);
+    }
+
+    *changed = n_missing || n_extra;
+
+    return status;
+}
+
+/*
+ * Takes over a route restored from snapshot when it is added again after
+ * warm restart. The route ends up with exactly the given next hops.
+ *
+ * @param[out] status - result, set if the route was stale
+ *
+ * @return true if the route was stale and is taken over. */
+static bool
+__route_stale_adopt(uint64_t                    vrid,
+                    const struct ops_sai_prefix *prefix,
+                    uint32_t                    next_hop_count,
+                    char *const *const          next_hops,
+                    sai_status_t                *status)
+{
+    sai_ops_route_t             *ops_routep = NULL;
+    struct ops_sai_route_key    key;
+    bool                        changed     = false;
+
+    if (!route_n_stale) {
+        return false;
+    }
+
+    ops_sai_route_key_init(&key, __route_vrf_num(vrid, false), prefix);
+    ops_routep = ops_sai_route_lookup(&key);
+    if (!ops_routep || !ops_routep->stale) {
+        return false;
+    }
+
+    ops_routep->stale = false;
+    route_n_stale--;
+
+    *status = __route_nexthops_replace(ops_routep, next_hop_count,
+                                       next_hops, &changed);
+    if (changed) {
+        route_snap_stats.updated++;
+    } else {
+        route_snap_stats.unchanged++;
+    }
+
+    return true;
+}
+
+/*
+ * Adds next hops of a remote route, for a parsed prefix. The route worker
+ * gets parsed prefixes in bulk entries and comes here directly.
+ */
+static int
+__ops_sai_route_remote_add(handle_t                    vrid,
+                           const struct ops_sai_prefix *prefix,
+                           uint32_t                    next_hop_count,
+                           char *const *const          next_hops)
+{
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+    uint32_t        cmd_add = true;
+    char            prefix_str[OPS_SAI_PREFIX_STR_LEN];
+
+    VLOG_INFO("Adding next hop(s) for remote route"
+              "(prefix: %s, next hop count %u)",
+              ops_sai_prefix_format(prefix, prefix_str, sizeof prefix_str),
+              next_hop_count);
+
+    ovs_assert(next_hops);
+    ovs_assert(next_hop_count);
+    if (SAI_NEXT_HOP_MAX <= next_hop_count) {
+        VLOG_ERR("The num of nexthops is overflow");
+        goto exit;
+    }
+
+    if (!__route_stale_adopt(vrid.data, prefix, next_hop_count, next_hops,
+                             &status)) {
+        status = __sai_route_remote_action(vrid.data, prefix, next_hop_count,
+                                           next_hops, cmd_add);
+    }
+
+    SAI_ERROR_LOG_EXIT(status, "Failed to add remote route"
+                      "(prefix: %s, next hop count %u)",
+                      ops_sai_prefix_format(prefix, prefix_str,
+                                            sizeof prefix_str),
+                      next_hop_count);
+
+exit:
+    return status;
+}
+
+/*
+ *  Function for adding next hops(list of remote routes) which are accessible
+ *  over specified IP prefix
+ *
+ * @param[in] vrid           - virtual router ID
+ * @param[in] prefix         - IP prefix
+ * @param[in] next_hop_count - count of next hops
+ * @param[in] next_hops      - list of next hops
+ *
+ * @return 0  if operation completed successfully.
+ * @return -1 if operation failed.*/
+static int
+__route_remote_add(handle_t           vrid,
+                   const char        *prefix,
+                   uint32_t           next_hop_count,
+                   char *const *const next_hops)
+{
+    struct ops_sai_prefix   ip_prefix;
+    int                     rc = 0;
+
+    ovs_assert(prefix);
+
+    rc = ops_sai_route_prefix_get(prefix, &ip_prefix);
+    if (rc) {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return rc;
+    }
+
+    return __ops_sai_route_remote_add(vrid, &ip_prefix, next_hop_count,
+                                      next_hops);
+}
+
+/* Sets next hops of a remote route, for a parsed prefix. */
+static int
+__ops_sai_route_remote_set(handle_t                    vrid,
+                           const struct ops_sai_prefix *prefix,
+                           uint32_t                    next_hop_count,
+                           char *const *const          next_hops)
+{
+    sai_status_t                status      = SAI_STATUS_SUCCESS;
+    sai_ops_route_t             *ops_routep = NULL;
+    struct ops_sai_route_key    key;
+    char                        prefix_str[OPS_SAI_PREFIX_STR_LEN];
+    bool                        changed     = false;
+
+    if (SAI_NEXT_HOP_MAX <= next_hop_count) {
+        return __ops_sai_route_remote_add(vrid, prefix, next_hop_count,
+                                          next_hops);
+    }
+
+    ops_sai_route_key_init(&key, __route_vrf_num(vrid.data, false), prefix);
+    ops_routep = ops_sai_route_lookup(&key);
+    if (!ops_routep || !ops_routep->n_nexthops || ops_routep->stale) {
+        return __ops_sai_route_remote_add(vrid, prefix, next_hop_count,
+                                          next_hops);
+    }
+
+    ops_sai_prefix_format(prefix, prefix_str, sizeof prefix_str);
+    VLOG_INFO("Replacing next hop(s) of remote route"
+              "(prefix: %s, next hop count %u)", prefix_str, next_hop_count);
+
+    status = __route_nexthops_replace(ops_routep, next_hop_count,
+                                      next_hops, &changed);
+    SAI_ERROR_LOG_EXIT(status, "Failed to replace next hops of remote route"
+                       "(prefix: %s, next hop count %u)",
+                       prefix_str, next_hop_count);
+
+exit:
+    return status;
+}
+
+/*
+ *  Function for setting next hops of a remote route to exactly the given
+ *  ones. A route which is not programmed yet is added.
+ *
+ * @param[in] vrid           - virtual router ID
+ * @param[in] prefix         - IP prefix
+ * @param[in] next_hop_count - count of next hops
+ * @param[in] next_hops      - list of next hops
+ *
+ * @return 0  if operation completed successfully.
+ * @return SAI status otherwise.*/
+static int
+__route_remote_set(handle_t           vrid,
+                   const char        *prefix,
+                   uint32_t           next_hop_count,
+                   char *const *const next_hops)
+{
+    struct ops_sai_prefix   ip_prefix;
+
+    if (ops_sai_route_prefix_get(prefix, &ip_prefix)) {
+        return __route_remote_add(vrid, prefix, next_hop_count, next_hops);
+    }
+
+    return __ops_sai_route_remote_set(vrid, &ip_prefix, next_hop_count,
+                                      next_hops);
+}
+
+/*
+ *  Function for deleting next hops(list of remote routes) which now are not
+ *  accessible over specified IP prefix
+ *
+ * @param[in] vrid           - virtual router ID
+ * @param[in] prefix         - IP prefix
+ * @param[in] next_hop_count - count of next hops
+ * @param[in] next_hops      - list of next hops
+ *
+ * @return 0  if operation completed successfully.
+ * @return -1 if operation failed.*/
+static int
+__route_remote_nh_remove(handle_t           vrid,
+                         const char        *prefix,
+                         uint32_t           next_hop_count,
+                         char *const *const next_hops)
+{
+    sai_status_t    status = SAI_STATUS_SUCCESS;
+    uint32_t        cmd_add = false;
+    struct ops_sai_prefix   ip_prefix;
+
+    status = ops_sai_route_prefix_get(prefix, &ip_prefix);
+    if (status) {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return status;
+    }
+
+    status = __sai_route_remote_action(vrid.data, &ip_prefix, next_hop_count,
+                                   next_hops, cmd_add);
+
+    return status;
+}
+
+/* Deletes a remote route, for a parsed prefix. */
+static int
+__ops_sai_route_remove(const handle_t *vrid,
+                       const struct ops_sai_prefix *prefix)
+{
+    sai_status_t        status          = SAI_STATUS_SUCCESS;
+    uint32_t            cmd_add         = false;
+    int                 vrf_id          = 0;
+    sai_ops_route_t     *ops_routep     = NULL;
+    struct ops_sai_route_key key;
+
+    vrf_id = __route_vrf_num(vrid->data, false);
+    ops_sai_route_key_init(&key, vrf_id, prefix);
+    status = __route_aggr_expand(&key);
+    if (status) {
+        return status;
+    }
+
+    ops_routep = ops_sai_route_lookup(&key);
+    if (NULL != ops_routep) {
+        if (ops_routep->refer_cnt) {
+            if (ops_routep->n_nexthops) {
+                if (1 <= ops_routep->refer_cnt) {
+                    ops_routep->refer_cnt --;
+                }
+            } else {
+                /* For route without nexthop of intf, and local multipath */
+                if (1 < ops_routep->refer_cnt) {
+                    ops_routep->refer_cnt --;
+                } else if (1 == ops_routep->refer_cnt) {
+                    /* for delete the local route */
+                    __ops_sai_route_local_delete(vrid, prefix);
+                    ops_sai_route_del(ops_routep);
+                }
+            }
+        } else {
+            if (ops_routep->n_nexthops) {
+                /* for delete the remote route and nexthop  */
+                status = __sai_route_remote_action(vrid->data, prefix, 0, NULL, cmd_add);
+            }
+        }
+    }
+
+    return status;
+}
+
+/*
+ *  Function for deleting remote route
+ *
+ * @param[in] vrid           - virtual router ID
+ * @param[in] prefix         - IP prefix over which next hops can be accessed
+ *
+ * @notes if next hops were already configured earlier for this route then
+ *        delete all next-hops of a route as well as the route itself.
+ *
+ * @return 0  if operation completed successfully.
+ * @return -1 if operation failed.*/
+static int
+__route_remove(const handle_t *vrid, const char     *prefix)
+{
+    struct ops_sai_prefix   ip_prefix;
+
+    if (NULL == vrid || NULL == prefix)
+    {
+        return SAI_STATUS_FAILURE;
+    }
+
+    if (ops_sai_route_prefix_get(prefix, &ip_prefix)) {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return SAI_STATUS_INVALID_PARAMETER;
+    }
+
+    return __ops_sai_route_remove(vrid, &ip_prefix);
+}
+
+/*
+ * Programs a batch of route entries, taking route table entries as
+ * __route_entry_create() does. The SAI route API in use has no bulk create,
+ * so entries are pushed one by one here; this is the single place to switch
+ * to a vectorized call.
+ */
+static void
+__route_entries_create(const sai_unicast_route_entry_t *routes,
+                       const sai_attribute_t (*attrs)[3],
+                       sai_status_t *statuses,
+                       uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        statuses[i] = __route_entry_create(&routes[i], attrs[i], 3);
+    }
+}
+
+/* Bulk counterpart of __route_entries_create() for route removal. */
+static void
+__route_entries_remove(const sai_unicast_route_entry_t *routes,
+                       sai_status_t *statuses,
+                       uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        statuses[i] = __route_entry_remove(&routes[i]);
+    }
+}
+
+/*
+ *  Function for adding a batch of remote routes at once.
+ *  New routes are collected and programmed with one bulk call, updates of
+ *  already known routes go through the single route path.
+ *
+ * @param[in]     vrid    - virtual router ID
+ * @param[in,out] entries - routes to add, status of every entry is set
+ * @param[in]     count   - count of entries
+ *
+ * @return 0  if all entries were added successfully.
+ * @return status of the first failed entry otherwise.*/
+static int
+__route_remote_add_bulk(handle_t                         vrid,
+                        struct ops_sai_route_bulk_entry *entries,
+                        uint32_t                         count)
+{
+    sai_unicast_route_entry_t   *routes     = NULL;
+    sai_ops_route_t             **ops_routes = NULL;
+    sai_attribute_t             (*attrs)[3] = NULL;
+    sai_status_t                *statuses   = NULL;
+    uint32_t                    *pending    = NULL;
+    uint32_t                    n_pending   = 0;
+    struct ops_sai_route_bulk_entry *entry  = NULL;
+    struct ops_sai_route_key    key;
+    sai_ops_route_t             *ops_routep = NULL;
+    handle_t                    l3_id;
+    int                         vrf_id      = 0;
+    int                         status      = 0;
+
+    routes = xcalloc(count, sizeof(*routes));
+    ops_routes = xcalloc(count, sizeof(*ops_routes));
+    attrs = xcalloc(count, sizeof(*attrs));
+    statuses = xcalloc(count, sizeof(*statuses));
+    pending = xcalloc(count, sizeof(*pending));
+    vrf_id = __route_vrf_num(vrid.data, true);
+
+    for (uint32_t i = 0; i < count; i++) {
+        entry = &entries[i];
+        entry->status = SAI_STATUS_SUCCESS;
+
+        if (!entry->next_hop_count ||
+            SAI_NEXT_HOP_MAX <= entry->next_hop_count) {
+            entry->status = __ops_sai_route_remote_add(vrid, &entry->ip_prefix,
+                                                       entry->next_hop_count,
+                                                       entry->next_hops);
+            continue;
+        }
+
+        ops_sai_route_key_init(&key, vrf_id, &entry->ip_prefix);
+        entry->status = __route_aggr_expand(&key);
+        if (entry->status) {
+            continue;
+        }
+
+        if (ops_sai_route_lookup(&key) ||
+            ops_sai_route_entry_fill(&routes[n_pending], vrid.data,
+                                     &entry->ip_prefix)) {
+            entry->status = __ops_sai_route_remote_add(vrid, &entry->ip_prefix,
+                                                       entry->next_hop_count,
+                                                       entry->next_hops);
+            continue;
+        }
+
+        ops_routep = ops_sai_route_add(&key);
+        ops_routep->vrid = vrid.data;
+        ops_sai_route_nexthops_add(ops_routep, entry->next_hop_count,
+                                   entry->next_hops, NULL);
+        memset(&l3_id, 0, sizeof(l3_id));
+        if (__route_nexthops_setup(ops_routep, &l3_id)) {
+            __route_remote_release(ops_routep);
+            entry->status = SAI_STATUS_FAILURE;
+            continue;
+        }
+        __route_state_update(ops_routep);
+
+        __route_park_set(ops_routep, __route_park_needed(ops_routep));
+        __route_forward_attr_fill(attrs[n_pending], &l3_id,
+                                  __route_packet_action(ops_routep));
+        ops_routes[n_pending] = ops_routep;
+        pending[n_pending++] = i;
+    }
+
+    __route_entries_create(routes, (const sai_attribute_t (*)[3]) attrs,
+                           statuses, n_pending);
+
+    for (uint32_t i = 0; i < n_pending; i++) {
+        entry = &entries[pending[i]];
+        entry->status = statuses[i];
+        if (SAI_ERROR_2_ERRNO(statuses[i])) {
+            VLOG_ERR("SAI error %d Failed to add route entry (prefix: %s)",
+                     statuses[i], entry->prefix);
+            __route_remote_release(ops_routes[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (entries[i].status) {
+            status = entries[i].status;
+            break;
+        }
+    }
+
+    free(pending);
+    free(statuses);
+    free(attrs);
+    free(ops_routes);
+    free(routes);
+
+    return status;
+}
+
+/*
+ *  Function for deleting a batch of remote routes at once.
+ *  Remote-only routes are removed from hardware with one bulk call, routes
+ *  shared with local routes go through the single route path.
+ *
+ * @param[in]     vrid    - virtual router ID
+ * @param[in,out] entries - routes to delete, status of every entry is set
+ * @param[in]     count   - count of entries
+ *
+ * @return 0  if all entries were deleted successfully.
+ * @return status of the first failed entry otherwise.*/
+static int
+__route_remove_bulk(const handle_t                  *vrid,
+                    struct ops_sai_route_bulk_entry *entries,
+                    uint32_t                         count)
+{
+    sai_unicast_route_entry_t   *routes     = NULL;
+    sai_ops_route_t             **ops_routes = NULL;
+    sai_status_t                *statuses   = NULL;
+    uint32_t                    *pending    = NULL;
+    uint32_t                    n_pending   = 0;
+    struct ops_sai_route_bulk_entry *entry  = NULL;
+    struct ops_sai_route_key    key;
+    sai_ops_route_t             *ops_routep = NULL;
+    int                         vrf_id      = 0;
+    int                         status      = 0;
+
+    routes = xcalloc(count, sizeof(*routes));
+    ops_routes = xcalloc(count, sizeof(*ops_routes));
+    statuses = xcalloc(count, sizeof(*statuses));
+    pending = xcalloc(count, sizeof(*pending));
+    vrf_id = __route_vrf_num(vrid->data, false);
+
+    for (uint32_t i = 0; i < count; i++) {
+        entry = &entries[i];
+        entry->status = SAI_STATUS_SUCCESS;
+
+        ops_sai_route_key_init(&key, vrf_id, &entry->ip_prefix);
+        entry->status = __route_aggr_expand(&key);
+        if (entry->status) {
+            continue;
+        }
+
+        ops_routep = ops_sai_route_lookup(&key);
+        if (!ops_routep) {
+            continue;
+        }
+
+        if (ops_routep->refer_cnt || !ops_routep->n_nexthops ||
+            ops_sai_route_entry_fill(&routes[n_pending], vrid->data,
+                                     &entry->ip_prefix)) {
+            entry->status = __ops_sai_route_remove(vrid, &entry->ip_prefix);
+            continue;
+        }
+
+        ops_routes[n_pending] = ops_routep;
+        pending[n_pending++] = i;
+    }
+
+    __route_entries_remove(routes, statuses, n_pending);
+
+    for (uint32_t i = 0; i < n_pending; i++) {
+        entry = &entries[pending[i]];
+        entry->status = statuses[i];
+        if (SAI_ERROR_2_ERRNO(statuses[i])) {
+            VLOG_ERR("SAI error %d Failed to delete route entry (prefix: %s)",
+                     statuses[i], entry->prefix);
+            continue;
+        }
+
+        __route_remote_release(ops_routes[i]);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (entries[i].status) {
+            status = entries[i].status;
+            break;
+        }
+    }
+
+    free(pending);
+    free(statuses);
+    free(ops_routes);
+    free(routes);
+
+    return status;
+}
+
+/*
+ *  Function for setting next hops of a batch of remote routes at once.
+ *
+ * @param[in]     vrid    - virtual router ID
+ * @param[in,out] entries - routes to set next hops of, status of every entry
+ *                          is set
+ * @param[in]     count   - count of entries
+ *
+ * @return 0  if all entries were set successfully.
+ * @return status of the first failed entry otherwise.*/
+static int
+__route_remote_set_bulk(handle_t                         vrid,
+                        struct ops_sai_route_bulk_entry *entries,
+                        uint32_t                         count)
+{
+    struct ops_sai_route_bulk_entry *entry  = NULL;
+    int                             status  = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        entry = &entries[i];
+        entry->status = __ops_sai_route_remote_set(vrid, &entry->ip_prefix,
+                                                   entry->next_hop_count,
+                                                   entry->next_hops);
+        if (!status) {
+            status = entry->status;
+        }
+    }
+
+    return status;
+}
+
+/*
+ *  Function for deleting next hops of a batch of remote routes at once.
+ *
+ * @param[in]     vrid    - virtual router ID
+ * @param[in,out] entries - routes and next hops to delete, status of every
+ *                          entry is set
+ * @param[in]     count   - count of entries
+ *
+ * @return 0  if all entries were handled successfully.
+ * @return status of the first failed entry otherwise.*/
+static int
+__route_remote_nh_remove_bulk(handle_t                         vrid,
+                              struct ops_sai_route_bulk_entry *entries,
+                              uint32_t                         count)
+{
+    struct ops_sai_route_bulk_entry *entry  = NULL;
+    int                             status  = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        entry = &entries[i];
+        entry->status = __sai_route_remote_action(vrid.data,
+                                                  &entry->ip_prefix,
+                                                  entry->next_hop_count,
+                                                  entry->next_hops, false);
+        if (!status) {
+            status = entry->status;
+        }
+    }
+
+    return status;
+}
+
+/*
+ *  Function for deleting all routes of a virtual router at once.
+ *  Route entries of routes and aggregates are removed with one bulk call,
+ *  then next hops and ECMP groups no longer used are released.
+ *
+ * @param[in] vrid - virtual router ID
+ *
+ * @return 0     if operation completed successfully.
+ * @return errno of the first failed entry otherwise. Routes of failed
+ *         entries are kept.*/
+static int
+__route_vrf_flush(const handle_t *vrid)
+{
+    struct ops_sai_route_vrf    *route_vrf  = __route_vrf_lookup(vrid->data);
+    sai_unicast_route_entry_t   *routes     = NULL;
+    sai_ops_route_t             **ops_routes = NULL;
+    struct ops_sai_route_aggr   **aggrs     = NULL;
+    sai_status_t                *statuses   = NULL;
+    sai_ops_route_t             *ops_routep = NULL;
+    struct ops_sai_route_aggr   *aggr       = NULL;
+    size_t                      count       = 0;
+    uint32_t                    n_pending   = 0;
+    int                         status      = 0;
+
+    if (!route_vrf) {
+        return 0;
+    }
+
+    count = hmap_count(&route_vrf->routes) + hmap_count(&route_vrf->aggrs);
+    routes = xcalloc(count, sizeof(*routes));
+    ops_routes = xcalloc(count, sizeof(*ops_routes));
+    aggrs = xcalloc(count, sizeof(*aggrs));
+    statuses = xcalloc(count, sizeof(*statuses));
+
+    /* Members of aggregates have no entry of their own */
+    HMAP_FOR_EACH(ops_routep, node, &route_vrf->routes) {
+        if (!ops_routep->aggr) {
+            ops_sai_route_entry_fill(&routes[n_pending], vrid->data,
+                                     &ops_routep->key.prefix);
+            ops_routes[n_pending++] = ops_routep;
+        }
+    }
+    HMAP_FOR_EACH(aggr, node, &route_vrf->aggrs) {
+        ops_sai_route_entry_fill(&routes[n_pending], vrid->data,
+                                 &aggr->key.prefix);
+        aggrs[n_pending++] = aggr;
+    }
+
+    __route_entries_remove(routes, statuses, n_pending);
+
+    for (uint32_t i = 0; i < n_pending; i++) {
+        if (SAI_ERROR_2_ERRNO(statuses[i])) {
+            VLOG_ERR("SAI error %d Failed to delete route entry while "
+                     "flushing virtual router 0x%"PRIx64, statuses[i],
+                     vrid->data);
+            if (!status) {
+                status = SAI_ERROR_2_ERRNO(statuses[i]);
+            }
+            continue;
+        }
+
+        if (ops_routes[i]) {
+            __route_remote_release(ops_routes[i]);
+            continue;
+        }
+
+        for (size_t j = 0; j < aggrs[i]->n_members; j++) {
+            aggrs[i]->members[j]->aggr = NULL;
+            __route_remote_release(aggrs[i]->members[j]);
+        }
+        __route_aggr_destroy(aggrs[i]);
+    }
+
+    VLOG_INFO("Flushed %"PRIu32" route entries of virtual router 0x%"PRIx64,
+              n_pending, vrid->data);
+
+    if (hmap_is_empty(&route_vrf->routes)) {
+        __route_vrf_destroy(route_vrf);
+    }
+
+    free(statuses);
+    free(aggrs);
+    free(ops_routes);
+    free(routes);
+
+    return status;
+}
+
+/*
+ * Warm restart snapshot. Remote routes, the next hops and ECMP groups they
+ * use and the aggregates they are programmed as are saved with their SAI
+ * object IDs. Records have a fixed size and refer to each other by position,
+ * so a mapped file is used in place. It is written on de-init, ahead of a
+ * planned restart, or on demand with sai/route/snapshot save.
+ *
+ * On start the snapshot is taken as the initial state without touching
+ * hardware, which the switch is expected to have kept. Restored routes are
+ * stale until added again, the ones not added by the reconcile deadline are
+ * removed. Restored next hops are held until then too, so neighbors and
+ * routes coming back find them in place.
+ */
+
+#define OPS_SAI_ROUTE_SNAP_MAGIC    0x53524e50      /* "SRNP" */
+#define OPS_SAI_ROUTE_SNAP_VERSION  2
+#define OPS_SAI_ROUTE_SNAP_NONE     UINT32_MAX
+#define OPS_SAI_ROUTE_SNAP_FILE     "sai-route.snap"
+
+struct route_snap_header {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    n_nexthops;
+    uint32_t    n_nhgs;
+    uint32_t    n_routes;
+    uint32_t    n_aggrs;
+    uint32_t    n_indices;
+    uint32_t    pad;
+};
+
+struct route_snap_nexthop {
+    struct ops_sai_nexthop_key  key;
+    uint64_t                    oid;
+    uint32_t                    weight;
+    uint8_t                     is_down;
+    uint8_t                     pad[3];
+};
+
+/* Next hops and buckets are ranges of the index array, which holds next hop
+ * record positions. */
+struct route_snap_nhg {
+    uint64_t    oid;
+    uint32_t    n_nexthops;
+    uint32_t    nexthops;
+    uint32_t    active;
+    uint32_t    n_buckets;
+    uint32_t    buckets;
+    uint32_t    pad;
+};
+
+struct route_snap_route {
+    struct ops_sai_route_key    key;
+    uint64_t                    vrid;
+    uint32_t                    n_nexthops;
+    uint32_t                    nexthops;
+    uint32_t                    nhg;        /* position or NONE */
+    uint32_t                    aggr;       /* position or NONE */
+};
+
+struct route_snap_aggr {
+    struct ops_sai_route_key    key;
+    uint64_t                    vrid;
+    uint64_t                    oid;
+};
+
+/* Position of an ECMP group or aggregate being saved */
+struct route_snap_pos {
+    struct hmap_node    node;
+    const void          *ptr;
+    uint32_t            pos;
+};
+
+struct route_snap_indices {
+    uint32_t    *indices;
+    size_t      n_indices;
+    size_t      allocated_indices;
+};
+
+/* Next hops held since restore, released when reconciling is over */
+static uint32_t *route_snap_holds;
+static size_t route_n_snap_holds;
+
+static char *
+__route_snapshot_path(void)
+{
+    return xasprintf("%s/%s", ovs_rundir(), OPS_SAI_ROUTE_SNAP_FILE);
+}
+
+static void
+__route_snap_pos_add(struct hmap *positions, const void *ptr, uint32_t pos)
+{
+    struct route_snap_pos *snap_pos = xmalloc(sizeof(*snap_pos));
+
+    snap_pos->ptr = ptr;
+    snap_pos->pos = pos;
+    hmap_insert(positions, &snap_pos->node, hash_pointer(ptr, 0));
+}
+
+static uint32_t
+__route_snap_pos_get(const struct hmap *positions, const void *ptr)
+{
+    struct route_snap_pos *snap_pos = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(snap_pos, node, hash_pointer(ptr, 0), positions) {
+        if (snap_pos->ptr == ptr) {
+            return snap_pos->pos;
+        }
+    }
+
+    return OPS_SAI_ROUTE_SNAP_NONE;
+}
+
+static void
+__route_snap_pos_destroy(struct hmap *positions)
+{
+    struct route_snap_pos *snap_pos = NULL;
+    struct route_snap_pos *next = NULL;
+
+    HMAP_FOR_EACH_SAFE(snap_pos, next, node, positions) {
+        hmap_remove(positions, &snap_pos->node);
+        free(snap_pos);
+    }
+    hmap_destroy(positions);
+}
+
+/* Appends next hop indices translated into record positions. Returns the
+ * start of the range. */
+static uint32_t
+__route_snap_indices_put(struct route_snap_indices *snap_indices,
+                         const uint32_t *nh_pos, const uint32_t *indices,
+                         uint32_t n_indices)
+{
+    uint32_t start = snap_indices->n_indices;
+
+    for (uint32_t i = 0; i < n_indices; i++) {
+        if (snap_indices->n_indices == snap_indices->allocated_indices) {
+            snap_indices->indices = x2nrealloc(snap_indices->indices,
+                                           &snap_indices->allocated_indices,
+                                           sizeof(*snap_indices->indices));
+        }
+        snap_indices->indices[snap_indices->n_indices++] =
+            OPS_SAI_NH_INDEX_INVALID == indices[i] ? OPS_SAI_ROUTE_SNAP_NONE
+                                                   : nh_pos[indices[i]];
+    }
+
+    return start;
+}
+
+static bool
+__route_snap_write(FILE *file, const void *data, size_t size)
+{
+    return !size || 1 == fwrite(data, size, 1, file);
+}
+
+/*
+ * Writes route state into the snapshot file. The file is replaced at once,
+ * so a crash while saving leaves the previous snapshot.
+ *
+ * @return 0 on success, errno otherwise. */
+static int
+__route_snapshot_save(void)
+{
+    struct route_snap_header    header;
+    struct route_snap_nexthop   *nexthops   = NULL;
+    struct route_snap_nhg       *nhgs       = NULL;
+    struct route_snap_route     *routes     = NULL;
+    struct route_snap_aggr      *aggrs      = NULL;
+    struct route_snap_indices   indices     = { NULL, 0, 0 };
+    struct hmap                 positions   = HMAP_INITIALIZER(&positions);
+    size_t                      n_slots = n_nh_slabs * OPS_SAI_NH_SLAB_SIZE;
+    uint32_t                    *nh_pos     = NULL;
+    struct nh_entry             *p_nh_entry = NULL;
+    struct ops_sai_nhg          *nhg        = NULL;
+    struct ops_sai_route_aggr   *aggr       = NULL;
+    struct ops_sai_route_vrf    *route_vrf  = NULL;
+    sai_ops_route_t             *routep     = NULL;
+    char                        *path       = NULL;
+    char                        *tmp_path   = NULL;
+    FILE                        *file       = NULL;
+    int                         error       = 0;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = OPS_SAI_ROUTE_SNAP_MAGIC;
+    header.version = OPS_SAI_ROUTE_SNAP_VERSION;
+
+    /* In index order, so restored indices keep group next hops sorted */
+    nh_pos = xmalloc(n_slots * sizeof(*nh_pos));
+    nexthops = xcalloc(hmap_count(&all_nexthop), sizeof(*nexthops));
+    for (uint32_t index = 0; index < n_slots; index++) {
+        nh_pos[index] = OPS_SAI_ROUTE_SNAP_NONE;
+        p_nh_entry = ops_sai_nexthop_get(index);
+        if (!p_nh_entry) {
+            continue;
+        }
+
+        nexthops[header.n_nexthops].key = p_nh_entry->key;
+        nexthops[header.n_nexthops].oid = p_nh_entry->handle.data;
+        nexthops[header.n_nexthops].weight = p_nh_entry->weight;
+        nexthops[header.n_nexthops].is_down = p_nh_entry->is_down;
+        nh_pos[index] = header.n_nexthops++;
+    }
+
+    nhgs = xcalloc(hmap_count(&all_nhg), sizeof(*nhgs));
+    HMAP_FOR_EACH(nhg, node, &all_nhg) {
+        nhgs[header.n_nhgs].oid = nhg->handle.data;
+        nhgs[header.n_nhgs].n_nexthops = nhg->n_nexthops;
+        nhgs[header.n_nhgs].nexthops =
+            __route_snap_indices_put(&indices, nh_pos, nhg->nexthops,
+                                     nhg->n_nexthops);
+        nhgs[header.n_nhgs].active = nhg->active;
+        nhgs[header.n_nhgs].n_buckets = nhg->n_buckets;
+        nhgs[header.n_nhgs].buckets =
+            __route_snap_indices_put(&indices, nh_pos, nhg->buckets,
+                                     nhg->n_buckets);
+        __route_snap_pos_add(&positions, nhg, header.n_nhgs++);
+    }
+
+    aggrs = xcalloc(route_n_aggrs, sizeof(*aggrs));
+    HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+        HMAP_FOR_EACH(aggr, node, &route_vrf->aggrs) {
+            aggrs[header.n_aggrs].key = aggr->key;
+            aggrs[header.n_aggrs].vrid = aggr->vrid;
+            aggrs[header.n_aggrs].oid = aggr->l3_id.data;
+            __route_snap_pos_add(&positions, aggr, header.n_aggrs++);
+        }
+    }
+
+    /* Local routes are added again on start and taken over as they are */
+    routes = xcalloc(__route_count(), sizeof(*routes));
+    HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+        HMAP_FOR_EACH(routep, node, &route_vrf->routes) {
+            if (!routep->n_nexthops) {
+                continue;
+            }
+
+            routes[header.n_routes].key = routep->key;
+            routes[header.n_routes].vrid = routep->vrid;
+            routes[header.n_routes].n_nexthops = routep->n_nexthops;
+            routes[header.n_routes].nexthops =
+                __route_snap_indices_put(&indices, nh_pos, routep->nexthops,
+                                         routep->n_nexthops);
+            routes[header.n_routes].nhg =
+                routep->nhg ? __route_snap_pos_get(&positions, routep->nhg)
+                            : OPS_SAI_ROUTE_SNAP_NONE;
+            routes[header.n_routes].aggr =
+                routep->aggr ? __route_snap_pos_get(&positions, routep->aggr)
+                             : OPS_SAI_ROUTE_SNAP_NONE;
+            header.n_routes++;
+        }
+    }
+    header.n_indices = indices.n_indices;
+
+    path = __route_snapshot_path();
+    tmp_path = xasprintf("%s.tmp", path);
+    file = fopen(tmp_path, "wb");
+    if (!file) {
+        error = errno;
+        goto exit;
+    }
+
+    if (!__route_snap_write(file, &header, sizeof(header)) ||
+        !__route_snap_write(file, nexthops,
+                            header.n_nexthops * sizeof(*nexthops)) ||
+        !__route_snap_write(file, nhgs, header.n_nhgs * sizeof(*nhgs)) ||
+        !__route_snap_write(file, routes, header.n_routes * sizeof(*routes)) ||
+        !__route_snap_write(file, aggrs, header.n_aggrs * sizeof(*aggrs)) ||
+        !__route_snap_write(file, indices.indices,
+                            header.n_indices * sizeof(*indices.indices)) ||
+        fflush(file) || fsync(fileno(file))) {
+        error = errno ? errno : EIO;
+    }
+    if (fclose(file) && !error) {
+        error = errno;
+    }
+    if (!error && rename(tmp_path, path)) {
+        error = errno;
+    }
+    if (error) {
+        unlink(tmp_path);
+        goto exit;
+    }
+
+    route_snap_stats.saves++;
+    route_snap_stats.last_save = time_wall_msec();
+    VLOG_DBG("Saved %u routes to snapshot %s", header.n_routes, path);
+
+exit:
+    if (error) {
+        VLOG_WARN("Failed to save route snapshot %s (%s)", path,
+                  ovs_strerror(error));
+    }
+    free(tmp_path);
+    free(path);
+    __route_snap_pos_destroy(&positions);
+    free(indices.indices);
+    free(routes);
+    free(aggrs);
+    free(nhgs);
+    free(nexthops);
+    free(nh_pos);
+
+    return error;
+}
+
+/* Whether a range of the index array holds next hop positions */
+static bool
+__route_snap_range_valid(const struct route_snap_header *header,
+                         const uint32_t *indices, uint32_t start, uint32_t n,
+                         bool allow_none)
+{
+    if (start > header->n_indices || n > header->n_indices - start) {
+        return false;
+    }
+
+    for (uint32_t i = start; i < start + n; i++) {
+        if (indices[i] >= header->n_nexthops &&
+            !(allow_none && OPS_SAI_ROUTE_SNAP_NONE == indices[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+__route_snap_key_valid(const struct ops_sai_route_key *key)
+{
+    return (AF_INET == key->prefix.family &&
+            key->prefix.len <= COPS_IPV4_ADDR_LEN_IN_BIT) ||
+           (AF_INET6 == key->prefix.family &&
+            key->prefix.len <= COPS_IPV6_ADDR_LEN_IN_BIT);
+}
+
+/* Checks that the snapshot is complete and consistent, so it can be
+ * restored without further checks. */
+static bool
+__route_snapshot_valid(const void *data, size_t size)
+{
+    const struct route_snap_header  *header = data;
+    const struct route_snap_nexthop *nexthops = NULL;
+    const struct route_snap_nhg     *nhgs = NULL;
+    const struct route_snap_route   *routes = NULL;
+    const struct route_snap_aggr    *aggrs = NULL;
+    const uint32_t                  *indices = NULL;
+
+    if (size < sizeof(*header) ||
+        OPS_SAI_ROUTE_SNAP_MAGIC != header->magic ||
+        OPS_SAI_ROUTE_SNAP_VERSION != header->version ||
+        size != sizeof(*header) +
+                (uint64_t) header->n_nexthops * sizeof(*nexthops) +
+                (uint64_t) header->n_nhgs * sizeof(*nhgs) +
+                (uint64_t) header->n_routes * sizeof(*routes) +
+                (uint64_t) header->n_aggrs * sizeof(*aggrs) +
+                (uint64_t) header->n_indices * sizeof(*indices)) {
+        return false;
+    }
+
+    nexthops = (const void *) (header + 1);
+    nhgs = (const void *) (nexthops + header->n_nexthops);
+    routes = (const void *) (nhgs + header->n_nhgs);
+    aggrs = (const void *) (routes + header->n_routes);
+    indices = (const void *) (aggrs + header->n_aggrs);
+
+    for (uint32_t i = 0; i < header->n_nhgs; i++) {
+        if (nhgs[i].n_nexthops < 2 || nhgs[i].n_nexthops > SAI_NEXT_HOP_MAX ||
+            nhgs[i].n_buckets > OPS_SAI_NHG_BUCKETS_MAX ||
+            !__route_snap_range_valid(header, indices, nhgs[i].nexthops,
+                                      nhgs[i].n_nexthops, false) ||
+            !__route_snap_range_valid(header, indices, nhgs[i].buckets,
+                                      nhgs[i].n_buckets, true)) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->n_routes; i++) {
+        if (!__route_snap_key_valid(&routes[i].key) ||
+            !routes[i].n_nexthops ||
+            routes[i].n_nexthops >= SAI_NEXT_HOP_MAX ||
+            !__route_snap_range_valid(header, indices, routes[i].nexthops,
+                                      routes[i].n_nexthops, false) ||
+            (routes[i].n_nexthops > 1) !=
+            (OPS_SAI_ROUTE_SNAP_NONE != routes[i].nhg) ||
+            (OPS_SAI_ROUTE_SNAP_NONE != routes[i].nhg &&
+             routes[i].nhg >= header->n_nhgs) ||
+            (OPS_SAI_ROUTE_SNAP_NONE != routes[i].aggr &&
+             routes[i].aggr >= header->n_aggrs)) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->n_aggrs; i++) {
+        if (!__route_snap_key_valid(&aggrs[i].key)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Whether the switch still has the next hops of the snapshot, that is
+ * whether it kept its state over the restart. */
+static bool
+__route_snapshot_oids_valid(const struct route_snap_header *header)
+{
+    const struct ops_sai_api_class  *sai_api = ops_sai_api_get_instance();
+    const struct route_snap_nexthop *nexthops = (const void *) (header + 1);
+    sai_attribute_t                 attr;
+    sai_status_t                    status = SAI_STATUS_SUCCESS;
+
+    for (uint32_t i = 0; i < header->n_nexthops; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.id = SAI_NEXT_HOP_ATTR_TYPE;
+        status = sai_api->nexthop_api->get_next_hop_attribute(
+                                                nexthops[i].oid, 1, &attr);
+        if (SAI_ERROR_2_ERRNO(status)) {
+            VLOG_WARN("Next hop 0x%"PRIx64" of route snapshot not found "
+                      "(status: %d)", nexthops[i].oid, status);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Rebuilds route state from a valid snapshot. Nothing is programmed. */
+static void
+__route_snapshot_restore(const struct route_snap_header *header)
+{
+    const struct route_snap_nexthop *nexthops = (const void *) (header + 1);
+    const struct route_snap_nhg     *nhgs = (const void *)
+                                            (nexthops + header->n_nexthops);
+    const struct route_snap_route   *routes = (const void *)
+                                              (nhgs + header->n_nhgs);
+    const struct route_snap_aggr    *aggrs = (const void *)
+                                             (routes + header->n_routes);
+    const uint32_t                  *indices = (const void *)
+                                               (aggrs + header->n_aggrs);
+    struct ops_sai_nhg              **nhg_ptrs  = NULL;
+    struct ops_sai_route_aggr       **aggr_ptrs = NULL;
+    struct ops_sai_nh_weight        *nh_weight  = NULL;
+    struct nh_entry                 *p_nh_entry = NULL;
+    struct ops_sai_nhg              *nhg        = NULL;
+    struct ops_sai_route_aggr       *aggr       = NULL;
+    sai_ops_route_t                 *routep     = NULL;
+    struct ops_sai_route_key        key;
+    handle_t                        l3_id;
+    uint32_t                        n_entries   = header->n_aggrs;
+    uint32_t                        pos         = 0;
+    uint32_t                        i = 0, j = 0;
+
+    route_snap_holds = xmalloc(header->n_nexthops * sizeof(*route_snap_holds));
+    for (i = 0; i < header->n_nexthops; i++) {
+        p_nh_entry = ops_sai_nexthop_alloc();
+        p_nh_entry->key = nexthops[i].key;
+        p_nh_entry->is_ipv6_addr = (AF_INET6 == nexthops[i].key.family);
+        p_nh_entry->handle.data = nexthops[i].oid;
+        p_nh_entry->weight = nexthops[i].weight;
+        p_nh_entry->is_down = nexthops[i].is_down;
+        p_nh_entry->ref = 1;
+        hmap_insert(&all_nexthop, &p_nh_entry->nh_hmap_node,
+                    ops_sai_nexthop_key_hash(&p_nh_entry->key));
+        route_snap_holds[route_n_snap_holds++] = p_nh_entry->index;
+
+        if (OPS_SAI_NH_WEIGHT_DEFAULT != p_nh_entry->weight &&
+            !ops_sai_nh_weight_lookup(&p_nh_entry->key)) {
+            nh_weight = xzalloc(sizeof(*nh_weight));
+            ops_sai_nh_weight_key_init(&nh_weight->key, &p_nh_entry->key);
+            nh_weight->weight = p_nh_entry->weight;
+            hmap_insert(&all_nh_weight, &nh_weight->node,
+                        ops_sai_nexthop_key_hash(&nh_weight->key));
+        }
+    }
+
+    nhg_ptrs = xcalloc(header->n_nhgs, sizeof(*nhg_ptrs));
+    for (i = 0; i < header->n_nhgs; i++) {
+        nhg = xzalloc(sizeof(*nhg));
+        nhg->n_nexthops = nhgs[i].n_nexthops;
+        for (j = 0; j < nhg->n_nexthops; j++) {
+            nhg->nexthops[j] = route_snap_holds[indices[nhgs[i].nexthops + j]];
+        }
+        nhg->active = nhgs[i].active;
+        nhg->handle.data = nhgs[i].oid;
+        if (nhgs[i].n_buckets) {
+            nhg->n_buckets = nhgs[i].n_buckets;
+            nhg->buckets = xmalloc(nhg->n_buckets * sizeof(*nhg->buckets));
+            for (j = 0; j < nhg->n_buckets; j++) {
+                pos = indices[nhgs[i].buckets + j];
+                nhg->buckets[j] = OPS_SAI_ROUTE_SNAP_NONE == pos
+                                  ? OPS_SAI_NH_INDEX_INVALID
+                                  : route_snap_holds[pos];
+            }
+        }
+        hmap_insert(&all_nhg, &nhg->node,
+                    ops_sai_nhg_hash(nhg->nexthops, nhg->n_nexthops));
+        for (j = 0; j < nhg->n_nexthops; j++) {
+            ops_sai_nhg_link(nhg, nhg->nexthops[j]);
+        }
+        nhg_ptrs[i] = nhg;
+    }
+
+    aggr_ptrs = xcalloc(header->n_aggrs, sizeof(*aggr_ptrs));
+    for (i = 0; i < header->n_aggrs; i++) {
+        l3_id.data = aggrs[i].oid;
+        key = aggrs[i].key;
+        key.vrf = __route_vrf_num(aggrs[i].vrid, true);
+        aggr_ptrs[i] = __route_aggr_create(&key, aggrs[i].vrid, &l3_id,
+                                           NULL, 0);
+    }
+
+    for (i = 0; i < header->n_routes; i++) {
+        /* Partition numbers are not kept over restart */
+        key = routes[i].key;
+        key.vrf = __route_vrf_num(routes[i].vrid, true);
+        routep = ops_sai_route_add(&key);
+        routep->vrid = routes[i].vrid;
+        routep->stale = true;
+        route_n_stale++;
+
+        for (j = 0; j < routes[i].n_nexthops; j++) {
+            pos = indices[routes[i].nexthops + j];
+            ops_sai_nexthop_add(routep, route_snap_holds[pos]);
+            ops_sai_nexthop_get(route_snap_holds[pos])->ref++;
+        }
+
+        if (OPS_SAI_ROUTE_SNAP_NONE != routes[i].nhg) {
+            routep->nhg = nhg_ptrs[routes[i].nhg];
+            routep->nhg->ref++;
+        }
+
+        if (OPS_SAI_ROUTE_SNAP_NONE != routes[i].aggr) {
+            aggr = aggr_ptrs[routes[i].aggr];
+            aggr->members = xrealloc(aggr->members, (aggr->n_members + 1) *
+                                                    sizeof(*aggr->members));
+            aggr->members[aggr->n_members++] = routep;
+            routep->aggr = aggr;
+        } else {
+            n_entries++;
+        }
+
+        __route_state_update(routep);
+        __route_park_set(routep, __route_park_needed(routep));
+    }
+
+    /* Restored objects are in hardware already and are released as they are
+     * removed, so they are counted whether they fit or not */
+    ops_sai_resource_force_admit(OPS_SAI_RESOURCE_NEXTHOP, header->n_nexthops);
+    ops_sai_resource_force_admit(OPS_SAI_RESOURCE_NHG, header->n_nhgs);
+    ops_sai_resource_force_admit(OPS_SAI_RESOURCE_ROUTE, n_entries);
+
+    route_snap_stats.restored += header->n_routes;
+
+    free(aggr_ptrs);
+    free(nhg_ptrs);
+}
+
+/*
+ * Restores route state saved before restart, if any. The snapshot is used
+ * once: it is removed whether it could be restored or not.
+ */
+static void
+__route_snapshot_load(void)
+{
+    char            *path   = __route_snapshot_path();
+    void            *data   = MAP_FAILED;
+    struct stat     st;
+    int             fd      = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (ENOENT != errno) {
+            VLOG_WARN("Failed to open route snapshot %s (%s)", path,
+                      ovs_strerror(errno));
+        }
+        goto exit;
+    }
+
+    if (!fstat(fd, &st) && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (MAP_FAILED == data) {
+        VLOG_WARN("Failed to map route snapshot %s", path);
+    } else if (!__route_snapshot_valid(data, st.st_size)) {
+        VLOG_WARN("Ignoring invalid route snapshot %s", path);
+    } else if (!__route_snapshot_oids_valid(data)) {
+        VLOG_WARN("Ignoring route snapshot %s, switch state was not kept",
+                  path);
+    } else {
+        __route_snapshot_restore(data);
+        route_reconcile_deadline = time_msec() + OPS_SAI_ROUTE_RECONCILE_MSEC;
+        route_reconcile_timer = route_reconcile_deadline;
+        VLOG_INFO("Restored %"PRIuSIZE" routes from snapshot %s", route_n_stale,
+                  path);
+    }
+
+    if (MAP_FAILED != data) {
+        munmap(data, st.st_size);
+    }
+    unlink(path);
+
+exit:
+    free(path);
+}
+
+/* Ends warm restart: removes stale routes and drops the next hop holds. */
+static void
+__route_reconcile_finish(void)
+{
+    struct ops_sai_route_key    *keys       = NULL;
+    struct ops_sai_route_vrf    *route_vrf  = NULL;
+    sai_ops_route_t             *routep     = NULL;
+    char                        prefix_str[OPS_SAI_PREFIX_STR_LEN];
+    char                        nh_str[SAI_NEXT_HOP_MAX][INET6_ADDRSTRLEN];
+    char                        *next_hops[SAI_NEXT_HOP_MAX];
+    size_t                      n_keys      = 0;
+    uint32_t                    n_nexthops  = 0;
+    int                         status      = 0;
+
+    keys = xmalloc(route_n_stale * sizeof(*keys));
+    HMAP_FOR_EACH(route_vrf, node, &all_route_vrf) {
+        HMAP_FOR_EACH(routep, node, &route_vrf->routes) {
+            if (routep->stale) {
+                keys[n_keys++] = routep->key;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n_keys; i++) {
+        routep = ops_sai_route_lookup(&keys[i]);
+        if (!routep || !routep->stale) {
+            continue;
+        }
+
+        /* Removing the next hops one by one brings back the local route
+         * of the prefix, if there is one */
+        n_nexthops = routep->n_nexthops;
+        for (uint32_t j = 0; j < n_nexthops; j++) {
+            next_hops[j] = nh_str[j];
+            ops_sai_nexthop_format(routep->nexthops[j], nh_str[j],
+                                   sizeof nh_str[j]);
+        }
+        status = __sai_route_remote_action(routep->vrid, &keys[i].prefix,
+                                           n_nexthops, next_hops, false);
+        if (status) {
+            VLOG_ERR("Failed to remove stale route %s (status: %d)",
+                     ops_sai_prefix_format(&keys[i].prefix, prefix_str,
+                                           sizeof prefix_str), status);
+        } else {
+            route_snap_stats.removed++;
+        }
+
+        routep = ops_sai_route_lookup(&keys[i]);
+        if (routep && routep->stale) {
+            routep->stale = false;
+            route_n_stale--;
+        }
+    }
+    free(keys);
+
+    for (size_t i = 0; i < route_n_snap_holds; i++) {
+        ops_sai_nexthop_unref(route_snap_holds[i]);
+    }
+    free(route_snap_holds);
+    route_snap_holds = NULL;
+    route_n_snap_holds = 0;
+
+    route_reconcile_deadline = 0;
+    VLOG_INFO("Route reconciliation done, %"PRIu64" stale routes removed",
+              route_snap_stats.removed);
+}
+
+/* Ends reconciliation unless sai/route/snapshot reconcile did already. Run
+ * by the route programming worker. */
+static int
+__route_reconcile_pass(void *aux OVS_UNUSED)
+{
+    if (route_reconcile_deadline) {
+        __route_reconcile_finish();
+    }
+
+    return 0;
+}
+
+/*
+ * Hands the end of reconciliation over to the route programming worker at
+ * its deadline. Called from ofproto type_run().
+ *
+ * The snapshot is not saved from here: writing the whole table would hold
+ * up route programming. It is saved on de-init and on sai/route/snapshot
+ * save.
+ */
+void
+ops_sai_route_snapshot_run(void)
+{
+    if (route_reconcile_timer && time_msec() >= route_reconcile_timer) {
+        route_reconcile_timer = 0;
+        ops_sai_route_pipeline_task(__route_reconcile_pass, NULL, NULL);
+    }
+}
+
+/* Wakes up the main loop for reconcile deadline. */
+void
+ops_sai_route_snapshot_wait(void)
+{
+    if (route_reconcile_timer) {
+        poll_timer_wait_until(route_reconcile_timer);
+    }
+}
+
+static int
+__route_snapshot_cmd(struct ds *ds, int argc, const char *argv[])
+{
+    char *path = NULL;
+
+    if (argc > 1) {
+        if (STR_EQ(argv[1], "save")) {
+            if (__route_snapshot_save()) {
+                ds_put_cstr(ds, "failed to save snapshot");
+                return EIO;
+            }
+        } else if (STR_EQ(argv[1], "reconcile")) {
+            if (route_reconcile_deadline) {
+                __route_reconcile_finish();
+            }
+        } else {
+            ds_put_cstr(ds, "expected save or reconcile");
+            return EINVAL;
+        }
+    }
+
+    path = __route_snapshot_path();
+    ds_put_format(ds, "file: %s\n", path);
+    if (route_reconcile_deadline) {
+        ds_put_format(ds, "reconciling: %"PRIuSIZE" stale routes, %lld ms "
+                      "left\n", route_n_stale,
+                      MAX(route_reconcile_deadline - time_msec(), 0));
+    } else {
+        ds_put_format(ds, "reconciling: no\n");
+    }
+    ds_put_format(ds, "restored: %"PRIu64", unchanged: %"PRIu64
+                  ", updated: %"PRIu64", removed: %"PRIu64"\n",
+                  route_snap_stats.restored, route_snap_stats.unchanged,
+                  route_snap_stats.updated, route_snap_stats.removed);
+    ds_put_format(ds, "saves: %"PRIu64, route_snap_stats.saves);
+    if (route_snap_stats.saves) {
+        ds_put_format(ds, ", last %lld s ago",
+                      (time_wall_msec() - route_snap_stats.last_save) / 1000);
+    }
+    ds_put_format(ds, "\n");
+    free(path);
+
+    return 0;
+}
+
+static void
+__route_unixctl_snapshot(struct unixctl_conn *conn, int argc,
+                         const char *argv[], void *aux OVS_UNUSED)
+{
+    ops_sai_route_pipeline_unixctl(conn, argc, argv, __route_snapshot_cmd);
+}
+
+/* Registers snapshot commands and restores routes saved before restart. */
+static void
+__route_snapshot_init(void)
+{
+    unixctl_command_register("sai/route/snapshot", "[save|reconcile]", 0, 1,
+                             __route_unixctl_snapshot, NULL);
+    __route_snapshot_load();
+}
+
+/*
+ * De-initializes route. Saves the snapshot for warm restart.
+ */
+static void
+__route_deinit(void)
+{
+    __route_snapshot_save();
+}
+
+DEFINE_GENERIC_CLASS(struct route_class, route) = {
+    .init = __route_init,
+    .ip_to_me_add = __route_ip_to_me_add,
+    .ip_to_me_delete = __route_ip_to_me_delete,
+    .local_add = __route_local_add,
+    .remote_add = __route_remote_add,
+    .remote_set = __route_remote_set,
     .remote_nh_remove = __route_remote_nh_remove,
     .remove = __route_remove,
+    .remote_add_bulk = __route_remote_add_bulk,
+    .remove_bulk = __route_remove_bulk,
+    .remote_set_bulk = __route_remote_set_bulk,
+    .remote_nh_remove_bulk = __route_remote_nh_remove_bulk,
+    .ecmp_resilient_set = __route_ecmp_resilient_set,
+    .vrf_flush = __route_vrf_flush,
     .deinit = __route_deinit,
 };
 
 DEFINE_GENERIC_CLASS_GETTER(struct route_class, route);
+
+static struct ops_sai_route_pending *
+__route_pending_lookup(const struct ops_sai_route_batch *batch,
+                       const struct ops_sai_route_key *key)
+{
+    struct ops_sai_route_pending *pending = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(pending, node, ops_sai_route_key_hash(key),
+                            &batch->pending) {
+        if (!memcmp(&pending->key, key, sizeof(*key))) {
+            return pending;
+        }
+    }
+
+    return NULL;
+}
+
+/* Prefix the batch has submitted an add for, and no remove since */
+struct ops_sai_route_programmed {
+    struct hmap_node            node;       /* ops_sai_route_batch */
+    struct ops_sai_route_key    key;
+};
+
+static struct ops_sai_route_programmed *
+__route_programmed_lookup(const struct ops_sai_route_batch *batch,
+                          const struct ops_sai_route_key *key)
+{
+    struct ops_sai_route_programmed *programmed = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(programmed, node, ops_sai_route_key_hash(key),
+                            &batch->programmed) {
+        if (!memcmp(&programmed->key, key, sizeof(*key))) {
+            return programmed;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+__route_programmed_set(struct ops_sai_route_batch *batch,
+                       const struct ops_sai_route_key *key, bool is_set)
+{
+    struct ops_sai_route_programmed *programmed =
+        __route_programmed_lookup(batch, key);
+
+    if (is_set && !programmed) {
+        programmed = xmalloc(sizeof(*programmed));
+        programmed->key = *key;
+        hmap_insert(&batch->programmed, &programmed->node,
+                    ops_sai_route_key_hash(key));
+    } else if (!is_set && programmed) {
+        hmap_remove(&batch->programmed, &programmed->node);
+        free(programmed);
+    }
+}
+
+static void
+__route_pending_next_hops_free(struct ops_sai_route_pending *pending)
+{
+    for (uint32_t i = 0; i < pending->next_hop_count; i++) {
+        free(pending->next_hops[i]);
+    }
+    free(pending->next_hops);
+    pending->next_hops = NULL;
+    pending->next_hop_count = 0;
+
+    for (uint32_t i = 0; i < pending->n_nh_removes; i++) {
+        free(pending->nh_removes[i]);
+    }
+    free(pending->nh_removes);
+    pending->nh_removes = NULL;
+    pending->n_nh_removes = 0;
+}
+
+/* Adds next hop to the list unless it is there already. */
+static void
+__route_pending_nh_add(char ***next_hops, uint32_t *n_next_hops,
+                       const char *next_hop)
+{
+    for (uint32_t i = 0; i < *n_next_hops; i++) {
+        if (!strcmp((*next_hops)[i], next_hop)) {
+            return;
+        }
+    }
+
+    *next_hops = xrealloc(*next_hops,
+                          (*n_next_hops + 1) * sizeof(**next_hops));
+    (*next_hops)[(*n_next_hops)++] = xstrdup(next_hop);
+}
+
+/* Drops next hop from the list if it is there. */
+static void
+__route_pending_nh_drop(char **next_hops, uint32_t *n_next_hops,
+                        const char *next_hop)
+{
+    for (uint32_t i = 0; i < *n_next_hops; i++) {
+        if (!strcmp(next_hops[i], next_hop)) {
+            free(next_hops[i]);
+            next_hops[i] = next_hops[--*n_next_hops];
+            return;
+        }
+    }
+}
+
+/* Moves pending operation into a bulk entry: next hops to add, or with
+ * add false none. Moved next hops are taken from pending. */
+static void
+__route_pending_to_entry(struct ops_sai_route_pending *pending,
+                         struct ops_sai_route_bulk_entry *entry, bool add)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->prefix = xstrdup(pending->prefix);
+    entry->ip_prefix = pending->key.prefix;
+    if (add) {
+        entry->next_hop_count = pending->next_hop_count;
+        entry->next_hops = pending->next_hops;
+        pending->next_hops = NULL;
+        pending->next_hop_count = 0;
+    }
+}
+
+/* Moves next hops to remove of pending operation into a bulk entry. */
+static void
+__route_pending_to_nh_remove(struct ops_sai_route_pending *pending,
+                             struct ops_sai_route_bulk_entry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->prefix = xstrdup(pending->prefix);
+    entry->ip_prefix = pending->key.prefix;
+    entry->next_hop_count = pending->n_nh_removes;
+    entry->next_hops = pending->nh_removes;
+    pending->nh_removes = NULL;
+    pending->n_nh_removes = 0;
+}
+
+void
+ops_sai_route_batch_init(struct ops_sai_route_batch *batch,
+                         const handle_t *vrid)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->vrid = vrid;
+    hmap_init(&batch->pending);
+    hmap_init(&batch->programmed);
+}
+
+/*
+ * Hands all pending operations of the batch to the route programming
+ * worker. A prefix removed and added again ends up with the next hops added
+ * last; if it was programmed they replace its next hops in place, so the
+ * prefix never goes missing. A prefix added and removed again which was not
+ * programmed before is not submitted at all.
+ */
+void
+ops_sai_route_batch_submit(struct ops_sai_route_batch *batch)
+{
+    struct ops_sai_route_pending *pending = NULL;
+    struct ops_sai_route_bulk_entry *entry = NULL;
+    struct ops_sai_route_job *job = NULL;
+    size_t n_pending = hmap_count(&batch->pending);
+    bool programmed = false;
+    bool add = false;
+
+    if (!n_pending) {
+        return;
+    }
+
+    route_coalesce_stats.pending -= n_pending;
+
+    job = xzalloc(sizeof(*job));
+    job->vrid = *batch->vrid;
+    job->removes = xcalloc(n_pending, sizeof(*job->removes));
+    job->sets = xcalloc(n_pending, sizeof(*job->sets));
+    job->adds = xcalloc(n_pending, sizeof(*job->adds));
+    job->nh_removes = xcalloc(n_pending, sizeof(*job->nh_removes));
+
+    HMAP_FOR_EACH_POP (pending, node, &batch->pending) {
+        programmed = !!__route_programmed_lookup(batch, &pending->key);
+        add = pending->next_hop_count;
+        if (pending->remove && add && programmed) {
+            __route_pending_to_entry(pending, &job->sets[job->n_sets++],
+                                     true);
+            route_coalesce_stats.replaced++;
+        } else if (add) {
+            __route_pending_to_entry(pending, &job->adds[job->n_adds++],
+                                     true);
+        } else if (pending->remove && programmed) {
+            __route_pending_to_entry(pending, &job->removes[job->n_removes++],
+                                     false);
+        } else if (pending->remove) {
+            route_coalesce_stats.cancelled++;
+        }
+
+        /* Next hops removed are never pending along with a remove */
+        if (pending->n_nh_removes && programmed) {
+            entry = &job->nh_removes[job->n_nh_removes++];
+            __route_pending_to_nh_remove(pending, entry);
+        } else if (pending->n_nh_removes) {
+            route_coalesce_stats.cancelled++;
+        }
+
+        if (add || pending->remove) {
+            __route_programmed_set(batch, &pending->key, add);
+        }
+
+        __route_pending_next_hops_free(pending);
+        free(pending->prefix);
+        free(pending);
+    }
+
+    if (!job->n_removes && !job->n_sets && !job->n_adds &&
+        !job->n_nh_removes) {
+        free(job->removes);
+        free(job->sets);
+        free(job->adds);
+        free(job->nh_removes);
+        free(job);
+        return;
+    }
+
+    route_coalesce_stats.submitted += job->n_removes + job->n_sets
+                                      + job->n_adds + job->n_nh_removes;
+    ops_sai_route_pipeline_submit(job);
+}
+
+/*
+ * Submits the batch once its coalescing window has expired. Called from
+ * ofproto run().
+ */
+void
+ops_sai_route_batch_run(struct ops_sai_route_batch *batch)
+{
+    if (!hmap_is_empty(&batch->pending) && time_msec() >= batch->deadline) {
+        ops_sai_route_batch_submit(batch);
+    }
+}
+
+/* Wakes up the main loop when the coalescing window of the batch expires. */
+void
+ops_sai_route_batch_wait(const struct ops_sai_route_batch *batch)
+{
+    if (!hmap_is_empty(&batch->pending)) {
+        poll_timer_wait_until(batch->deadline);
+    }
+}
+
+/*
+ * Pushes all pending operations of the batch to the route class and waits
+ * for them and any operations submitted before. Failed entries are logged.
+ *
+ * @return 0 if all entries succeeded, status of the first failure otherwise.
+ */
+int
+ops_sai_route_batch_flush(struct ops_sai_route_batch *batch)
+{
+    ops_sai_route_batch_submit(batch);
+
+    return ops_sai_route_pipeline_sync();
+}
+
+/*
+ * Queues remote route operation. It is merged with operations already
+ * pending for the prefix: next hops of adds accumulate, a remove drops them,
+ * and next hops deleted cancel pending adds of them. Next hops deleted are
+ * removed from the programmed route only if no remove is pending, since a
+ * remove takes them all.
+ * Batch is submitted when it holds OPS_SAI_ROUTE_BATCH_MAX prefixes or when
+ * the coalescing window opened by its first operation expires.
+ */
+void
+ops_sai_route_batch_add(struct ops_sai_route_batch *batch,
+                        enum ops_sai_route_batch_op op,
+                        const char *prefix,
+                        uint32_t next_hop_count,
+                        char *const *const next_hops)
+{
+    struct ops_sai_route_pending *pending = NULL;
+    struct ops_sai_route_key key;
+    struct ops_sai_prefix ip_prefix;
+    uint32_t i = 0;
+
+    if (ops_sai_route_prefix_get(prefix, &ip_prefix)) {
+        VLOG_ERR("Invalid IP prefix %s", prefix);
+        return;
+    }
+    ops_sai_route_key_init(&key, 0, &ip_prefix);
+
+    route_coalesce_stats.received++;
+
+    pending = __route_pending_lookup(batch, &key);
+    if (pending) {
+        route_coalesce_stats.merged++;
+    } else {
+        if (hmap_is_empty(&batch->pending)) {
+            batch->deadline = time_msec() + route_coalesce_msec;
+        }
+        route_coalesce_stats.pending++;
+
+        pending = xzalloc(sizeof(*pending));
+        pending->key = key;
+        pending->prefix = xstrdup(prefix);
+        hmap_insert(&batch->pending, &pending->node,
+                    ops_sai_route_key_hash(&key));
+    }
+
+    if (OPS_SAI_ROUTE_BATCH_REMOVE == op) {
+        __route_pending_next_hops_free(pending);
+        pending->remove = true;
+    } else if (OPS_SAI_ROUTE_BATCH_DELETE_NH == op) {
+        for (i = 0; i < next_hop_count; i++) {
+            __route_pending_nh_drop(pending->next_hops,
+                                    &pending->next_hop_count, next_hops[i]);
+            if (!pending->remove) {
+                __route_pending_nh_add(&pending->nh_removes,
+                                       &pending->n_nh_removes, next_hops[i]);
+            }
+        }
+    } else {
+        for (i = 0; i < next_hop_count; i++) {
+            __route_pending_nh_drop(pending->nh_removes,
+                                    &pending->n_nh_removes, next_hops[i]);
+            __route_pending_nh_add(&pending->next_hops,
+                                   &pending->next_hop_count, next_hops[i]);
+        }
+    }
+
+    if (OPS_SAI_ROUTE_BATCH_MAX <= hmap_count(&batch->pending)) {
+        ops_sai_route_batch_submit(batch);
+    }
+}
+
+void
+ops_sai_route_batch_destroy(struct ops_sai_route_batch *batch)
+{
+    struct ops_sai_route_programmed *programmed = NULL;
+
+    ops_sai_route_batch_flush(batch);
+    HMAP_FOR_EACH_POP (programmed, node, &batch->programmed) {
+        free(programmed);
+    }
+    hmap_destroy(&batch->programmed);
+    hmap_destroy(&batch->pending);
+    memset(batch, 0, sizeof(*batch));
+}
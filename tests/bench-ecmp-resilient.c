@@ -0,0 +1,268 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+/*
+ * Simulates flow disruption of ECMP membership changes. A route is spread
+ * over a group of next hops, and flows are hashed onto the group as the
+ * switch does: flow hash modulo the member list programmed, which for
+ * resilient hashing is the bucket table. Every member in turn goes down and
+ * comes back up, and the share of flows which then hash to another member is
+ * compared with the minimum, the share of flows of the member that changed.
+ *
+ * Usage: bench-ecmp-resilient [members [flows]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hash.h>
+#include <sai-neighbor.h>
+#include <sai-resource.h>
+#include <sai-route.h>
+#include <util.h>
+
+#include "sai-stub.h"
+
+#define BENCH_MEMBERS_DEFAULT   8
+#define BENCH_MEMBERS_MAX       32      /* next hops of a route */
+#define BENCH_FLOWS_DEFAULT     100000
+
+static const handle_t bench_vrid = { .data = 1 };
+static const handle_t bench_rif = { .data = 0x600 };
+
+/* Disruption of one kind of membership change */
+struct bench_disruption {
+    uint32_t    changes;
+    double      moved;      /* sum of shares of flows moved */
+    double      minimum;    /* sum of shares which had to move */
+    uint64_t    sai_calls;
+};
+
+static void
+__nexthop_get(uint8_t idx, char *ip_addr, size_t size)
+{
+    snprintf(ip_addr, size, "10.0.0.%u", idx + 1);
+}
+
+/* Member goes up or down the way __add_l3_host_entry() and
+ * __delete_l3_host_entry() resolve and unresolve next hops. */
+static void
+__member_set(uint32_t idx, bool up)
+{
+    struct ether_addr mac = { { 0x00, 0x02, 0xc9, 0x00, 0x00, 0x00 } };
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
+    char ip_addr[INET_ADDRSTRLEN];
+
+    __nexthop_get(idx, ip_addr, sizeof(ip_addr));
+    ovs_assert(!ops_sai_neighbor_key_init(&key, &bench_vrid, &bench_rif,
+                                          ip_addr));
+    memcpy(&mac.ether_addr_octet[4], &idx, 2);
+
+    if (up) {
+        ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_CREATE, &key, &mac);
+        neigh = ops_sai_neighbor_insert(&key);
+        ops_sai_neighbor_mac_set(neigh, &mac);
+    } else {
+        neigh = ops_sai_neighbor_lookup(&key);
+        ovs_assert(neigh);
+        ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_REMOVE, &key, NULL);
+        ops_sai_neighbor_delete(neigh);
+    }
+
+    ops_sai_neighbor_queue_run();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+}
+
+/* Copy of the member list of the group as programmed now */
+static uint32_t
+__members_get(sai_object_id_t **members)
+{
+    const sai_object_id_t *programmed = NULL;
+    uint32_t n_members = sai_stub_nhg_members(sai_stub_nhg_first(),
+                                              &programmed);
+
+    ovs_assert(n_members);
+    *members = xmemdup(programmed, n_members * sizeof(*programmed));
+
+    return n_members;
+}
+
+/* First member of list a which is not in list b */
+static sai_object_id_t
+__members_diff(const sai_object_id_t *a, uint32_t n_a,
+               const sai_object_id_t *b, uint32_t n_b)
+{
+    for (uint32_t i = 0; i < n_a; i++) {
+        uint32_t j = 0;
+
+        for (j = 0; j < n_b && a[i] != b[j]; j++) {
+        }
+        if (j == n_b) {
+            return a[i];
+        }
+    }
+
+    return SAI_NULL_OBJECT_ID;
+}
+
+/* Next hop every flow hashes to */
+static void
+__flows_hash(const sai_object_id_t *members, uint32_t n_members,
+             uint32_t n_flows, sai_object_id_t *flows)
+{
+    for (uint32_t i = 0; i < n_flows; i++) {
+        flows[i] = members[hash_int(i, 0) % n_members];
+    }
+}
+
+static uint64_t
+__sai_calls(void)
+{
+    return sai_stub_stats.nhg_creates + sai_stub_stats.nhg_removes +
+           sai_stub_stats.nhg_sets + sai_stub_stats.nhg_member_adds +
+           sai_stub_stats.nhg_member_removes + sai_stub_stats.route_sets;
+}
+
+/*
+ * Changes membership and accounts flows moved.
+ *
+ * @param[in]     idx       - member
+ * @param[in]     up        - member comes up, goes down otherwise
+ * @param[in]     n_flows   - count of flows
+ * @param[in,out] flows     - next hop of every flow
+ * @param[out]    dis       - disruption */
+static void
+__change(uint32_t idx, bool up, uint32_t n_flows, sai_object_id_t *flows,
+         struct bench_disruption *dis)
+{
+    sai_object_id_t *before = xmemdup(flows, n_flows * sizeof(*flows));
+    sai_object_id_t *members_before = NULL;
+    sai_object_id_t *members = NULL;
+    uint32_t n_members_before = __members_get(&members_before);
+    uint32_t n_members = 0;
+    uint64_t calls = __sai_calls();
+    sai_object_id_t member = SAI_NULL_OBJECT_ID;
+    uint32_t moved = 0;
+    uint32_t minimum = 0;
+
+    __member_set(idx, up);
+    n_members = __members_get(&members);
+    __flows_hash(members, n_members, n_flows, flows);
+
+    /* Flows of the member that changed have to move */
+    if (up) {
+        member = __members_diff(members, n_members, members_before,
+                                n_members_before);
+    } else {
+        member = __members_diff(members_before, n_members_before, members,
+                                n_members);
+    }
+    ovs_assert(SAI_NULL_OBJECT_ID != member);
+
+    for (uint32_t i = 0; i < n_flows; i++) {
+        moved += before[i] != flows[i];
+        minimum += (up ? flows[i] : before[i]) == member;
+    }
+
+    dis->changes++;
+    dis->moved += (double) moved / n_flows;
+    dis->minimum += (double) minimum / n_flows;
+    dis->sai_calls += __sai_calls() - calls;
+
+    free(members_before);
+    free(members);
+    free(before);
+}
+
+static void
+__report(const char *mode, const char *change,
+         const struct bench_disruption *dis)
+{
+    printf("%-10s %-6s %8u %11.2f%% %11.2f%% %10.1f\n", mode, change,
+           dis->changes, 100 * dis->moved / dis->changes,
+           100 * dis->minimum / dis->changes,
+           (double) dis->sai_calls / dis->changes);
+}
+
+static void
+__bench(bool resilient, uint32_t n_members, uint32_t n_flows)
+{
+    const char *mode = resilient ? "resilient" : "regular";
+    sai_object_id_t *flows = xmalloc(n_flows * sizeof(*flows));
+    sai_object_id_t *members = NULL;
+    uint32_t n_members_programmed = 0;
+    struct bench_disruption down;
+    struct bench_disruption up;
+
+    ovs_assert(!ops_sai_route_ecmp_resilient_set(resilient));
+    memset(&down, 0, sizeof(down));
+    memset(&up, 0, sizeof(up));
+
+    n_members_programmed = __members_get(&members);
+    __flows_hash(members, n_members_programmed, n_flows, flows);
+    free(members);
+    for (uint32_t i = 0; i < n_members; i++) {
+        __change(i, false, n_flows, flows, &down);
+        __change(i, true, n_flows, flows, &up);
+    }
+
+    __report(mode, "down", &down);
+    __report(mode, "up", &up);
+
+    free(flows);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t n_members = BENCH_MEMBERS_DEFAULT;
+    uint32_t n_flows = BENCH_FLOWS_DEFAULT;
+    char **next_hops = NULL;
+
+    if ((argc > 1 && !str_to_uint(argv[1], 10, &n_members)) ||
+        (argc > 2 && !str_to_uint(argv[2], 10, &n_flows)) ||
+        n_members < 2 || n_members > BENCH_MEMBERS_MAX || !n_flows) {
+        fprintf(stderr, "Usage: %s [members [flows]]\n", argv[0]);
+        return 1;
+    }
+
+    sai_stub_init();
+    ops_sai_resource_init();
+    ops_sai_neighbor_init();
+    ops_sai_route_init();
+    ovs_assert(!ops_sai_route_local_add(&bench_vrid, "10.0.0.0/24",
+                                        &bench_rif));
+
+    next_hops = xcalloc(n_members, sizeof(*next_hops));
+    for (uint32_t i = 0; i < n_members; i++) {
+        next_hops[i] = xmalloc(INET_ADDRSTRLEN);
+        __nexthop_get(i, next_hops[i], INET_ADDRSTRLEN);
+        __member_set(i, true);
+    }
+    ovs_assert(!ops_sai_route_remote_add(bench_vrid, "192.168.0.0/16",
+                                         n_members, next_hops));
+    ovs_assert(!ops_sai_route_pipeline_sync());
+
+    printf("%u members, %u flows\n", n_members, n_flows);
+    printf("%-10s %-6s %8s %12s %12s %10s\n", "mode", "change", "changes",
+           "moved", "minimum", "sai calls");
+    __bench(false, n_members, n_flows);
+    __bench(true, n_members, n_flows);
+
+    ovs_assert(!ops_sai_route_remove(&bench_vrid, "192.168.0.0/16"));
+    ovs_assert(!ops_sai_route_remove(&bench_vrid, "10.0.0.0/24"));
+    for (uint32_t i = 0; i < n_members; i++) {
+        free(next_hops[i]);
+    }
+    free(next_hops);
+
+    ops_sai_route_deinit();
+    ops_sai_neighbor_deinit();
+
+    return 0;
+}
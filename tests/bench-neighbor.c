@@ -0,0 +1,167 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+/*
+ * Pushes neighbors through the path of __add_l3_host_entry() and
+ * __delete_l3_host_entry(): operations are queued and handed to the route
+ * programming worker in bulk from run(). For comparison, the same neighbors
+ * are programmed one by one, waiting for each, as before the queue.
+ *
+ * Usage: bench-neighbor [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sai-neighbor.h>
+#include <sai-resource.h>
+#include <sai-route.h>
+#include <timeval.h>
+#include <util.h>
+
+#include "sai-stub.h"
+
+#define BENCH_NEIGHBORS_DEFAULT     20000
+
+static const handle_t bench_vrid = { .data = 1 };
+static const handle_t bench_rif = { .data = 0x600 };
+
+static void
+__neighbor_key_get(uint32_t idx, struct ops_sai_neighbor_key *key)
+{
+    char ip_addr[INET_ADDRSTRLEN];
+
+    snprintf(ip_addr, sizeof(ip_addr), "10.%u.%u.%u", (idx >> 16) & 0xff,
+             (idx >> 8) & 0xff, idx & 0xff);
+    ovs_assert(!ops_sai_neighbor_key_init(key, &bench_vrid, &bench_rif,
+                                          ip_addr));
+}
+
+/* Same as __add_l3_host_entry() for a new neighbor. */
+static void
+__neighbor_add(uint32_t idx, bool serial)
+{
+    struct ether_addr mac = { { 0x00, 0x02, 0xc9, 0x00, 0x00, 0x00 } };
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
+
+    __neighbor_key_get(idx, &key);
+    memcpy(&mac.ether_addr_octet[3], &idx, 3);
+
+    ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_CREATE, &key, &mac);
+    neigh = ops_sai_neighbor_insert(&key);
+    ops_sai_neighbor_mac_set(neigh, &mac);
+
+    if (serial) {
+        ops_sai_neighbor_queue_flush();
+        ops_sai_route_pipeline_sync();
+    }
+}
+
+/* Same as __delete_l3_host_entry(). */
+static void
+__neighbor_delete(uint32_t idx, bool serial)
+{
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
+
+    __neighbor_key_get(idx, &key);
+    neigh = ops_sai_neighbor_lookup(&key);
+    ovs_assert(neigh);
+
+    if (ops_sai_neighbor_is_resolved(neigh)) {
+        ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_REMOVE, &key, NULL);
+    }
+    ops_sai_neighbor_delete(neigh);
+
+    if (serial) {
+        ops_sai_neighbor_queue_flush();
+        ops_sai_route_pipeline_sync();
+    }
+}
+
+static void
+__report(const char *name, uint32_t count, long long int usec)
+{
+    uint64_t calls = sai_stub_stats.neighbor_creates +
+                     sai_stub_stats.neighbor_removes +
+                     sai_stub_stats.nh_creates + sai_stub_stats.nh_removes;
+
+    printf("%-22s %8u %10.1f %12.0f %10"PRIu64"\n", name, count,
+           usec / 1000.0, usec ? count * 1e6 / usec : 0.0, calls);
+}
+
+static void
+__bench(uint32_t count, bool serial)
+{
+    long long int start = 0;
+
+    memset(&sai_stub_stats, 0, sizeof(sai_stub_stats));
+    start = time_usec();
+    for (uint32_t i = 0; i < count; i++) {
+        __neighbor_add(i, serial);
+    }
+    ops_sai_neighbor_queue_run();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    __report(serial ? "add, one by one" : "add, queued", count,
+             time_usec() - start);
+    ovs_assert(sai_stub_n_neighbors() == count);
+    ovs_assert(sai_stub_n_nexthops() == count);
+
+    /* Link flap: every neighbor goes away and is learned again */
+    memset(&sai_stub_stats, 0, sizeof(sai_stub_stats));
+    start = time_usec();
+    for (uint32_t i = 0; i < count; i++) {
+        __neighbor_delete(i, serial);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        __neighbor_add(i, serial);
+    }
+    ops_sai_neighbor_queue_run();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    __report(serial ? "flap, one by one" : "flap, queued", 2 * count,
+             time_usec() - start);
+    ovs_assert(sai_stub_n_neighbors() == count);
+
+    memset(&sai_stub_stats, 0, sizeof(sai_stub_stats));
+    start = time_usec();
+    for (uint32_t i = 0; i < count; i++) {
+        __neighbor_delete(i, serial);
+    }
+    ops_sai_neighbor_queue_run();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    __report(serial ? "delete, one by one" : "delete, queued", count,
+             time_usec() - start);
+    ovs_assert(!sai_stub_n_neighbors());
+    ovs_assert(!sai_stub_n_nexthops());
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t count = BENCH_NEIGHBORS_DEFAULT;
+
+    if (argc > 1 && !str_to_uint(argv[1], 10, &count)) {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return 1;
+    }
+
+    sai_stub_init();
+    ops_sai_resource_init();
+    ops_sai_neighbor_init();
+    ops_sai_route_init();
+
+    printf("%-22s %8s %10s %12s %10s\n", "", "ops", "msec", "ops/sec",
+           "sai calls");
+    __bench(count, false);
+    __bench(count, true);
+
+    ops_sai_route_deinit();
+    ops_sai_neighbor_deinit();
+
+    return 0;
+}
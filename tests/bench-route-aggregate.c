@@ -0,0 +1,369 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+/*
+ * Measures route aggregation over a BGP table: how many route entries
+ * aggregation saves, and what incremental updates cost with and without it.
+ *
+ * The table is read from a dump in "bgpdump -m" format, such as a RouteViews
+ * or RIPE RIS RIB. Of the paths of a prefix, the one with the shortest AS
+ * path is programmed, over its next hop. Without a dump, a table of /24s
+ * handed out in blocks to a few next hops is made up.
+ *
+ * Updates move a random prefix to another next hop. Each one is timed with
+ * the SAI route calls it takes, followed by the aggregation pass that
+ * compresses the table again, which is checked against compressing the
+ * same table from scratch.
+ *
+ * Usage: bench-route-aggregate [dump|- [updates]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sai-neighbor.h>
+#include <sai-resource.h>
+#include <sai-route.h>
+#include <shash.h>
+#include <timeval.h>
+#include <util.h>
+
+#include "sai-stub.h"
+
+#define BENCH_UPDATES_DEFAULT       10000
+#define BENCH_SYNTH_ROUTES          100000
+#define BENCH_SYNTH_NEXTHOPS        8
+#define BENCH_SEED                  0x5a1
+
+/* bgpdump -m fields */
+#define DUMP_FIELD_PREFIX           5
+#define DUMP_FIELD_AS_PATH          6
+#define DUMP_FIELD_NEXTHOP          8
+#define DUMP_FIELDS                 9
+
+static const handle_t bench_vrid = { .data = 1 };
+static const handle_t bench_rif = { .data = 0x600 };
+
+struct bench_route {
+    char        *prefix;
+    uint32_t    nh;
+    uint32_t    path_len;
+};
+
+static struct shash bench_routes_by_prefix;
+static struct bench_route **bench_routes;
+static size_t bench_n_routes;
+
+static struct shash bench_nexthops_by_ip;
+static char **bench_nexthops;
+static size_t bench_n_nexthops;
+static size_t bench_allocated_nexthops;
+
+static uint32_t
+__nexthop_index(const char *ip_addr)
+{
+    struct shash_node *node = shash_find(&bench_nexthops_by_ip, ip_addr);
+
+    if (node) {
+        return (uintptr_t) node->data;
+    }
+
+    if (bench_n_nexthops == bench_allocated_nexthops) {
+        bench_nexthops = x2nrealloc(bench_nexthops, &bench_allocated_nexthops,
+                                    sizeof(*bench_nexthops));
+    }
+    bench_nexthops[bench_n_nexthops] = xstrdup(ip_addr);
+    shash_add(&bench_nexthops_by_ip, ip_addr,
+              (void *) (uintptr_t) bench_n_nexthops);
+
+    return bench_n_nexthops++;
+}
+
+/* Keeps the path with the shortest AS path of every prefix. */
+static void
+__route_offer(const char *prefix, const char *nh, uint32_t path_len)
+{
+    struct bench_route *route = shash_find_data(&bench_routes_by_prefix,
+                                                prefix);
+
+    if (!route) {
+        route = xzalloc(sizeof(*route));
+        route->prefix = xstrdup(prefix);
+        route->path_len = UINT32_MAX;
+        shash_add(&bench_routes_by_prefix, prefix, route);
+    }
+
+    if (path_len < route->path_len) {
+        route->nh = __nexthop_index(nh);
+        route->path_len = path_len;
+    }
+}
+
+/*
+ * Reads RIB entries in "bgpdump -m" format:
+ * TABLE_DUMP2|time|B|peer ip|peer as|prefix|as path|origin|next hop|...
+ */
+static int
+__dump_read(const char *path)
+{
+    FILE *file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    char *fields[DUMP_FIELDS];
+    char *line = NULL;
+    size_t size = 0;
+    char *cursor = NULL;
+    uint32_t path_len = 0;
+
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    while (getline(&line, &size, file) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        cursor = line;
+        for (int i = 0; i < DUMP_FIELDS; i++) {
+            fields[i] = strsep(&cursor, "|");
+            if (!fields[i]) {
+                break;
+            }
+        }
+        if (!fields[DUMP_FIELDS - 1] || strncmp(fields[0], "TABLE_DUMP", 10)) {
+            continue;
+        }
+
+        path_len = 1;
+        for (const char *c = fields[DUMP_FIELD_AS_PATH]; *c; c++) {
+            path_len += ' ' == *c;
+        }
+        __route_offer(fields[DUMP_FIELD_PREFIX], fields[DUMP_FIELD_NEXTHOP],
+                      path_len);
+    }
+
+    free(line);
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    return 0;
+}
+
+/* Runs of /24s out of random /16 blocks, most runs over one next hop. */
+static void
+__table_synthesize(void)
+{
+    char prefix[OPS_SAI_PREFIX_STR_LEN];
+    char nh[INET_ADDRSTRLEN];
+    uint32_t block = 0;
+    uint32_t run = 0;
+    uint32_t first = 0;
+
+    srandom(BENCH_SEED);
+    while (shash_count(&bench_routes_by_prefix) < BENCH_SYNTH_ROUTES) {
+        block = 1 + random() % 223;
+        block = block << 8 | random() % 256;
+        run = 1 + random() % 64;
+        first = random() % (257 - run);
+        snprintf(nh, sizeof(nh), "10.0.0.%u",
+                 (uint8_t) (1 + random() % BENCH_SYNTH_NEXTHOPS));
+
+        for (uint32_t i = first; i < first + run; i++) {
+            if (!(random() % 10)) {
+                snprintf(nh, sizeof(nh), "10.0.0.%u",
+                         (uint8_t) (1 + random() % BENCH_SYNTH_NEXTHOPS));
+            }
+            snprintf(prefix, sizeof(prefix), "%u.%u.%u.0/24", block >> 8,
+                     block & 0xff, i);
+            __route_offer(prefix, nh, 1);
+        }
+    }
+}
+
+/* Puts every next hop on a point to point interface of its own, so the
+ * routes over it have an egress interface. */
+static void
+__interfaces_add(void)
+{
+    char prefix[OPS_SAI_PREFIX_STR_LEN];
+    handle_t rif;
+
+    for (size_t i = 0; i < bench_n_nexthops; i++) {
+        rif.data = bench_rif.data + i;
+        snprintf(prefix, sizeof(prefix), "%s/%u", bench_nexthops[i],
+                 strchr(bench_nexthops[i], ':') ? 128 : 32);
+        ovs_assert(!ops_sai_route_local_add(&bench_vrid, prefix, &rif));
+    }
+    ovs_assert(!ops_sai_route_pipeline_sync());
+}
+
+/* Resolves next hops the way __add_l3_host_entry() does. */
+static void
+__nexthops_resolve(void)
+{
+    struct ether_addr mac = { { 0x00, 0x02, 0xc9, 0x00, 0x00, 0x00 } };
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
+    handle_t rif;
+
+    for (size_t i = 0; i < bench_n_nexthops; i++) {
+        rif.data = bench_rif.data + i;
+        if (ops_sai_neighbor_key_init(&key, &bench_vrid, &rif,
+                                      bench_nexthops[i])) {
+            continue;
+        }
+        memcpy(&mac.ether_addr_octet[3], &i, 3);
+        ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_CREATE, &key, &mac);
+        neigh = ops_sai_neighbor_insert(&key);
+        ops_sai_neighbor_mac_set(neigh, &mac);
+    }
+
+    ops_sai_neighbor_queue_flush();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+}
+
+static uint64_t
+__sai_route_calls(void)
+{
+    return sai_stub_stats.route_creates + sai_stub_stats.route_removes +
+           sai_stub_stats.route_sets;
+}
+
+/* Aggregation pass as run from ofproto run(). Returns pass time, usec. */
+static long long int
+__aggregate(void)
+{
+    const char *argv[] = { "sai/route/aggregate", "on" };
+    long long int start = 0;
+
+    /* Setting the mode makes the next run pass right away */
+    sai_stub_appctl(ARRAY_SIZE(argv), argv);
+
+    start = time_usec();
+    ops_sai_route_aggregate_run();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+
+    return time_usec() - start;
+}
+
+static void
+__aggregate_off(void)
+{
+    const char *argv[] = { "sai/route/aggregate", "off" };
+
+    sai_stub_appctl(ARRAY_SIZE(argv), argv);
+}
+
+/* Entries of the routes, not counting the interface routes */
+static void
+__report_entries(const char *name, long long int usec)
+{
+    size_t n_entries = sai_stub_n_routes() - bench_n_nexthops;
+
+    printf("%-24s %10.1f msec %10zu hw entries %8.3f of routes\n", name,
+           usec / 1000.0, n_entries, (double) n_entries / bench_n_routes);
+}
+
+/* Moves random prefixes to another next hop. */
+static void
+__updates(const char *name, uint32_t n_updates)
+{
+    struct bench_route *route = NULL;
+    uint64_t calls = __sai_route_calls();
+    long long int start = 0;
+    uint32_t failed = 0;
+
+    srandom(BENCH_SEED);
+    start = time_usec();
+    for (uint32_t i = 0; i < n_updates; i++) {
+        route = bench_routes[random() % bench_n_routes];
+        route->nh = (route->nh + 1 + random() % (bench_n_nexthops - 1)) %
+                    bench_n_nexthops;
+        failed += !!ops_sai_route_remote_set(bench_vrid, route->prefix, 1,
+                                             &bench_nexthops[route->nh]);
+    }
+    ovs_assert(!ops_sai_route_pipeline_sync());
+
+    printf("%-24s %10.2f usec/update %6.2f sai calls/update %u failed\n",
+           name, (double) (time_usec() - start) / n_updates,
+           (double) (__sai_route_calls() - calls) / n_updates, failed);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct shash_node *node = NULL;
+    struct bench_route *route = NULL;
+    uint32_t n_updates = BENCH_UPDATES_DEFAULT;
+    long long int start = 0;
+    uint32_t failed = 0;
+
+    if (argc > 2 && !str_to_uint(argv[2], 10, &n_updates)) {
+        fprintf(stderr, "Usage: %s [dump|- [updates]]\n", argv[0]);
+        return 1;
+    }
+
+    shash_init(&bench_routes_by_prefix);
+    shash_init(&bench_nexthops_by_ip);
+    if (argc > 1) {
+        if (__dump_read(argv[1])) {
+            return 1;
+        }
+    } else {
+        __table_synthesize();
+    }
+
+    bench_n_routes = shash_count(&bench_routes_by_prefix);
+    if (!bench_n_routes) {
+        fprintf(stderr, "No routes\n");
+        return 1;
+    }
+    bench_routes = xmalloc(bench_n_routes * sizeof(*bench_routes));
+    bench_n_routes = 0;
+    SHASH_FOR_EACH(node, &bench_routes_by_prefix) {
+        bench_routes[bench_n_routes++] = node->data;
+    }
+
+    sai_stub_init();
+    ops_sai_resource_init();
+    ops_sai_neighbor_init();
+    ops_sai_route_init();
+    __interfaces_add();
+    __nexthops_resolve();
+
+    printf("%zu routes over %zu next hops\n", bench_n_routes,
+           bench_n_nexthops);
+
+    start = time_usec();
+    for (size_t i = 0; i < bench_n_routes; i++) {
+        route = bench_routes[i];
+        failed += !!ops_sai_route_remote_add(bench_vrid, route->prefix, 1,
+                                             &bench_nexthops[route->nh]);
+    }
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    bench_n_routes -= failed;
+    __report_entries("add", time_usec() - start);
+
+    __report_entries("aggregate", __aggregate());
+
+    if (bench_n_nexthops < 2) {
+        printf("single next hop, no updates\n");
+    } else if (n_updates) {
+        __updates("updates, aggregated", n_updates);
+        __report_entries("aggregate again", __aggregate());
+
+        start = time_usec();
+        __aggregate_off();
+        __report_entries("split all", time_usec() - start);
+        __report_entries("aggregate from scratch", __aggregate());
+        __aggregate_off();
+        __updates("updates, not aggregated", n_updates);
+    }
+
+    ops_sai_route_deinit();
+    ops_sai_neighbor_deinit();
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+/*
+ * Adds and deletes IPv6 prefixes through the route class, reporting
+ * routes/sec and resident memory. Every fourth prefix is a /64, the rest
+ * are /48s; every eighth one is routed over a two way ECMP group. Memory
+ * per route includes the entry of the stub switch.
+ *
+ * Usage: bench-route-v6 [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sai-neighbor.h>
+#include <sai-resource.h>
+#include <sai-route.h>
+#include <timeval.h>
+#include <util.h>
+
+#include "sai-stub.h"
+
+#define BENCH_ROUTES_DEFAULT    200000
+
+static const handle_t bench_vrid = { .data = 1 };
+static const handle_t bench_rif = { .data = 0x600 };
+
+static char *bench_nh_single[] = { "2001:db8:ffff::1" };
+static char *bench_nh_ecmp[] = { "2001:db8:ffff::1", "2001:db8:ffff::2" };
+
+/* Resolves next hop the way __add_l3_host_entry() does. */
+static void
+__neighbor_resolve(const char *ip_addr, uint8_t mac_id)
+{
+    struct ether_addr mac = { { 0x00, 0x02, 0xc9, 0x00, 0x00, mac_id } };
+    struct ops_sai_neighbor *neigh = NULL;
+    struct ops_sai_neighbor_key key;
+
+    ovs_assert(!ops_sai_neighbor_key_init(&key, &bench_vrid, &bench_rif,
+                                          ip_addr));
+    ops_sai_neighbor_enqueue(OPS_SAI_NEIGHBOR_OP_CREATE, &key, &mac);
+    neigh = ops_sai_neighbor_insert(&key);
+    ops_sai_neighbor_mac_set(neigh, &mac);
+}
+
+static void
+__prefix_get(uint32_t idx, char *prefix, size_t size)
+{
+    snprintf(prefix, size, "2a00:%x:%x::/%u", idx >> 16, idx & 0xffff,
+             idx % 4 ? 48 : 64);
+}
+
+static void
+__report(const char *name, uint32_t count, long long int usec)
+{
+    printf("%-8s %8u routes %10.1f msec %10.0f routes/sec "
+           "%8zu kB RSS %8zu hw routes\n", name, count, usec / 1000.0,
+           usec ? count * 1e6 / usec : 0.0, sai_stub_rss_kb(),
+           sai_stub_n_routes());
+}
+
+int
+main(int argc, char *argv[])
+{
+    char prefix[OPS_SAI_PREFIX_STR_LEN];
+    uint32_t count = BENCH_ROUTES_DEFAULT;
+    long long int start = 0;
+    size_t rss_base = 0;
+
+    if (argc > 1 && !str_to_uint(argv[1], 10, &count)) {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return 1;
+    }
+
+    sai_stub_init();
+    ops_sai_resource_init();
+    ops_sai_neighbor_init();
+    ops_sai_route_init();
+    ovs_assert(!ops_sai_route_local_add(&bench_vrid, "2001:db8:ffff::/64",
+                                        &bench_rif));
+
+    __neighbor_resolve(bench_nh_ecmp[0], 1);
+    __neighbor_resolve(bench_nh_ecmp[1], 2);
+    ops_sai_neighbor_queue_flush();
+    ovs_assert(!ops_sai_route_pipeline_sync());
+
+    rss_base = sai_stub_rss_kb();
+    printf("%-8s %8s        %10s      %10s            %8zu kB RSS\n", "start",
+           "", "", "", rss_base);
+
+    start = time_usec();
+    for (uint32_t i = 0; i < count; i++) {
+        __prefix_get(i, prefix, sizeof(prefix));
+        ovs_assert(!ops_sai_route_remote_add(bench_vrid, prefix,
+                                             i % 8 ? 1 : 2,
+                                             i % 8 ? bench_nh_single
+                                                   : bench_nh_ecmp));
+    }
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    __report("add", count, time_usec() - start);
+    printf("%-8s %8.0f bytes/route\n", "",
+           count ? (sai_stub_rss_kb() - rss_base) * 1024.0 / count : 0.0);
+
+    start = time_usec();
+    for (uint32_t i = 0; i < count; i++) {
+        __prefix_get(i, prefix, sizeof(prefix));
+        ovs_assert(!ops_sai_route_remove(&bench_vrid, prefix));
+    }
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    __report("delete", count, time_usec() - start);
+    ovs_assert(!ops_sai_route_remove(&bench_vrid, "2001:db8:ffff::/64"));
+    ovs_assert(!ops_sai_route_pipeline_sync());
+    ovs_assert(!sai_stub_n_routes());
+
+    ops_sai_route_deinit();
+    ops_sai_neighbor_deinit();
+
+    return 0;
+}
@@ -0,0 +1,670 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sai-api-class.h>
+#include <sai-route.h>
+#include <hash.h>
+#include <hmap.h>
+#include <util.h>
+#include "unixctl.h"
+
+#include "sai-stub.h"
+
+#define STUB_OID_BASE       0x1000
+#define STUB_CAPACITY_MAX   8
+#define STUB_COMMANDS_MAX   64
+
+struct sai_stub_stats sai_stub_stats;
+
+struct stub_route {
+    struct hmap_node            node;
+    sai_unicast_route_entry_t   entry;
+    sai_object_id_t             nexthop;
+    int32_t                     action;
+};
+
+struct stub_neighbor {
+    struct hmap_node            node;
+    sai_neighbor_entry_t        entry;
+};
+
+/* Next hop or group. Groups keep members in programming order. */
+struct stub_object {
+    struct hmap_node            node;
+    sai_object_id_t             oid;
+    bool                        is_group;
+    sai_object_id_t             *members;
+    uint32_t                    n_members;
+    uint32_t                    allocated_members;
+};
+
+struct stub_capacity {
+    sai_attr_id_t               id;
+    uint32_t                    capacity;
+};
+
+struct stub_command {
+    const char                  *name;
+    unixctl_cb_func             *cb;
+    void                        *aux;
+};
+
+static struct hmap stub_routes = HMAP_INITIALIZER(&stub_routes);
+static struct hmap stub_neighbors = HMAP_INITIALIZER(&stub_neighbors);
+static struct hmap stub_objects = HMAP_INITIALIZER(&stub_objects);
+static sai_object_id_t stub_next_oid = STUB_OID_BASE;
+static size_t stub_n_nexthops;
+static size_t stub_n_nhgs;
+
+static struct stub_capacity stub_capacities[STUB_CAPACITY_MAX];
+static size_t stub_n_capacities;
+
+static struct stub_command stub_commands[STUB_COMMANDS_MAX];
+static size_t stub_n_commands;
+static char *stub_reply;
+
+static struct stub_route *
+__route_lookup(const sai_unicast_route_entry_t *entry)
+{
+    struct stub_route *route = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(route, node, hash_bytes(entry, sizeof(*entry), 0),
+                            &stub_routes) {
+        if (!memcmp(&route->entry, entry, sizeof(*entry))) {
+            return route;
+        }
+    }
+
+    return NULL;
+}
+
+static struct stub_neighbor *
+__neighbor_lookup(const sai_neighbor_entry_t *entry)
+{
+    struct stub_neighbor *neighbor = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(neighbor, node,
+                            hash_bytes(entry, sizeof(*entry), 0),
+                            &stub_neighbors) {
+        if (!memcmp(&neighbor->entry, entry, sizeof(*entry))) {
+            return neighbor;
+        }
+    }
+
+    return NULL;
+}
+
+static struct stub_object *
+__object_lookup(sai_object_id_t oid)
+{
+    struct stub_object *object = NULL;
+
+    HMAP_FOR_EACH_WITH_HASH(object, node, hash_uint64(oid), &stub_objects) {
+        if (object->oid == oid) {
+            return object;
+        }
+    }
+
+    return NULL;
+}
+
+static struct stub_object *
+__object_create(bool is_group)
+{
+    struct stub_object *object = xzalloc(sizeof(*object));
+
+    object->oid = stub_next_oid++;
+    object->is_group = is_group;
+    hmap_insert(&stub_objects, &object->node, hash_uint64(object->oid));
+
+    return object;
+}
+
+static void
+__object_destroy(struct stub_object *object)
+{
+    hmap_remove(&stub_objects, &object->node);
+    free(object->members);
+    free(object);
+}
+
+static void
+__group_members_add(struct stub_object *group, uint32_t count,
+                    const sai_object_id_t *members)
+{
+    if (group->n_members + count > group->allocated_members) {
+        group->allocated_members = group->n_members + count;
+        group->members = xrealloc(group->members,
+                                  group->allocated_members *
+                                  sizeof(*group->members));
+    }
+
+    memcpy(&group->members[group->n_members], members,
+           count * sizeof(*members));
+    group->n_members += count;
+}
+
+static void
+__route_attrs_apply(struct stub_route *route, uint32_t attr_count,
+                    const sai_attribute_t *attr_list)
+{
+    for (uint32_t i = 0; i < attr_count; i++) {
+        if (SAI_ROUTE_ATTR_NEXT_HOP_ID == attr_list[i].id) {
+            route->nexthop = attr_list[i].value.oid;
+        } else if (SAI_ROUTE_ATTR_PACKET_ACTION == attr_list[i].id) {
+            route->action = attr_list[i].value.s32;
+        }
+    }
+}
+
+static sai_status_t
+__stub_route_create(const sai_unicast_route_entry_t *entry,
+                    uint32_t attr_count, const sai_attribute_t *attr_list)
+{
+    struct stub_route *route = NULL;
+
+    sai_stub_stats.route_creates++;
+    if (__route_lookup(entry)) {
+        return SAI_STATUS_ITEM_ALREADY_EXISTS;
+    }
+
+    route = xzalloc(sizeof(*route));
+    route->entry = *entry;
+    route->action = SAI_PACKET_ACTION_FORWARD;
+    __route_attrs_apply(route, attr_count, attr_list);
+    hmap_insert(&stub_routes, &route->node,
+                hash_bytes(entry, sizeof(*entry), 0));
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_route_remove(const sai_unicast_route_entry_t *entry)
+{
+    struct stub_route *route = __route_lookup(entry);
+
+    sai_stub_stats.route_removes++;
+    if (!route) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    hmap_remove(&stub_routes, &route->node);
+    free(route);
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_route_set(const sai_unicast_route_entry_t *entry,
+                 const sai_attribute_t *attr)
+{
+    struct stub_route *route = __route_lookup(entry);
+
+    sai_stub_stats.route_sets++;
+    if (!route) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    __route_attrs_apply(route, 1, attr);
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_route_get(const sai_unicast_route_entry_t *entry, uint32_t attr_count,
+                 sai_attribute_t *attr_list)
+{
+    struct stub_route *route = __route_lookup(entry);
+
+    if (!route) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    for (uint32_t i = 0; i < attr_count; i++) {
+        if (SAI_ROUTE_ATTR_NEXT_HOP_ID == attr_list[i].id) {
+            attr_list[i].value.oid = route->nexthop;
+        } else if (SAI_ROUTE_ATTR_PACKET_ACTION == attr_list[i].id) {
+            attr_list[i].value.s32 = route->action;
+        }
+    }
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nh_create(sai_object_id_t *oid, uint32_t attr_count OVS_UNUSED,
+                 const sai_attribute_t *attr_list OVS_UNUSED)
+{
+    sai_stub_stats.nh_creates++;
+    stub_n_nexthops++;
+    *oid = __object_create(false)->oid;
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nh_remove(sai_object_id_t oid)
+{
+    struct stub_object *object = __object_lookup(oid);
+
+    sai_stub_stats.nh_removes++;
+    if (!object || object->is_group) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    stub_n_nexthops--;
+    __object_destroy(object);
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nh_get(sai_object_id_t oid, uint32_t attr_count OVS_UNUSED,
+              sai_attribute_t *attr_list OVS_UNUSED)
+{
+    struct stub_object *object = __object_lookup(oid);
+
+    return object && !object->is_group ? SAI_STATUS_SUCCESS
+                                       : SAI_STATUS_ITEM_NOT_FOUND;
+}
+
+static sai_status_t
+__stub_nhg_create(sai_object_id_t *oid, uint32_t attr_count,
+                  const sai_attribute_t *attr_list)
+{
+    struct stub_object *group = __object_create(true);
+
+    sai_stub_stats.nhg_creates++;
+    stub_n_nhgs++;
+    for (uint32_t i = 0; i < attr_count; i++) {
+        if (SAI_NEXT_HOP_GROUP_ATTR_NEXT_HOP_LIST == attr_list[i].id) {
+            __group_members_add(group, attr_list[i].value.objlist.count,
+                                attr_list[i].value.objlist.list);
+        }
+    }
+    *oid = group->oid;
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nhg_remove(sai_object_id_t oid)
+{
+    struct stub_object *group = __object_lookup(oid);
+
+    sai_stub_stats.nhg_removes++;
+    if (!group || !group->is_group) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    stub_n_nhgs--;
+    __object_destroy(group);
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nhg_set(sai_object_id_t oid, const sai_attribute_t *attr)
+{
+    struct stub_object *group = __object_lookup(oid);
+
+    sai_stub_stats.nhg_sets++;
+    if (!group || !group->is_group) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    if (SAI_NEXT_HOP_GROUP_ATTR_NEXT_HOP_LIST == attr->id) {
+        group->n_members = 0;
+        __group_members_add(group, attr->value.objlist.count,
+                            attr->value.objlist.list);
+    }
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nhg_get(sai_object_id_t oid, uint32_t attr_count,
+               sai_attribute_t *attr_list)
+{
+    struct stub_object *group = __object_lookup(oid);
+
+    if (!group || !group->is_group) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    for (uint32_t i = 0; i < attr_count; i++) {
+        if (SAI_NEXT_HOP_GROUP_ATTR_NEXT_HOP_COUNT == attr_list[i].id) {
+            attr_list[i].value.u32 = group->n_members;
+        }
+    }
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_nhg_members_add(sai_object_id_t oid, uint32_t count,
+                       const sai_object_id_t *members)
+{
+    struct stub_object *group = __object_lookup(oid);
+
+    sai_stub_stats.nhg_member_adds++;
+    if (!group || !group->is_group) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    __group_members_add(group, count, members);
+
+    return SAI_STATUS_SUCCESS;
+}
+
+/* Remaining members keep their order */
+static sai_status_t
+__stub_nhg_members_remove(sai_object_id_t oid, uint32_t count,
+                          const sai_object_id_t *members)
+{
+    struct stub_object *group = __object_lookup(oid);
+    uint32_t n = 0;
+
+    sai_stub_stats.nhg_member_removes++;
+    if (!group || !group->is_group) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    for (uint32_t i = 0; i < group->n_members; i++) {
+        bool removed = false;
+
+        for (uint32_t j = 0; j < count && !removed; j++) {
+            removed = group->members[i] == members[j];
+        }
+        if (!removed) {
+            group->members[n++] = group->members[i];
+        }
+    }
+    group->n_members = n;
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_neighbor_create(const sai_neighbor_entry_t *entry,
+                       uint32_t attr_count OVS_UNUSED,
+                       const sai_attribute_t *attr_list OVS_UNUSED)
+{
+    struct stub_neighbor *neighbor = NULL;
+
+    sai_stub_stats.neighbor_creates++;
+    if (__neighbor_lookup(entry)) {
+        return SAI_STATUS_ITEM_ALREADY_EXISTS;
+    }
+
+    neighbor = xzalloc(sizeof(*neighbor));
+    neighbor->entry = *entry;
+    hmap_insert(&stub_neighbors, &neighbor->node,
+                hash_bytes(entry, sizeof(*entry), 0));
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_neighbor_remove(const sai_neighbor_entry_t *entry)
+{
+    struct stub_neighbor *neighbor = __neighbor_lookup(entry);
+
+    sai_stub_stats.neighbor_removes++;
+    if (!neighbor) {
+        return SAI_STATUS_ITEM_NOT_FOUND;
+    }
+
+    hmap_remove(&stub_neighbors, &neighbor->node);
+    free(neighbor);
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_status_t
+__stub_neighbor_set(const sai_neighbor_entry_t *entry,
+                    const sai_attribute_t *attr OVS_UNUSED)
+{
+    sai_stub_stats.neighbor_sets++;
+
+    return __neighbor_lookup(entry) ? SAI_STATUS_SUCCESS
+                                    : SAI_STATUS_ITEM_NOT_FOUND;
+}
+
+static sai_status_t
+__stub_neighbor_get(const sai_neighbor_entry_t *entry,
+                    uint32_t attr_count OVS_UNUSED,
+                    sai_attribute_t *attr_list OVS_UNUSED)
+{
+    return __neighbor_lookup(entry) ? SAI_STATUS_SUCCESS
+                                    : SAI_STATUS_ITEM_NOT_FOUND;
+}
+
+/* Only table sizes set by the driver are reported */
+static sai_status_t
+__stub_switch_get(uint32_t attr_count, sai_attribute_t *attr_list)
+{
+    for (uint32_t i = 0; i < attr_count; i++) {
+        size_t j = 0;
+
+        for (j = 0; j < stub_n_capacities; j++) {
+            if (stub_capacities[j].id == attr_list[i].id) {
+                attr_list[i].value.u32 = stub_capacities[j].capacity;
+                break;
+            }
+        }
+        if (j == stub_n_capacities) {
+            return SAI_STATUS_NOT_SUPPORTED;
+        }
+    }
+
+    return SAI_STATUS_SUCCESS;
+}
+
+static sai_route_api_t stub_route_api = {
+    .create_route = __stub_route_create,
+    .remove_route = __stub_route_remove,
+    .set_route_attribute = __stub_route_set,
+    .get_route_attribute = __stub_route_get,
+};
+
+static sai_next_hop_api_t stub_nh_api = {
+    .create_next_hop = __stub_nh_create,
+    .remove_next_hop = __stub_nh_remove,
+    .get_next_hop_attribute = __stub_nh_get,
+};
+
+static sai_next_hop_group_api_t stub_nhg_api = {
+    .create_next_hop_group = __stub_nhg_create,
+    .remove_next_hop_group = __stub_nhg_remove,
+    .set_next_hop_group_attribute = __stub_nhg_set,
+    .get_next_hop_group_attribute = __stub_nhg_get,
+    .add_next_hop_to_group = __stub_nhg_members_add,
+    .remove_next_hop_from_group = __stub_nhg_members_remove,
+};
+
+static sai_neighbor_api_t stub_neighbor_api = {
+    .create_neighbor_entry = __stub_neighbor_create,
+    .remove_neighbor_entry = __stub_neighbor_remove,
+    .set_neighbor_attribute = __stub_neighbor_set,
+    .get_neighbor_attribute = __stub_neighbor_get,
+};
+
+static sai_switch_api_t stub_switch_api = {
+    .get_switch_attribute = __stub_switch_get,
+};
+
+static struct ops_sai_api_class stub_api = {
+    .switch_api = &stub_switch_api,
+    .route_api = &stub_route_api,
+    .nexthop_api = &stub_nh_api,
+    .nhg_api = &stub_nhg_api,
+    .neighbor_api = &stub_neighbor_api,
+    .initialized = true,
+};
+
+/* Replaces SAI API of sai-api-class.c, which is not linked in. */
+const struct ops_sai_api_class *
+ops_sai_api_get_instance(void)
+{
+    return &stub_api;
+}
+
+/* Commands are run by sai_stub_appctl(), there is no unixctl server. */
+void
+unixctl_command_register(const char *name, const char *usage OVS_UNUSED,
+                         int min_args OVS_UNUSED, int max_args OVS_UNUSED,
+                         unixctl_cb_func *cb, void *aux)
+{
+    ovs_assert(stub_n_commands < STUB_COMMANDS_MAX);
+    stub_commands[stub_n_commands].name = name;
+    stub_commands[stub_n_commands].cb = cb;
+    stub_commands[stub_n_commands].aux = aux;
+    stub_n_commands++;
+}
+
+void
+unixctl_command_reply(struct unixctl_conn *conn OVS_UNUSED, const char *body)
+{
+    free(stub_reply);
+    stub_reply = xstrdup(body ? body : "");
+}
+
+void
+unixctl_command_reply_error(struct unixctl_conn *conn OVS_UNUSED,
+                            const char *error)
+{
+    free(stub_reply);
+    stub_reply = xstrdup(error ? error : "");
+}
+
+/*
+ * Points the route snapshot at a scratch directory, so a snapshot of the
+ * switch is neither restored nor overwritten. Must be called first.
+ */
+void
+sai_stub_init(void)
+{
+    char dir[] = "/tmp/sai-bench-XXXXXX";
+
+    if (!mkdtemp(dir)) {
+        ovs_fatal(errno, "Failed to create %s", dir);
+    }
+    setenv("OVS_RUNDIR", dir, 1);
+}
+
+/* Makes the switch report table size attribute id. */
+void
+sai_stub_capacity_set(sai_attr_id_t id, uint32_t capacity)
+{
+    ovs_assert(stub_n_capacities < STUB_CAPACITY_MAX);
+    stub_capacities[stub_n_capacities].id = id;
+    stub_capacities[stub_n_capacities].capacity = capacity;
+    stub_n_capacities++;
+}
+
+size_t
+sai_stub_n_routes(void)
+{
+    return hmap_count(&stub_routes);
+}
+
+size_t
+sai_stub_n_nexthops(void)
+{
+    return stub_n_nexthops;
+}
+
+size_t
+sai_stub_n_nhgs(void)
+{
+    return stub_n_nhgs;
+}
+
+size_t
+sai_stub_n_neighbors(void)
+{
+    return hmap_count(&stub_neighbors);
+}
+
+/* Some programmed group, SAI_NULL_OBJECT_ID if there is none. For drivers
+ * which program a single group. */
+sai_object_id_t
+sai_stub_nhg_first(void)
+{
+    struct stub_object *object = NULL;
+
+    HMAP_FOR_EACH(object, node, &stub_objects) {
+        if (object->is_group) {
+            return object->oid;
+        }
+    }
+
+    return SAI_NULL_OBJECT_ID;
+}
+
+/* Members of group in programming order. Returns count of members. */
+uint32_t
+sai_stub_nhg_members(sai_object_id_t oid, const sai_object_id_t **members)
+{
+    struct stub_object *group = __object_lookup(oid);
+
+    if (!group || !group->is_group) {
+        *members = NULL;
+        return 0;
+    }
+
+    *members = group->members;
+    return group->n_members;
+}
+
+/*
+ * Runs appctl command registered by the plugin and waits for the route
+ * programming worker, which replies to most of them.
+ *
+ * @return reply or error message, valid until the next command.
+ */
+const char *
+sai_stub_appctl(int argc, const char *argv[])
+{
+    free(stub_reply);
+    stub_reply = NULL;
+
+    for (size_t i = 0; i < stub_n_commands; i++) {
+        if (!strcmp(stub_commands[i].name, argv[0])) {
+            stub_commands[i].cb(NULL, argc, argv, stub_commands[i].aux);
+            ops_sai_route_pipeline_sync();
+            break;
+        }
+    }
+
+    return stub_reply ? stub_reply : "unknown command";
+}
+
+/* Resident set size of the process. */
+size_t
+sai_stub_rss_kb(void)
+{
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+
+    if (!file) {
+        return 0;
+    }
+    if (2 != fscanf(file, "%lu %lu", &size, &resident)) {
+        resident = 0;
+    }
+    fclose(file);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
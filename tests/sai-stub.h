@@ -0,0 +1,70 @@
+/*
+ * Copyright Mellanox Technologies, Ltd. 2001-2016.
+ * This software product is licensed under Apache version 2, as detailed in
+ * the COPYING file.
+ */
+
+#ifndef SAI_STUB_H
+#define SAI_STUB_H 1
+
+#include <sai.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In-memory SAI switch for benchmark drivers. Routes, next hops, ECMP
+ * groups and neighbors are kept in hash maps, so drivers measure the plugin
+ * rather than the switch. Groups keep their members in programming order,
+ * which drivers use to model hashing.
+ */
+
+/* Calls made to the switch */
+struct sai_stub_stats {
+    uint64_t    route_creates;
+    uint64_t    route_removes;
+    uint64_t    route_sets;
+    uint64_t    nh_creates;
+    uint64_t    nh_removes;
+    uint64_t    nhg_creates;
+    uint64_t    nhg_removes;
+    uint64_t    nhg_sets;
+    uint64_t    nhg_member_adds;
+    uint64_t    nhg_member_removes;
+    uint64_t    neighbor_creates;
+    uint64_t    neighbor_removes;
+    uint64_t    neighbor_sets;
+};
+
+extern struct sai_stub_stats sai_stub_stats;
+
+void
+sai_stub_init(void);
+
+void
+sai_stub_capacity_set(sai_attr_id_t id, uint32_t capacity);
+
+size_t
+sai_stub_n_routes(void);
+
+size_t
+sai_stub_n_nexthops(void);
+
+size_t
+sai_stub_n_nhgs(void);
+
+size_t
+sai_stub_n_neighbors(void);
+
+sai_object_id_t
+sai_stub_nhg_first(void);
+
+uint32_t
+sai_stub_nhg_members(sai_object_id_t nhg, const sai_object_id_t **members);
+
+const char *
+sai_stub_appctl(int argc, const char *argv[]);
+
+size_t
+sai_stub_rss_kb(void);
+
+#endif /* sai-stub.h */